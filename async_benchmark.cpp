@@ -0,0 +1,206 @@
+#include "xlog.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+
+#include <boost/make_shared.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/unbounded_fifo_queue.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+#include <boost/log/attributes/clock.hpp>
+#include <boost/log/support/date_time.hpp>
+
+/*
+ * Compares dispatch modes with many threads logging at once
+ *
+ * Every thread logs through a few GET_LOGGER-style channels into a file sink writing to /dev/null,
+ * so what's measured is xlog rather than the disk. 'logging' is how long the threads took to log
+ * everything (what the application sees), 'total' includes writing whatever was still queued.
+ *
+ * For reference, 'boost async sink' skips xlog altogether: plain Boost.Log loggers (one per thread)
+ * feeding a boost::log::sinks::asynchronous_sink with an unbounded_fifo_queue, Boost's lock-free
+ * multi-producer queue, formatting about the same line into /dev/null on its own thread.
+ *
+ * Logging can only be initialized once per process, so each run happens in a child of its own.
+ *
+ * Usage: xlog-bench-async [records per thread] [thread counts...] (defaults to 100000, and 8 32 64)
+ */
+
+enum class bench_mode
+{
+    SYNC,
+    SHARED_QUEUE,
+    PER_THREAD_QUEUES,
+    BOOST_ASYNC_SINK
+};
+
+static const char* mode_name(bench_mode mode)
+{
+    switch(mode)
+    {
+        case bench_mode::SYNC:
+            return "sync";
+        case bench_mode::SHARED_QUEUE:
+            return "shared queue";
+        case bench_mode::PER_THREAD_QUEUES:
+            return "per-thread queues";
+        default:
+            return "boost async sink";
+    }
+}
+
+static const char* const CHANNELS[] = { "Network", "Storage", "Scheduler", "Cache" };
+
+static void log_records(size_t thread, size_t records)
+{
+    XLog::LoggerType& logger = XLog::GetNamedLogger(CHANNELS[thread % std::size(CHANNELS)]);
+
+    for(size_t i = 0; i < records; i++)
+    {
+        CUSTOM_LOG_SEV(logger, XLog::Severity::INFO) << "Request " << i << " from worker " << thread << " handled in " << (i % 997) << "us";
+    }
+}
+
+typedef boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend, boost::log::sinks::unbounded_fifo_queue> boost_async_sink;
+
+static boost::shared_ptr<boost_async_sink> start_boost_async_sink()
+{
+    namespace expr = boost::log::expressions;
+
+    auto backend = boost::make_shared<boost::log::sinks::text_ostream_backend>();
+    backend->add_stream(boost::make_shared<std::ofstream>("/dev/null"));
+
+    auto sink = boost::make_shared<boost_async_sink>(backend);
+    sink->set_formatter(expr::stream
+        << expr::format_date_time<boost::posix_time::ptime>("TimeStamp", "%Y-%b-%d %H:%M:%S.%f")
+        << " <" << expr::attr<int>("Severity") << "> ["
+        << expr::attr<std::string>("Channel") << "] - "
+        << expr::smessage);
+
+    boost::log::core::get()->add_global_attribute("TimeStamp", boost::log::attributes::local_clock());
+    boost::log::core::get()->add_sink(sink);
+    return sink;
+}
+
+static void log_boost_records(size_t thread, size_t records)
+{
+    // Boost's loggers are cheapest kept per thread (the _mt ones lock for every record)
+    boost::log::sources::severity_channel_logger<int, std::string> logger(boost::log::keywords::channel = CHANNELS[thread % std::size(CHANNELS)]);
+
+    for(size_t i = 0; i < records; i++)
+    {
+        BOOST_LOG_SEV(logger, 0) << "Request " << i << " from worker " << thread << " handled in " << (i % 997) << "us";
+    }
+}
+
+static void run(bench_mode mode, size_t threads, size_t records)
+{
+    boost::shared_ptr<boost_async_sink> boost_sink;
+    if(mode == bench_mode::BOOST_ASYNC_SINK)
+    {
+        boost_sink = start_boost_async_sink();
+    }
+    else
+    {
+        XLog::LogSettings settings;
+        settings.s_console.enabled = false;
+        settings.s_file.enabled = true;
+        settings.s_file.path = "/dev/null";
+        settings.s_async.enabled = mode != bench_mode::SYNC;
+        settings.s_async.per_thread_queues = mode == bench_mode::PER_THREAD_QUEUES;
+        XLog::InitializeLogging(settings);
+    }
+
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < threads; i++)
+    {
+        workers.emplace_back(boost_sink ? log_boost_records : log_records, i, records);
+    }
+    for(auto& worker : workers)
+    {
+        worker.join();
+    }
+    const auto logged = std::chrono::steady_clock::now();
+
+    if(boost_sink)
+    {
+        // Writes whatever is still queued, then stops the sink's thread
+        boost::log::core::get()->remove_sink(boost_sink);
+        boost_sink->stop();
+        boost_sink->flush();
+    }
+    else
+    {
+        XLog::ShutownLogging();
+    }
+    const auto done = std::chrono::steady_clock::now();
+
+    const double total_records = static_cast<double>(threads * records);
+    const double logging_s = std::chrono::duration<double>(logged - start).count();
+    const double total_s = std::chrono::duration<double>(done - start).count();
+
+    std::cout
+        << "  " << std::left << std::setw(20) << mode_name(mode)
+        << std::right << std::fixed << std::setprecision(2)
+        << std::setw(10) << (total_records / logging_s / 1e6) << " M/s logging"
+        << std::setw(10) << (logging_s * 1e9 * threads / total_records) << " ns/record/thread"
+        << std::setw(10) << (total_records / total_s / 1e6) << " M/s total"
+        << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    const size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+    std::vector<size_t> thread_counts;
+    for(int i = 2; i < argc; i++)
+    {
+        thread_counts.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+    if(thread_counts.empty())
+    {
+        thread_counts = { 8, 32, 64 };
+    }
+
+    std::cout << records << " records per thread, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    for(size_t threads : thread_counts)
+    {
+        std::cout << threads << " threads" << std::endl;
+        for(bench_mode mode : { bench_mode::SYNC, bench_mode::SHARED_QUEUE, bench_mode::PER_THREAD_QUEUES, bench_mode::BOOST_ASYNC_SINK })
+        {
+            std::cout.flush();
+
+            const pid_t child = ::fork();
+            if(child == 0)
+            {
+                run(mode, threads, records);
+                std::cout.flush();
+                ::_exit(0);
+            }
+
+            int status = 0;
+            ::waitpid(child, &status, 0);
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                std::cout << "  " << mode_name(mode) << " failed" << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "xlog.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+/*
+ * Compares logging a batch of lines one statement at a time with XLog::LogBatch
+ *
+ * A single thread logs 'batches' batches of 'batch size' pre-built lines into a file sink writing to
+ * /dev/null, either with a LOG_INFO() per line or a LOG_BATCH() per batch, with and without async
+ * dispatch. 'logging' is how long the thread took, 'total' includes writing whatever was still queued.
+ *
+ * Logging can only be initialized once per process, so each run happens in a child of its own.
+ *
+ * Usage: xlog-bench-batch [batch size] [batches] (defaults to 1000, and 200)
+ */
+
+GET_LOGGER("Batch")
+
+static void run(bool async, bool batched, const std::vector<std::string>& lines, size_t batches)
+{
+    XLog::LogSettings settings;
+    settings.s_console.enabled = false;
+    settings.s_file.enabled = true;
+    settings.s_file.path = "/dev/null";
+    settings.s_async.enabled = async;
+    XLog::InitializeLogging(settings);
+
+    const auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < batches; i++)
+    {
+        if(batched)
+        {
+            LOG_BATCH(XLog::Severity::INFO, lines);
+        }
+        else
+        {
+            for(const auto& line : lines)
+            {
+                LOG_INFO() << line;
+            }
+        }
+    }
+    const auto logged = std::chrono::steady_clock::now();
+
+    XLog::ShutownLogging();
+    const auto done = std::chrono::steady_clock::now();
+
+    const double records = static_cast<double>(lines.size() * batches);
+    std::cout
+        << "  " << std::left << std::setw(8) << (async ? "async" : "sync")
+        << std::setw(10) << (batched ? "LOG_BATCH" : "LOG_INFO")
+        << std::right << std::fixed << std::setprecision(1)
+        << std::setw(10) << (std::chrono::duration<double, std::nano>(logged - start).count() / records) << " ns/record logging"
+        << std::setw(10) << (std::chrono::duration<double, std::nano>(done - start).count() / records) << " ns/record total"
+        << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    const size_t batch_size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    const size_t batches = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+
+    std::vector<std::string> lines;
+    for(size_t i = 0; i < batch_size; i++)
+    {
+        lines.push_back("Event " + std::to_string(i) + " replayed from worker queue");
+    }
+
+    std::cout << batches << " batches of " << batch_size << " records" << std::endl;
+    for(bool async : { false, true })
+    {
+        for(bool batched : { false, true })
+        {
+            std::cout.flush();
+
+            const pid_t child = ::fork();
+            if(child == 0)
+            {
+                run(async, batched, lines, batches);
+                std::cout.flush();
+                ::_exit(0);
+            }
+
+            int status = 0;
+            ::waitpid(child, &status, 0);
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                std::cout << "  run failed" << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "xlog_test.noexport.h"
+
+#include <vector>
+
+/*
+ * Batches are filtered once, on their first record, and then written as a whole, so each test
+ * logs a few batches into a file and checks exactly which records made it.
+ */
+
+namespace
+{
+    std::vector<std::string> batch_messages(const std::string& tag, size_t count)
+    {
+        std::vector<std::string> rValue;
+        for(size_t i = 0; i < count; i++)
+        {
+            rValue.push_back(tag + " " + std::to_string(i));
+        }
+        return rValue;
+    }
+
+    // Lines of the file containing 'tag', in file order
+    std::vector<std::string> lines_with(const std::string& contents, const std::string& tag)
+    {
+        std::vector<std::string> rValue;
+        std::stringstream stream(contents);
+        for(std::string line; std::getline(stream, line); )
+        {
+            if(line.find(tag) != std::string::npos)
+            {
+                rValue.push_back(line);
+            }
+        }
+        return rValue;
+    }
+
+    XLog::LogSettings file_settings(const std::string& path, bool async)
+    {
+        XLog::LogSettings rValue;
+        rValue.s_console.enabled = false;
+        rValue.s_file.enabled = true;
+        rValue.s_file.path = path;
+        rValue.s_async.enabled = async;
+        return rValue;
+    }
+
+    void check_batches(bool async)
+    {
+        test_directory dir;
+        const std::string path = dir.path("batch.log");
+        XLog::InitializeLogging(file_settings(path, async));
+
+        XLog::LoggerType& logger = XLog::GetNamedLogger("Batch");
+        XLog::LoggerType& quiet = XLog::GetNamedLogger("QuietBatch");
+        XLog::SetLoggingLevel(XLog::Severity::ERROR, "QuietBatch");
+
+        {
+            XLog::ScopedContext ctx("request", 42);
+            CUSTOM_LOG_BATCH(logger, XLog::Severity::INFO, batch_messages("accepted", 50));
+        }
+        CUSTOM_LOG_BATCH(quiet, XLog::Severity::INFO, batch_messages("below level", 50));
+        CUSTOM_LOG_BATCH(quiet, XLog::Severity::WARNING, batch_messages("quiet channel", 50));
+        CUSTOM_LOG_BATCH(quiet, XLog::Severity::ERROR, batch_messages("loud enough", 5));
+        CUSTOM_LOG_BATCH(logger, XLog::Severity::INFO, std::vector<std::string>());
+        XLog::LogBatch(logger, XLog::Severity::WARNING, batch_messages("unchecked", 3));
+        CUSTOM_LOG_SEV(logger, XLog::Severity::INFO) << "after the batches";
+
+        XLog::ShutownLogging();
+        const std::string contents = read_test_file(path);
+
+        const std::vector<std::string> accepted = lines_with(contents, "accepted ");
+        REQUIRE(accepted.size() == 50u);
+        for(size_t i = 0; i < accepted.size(); i++)
+        {
+            // In order, each with the channel, severity & context of the batch
+            CHECK(accepted[i].find("accepted " + std::to_string(i)) != std::string::npos) << accepted[i];
+            CHECK(accepted[i].find("Batch") != std::string::npos) << accepted[i];
+            CHECK(accepted[i].find("INFO") != std::string::npos) << accepted[i];
+            CHECK(accepted[i].find("42") != std::string::npos) << accepted[i];
+        }
+
+        CHECK(lines_with(contents, "below level").empty());
+        CHECK(lines_with(contents, "quiet channel").empty());
+        CHECK(lines_with(contents, "loud enough").size() == 5u);
+        CHECK(lines_with(contents, "unchecked").size() == 3u);
+
+        // Nothing of a batch is left behind for the records after it
+        const size_t last_batch = contents.rfind("unchecked 2");
+        const size_t after = contents.find("after the batches");
+        REQUIRE(after != std::string::npos);
+        CHECK(last_batch < after);
+    }
+}
+
+XLOG_TEST(Batch, FilteredOncePerBatch)
+{
+    check_batches(false);
+}
+
+XLOG_TEST(Batch, FilteredOncePerBatchAsync)
+{
+    check_batches(true);
+}
+
+XLOG_TEST(Batch, SinkLevelStillApplies)
+{
+    test_directory dir;
+    const std::string path = dir.path("batch.log");
+    XLog::InitializeLogging(file_settings(path, false));
+
+    // The batch gets past the logger, but the file only wants warnings
+    XLog::SetSinkLevel("file", XLog::Severity::WARNING);
+
+    XLog::LoggerType& logger = XLog::GetNamedLogger("Batch");
+    CUSTOM_LOG_BATCH(logger, XLog::Severity::INFO, batch_messages("info", 10));
+    CUSTOM_LOG_BATCH(logger, XLog::Severity::WARNING, batch_messages("warning", 10));
+
+    XLog::ShutownLogging();
+    const std::string contents = read_test_file(path);
+
+    CHECK(lines_with(contents, "info ").empty());
+    CHECK(lines_with(contents, "warning ").size() == 10u);
+}
@@ -0,0 +1,314 @@
+#include "xlog_block_file.noexport.h"
+#include "xlog_test.noexport.h"
+
+#include <sys/resource.h>
+
+#include <future>
+#include <random>
+#include <vector>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <zstd.h>
+
+/*
+ * Compressed block files are written through the compressed file sink exactly as an application
+ * would, then taken apart block by block and checked against their index (and against xlog-query,
+ * when it's built as well).
+ */
+
+namespace
+{
+    const char* const CHANNELS[] = { "Network", "Storage", "Scheduler" };
+    const XLog::Severity SEVERITIES[] = { XLog::Severity::INFO, XLog::Severity::WARNING, XLog::Severity::ERROR };
+
+    struct parsed_block
+    {
+        uint64_t offset;
+        uint64_t length;
+        xlog_block_header header;
+    };
+
+    struct parsed_file
+    {
+        std::vector<parsed_block> blocks;
+        std::string text;
+        size_t size = 0;
+        size_t parsed = 0; // Up to where the file was made of whole blocks
+    };
+
+    parsed_file parse_block_file(const std::string& path)
+    {
+        parsed_file rValue;
+        const std::string contents = read_test_file(path);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(contents.data());
+        rValue.size = contents.size();
+
+        size_t position = 0;
+        while(position < contents.size())
+        {
+            xlog_block_header header;
+            if(!read_block_header(data + position, contents.size() - position, header))
+            {
+                break;
+            }
+
+            const uint8_t* frame = data + position + XLOG_BLOCK_HEADER_FRAME_SIZE;
+            if(check_block_sizes(header, frame, contents.size() - position - XLOG_BLOCK_HEADER_FRAME_SIZE) != nullptr)
+            {
+                break;
+            }
+
+            std::string text(header.uncompressed_size, '\0');
+            const size_t decompressed = ZSTD_decompress(text.data(), text.size(), frame, header.compressed_size);
+            if(ZSTD_isError(decompressed) || decompressed != header.uncompressed_size)
+            {
+                break;
+            }
+
+            const size_t length = XLOG_BLOCK_HEADER_FRAME_SIZE + header.compressed_size;
+            rValue.blocks.push_back(parsed_block{ position, length, header });
+            rValue.text += text;
+            position += length;
+        }
+
+        rValue.parsed = position;
+        return rValue;
+    }
+
+    size_t count_lines(const std::string& text, const std::string& tag)
+    {
+        size_t rValue = 0;
+        for(size_t found = text.find(tag); found != std::string::npos; found = text.find(tag, found + tag.size()))
+        {
+            rValue++;
+        }
+        return rValue;
+    }
+
+    XLog::LogSettings block_file_settings(const std::string& path)
+    {
+        XLog::LogSettings rValue;
+        rValue.s_console.enabled = false;
+        rValue.s_compressed_file.enabled = true;
+        rValue.s_compressed_file.path = path;
+        rValue.s_compressed_file.block_size = 4096;
+        rValue.s_compressed_file.max_pending_blocks = 1024;
+        return rValue;
+    }
+
+    // Varied enough that the blocks don't compress to nothing
+    void log_test_records(size_t count)
+    {
+        std::mt19937 rng(42);
+        for(size_t i = 0; i < count; i++)
+        {
+            std::string noise;
+            for(int j = 0; j < 40; j++)
+            {
+                noise.push_back(static_cast<char>('a' + rng() % 26));
+            }
+
+            XLog::LoggerType& logger = XLog::GetNamedLogger(CHANNELS[i % std::size(CHANNELS)]);
+            CUSTOM_LOG_SEV(logger, SEVERITIES[(i / 3) % std::size(SEVERITIES)]) << "test record " << i << " " << noise;
+        }
+    }
+
+    void flush_logging()
+    {
+        std::promise<void> flushed;
+        XLog::FlushInBackground([&]() { flushed.set_value(); });
+        flushed.get_future().wait();
+    }
+
+#ifdef XLOG_QUERY_TOOL
+    std::string run_query(const std::string& arguments)
+    {
+        std::string rValue;
+        FILE* output = ::popen((std::string(XLOG_QUERY_TOOL) + " " + arguments + " 2>&1").c_str(), "r");
+        if(output == nullptr)
+        {
+            return rValue;
+        }
+
+        char buffer[4096];
+        for(size_t read; (read = std::fread(buffer, 1, sizeof(buffer), output)) > 0; )
+        {
+            rValue.append(buffer, read);
+        }
+        ::pclose(output);
+        return rValue;
+    }
+#endif
+}
+
+XLOG_TEST(BlockFile, RoundTrip)
+{
+    test_directory dir;
+    const std::string path = dir.path("test.xlz");
+    XLog::InitializeLogging(block_file_settings(path));
+
+    constexpr size_t RECORDS = 3000;
+    log_test_records(RECORDS);
+    XLog::ShutownLogging();
+
+    const parsed_file file = parse_block_file(path);
+    REQUIRE(file.parsed == file.size);
+    CHECK(file.blocks.size() > 10) << file.blocks.size() << " blocks";
+
+    // Every record, in order, exactly once
+    size_t position = 0;
+    for(size_t i = 0; i < RECORDS; i++)
+    {
+        position = file.text.find("test record " + std::to_string(i) + " ", position);
+        CHECK(position != std::string::npos) << "record " << i;
+        REQUIRE(position != std::string::npos);
+    }
+    CHECK(count_lines(file.text, "test record ") == RECORDS);
+
+    // Skippable frames are ignored by plain zstd, so decompressing the whole file gives back the same text
+    const std::string contents = read_test_file(path);
+    std::string plain(file.text.size(), '\0');
+    const size_t plain_size = ZSTD_decompress(plain.data(), plain.size(), contents.data(), contents.size());
+    CHECK(!ZSTD_isError(plain_size)) << ZSTD_getErrorName(plain_size);
+    REQUIRE(!ZSTD_isError(plain_size));
+    CHECK(plain_size == file.text.size());
+    CHECK(plain == file.text);
+
+    // The summaries have to cover what the blocks hold, or readers would skip blocks they need
+    uint64_t summarized = 0;
+    for(const parsed_block& block : file.blocks)
+    {
+        const xlog_record_summary& summary = block.header.summary;
+        summarized += summary.record_count;
+        CHECK(summary.first_ns <= summary.last_ns);
+        CHECK(summary.has_severity(XLog::Severity::INFO) || summary.has_severity(XLog::Severity::WARNING) || summary.has_severity(XLog::Severity::ERROR));
+        CHECK(!summary.has_severity(XLog::Severity::FATAL));
+    }
+    CHECK(summarized >= RECORDS) << summarized;
+    for(const char* channel : CHANNELS)
+    {
+        CHECK(file.blocks.front().header.summary.may_have_channel(xlog_channel_bit(channel))) << channel;
+    }
+
+    // One index entry per block, pointing straight at it
+    std::vector<xlog_index_entry> index;
+    REQUIRE(read_index(xlog_index_path(path), index));
+    CHECK(index.size() == file.blocks.size()) << index.size() << " entries for " << file.blocks.size() << " blocks";
+    REQUIRE(index.size() == file.blocks.size());
+    for(size_t i = 0; i < index.size(); i++)
+    {
+        CHECK(index[i].offset == file.blocks[i].offset) << "entry " << i;
+        CHECK(index[i].length == file.blocks[i].length) << "entry " << i;
+        CHECK(index[i].flags == XLOG_INDEX_COMPRESSED) << "entry " << i;
+        CHECK(std::memcmp(&index[i].summary, &file.blocks[i].header.summary, sizeof(xlog_record_summary)) == 0) << "entry " << i;
+    }
+
+#ifdef XLOG_QUERY_TOOL
+    size_t on_storage = 0;
+    size_t errors = 0;
+    for(size_t i = 0; i < RECORDS; i++)
+    {
+        on_storage += (std::string(CHANNELS[i % std::size(CHANNELS)]) == "Storage");
+        errors += (SEVERITIES[(i / 3) % std::size(SEVERITIES)] == XLog::Severity::ERROR);
+    }
+
+    CHECK(std::stoul(run_query("--count -s 'test record ' " + path)) == RECORDS);
+    CHECK(std::stoul(run_query("--count -c Storage -s 'test record ' " + path)) == on_storage);
+    CHECK(std::stoul(run_query("--count -l ERROR -s 'test record ' " + path)) == errors);
+    CHECK(std::stoul(run_query("--count --no-index -l ERROR -s 'test record ' " + path)) == errors);
+
+    // No block has a FATAL record, so the index rules out every one of them
+    const std::string stats = run_query("--count --stats -l FATAL " + path);
+    const std::string expected = std::to_string(file.blocks.size()) + " regions, " + std::to_string(file.blocks.size()) + " skipped";
+    CHECK(stats.find(expected) != std::string::npos) << stats;
+#endif
+}
+
+XLOG_TEST(BlockFile, FailedWritesAreDroppedNotIndexed)
+{
+    test_directory dir;
+    const std::string path = dir.path("full.xlz");
+
+    // Writes past this size fail (EFBIG) rather than killing the process, like a full disk
+    std::signal(SIGXFSZ, SIG_IGN);
+    const rlimit limit{ 20000, 20000 };
+    REQUIRE(::setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+    XLog::LogSettings settings = block_file_settings(path);
+    settings.s_compressed_file.workers = 1;
+    XLog::InitializeLogging(settings);
+
+    constexpr size_t RECORDS = 1000;
+    log_test_records(RECORDS);
+    flush_logging();
+
+    XLog::SinkInformation info{};
+    for(const XLog::SinkInformation& sink : XLog::GetAllSinks())
+    {
+        if(sink.name == "compressed_file")
+        {
+            info = sink;
+        }
+    }
+    XLog::ShutownLogging();
+
+    // Whatever part of a block did get out was cut off again, so the file is still whole blocks
+    const parsed_file file = parse_block_file(path);
+    CHECK(file.parsed == file.size) << file.parsed << " of " << file.size << " bytes parsed";
+    CHECK(file.size <= 20000u);
+    CHECK(info.dropped > 0);
+
+    // Nothing is lost without being counted
+    CHECK(count_lines(file.text, "test record ") + info.dropped >= RECORDS) << info.dropped << " dropped";
+
+    // And only blocks that were written are indexed
+    std::vector<xlog_index_entry> index;
+    REQUIRE(read_index(xlog_index_path(path), index));
+    CHECK(index.size() == file.blocks.size()) << index.size() << " entries for " << file.blocks.size() << " blocks";
+    for(size_t i = 0; i < std::min(index.size(), file.blocks.size()); i++)
+    {
+        CHECK(index[i].offset == file.blocks[i].offset && index[i].length == file.blocks[i].length) << "entry " << i;
+    }
+}
+
+XLOG_TEST(BlockFile, ImplausibleSizesAreRejected)
+{
+    test_directory dir;
+    const std::string path = dir.path("test.xlz");
+    XLog::InitializeLogging(block_file_settings(path));
+    log_test_records(100);
+    XLog::ShutownLogging();
+
+    const std::string contents = read_test_file(path);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(contents.data());
+    xlog_block_header good;
+    REQUIRE(read_block_header(data, contents.size(), good));
+
+    const uint8_t* frame = data + XLOG_BLOCK_HEADER_FRAME_SIZE;
+    const size_t available = contents.size() - XLOG_BLOCK_HEADER_FRAME_SIZE;
+    CHECK(check_block_sizes(good, frame, available) == nullptr);
+
+    // Each of these would otherwise decide how much a reader allocates
+    xlog_block_header header = good;
+    header.uncompressed_size = uint64_t(1) << 40;
+    CHECK(check_block_sizes(header, frame, available) != nullptr);
+
+    header = good;
+    header.uncompressed_size = header.compressed_size * XLOG_BLOCK_MAX_COMPRESSION_RATIO * 2;
+    CHECK(check_block_sizes(header, frame, available) != nullptr);
+
+    header = good;
+    header.uncompressed_size++;
+    CHECK(check_block_sizes(header, frame, available) != nullptr);
+
+    header = good;
+    header.compressed_size = available + 1;
+    CHECK(check_block_sizes(header, frame, available) != nullptr);
+
+    // Whatever the header says, the frame has to be a zstd frame
+    std::vector<uint8_t> garbage(frame, frame + good.compressed_size);
+    std::memset(garbage.data(), 0, 4);
+    CHECK(check_block_sizes(good, garbage.data(), garbage.size()) != nullptr);
+}
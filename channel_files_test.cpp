@@ -0,0 +1,66 @@
+#include "xlog_test.noexport.h"
+
+#include <future>
+
+/*
+ * Per-channel files: records go to the file their channel is routed to, and records of channels
+ * without a route are counted as unrouted rather than as written.
+ */
+
+namespace
+{
+    XLog::SinkInformation channel_files_information()
+    {
+        std::promise<void> flushed;
+        XLog::FlushInBackground([&]() { flushed.set_value(); });
+        flushed.get_future().wait();
+
+        for(const XLog::SinkInformation& sink : XLog::GetAllSinks())
+        {
+            if(sink.name == "channel_files")
+            {
+                return sink;
+            }
+        }
+        return XLog::SinkInformation{};
+    }
+}
+
+XLOG_TEST(ChannelFiles, UnroutedRecordsAreNotWritten)
+{
+    test_directory dir;
+
+    XLog::LogSettings settings;
+    settings.s_console.enabled = false;
+    settings.s_channel_files.enabled = true;
+    settings.s_channel_files.directory = dir.path("");
+    settings.s_channel_files.routes = { { "Net*", "network.log" }, { "Storage", "storage.log" } };
+    XLog::InitializeLogging(settings);
+
+    XLog::LoggerType& network = XLog::GetNamedLogger("NetClient");
+    XLog::LoggerType& storage = XLog::GetNamedLogger("Storage");
+    XLog::LoggerType& other = XLog::GetNamedLogger("Elsewhere");
+    for(int i = 0; i < 10; i++)
+    {
+        CUSTOM_LOG_SEV(network, XLog::Severity::INFO) << "network " << i;
+        CUSTOM_LOG_SEV(storage, XLog::Severity::INFO) << "storage " << i;
+        CUSTOM_LOG_SEV(other, XLog::Severity::INFO) << "unrouted " << i;
+    }
+
+    const XLog::SinkInformation info = channel_files_information();
+    XLog::ShutownLogging();
+
+    CHECK(info.name == "channel_files");
+    CHECK(info.unrouted >= 10u) << info.unrouted; // And INTERNAL records, with internal logging
+    CHECK(info.dropped == 0u) << info.dropped;
+
+    // Whatever else went into the files (INTERNAL records, with internal logging), every one of the routed records did
+    CHECK(info.records >= 20u) << info.records;
+    const std::string network_log = read_test_file(dir.path("network.log"));
+    const std::string storage_log = read_test_file(dir.path("storage.log"));
+    // The files can only have more (the newlines added to records), the unrouted records' bytes aren't counted
+    CHECK(info.bytes <= network_log.size() + storage_log.size()) << info.bytes << " bytes for " << network_log.size() + storage_log.size() << " in the files";
+    CHECK(network_log.find("network 9") != std::string::npos);
+    CHECK(storage_log.find("storage 9") != std::string::npos);
+    CHECK(network_log.find("unrouted") == std::string::npos && storage_log.find("unrouted") == std::string::npos);
+}
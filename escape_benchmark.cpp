@@ -0,0 +1,109 @@
+#include "xlog_escape.noexport.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+
+/*
+ * Compares the scalar, SSE2, and AVX2 escaping/validation kernels across message sizes
+ *
+ * Each input is mostly printable ASCII (like real log lines) with the odd quote,
+ * newline, and multibyte UTF-8 character mixed in.
+ */
+
+static std::string make_message(size_t size, std::mt19937& rng)
+{
+    static const std::string_view SPECIALS[] = { "\"", "\n", "\\", "\t", "\xC3\xA9", "\xE2\x82\xAC" };
+
+    std::uniform_int_distribution<int> printable(0x20, 0x7E);
+    std::uniform_int_distribution<int> special_chance(0, 99);
+    std::uniform_int_distribution<size_t> special_pick(0, std::size(SPECIALS) - 1);
+
+    std::string msg;
+    msg.reserve(size + 4);
+    while(msg.size() < size)
+    {
+        if(special_chance(rng) == 0)
+        {
+            msg += SPECIALS[special_pick(rng)];
+        }
+        else
+        {
+            char c = static_cast<char>(printable(rng));
+            msg += (c == '"' || c == '\\') ? 'x' : c;
+        }
+    }
+
+    return msg;
+}
+
+template<typename Func>
+static double time_ns_per_call(Func&& func, size_t bytes)
+{
+    // Aim for roughly 64MB of input per measurement so small sizes still run long enough to time
+    const size_t iterations = std::max<size_t>(64, (64 * 1024 * 1024) / std::max<size_t>(bytes, 1));
+
+    // Warm-up
+    for(size_t i = 0; i < iterations / 8; i++)
+    {
+        func();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < iterations; i++)
+    {
+        func();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+static void print_result(const char* name, size_t bytes, double ns)
+{
+    std::cout
+        << "  " << std::left << std::setw(16) << name
+        << std::right << std::setw(12) << std::fixed << std::setprecision(1) << ns << " ns"
+        << std::setw(10) << std::setprecision(2) << (bytes / ns) << " GB/s"
+        << std::endl;
+}
+
+int main()
+{
+    const size_t SIZES[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+
+    std::mt19937 rng(42);
+    std::string out;
+    volatile bool sink = false;
+
+    std::cout << "Runtime dispatch picked: " << XLogEscape::implementation_name() << std::endl;
+
+    for(size_t size : SIZES)
+    {
+        const std::string msg = make_message(size, rng);
+        std::cout << "Message size " << msg.size() << " bytes" << std::endl;
+
+        print_result("escape/scalar", msg.size(), time_ns_per_call([&]() { out.clear(); XLogEscape::json_escape_scalar(msg, out); }, msg.size()));
+#ifdef XLOG_ESCAPE_HAVE_X86
+        print_result("escape/sse2", msg.size(), time_ns_per_call([&]() { out.clear(); XLogEscape::json_escape_sse2(msg, out); }, msg.size()));
+        if(XLogEscape::cpu_has_avx2())
+        {
+            print_result("escape/avx2", msg.size(), time_ns_per_call([&]() { out.clear(); XLogEscape::json_escape_avx2(msg, out); }, msg.size()));
+        }
+#endif
+
+        print_result("validate/scalar", msg.size(), time_ns_per_call([&]() { sink = XLogEscape::utf8_validate_scalar(msg); }, msg.size()));
+#ifdef XLOG_ESCAPE_HAVE_X86
+        print_result("validate/sse2", msg.size(), time_ns_per_call([&]() { sink = XLogEscape::utf8_validate_sse2(msg); }, msg.size()));
+        if(XLogEscape::cpu_has_avx2())
+        {
+            print_result("validate/avx2", msg.size(), time_ns_per_call([&]() { sink = XLogEscape::utf8_validate_avx2(msg); }, msg.size()));
+        }
+#endif
+    }
+
+    return 0;
+}
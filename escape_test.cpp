@@ -0,0 +1,173 @@
+#include "xlog_escape.noexport.h"
+#include "xlog_test.noexport.h"
+
+#include <random>
+#include <string>
+#include <vector>
+#include <iomanip>
+
+/*
+ * The SIMD kernels only hand the awkward bytes to the scalar code, so they can get wrong
+ * exactly what the scalar code gets right: sequences that start in one 16/32 byte block and
+ * end in the next, or are cut off by the end of the input. Every case is run at every offset
+ * across a couple of blocks, and every implementation has to agree with the scalar one.
+ */
+
+namespace
+{
+    struct implementation
+    {
+        const char* name;
+        void (*escape)(std::string_view, std::string&);
+        bool (*validate)(std::string_view);
+    };
+
+    std::vector<implementation> simd_implementations()
+    {
+        std::vector<implementation> rValue;
+#ifdef XLOG_ESCAPE_HAVE_X86
+        rValue.push_back({ "sse2", XLogEscape::json_escape_sse2, XLogEscape::utf8_validate_sse2 });
+        if(XLogEscape::cpu_has_avx2())
+        {
+            rValue.push_back({ "avx2", XLogEscape::json_escape_avx2, XLogEscape::utf8_validate_avx2 });
+        }
+#endif
+        return rValue;
+    }
+
+    // Invalid UTF-8 printed as escapes, so failures can be read
+    std::string printable(std::string_view in)
+    {
+        std::ostringstream out;
+        for(unsigned char c : in)
+        {
+            if(c >= 0x20 && c < 0x7F)
+            {
+                out << c;
+            }
+            else
+            {
+                out << "\\x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+            }
+        }
+        return out.str();
+    }
+
+    std::string escape_with(void (*escape)(std::string_view, std::string&), std::string_view in)
+    {
+        std::string out = "prefix:";
+        escape(in, out);
+        return out;
+    }
+
+    // 'sequence' at every offset from 0 to 70, with printable ASCII around it so the blocks have to be scanned
+    void check_everywhere(const std::string& sequence)
+    {
+        for(size_t offset = 0; offset <= 70; offset++)
+        {
+            for(const std::string& tail : { std::string(), std::string("tail of the string, long enough for one more block")})
+            {
+                const std::string input = std::string(offset, 'a') + sequence + tail;
+                const std::string expected = escape_with(XLogEscape::json_escape_scalar, input);
+                const bool valid = XLogEscape::utf8_validate_scalar(input);
+
+                for(const implementation& impl : simd_implementations())
+                {
+                    CHECK(escape_with(impl.escape, input) == expected) << impl.name << " escaping " << printable(sequence) << " at offset " << offset;
+                    CHECK(impl.validate(input) == valid) << impl.name << " validating " << printable(sequence) << " at offset " << offset;
+                }
+            }
+        }
+    }
+}
+
+XLOG_TEST(Escape, ScalarEscapes)
+{
+    std::string out;
+    XLogEscape::json_escape_scalar("a\"b\\c\nd\te\x01", out);
+    CHECK(out == "a\\\"b\\\\c\\nd\\te\\u0001") << printable(out);
+
+    out.clear();
+    XLogEscape::json_escape_scalar("caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80", out);
+    CHECK(out == "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80") << printable(out);
+}
+
+XLOG_TEST(Escape, ScalarRejectsInvalid)
+{
+    // Overlongs, surrogates, past U+10FFFF, bytes that can never appear, stray continuations, cut off sequences
+    for(std::string_view invalid : {
+        "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xE0\x9F\xBF", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+        "\xED\xA0\x80", "\xED\xBF\xBF",
+        "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF", "\xFE",
+        "\x80", "\xBF",
+        "\xC3", "\xE2\x82", "\xF0\x9F\x98" })
+    {
+        CHECK(!XLogEscape::utf8_validate_scalar(invalid)) << printable(invalid);
+
+        std::string escaped;
+        XLogEscape::json_escape_scalar(invalid, escaped);
+        CHECK(escaped.find("\\ufffd") != std::string::npos) << printable(invalid);
+
+        std::string sanitized;
+        XLogEscape::utf8_sanitize(invalid, sanitized);
+        CHECK(XLogEscape::utf8_validate_scalar(sanitized)) << printable(invalid);
+        CHECK(sanitized.find("\xEF\xBF\xBD") != std::string::npos) << printable(invalid);
+    }
+
+    // The edges of what's allowed
+    for(std::string_view valid : { "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xEE\x80\x80", "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF" })
+    {
+        CHECK(XLogEscape::utf8_validate_scalar(valid)) << printable(valid);
+    }
+}
+
+XLOG_TEST(Escape, ImplementationsAgreeAcrossBlocks)
+{
+    for(const std::string& sequence : {
+        // Valid multibyte sequences, which the SIMD code has to pass through untouched
+        std::string("\xC3\xA9"), std::string("\xE2\x82\xAC"), std::string("\xF0\x9F\x98\x80"), std::string("\xF4\x8F\xBF\xBF"),
+        // Overlongs & surrogates
+        std::string("\xC0\xAF"), std::string("\xE0\x80\xAF"), std::string("\xF0\x80\x80\xAF"), std::string("\xED\xA0\x80"), std::string("\xED\xB0\x80"),
+        // Out of range & never valid
+        std::string("\xF4\x90\x80\x80"), std::string("\xF8\x88\x80\x80\x80"), std::string("\xFF"),
+        // Truncated, then followed by ASCII (or the end of the input)
+        std::string("\xC3"), std::string("\xE2\x82"), std::string("\xF0\x9F\x98"),
+        // Continuation bytes on their own
+        std::string("\x80\x80"), std::string("\xBF"),
+        // Things that need escaping without being UTF-8
+        std::string("\""), std::string("\\"), std::string("\n\r\t"), std::string(1, '\0'), std::string("\x1F\x7F") })
+    {
+        check_everywhere(sequence);
+    }
+}
+
+XLOG_TEST(Escape, ImplementationsAgreeOnRandomInput)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_int_distribution<int> ascii(0x20, 0x7E);
+    std::uniform_int_distribution<int> chance(0, 99);
+    std::uniform_int_distribution<size_t> length(0, 200);
+
+    for(int round = 0; round < 2000; round++)
+    {
+        // Mostly ASCII with some arbitrary bytes, like real (occasionally broken) log lines
+        std::string input;
+        const size_t size = length(rng);
+        for(size_t i = 0; i < size; i++)
+        {
+            input.push_back(static_cast<char>(chance(rng) < 90 ? ascii(rng) : byte(rng)));
+        }
+
+        const std::string expected = escape_with(XLogEscape::json_escape_scalar, input);
+        const bool valid = XLogEscape::utf8_validate_scalar(input);
+        for(const implementation& impl : simd_implementations())
+        {
+            CHECK(escape_with(impl.escape, input) == expected) << impl.name << " on " << printable(input);
+            CHECK(impl.validate(input) == valid) << impl.name << " on " << printable(input);
+        }
+
+        // One failing input is enough to go on
+        REQUIRE(!xlog_test_failed());
+    }
+}
@@ -0,0 +1,152 @@
+#include "xlog_guard.noexport.h"
+#include "xlog_test.noexport.h"
+
+#include <atomic>
+#include <algorithm>
+
+namespace
+{
+    // Fails, or takes its time over, every record while told to
+    class test_sink final : public xlog_sink
+    {
+    public:
+        explicit test_sink(std::string name) : xlog_sink(std::move(name), nullptr) {}
+
+        std::atomic<bool> failing{false};
+        std::atomic<int> delay_ms{0};
+        std::atomic<size_t> attempts{0};
+
+    protected:
+        bool consume(const boost::log::record_view&, const xlog_formatted_text&) override
+        {
+            if(delay_ms.load() > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms.load()));
+            }
+            attempts++;
+            return !failing.load();
+        }
+    };
+
+    XLog::SinkBreakerSettings test_breaker()
+    {
+        XLog::SinkBreakerSettings rValue;
+        rValue.enabled = true;
+        rValue.budget_ms = 50;
+        rValue.max_strikes = 3;
+        rValue.retry_ms = 100;
+        return rValue;
+    }
+
+    bool reported(xlog_guarded_sink& guarded, const std::string& what)
+    {
+        const std::vector<std::string> reports = guarded.check();
+        return std::any_of(reports.begin(), reports.end(), [&](const std::string& report) { return report.find(what) != std::string::npos; });
+    }
+
+    // Hands the guard one record and waits until its thread has tried to write it
+    void deliver_one(xlog_guarded_sink& guarded, test_sink& sink)
+    {
+        const size_t before = sink.attempts.load();
+        guarded.deliver(make_test_record(XLog::Severity::INFO, "Guarded", "record"), nullptr);
+        REQUIRE(wait_for_test([&]() { return sink.attempts.load() > before; }));
+    }
+}
+
+XLOG_TEST(Breaker, TripsAfterStrikesAndRecoversOnProbe)
+{
+    auto sink = std::make_shared<test_sink>("flaky");
+    auto fallback = std::make_shared<test_sink>("fallback");
+    fallback->level = XLog::Severity::FATAL; // So it only gets what's diverted to it
+
+    xlog_guarded_sink guarded(sink, test_breaker());
+    guarded.set_fallback(fallback);
+
+    sink->failing = true;
+    for(int i = 0; i < 3; i++)
+    {
+        CHECK(!guarded.information().tripped) << "after " << i << " strikes";
+        deliver_one(guarded, *sink);
+    }
+
+    REQUIRE(wait_for_test([&]() { return guarded.information().tripped; }));
+    CHECK(guarded.information().trips == 1u);
+    CHECK(reported(guarded, "tripped"));
+
+    // Tripped, so records go to the fallback without the sink seeing them
+    const size_t attempts = sink->attempts.load();
+    CHECK(!guarded.deliver(make_test_record(XLog::Severity::INFO, "Guarded", "diverted"), nullptr));
+    CHECK(sink->attempts.load() == attempts);
+    CHECK(fallback->attempts.load() == 1u);
+
+    // Once 'retry_ms' is up the next record is a probe, and a good one closes the breaker
+    sink->failing = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    deliver_one(guarded, *sink);
+
+    REQUIRE(wait_for_test([&]() { return !guarded.information().tripped; }));
+    CHECK(guarded.information().trips == 1u);
+    CHECK(reported(guarded, "recovered"));
+
+    deliver_one(guarded, *sink);
+    CHECK(!guarded.information().tripped);
+}
+
+XLOG_TEST(Breaker, FailedProbeStaysTripped)
+{
+    auto sink = std::make_shared<test_sink>("broken");
+    xlog_guarded_sink guarded(sink, test_breaker());
+
+    sink->failing = true;
+    for(int i = 0; i < 3; i++)
+    {
+        deliver_one(guarded, *sink);
+    }
+    REQUIRE(wait_for_test([&]() { return guarded.information().tripped; }));
+
+    // Before 'retry_ms' nothing gets through
+    const size_t attempts = sink->attempts.load();
+    CHECK(!guarded.deliver(make_test_record(XLog::Severity::INFO, "Guarded", "too soon"), nullptr));
+    CHECK(sink->attempts.load() == attempts);
+
+    // The probe fails, so it's tripped for another 'retry_ms' without counting as another trip
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    deliver_one(guarded, *sink);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(guarded.information().tripped);
+    CHECK(guarded.information().trips == 1u);
+
+    CHECK(!guarded.deliver(make_test_record(XLog::Severity::INFO, "Guarded", "still broken"), nullptr));
+    CHECK(sink->attempts.load() == attempts + 1);
+}
+
+XLOG_TEST(Breaker, SlowRecordsAreStrikes)
+{
+    auto sink = std::make_shared<test_sink>("slow");
+    xlog_guarded_sink guarded(sink, test_breaker());
+
+    // Written fine, but each over the budget
+    sink->delay_ms = 60;
+    for(int i = 0; i < 3; i++)
+    {
+        deliver_one(guarded, *sink);
+    }
+
+    REQUIRE(wait_for_test([&]() { return guarded.information().tripped; }));
+    CHECK(reported(guarded, "took longer than"));
+}
+
+XLOG_TEST(Breaker, StuckSinkIsTrippedByCheck)
+{
+    auto sink = std::make_shared<test_sink>("stuck");
+    xlog_guarded_sink guarded(sink, test_breaker());
+
+    // Stuck on its first record, the watchdog (check()) trips it rather than waiting for strikes
+    sink->delay_ms = 400;
+    guarded.deliver(make_test_record(XLog::Severity::INFO, "Guarded", "stuck"), nullptr);
+
+    REQUIRE(wait_for_test([&]() { return reported(guarded, "stuck writing"); }));
+    CHECK(guarded.information().tripped);
+
+    CHECK(!guarded.deliver(make_test_record(XLog::Severity::INFO, "Guarded", "while stuck"), nullptr));
+}
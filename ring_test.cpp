@@ -0,0 +1,222 @@
+#include "xlog_shm.noexport.h"
+#include "xlog_test.noexport.h"
+
+#include <vector>
+
+/*
+ * Records go into the ring through xlog_shm_sink, as they would in a logging process, and come
+ * back out through a second mapping of the same file, as xlog-collector would read them.
+ */
+
+namespace
+{
+    constexpr size_t RING_CAPACITY = 64 * 1024; // The smallest there is
+
+    struct test_ring
+    {
+        test_directory dir;
+        xlog_ring* producer = nullptr;
+        std::unique_ptr<xlog_shm_sink> sink;
+        std::unique_ptr<xlog_ring> consumer;
+
+        test_ring()
+        {
+            std::unique_ptr<xlog_ring> ring = xlog_ring::create(dir.path("test.ring"), RING_CAPACITY, false);
+            if(ring)
+            {
+                producer = ring.get();
+                sink = std::make_unique<xlog_shm_sink>(std::move(ring));
+                consumer = xlog_ring::open(dir.path("test.ring"));
+            }
+        }
+
+        bool deliver(XLog::Severity sev, const std::string& channel, const std::string& message)
+        {
+            return sink->deliver(make_test_record(sev, channel, message), nullptr);
+        }
+
+        // Messages of (up to 'max_records') decoded records, in ring order
+        std::vector<std::string> drain(size_t max_records = SIZE_MAX)
+        {
+            std::vector<std::string> rValue;
+            consumer->drain([&](const uint8_t* data, size_t length)
+            {
+                xlog_ring_decoded decoded;
+                CHECK(decode_ring_record(data, length, decoded)) << length << " bytes";
+                rValue.emplace_back(decoded.message);
+            }, max_records);
+            return rValue;
+        }
+    };
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+}
+
+XLOG_TEST(Ring, EncodeDecode)
+{
+    test_ring ring;
+    REQUIRE(ring.producer != nullptr && ring.consumer != nullptr);
+    CHECK(ring.consumer->header().capacity == RING_CAPACITY);
+    CHECK(ring.consumer->header().pid == ::getpid());
+
+    const int64_t before = now_ns();
+    CHECK(ring.deliver(XLog::Severity::WARNING, "Network", "connection reset"));
+    CHECK(ring.deliver(XLog::Severity::ERROR2, "", ""));
+    CHECK(ring.deliver(XLog::Severity::INFO, "Storage", std::string("binary\0message\xff", 15)));
+    const int64_t after = now_ns();
+
+    std::vector<xlog_ring_decoded> decoded;
+    std::vector<std::string> channels;
+    std::vector<std::string> messages;
+    const size_t count = ring.consumer->drain([&](const uint8_t* data, size_t length)
+    {
+        xlog_ring_decoded record;
+        CHECK(decode_ring_record(data, length, record));
+        decoded.push_back(record);
+        channels.emplace_back(record.channel);
+        messages.emplace_back(record.message);
+    }, SIZE_MAX);
+
+    REQUIRE(count == 3u);
+    REQUIRE(decoded.size() == 3u);
+    CHECK(decoded[0].severity == XLog::Severity::WARNING);
+    CHECK(channels[0] == "Network");
+    CHECK(messages[0] == "connection reset");
+    CHECK(decoded[1].severity == XLog::Severity::ERROR2);
+    CHECK(channels[1].empty() && messages[1].empty());
+    CHECK(channels[2] == "Storage");
+    CHECK(messages[2] == std::string("binary\0message\xff", 15));
+
+    for(const xlog_ring_decoded& record : decoded)
+    {
+        // Timestamps are wall clock, whatever clock the record itself had
+        CHECK(record.wall_ns >= before - 1000000000 && record.wall_ns <= after + 1000000000) << record.wall_ns;
+        CHECK(record.context_count == 0u);
+    }
+
+    CHECK(ring.consumer->empty());
+    CHECK(ring.consumer->header().dropped.load() == 0u);
+}
+
+XLOG_TEST(Ring, DecodeRejectsTruncatedRecords)
+{
+    test_ring ring;
+    REQUIRE(ring.producer != nullptr && ring.consumer != nullptr);
+    CHECK(ring.deliver(XLog::Severity::INFO, "Channel", "a message long enough to cut short"));
+
+    std::vector<uint8_t> encoded;
+    ring.consumer->drain([&](const uint8_t* data, size_t length) { encoded.assign(data, data + length); }, 1);
+    REQUIRE(!encoded.empty());
+
+    // Entries are padded to 8 bytes, so cutting off the padding still decodes but anything more can't
+    xlog_ring_record record;
+    std::memcpy(&record, encoded.data(), sizeof(record));
+    const size_t used = sizeof(record) + record.channel_length + record.message_length + record.file_length + record.function_length;
+
+    xlog_ring_decoded decoded;
+    CHECK(decode_ring_record(encoded.data(), used, decoded));
+    for(size_t length = 0; length < used; length++)
+    {
+        CHECK(!decode_ring_record(encoded.data(), length, decoded)) << length << " of " << used << " bytes";
+    }
+
+    // As is a severity that doesn't exist
+    record.severity = static_cast<uint8_t>(XLog::Severity::INTERNAL) + 1;
+    std::memcpy(encoded.data(), &record, sizeof(record));
+    CHECK(!decode_ring_record(encoded.data(), encoded.size(), decoded));
+}
+
+XLOG_TEST(Ring, FullRingDropsAndCounts)
+{
+    test_ring ring;
+    REQUIRE(ring.producer != nullptr && ring.consumer != nullptr);
+
+    // Nothing is draining, so eventually there's no room
+    const std::string padding(1000, 'x');
+    size_t written = 0;
+    while(ring.deliver(XLog::Severity::INFO, "Full", "record " + std::to_string(written) + " " + padding))
+    {
+        written++;
+        REQUIRE(written < RING_CAPACITY);
+    }
+    CHECK(written > 30u) << written;
+    CHECK(!ring.deliver(XLog::Severity::INFO, "Full", "still full " + padding));
+
+    CHECK(ring.consumer->header().dropped.load() == 2u);
+    CHECK(ring.sink->information().dropped == 2u);
+
+    // Too big for the ring, however empty it is
+    CHECK(!ring.deliver(XLog::Severity::INFO, "Full", std::string(RING_CAPACITY / 4, 'x')));
+    CHECK(ring.consumer->header().dropped.load() == 3u);
+
+    // Everything that was accepted is there, & draining makes room again
+    const std::vector<std::string> messages = ring.drain();
+    REQUIRE(messages.size() == written);
+    for(size_t i = 0; i < written; i++)
+    {
+        CHECK(messages[i].rfind("record " + std::to_string(i) + " ", 0) == 0) << "record " << i;
+    }
+
+    CHECK(ring.deliver(XLog::Severity::INFO, "Full", "room again"));
+    CHECK(ring.drain() == std::vector<std::string>{ "room again" });
+}
+
+XLOG_TEST(Ring, WrapsAroundInOrder)
+{
+    test_ring ring;
+    REQUIRE(ring.producer != nullptr && ring.consumer != nullptr);
+
+    // Sizes that don't divide the capacity, drained a few at a time (as many as are written, on average), so entries
+    // keep landing across the end of the buffer
+    size_t next_written = 0;
+    size_t next_read = 0;
+    for(int round = 0; round < 500; round++)
+    {
+        for(int i = 0; i < 7; i++)
+        {
+            const std::string message = "record " + std::to_string(next_written) + " " + std::string(50 + (next_written * 37) % 700, 'x');
+            CHECK(ring.deliver(XLog::Severity::INFO, "Wrap", message)) << "record " << next_written;
+            next_written++;
+        }
+
+        for(const std::string& message : ring.drain(6 + round % 3))
+        {
+            CHECK(message.rfind("record " + std::to_string(next_read) + " ", 0) == 0) << "expected record " << next_read;
+            next_read++;
+        }
+        REQUIRE(!xlog_test_failed());
+    }
+
+    for(const std::string& message : ring.drain())
+    {
+        CHECK(message.rfind("record " + std::to_string(next_read) + " ", 0) == 0) << "expected record " << next_read;
+        next_read++;
+    }
+
+    CHECK(next_read == next_written);
+    CHECK(ring.consumer->header().write_position.load() > 10 * RING_CAPACITY);
+    CHECK(ring.consumer->header().dropped.load() == 0u);
+    CHECK(!ring.consumer->corrupt());
+}
+
+XLOG_TEST(Ring, UnpublishedEntryCanBeSkipped)
+{
+    test_ring ring;
+    REQUIRE(ring.producer != nullptr && ring.consumer != nullptr);
+
+    // As if the process died between reserving an entry and publishing it
+    xlog_ring::reservation abandoned;
+    REQUIRE(ring.producer->reserve(100, abandoned));
+    CHECK(ring.deliver(XLog::Severity::INFO, "Skip", "after the abandoned entry"));
+
+    CHECK(ring.drain().empty());
+    CHECK(!ring.consumer->empty());
+
+    CHECK(ring.consumer->skip_unpublished());
+    CHECK(ring.drain() == std::vector<std::string>{ "after the abandoned entry" });
+    CHECK(ring.consumer->empty());
+    CHECK(!ring.consumer->skip_unpublished());
+}
@@ -0,0 +1,64 @@
+#include "xlog_test.noexport.h"
+
+#include <sys/wait.h>
+
+#include <cstring>
+
+/*
+ * Runs every registered test (or those of the groups given on the command line), each in a
+ * child process of its own, and exits non-zero if any of them failed or crashed.
+ *
+ * Usage: xlog-unit-tests [groups...]
+ */
+
+static bool run_test(const xlog_test_case& test)
+{
+    std::cout << "[ RUN  ] " << test.group << "." << test.name << std::endl;
+
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t child = ::fork();
+    if(child == 0)
+    {
+        test.run();
+        std::cout.flush();
+        std::cerr.flush();
+        ::_exit(xlog_test_failed() ? 1 : 0);
+    }
+
+    int status = 0;
+    ::waitpid(child, &status, 0);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    const bool passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    std::cout << (passed ? "[  OK  ] " : "[ FAIL ] ") << test.group << "." << test.name << " (" << elapsed.count() << "ms)";
+    if(WIFSIGNALED(status))
+    {
+        std::cout << ", killed by " << ::strsignal(WTERMSIG(status));
+    }
+    std::cout << std::endl;
+
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    size_t ran = 0;
+    size_t failed = 0;
+    for(const xlog_test_case& test : xlog_test_cases())
+    {
+        bool selected = argc == 1;
+        for(int i = 1; i < argc; i++)
+        {
+            selected |= std::strcmp(argv[i], test.group) == 0;
+        }
+
+        if(selected)
+        {
+            ran++;
+            failed += run_test(test) ? 0 : 1;
+        }
+    }
+
+    std::cout << ran - failed << " of " << ran << " tests passed" << std::endl;
+    return ran != 0 && failed == 0 ? 0 : 1;
+}
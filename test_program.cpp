@@ -5,26 +5,26 @@ GET_LOGGER("Test Program")
 #include <iostream>
 
 #include <csignal>
-#include <unordered_map>
-std::unordered_map<int, sighandler_t> base_signals;
+#include <pthread.h>
 
 // Make sure our program correctly exits and removes the logging socket
-void handle_signal(int signal)
+// Signals are blocked and waited for on a thread of their own, logging (or shutting it down) inside a signal handler can deadlock
+void handle_signals(sigset_t signals)
 {
+    int signal = 0;
+    while(sigwait(&signals, &signal) != 0)
+    {
+    }
+
     LOG_INFO() << "Stopping!" << std::endl;
     XLog::ShutownLogging(signal);
 
-    // Restore original signal and then trigger it
-    std::signal(signal, base_signals[signal]);
+    // Let the signal do what it would have done
+    std::signal(signal, SIG_DFL);
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
     std::raise(signal);
 }
 
-// Setup a new signal and save the old one
-void setup_signal(int signal)
-{
-    base_signals[signal] = std::signal(signal, handle_signal);
-}
-
 // Custom log macro to make life a little easier
 #define LOG_AT(sev) CUSTOM_LOG_SEV(__logger, sev) << "Logging @ " << XLog::GetSeverityString(sev)
 
@@ -59,6 +59,12 @@ int main(int argc, char** argv)
     XLog::LogSettings settings
     {
         .s_default_level = XLog::Severity::INFO,
+        // Crashes (SIGSEGV, SIGBUS, SIGABRT, SIGFPE) are reported by xlog, see xlog-manager --symbolize
+        .s_crash =
+        {
+            .enabled = true,
+            .path = "/tmp/xlog-test-%p.crash"
+        },
 #ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
         .s_external_control =
         {
@@ -82,17 +88,21 @@ int main(int argc, char** argv)
 #endif // XLOG_USE_JOURNAL_LOG
     };
 
-    XLog::InitializeLogging(settings);
+    // Blocked before anything starts a thread, so every thread (xlog's included) inherits it & only ours takes them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::thread(handle_signals, signals).detach();
 
-    // Setup our signals
-    setup_signal(SIGINT);
-    setup_signal(SIGTERM);
-    setup_signal(SIGABRT);
+    XLog::InitializeLogging(settings);
 
     // Loop over each level every second
     auto current_sev = XLog::Severity::INFO;
-    while(true)
+    for(uint64_t iteration = 0; ; iteration++)
     {
+        XLog::ScopedContext ctx("iteration", iteration);
         LOG_AT(current_sev);
         current_sev = get_next(current_sev);
         std::this_thread::sleep_for(std::chrono::milliseconds(1000));
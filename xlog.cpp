@@ -7,13 +7,15 @@ static XLog::LogSettings LOGGER_SETTINGS;
 
 #include <mutex>
 #include <atomic>
+#include <thread>
+#include <future>
+#include <iostream>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
 
 #include <boost/log/utility/setup.hpp>
-#include <boost/log/expressions/predicates/channel_severity_filter.hpp>
-
-BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", XLog::Severity)
-BOOST_LOG_ATTRIBUTE_KEYWORD(channel, "Channel", std::string)
 
 #ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
 #include "xlog_grpc.noexport.h"
@@ -23,39 +25,67 @@ static std::unique_ptr<grpc::Server> ServerPointer;
 #endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
 
 
+#include "xlog_sinks.noexport.h"
+#include "xlog_channel_files.noexport.h"
+#include "xlog_overload.noexport.h"
+#include "xlog_guard.noexport.h"
+#include "xlog_crash.noexport.h"
+#include "xlog_trace.noexport.h"
+#include "xlog_metrics.noexport.h"
+#include "xlog_memory.noexport.h"
+#include "xlog_async.noexport.h"
+#include "xlog_flush.noexport.h"
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+#include "xlog_profiler.noexport.h"
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+#include <boost/core/null_deleter.hpp>
+static boost::shared_ptr<xlog_dispatch_backend> DISPATCH_BACKEND_PTR;
+static boost::shared_ptr<xlog_dispatch_frontend> DISPATCH_FRONTEND_PTR;
+static std::unique_ptr<xlog_overload_controller> OVERLOAD_CONTROLLER;
+static std::unique_ptr<xlog_metric_reporter> METRIC_REPORTER;
+static std::shared_ptr<xlog_async_dispatcher> ASYNC_DISPATCHER;
+static std::unique_ptr<xlog_background_flusher> BACKGROUND_FLUSHER;
+static std::unique_ptr<xlog_sink_watchdog> SINK_WATCHDOG;
+
 #ifdef XLOG_USE_SYSLOG_LOG
 #include <boost/log/sinks/syslog_backend.hpp>
-static boost::shared_ptr<boost::log::sinks::synchronous_sink<boost::log::sinks::syslog_backend>> SYSLOG_BACKEND_PTR;
 static boost::log::sinks::syslog::custom_severity_mapping<XLog::Severity> SYSLOG_SEV_MAPPER("Severity");
 #endif //XLOG_USE_SYSLOG_LOG
 
 #ifdef XLOG_USE_JOURNAL_LOG
 #include "xlog_journal.noexport.h"
-static boost::shared_ptr<boost::log::sinks::synchronous_sink<xlog_journal_backend>> JOURNAL_BACKEND_PTR;
 #endif // XLOG_USE_JOURNAL_LOG
 
-#include "xlog_log_internal.noexport.h"
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+#include "xlog_block_file.noexport.h"
+#endif // XLOG_ENABLE_COMPRESSED_FILE_LOG
 
-typedef boost::log::expressions::channel_severity_filter_actor<std::string, XLog::Severity> min_severity_filter;
-min_severity_filter& get_sev_filter()
-{
-    static min_severity_filter filter = boost::log::expressions::channel_severity_filter(channel, severity);
-    return filter;
-}
+#ifdef XLOG_ENABLE_SHARED_MEMORY_LOG
+#include "xlog_shm.noexport.h"
+#include "xlog_paths.noexport.h"
+#endif // XLOG_ENABLE_SHARED_MEMORY_LOG
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#include "xlog_paths.noexport.h"
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+#include "xlog_clock.noexport.h"
+#include "xlog_control.noexport.h"
+#include "xlog_log_internal.noexport.h"
 
 struct LoggerInformation
 {
     XLog::LoggerType logger;
 
     std::string channel;
-    XLog::Severity severity;
+
+    // The channel's slot in the control block, which the logger (and its copies) read as well
+    XLog::ChannelLevel* level;
 };
 
 typedef std::unordered_map<std::string, LoggerInformation, XLog::StringHash, std::equal_to<>> LoggerMap;
 static std::mutex _LoggerMutex;
 
-static std::atomic<XLog::Severity> _DefaultSeverity = XLog::Severity::INFO;
-
 static LoggerMap& GetLoggerMap() noexcept
 {
     static LoggerMap map;
@@ -88,12 +118,53 @@ std::string XLog::GetSeverityString(Severity sev) noexcept
     return "???";
 }
 
+static xlog_formatter_function get_formatter(XLog::OutputFormat format)
+{
+    switch(format)
+    {
+        case XLog::OutputFormat::TEXT:
+            return &XLogFormatters::default_formatter;
+        case XLog::OutputFormat::JSON:
+            return &XLogFormatters::json_formatter;
+    }
+
+    return &XLogFormatters::default_formatter;
+}
+
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+// Reads the logging thread's XLOG_RECORD_SOURCE_LOCATION, so threads never write to a shared attribute
+class source_location_attribute_impl final : public boost::log::attribute::impl
+{
+public:
+    boost::log::attribute_value get_value() override
+    {
+        return boost::log::attribute_value(new boost::log::attributes::attribute_value_impl<std::source_location>(XLOG_RECORD_SOURCE_LOCATION));
+    }
+};
+#endif
+
+// Never destroyed (so the names outlive every logger), and a set so the strings never move
+const std::string& XLog::LoggerType::intern_channel_name() const noexcept
+{
+    static std::mutex mutex;
+    static std::unordered_set<std::string>* names = new std::unordered_set<std::string>();
+
+    std::string channel_string = channel();
+    std::scoped_lock lock(mutex);
+    const std::string* interned = &*names->insert(std::move(channel_string)).first;
+    name.store(interned, std::memory_order_release);
+    return *interned;
+}
+
 // For atexit()
 void call_exit()
 {
     XLog::ShutownLogging(-1);
 }
 
+// Also for atexit(), runs after call_exit (see ShutownLogging)
+static void wait_for_shutdown_stragglers();
+
 XLog::LoggerType& XLog::GetNamedLogger(const std::string_view channel) noexcept
 {
     if(channel.compare(INTERNAL_LOGGER_NAME) == 0)
@@ -116,14 +187,14 @@ XLog::LoggerType& XLog::GetNamedLogger(const std::string_view channel) noexcept
         {
             .logger = LoggerType{boost::log::keywords::channel = channelString},
             .channel = channelString,
-            .severity = _DefaultSeverity
+            .level = new XLog::ChannelLevel(XLogControl::add_channel(channelString))
         });
 
         if (emplaced.second)
         {
-            min_severity_filter& filter = get_sev_filter();
-            filter[channelString] = _DefaultSeverity;
-            return emplaced.first->second.logger;
+            LoggerInformation& info = emplaced.first->second;
+            info.logger.set_level_slot(info.level);
+            return info.logger;
         }
         else
         {
@@ -146,17 +217,130 @@ void XLog::InitializeLogging(LogSettings settings)
     {
         isInitialized = true;
         LOGGER_SETTINGS = std::move(settings);
+        xlog_memory_setup(LOGGER_SETTINGS.s_memory);
+        {
+            GET_LOGGER_MAP(all_loggers)
+            // Loggers created before now only had the default from before we were configured
+            XLogControl::block().default_level.store(static_cast<uint32_t>(LOGGER_SETTINGS.s_default_level), std::memory_order_relaxed);
+            for(const auto& [key, value] : all_loggers)
+            {
+                value.level->load(std::memory_order_relaxed)->store(static_cast<uint32_t>(LOGGER_SETTINGS.s_default_level), std::memory_order_relaxed);
+            }
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+            // Existing loggers (GET_LOGGER at namespace scope, copies of them, instance loggers) move over to the same
+            // slots in the shared block with their channels, channels with a private slot keep it
+            xlog_control_block& local = XLogControl::block();
+            if(LOGGER_SETTINGS.s_shared_memory_control.enabled && TRY_SETUP_RUNTIME_DIRECTORY() &&
+               XLogControl::share(GET_THIS_PROGRAM_RUNTIME_FILE("control"), LOGGER_SETTINGS.s_shared_memory_control.allow_anyone_access))
+            {
+                xlog_control_block& shared = XLogControl::block();
+                const auto relocate = [&](const std::atomic<uint32_t>* slot) -> std::atomic<uint32_t>*
+                {
+                    const auto first = reinterpret_cast<uintptr_t>(&local.channels[0]);
+                    const auto address = reinterpret_cast<uintptr_t>(slot);
+                    if(address < first || address >= first + sizeof(local.channels))
+                    {
+                        return const_cast<std::atomic<uint32_t>*>(slot);
+                    }
+
+                    return &shared.channels[(address - first) / sizeof(xlog_control_channel)].level;
+                };
+
+                for(auto& [key, value] : all_loggers)
+                {
+                    value.level->store(relocate(value.level->load(std::memory_order_relaxed)), std::memory_order_release);
+                }
+            }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+        }
+
+        // Every output hangs off this one Boost sink, so each record is only formatted once per formatter
+        DISPATCH_BACKEND_PTR = boost::make_shared<xlog_dispatch_backend>();
+        const xlog_formatter_function formatter = get_formatter(LOGGER_SETTINGS.s_format);
+
+        // Sinks with a breaker, they're swapped for guarded versions once every sink exists
+        std::vector<std::pair<std::string, XLog::SinkBreakerSettings>> breakers;
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_LOG
+        // Records just get copied into the ring, xlog-collector does the formatting & writing
+        std::string ring_path;
+        std::unique_ptr<xlog_ring> ring;
+        if(LOGGER_SETTINGS.s_shared_memory.enabled && TRY_SETUP_RUNTIME_DIRECTORY())
+        {
+            ring_path = GET_THIS_PROGRAM_RUNTIME_FILE("ring");
+            ring = xlog_ring::create(ring_path, LOGGER_SETTINGS.s_shared_memory.ring_size, LOGGER_SETTINGS.s_shared_memory.allow_anyone_access);
+        }
+
+        const bool use_shared_memory = ring != nullptr;
+        if(use_shared_memory)
         {
-            _DefaultSeverity.store(LOGGER_SETTINGS.s_default_level);
+            DISPATCH_BACKEND_PTR->add_sink(std::make_shared<xlog_shm_sink>(std::move(ring)));
+        }
+#else
+        const bool use_shared_memory = false;
+#endif // XLOG_ENABLE_SHARED_MEMORY_LOG
+
+        // The console is always there so it can be turned on at runtime, it just starts disabled if configured that way
+        auto console_sink = std::make_shared<xlog_stream_sink>("console", formatter, boost::shared_ptr<std::ostream>(&std::clog, boost::null_deleter()));
+        console_sink->enabled = LOGGER_SETTINGS.s_console.enabled && !use_shared_memory;
+        console_sink->level = LOGGER_SETTINGS.s_console.level;
+        DISPATCH_BACKEND_PTR->add_sink(console_sink);
+        if(LOGGER_SETTINGS.s_console.breaker.enabled)
+        {
+            breakers.emplace_back("console", LOGGER_SETTINGS.s_console.breaker);
+        }
+
+        std::shared_ptr<xlog_file_sink> file_sink;
+        if(LOGGER_SETTINGS.s_file.enabled && !use_shared_memory)
+        {
+            file_sink = std::make_shared<xlog_file_sink>("file", formatter, LOGGER_SETTINGS.s_file);
+            file_sink->level = LOGGER_SETTINGS.s_file.level;
+            DISPATCH_BACKEND_PTR->add_sink(file_sink);
+            if(LOGGER_SETTINGS.s_file.breaker.enabled)
+            {
+                breakers.emplace_back("file", LOGGER_SETTINGS.s_file.breaker);
+            }
+        }
+
+        if(LOGGER_SETTINGS.s_channel_files.enabled && !use_shared_memory)
+        {
+            auto channel_files_sink = std::make_shared<xlog_channel_file_sink>("channel_files", formatter, LOGGER_SETTINGS.s_channel_files);
+            channel_files_sink->level = LOGGER_SETTINGS.s_channel_files.level;
+            DISPATCH_BACKEND_PTR->add_sink(channel_files_sink);
         }
 
-        boost::log::add_console_log(std::clog, boost::log::keywords::format = &XLogFormatters::default_formatter);
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+        std::shared_ptr<xlog_block_file_sink> compressed_file_sink;
+        if(LOGGER_SETTINGS.s_compressed_file.enabled && !use_shared_memory)
+        {
+            compressed_file_sink = std::make_shared<xlog_block_file_sink>("compressed_file", formatter, LOGGER_SETTINGS.s_compressed_file);
+            compressed_file_sink->level = LOGGER_SETTINGS.s_compressed_file.level;
+            DISPATCH_BACKEND_PTR->add_sink(compressed_file_sink);
+        }
+#endif // XLOG_ENABLE_COMPRESSED_FILE_LOG
 
 #ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
-        boost::log::core::get()->add_global_attribute("SourceLocation", boost::log::attributes::mutable_constant<std::source_location>(std::source_location::current()));
+        boost::log::core::get()->add_global_attribute("SourceLocation", boost::log::attribute(new source_location_attribute_impl()));
 #endif
 
-        boost::log::add_common_attributes();
+        if(XLogClock::setup(LOGGER_SETTINGS.s_timestamp_source) == XLog::TimestampSource::WALL_CLOCK)
+        {
+            boost::log::core::get()->add_global_attribute("TimeStamp", boost::log::attributes::local_clock());
+        }
+        else
+        {
+            boost::log::core::get()->add_global_attribute(XLogClock::RAW_TIMESTAMP_ATTRIBUTE_NAME, XLogClock::make_raw_timestamp_attribute());
+        }
+
+        if(LOGGER_SETTINGS.s_common_attributes)
+        {
+            // Not add_common_attributes(), its TimeStamp would read the wall clock even when the source is MONOTONIC or TSC
+            auto core = boost::log::core::get();
+            core->add_global_attribute("LineID", boost::log::attributes::counter<unsigned int>(1));
+            core->add_global_attribute("ProcessID", boost::log::attributes::current_process_id());
+            core->add_global_attribute("ThreadID", boost::log::attributes::current_thread_id());
+        }
 
 #ifdef XLOG_USE_SYSLOG_LOG
     #ifdef BOOST_LOG_USE_NATIVE_SYSLOG
@@ -164,7 +348,7 @@ void XLog::InitializeLogging(LogSettings settings)
     #else
         #define _XLOG_SET_IMPL boost::log::keywords::use_impl = boost::log::sinks::syslog::impl_types::udp_socket_based
     #endif // BOOST_LOG_USE_NATIVE_SYSLOG
-        if(LOGGER_SETTINGS.s_syslog.enabled)
+        if(LOGGER_SETTINGS.s_syslog.enabled && !use_shared_memory)
         {
             SYSLOG_SEV_MAPPER[XLog::Severity::INFO] = boost::log::sinks::syslog::level::debug;
             SYSLOG_SEV_MAPPER[XLog::Severity::DEBUG] = boost::log::sinks::syslog::level::info;
@@ -176,25 +360,147 @@ void XLog::InitializeLogging(LogSettings settings)
             SYSLOG_SEV_MAPPER[XLog::Severity::FATAL] = boost::log::sinks::syslog::level::critical;
             SYSLOG_SEV_MAPPER[XLog::Severity::INTERNAL] = boost::log::sinks::syslog::level::alert;
 
-            SYSLOG_BACKEND_PTR = boost::shared_ptr<boost::log::sinks::synchronous_sink<boost::log::sinks::syslog_backend>>(new boost::log::sinks::synchronous_sink<boost::log::sinks::syslog_backend>(_XLOG_SET_IMPL, boost::log::keywords::facility = LOGGER_SETTINGS.s_syslog.facility));
-            SYSLOG_BACKEND_PTR->locked_backend()->set_severity_mapper(SYSLOG_SEV_MAPPER);
-            SYSLOG_BACKEND_PTR->set_formatter(&XLogFormatters::default_formatter);
+            auto syslog_backend = boost::make_shared<boost::log::sinks::syslog_backend>(_XLOG_SET_IMPL, boost::log::keywords::facility = LOGGER_SETTINGS.s_syslog.facility);
+            syslog_backend->set_severity_mapper(SYSLOG_SEV_MAPPER);
 
-            boost::log::core::get()->add_sink(SYSLOG_BACKEND_PTR);
-            INTERNAL() << "Added syslog backed";
+            auto syslog_sink = std::make_shared<xlog_syslog_sink>("syslog", formatter, syslog_backend);
+            syslog_sink->level = LOGGER_SETTINGS.s_syslog.level;
+            DISPATCH_BACKEND_PTR->add_sink(syslog_sink);
+            if(LOGGER_SETTINGS.s_syslog.breaker.enabled)
+            {
+                breakers.emplace_back("syslog", LOGGER_SETTINGS.s_syslog.breaker);
+            }
         }
     #undef _XLOG_SET_IMPL
 #endif // XLOG_USE_SYSLOG_LOG
 
 #ifdef XLOG_USE_JOURNAL_LOG
-        if(LOGGER_SETTINGS.s_journal.enabled)
+        if(LOGGER_SETTINGS.s_journal.enabled && !use_shared_memory)
         {
-            JOURNAL_BACKEND_PTR = boost::shared_ptr<boost::log::sinks::synchronous_sink<xlog_journal_backend>>(new boost::log::sinks::synchronous_sink<xlog_journal_backend>);
+            auto journal_sink = std::make_shared<xlog_journal_backend>();
+            journal_sink->level = LOGGER_SETTINGS.s_journal.level;
+            DISPATCH_BACKEND_PTR->add_sink(journal_sink);
+            if(LOGGER_SETTINGS.s_journal.breaker.enabled)
+            {
+                breakers.emplace_back("journal", LOGGER_SETTINGS.s_journal.breaker);
+            }
+        }
+#endif // XLOG_USE_JOURNAL_LOG
+
+        // Fallbacks are looked up once everything is guarded, so a fallback with a breaker of its own keeps it
+        std::vector<std::shared_ptr<xlog_guarded_sink>> guarded_sinks;
+        for(const auto& [name, breaker] : breakers)
+        {
+            auto sink = DISPATCH_BACKEND_PTR->find_sink(name);
+            auto guarded = std::make_shared<xlog_guarded_sink>(sink, breaker);
+            guarded->enabled = sink->enabled.load();
+            guarded->level = sink->level.load();
+            DISPATCH_BACKEND_PTR->replace_sink(guarded);
+            guarded_sinks.push_back(std::move(guarded));
+        }
+
+        std::vector<std::string> missing_fallbacks;
+        for(size_t i = 0; i < breakers.size(); i++)
+        {
+            const std::string& fallback = breakers[i].second.fallback;
+            if(fallback.empty())
+            {
+                continue;
+            }
+
+            auto found = DISPATCH_BACKEND_PTR->find_sink(fallback);
+            if(found && found != guarded_sinks[i])
+            {
+                guarded_sinks[i]->set_fallback(std::move(found));
+            }
+            else
+            {
+                missing_fallbacks.push_back(fallback);
+            }
+        }
+
+        // Guarded sinks write records from their own threads, which needs the core to detach them from ours
+        const bool cross_thread = !guarded_sinks.empty();
+        if(cross_thread)
+        {
+            SINK_WATCHDOG = std::make_unique<xlog_sink_watchdog>(std::move(guarded_sinks));
+        }
+
+        if(LOGGER_SETTINGS.s_async.enabled)
+        {
+            ASYNC_DISPATCHER = std::make_shared<xlog_async_dispatcher>(LOGGER_SETTINGS.s_async, DISPATCH_BACKEND_PTR);
+        }
 
-            boost::log::core::get()->add_sink(JOURNAL_BACKEND_PTR);
+        DISPATCH_FRONTEND_PTR = boost::make_shared<xlog_dispatch_frontend>(DISPATCH_BACKEND_PTR, cross_thread, ASYNC_DISPATCHER);
+        boost::log::core::get()->add_sink(DISPATCH_FRONTEND_PTR);
+        BACKGROUND_FLUSHER = std::make_unique<xlog_background_flusher>(DISPATCH_FRONTEND_PTR, DISPATCH_BACKEND_PTR);
+        if(LOGGER_SETTINGS.s_overload.enabled && !LOGGER_SETTINGS.s_overload.shed_levels.empty())
+        {
+            OVERLOAD_CONTROLLER = std::make_unique<xlog_overload_controller>(LOGGER_SETTINGS.s_overload, DISPATCH_BACKEND_PTR);
+        }
+        xlog_trace_setup(LOGGER_SETTINGS.s_trace);
+        xlog_crash_setup(LOGGER_SETTINGS.s_crash);
+        METRIC_REPORTER = xlog_metrics_setup(LOGGER_SETTINGS.s_metrics);
+        if(file_sink && !file_sink->is_open())
+        {
+            INTERNAL() << "Failed to open log file '" << LOGGER_SETTINGS.s_file.path << "'";
+        }
+        else if(file_sink && LOGGER_SETTINGS.s_file.use_io_uring && !file_sink->using_io_uring())
+        {
+            INTERNAL() << "io_uring isn't available, writing the log file with writev";
+        }
+        for(const auto& fallback : missing_fallbacks)
+        {
+            INTERNAL() << "Unknown fallback sink '" << fallback << "', records of the sink it's for are dropped while it's tripped";
+        }
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+        if(compressed_file_sink && !compressed_file_sink->is_open())
+        {
+            INTERNAL() << "Failed to open compressed log file '" << LOGGER_SETTINGS.s_compressed_file.path << "'";
+        }
+#endif // XLOG_ENABLE_COMPRESSED_FILE_LOG
+#ifdef XLOG_ENABLE_SHARED_MEMORY_LOG
+        if(use_shared_memory)
+        {
+            INTERNAL() << "Logging through shared-memory ring '" << ring_path << "'";
+        }
+        else if(LOGGER_SETTINGS.s_shared_memory.enabled)
+        {
+            INTERNAL() << "Failed to set up shared-memory ring, logging from this process instead";
+        }
+#endif // XLOG_ENABLE_SHARED_MEMORY_LOG
+#ifdef XLOG_USE_SYSLOG_LOG
+        if(LOGGER_SETTINGS.s_syslog.enabled && !use_shared_memory)
+        {
+            INTERNAL() << "Added syslog backed";
+        }
+#endif // XLOG_USE_SYSLOG_LOG
+#ifdef XLOG_USE_JOURNAL_LOG
+        if(LOGGER_SETTINGS.s_journal.enabled && !use_shared_memory)
+        {
             INTERNAL() << "Added journal backed";
         }
 #endif // XLOG_USE_JOURNAL_LOG
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+        if(LOGGER_SETTINGS.s_shared_memory_control.enabled)
+        {
+            if(XLogControl::block().magic == XLOG_CONTROL_MAGIC)
+            {
+                INTERNAL() << "Channel levels published in '" << GET_THIS_PROGRAM_RUNTIME_FILE("control") << "'";
+            }
+            else
+            {
+                INTERNAL() << "Failed to publish channel levels, they can only be changed from this process";
+            }
+        }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+        // Whatever is still queued or buffered is written out at exit, even if ShutownLogging is never called
+        // (and anything that didn't finish within its deadline is waited on after it)
+        if(atexit(wait_for_shutdown_stragglers) != 0 || atexit(call_exit) != 0)
+        {
+            INTERNAL() << "Failed to set atexit() for xlog";
+        }
 
 #ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
         // Dirty solution that lets us "break" from this part of the setup at any time
@@ -234,12 +540,6 @@ void XLog::InitializeLogging(LogSettings settings)
                 }
             }
 
-            if(atexit(call_exit) != 0)
-            {
-                INTERNAL() << "Failed to set atexit() for xlog";
-                break;
-            }
-
             XLOG_EXTERNAL_CONTROL_SUCCESS = true;
             break;
         }
@@ -252,9 +552,112 @@ void XLog::InitializeLogging(LogSettings settings)
     }
 }
 
-void XLog::ShutownLogging(int signal)
+// Sum of every enabled sink's dropped records (disabled sinks count everything they skip as dropped)
+static uint64_t sink_dropped()
+{
+    uint64_t rValue = 0;
+    if(DISPATCH_BACKEND_PTR)
+    {
+        for(const auto& sink : DISPATCH_BACKEND_PTR->get_sinks())
+        {
+            const XLog::SinkInformation info = sink->information();
+            if(!info.enabled)
+            {
+                continue;
+            }
+
+            rValue += info.dropped;
+        }
+    }
+
+    return rValue;
+}
+
+// Flushes through the flush thread, giving up (but leaving it running) after 'deadline' (0 = no limit), true if it finished
+static bool flush_within(std::chrono::milliseconds deadline)
+{
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> finished = done->get_future();
+    XLog::FlushInBackground([done]() { done->set_value(); });
+
+    if(deadline.count() == 0)
+    {
+        finished.wait();
+        return true;
+    }
+
+    return finished.wait_for(deadline) == std::future_status::ready;
+}
+
+// Guards ShutownLogging, both trivially destructible so they still work from atexit() after other statics are gone
+static std::mutex SHUTDOWN_MUTEX;
+static std::optional<XLog::ShutdownReport> SHUTDOWN_REPORT;
+
+// Set by the drain thread once it's done
+struct shutdown_drain
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+};
+
+// What ShutownLogging had to leave running at its deadline, never freed since they may still be using it
+struct shutdown_stragglers
+{
+    std::shared_ptr<shutdown_drain> drain;
+    std::thread drain_thread;
+    xlog_background_flusher* flusher;
+    std::chrono::milliseconds deadline;
+};
+static shutdown_stragglers* SHUTDOWN_STRAGGLERS = nullptr;
+
+/*
+ * For atexit(), after call_exit. Whatever was left running gets one more deadline to finish & is joined,
+ * if it's still stuck (in a sink) the process ends here, rather than destroying the statics it's using
+ */
+static void wait_for_shutdown_stragglers()
 {
+    shutdown_stragglers* stragglers;
+    {
+        std::scoped_lock lock(SHUTDOWN_MUTEX);
+        stragglers = std::exchange(SHUTDOWN_STRAGGLERS, nullptr);
+    }
+
+    if(stragglers == nullptr)
+    {
+        return;
+    }
+
+    const auto until = std::chrono::steady_clock::now() + stragglers->deadline;
+    bool finished;
+    {
+        std::unique_lock lock(stragglers->drain->mutex);
+        finished = stragglers->drain->cv.wait_until(lock, until, [&]() { return stragglers->drain->done; });
+    }
+
+    if(finished && (stragglers->flusher == nullptr || stragglers->flusher->stop(until)))
+    {
+        stragglers->drain_thread.join();
+        return;
+    }
+
+    std::cerr << "xlog: records were still being written at exit, exiting without waiting for them" << std::endl;
+    std::_Exit(EXIT_FAILURE);
+}
+
+XLog::ShutdownReport XLog::ShutownLogging(int signal)
+{
+    std::scoped_lock shutdown_lock(SHUTDOWN_MUTEX);
+    if(SHUTDOWN_REPORT)
+    {
+        return *SHUTDOWN_REPORT;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::chrono::milliseconds deadline(LOGGER_SETTINGS.s_shutdown.deadline_ms);
+
 #ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    // First, so nothing can reach into what's being torn down below
     if(LOGGER_SETTINGS.s_external_control.enabled)
     {
         if(ServerPointer)
@@ -264,20 +667,275 @@ void XLog::ShutownLogging(int signal)
         TRY_SHUTDOWN_THIS_PROGRAM_SOCKET();
     }
 #endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    if(signal >= 0)
+    {
+        INTERNAL() << "Shutting down logging on signal " << signal << " (" << strsignal(signal) << ")";
+    }
+
+    // Nothing should be shed while we're shutting down, and a crash from here on only writes its report
+    OVERLOAD_CONTROLLER.reset();
+    xlog_crash_shutdown();
+
+    // Before the flush, so a failure to write it (and the last summaries) are still logged
+    xlog_trace_shutdown(LOGGER_SETTINGS.s_trace);
+    METRIC_REPORTER.reset();
+
+    // From here, only records still queued for async dispatch count as flushed (each once, however many sinks take it)
+    const uint64_t dispatched_before = ASYNC_DISPATCHER ? ASYNC_DISPATCHER->dispatched() : 0;
+    const uint64_t dropped_before = sink_dropped();
+
+    /*
+     * The drain runs on a thread of its own so a stuck sink can't hold us past the deadline, if it
+     * doesn't finish in time it's waited on again at exit (see wait_for_shutdown_stragglers)
+     */
+    auto drain = std::make_shared<shutdown_drain>();
+    std::thread drain_thread([drain, async = ASYNC_DISPATCHER, backend = DISPATCH_BACKEND_PTR]()
+    {
+        // Records still queued are written first, anything logged from now on is written by its own thread
+        if(async)
+        {
+            async->stop();
+        }
+
+        // Anything still buffered (i.e. a partly filled compressed block) goes out now
+        if(backend)
+        {
+            backend->flush();
+        }
+
+        std::scoped_lock lock(drain->mutex);
+        drain->done = true;
+        drain->cv.notify_all();
+    });
+
+    bool completed = true;
+    {
+        std::unique_lock lock(drain->mutex);
+        if(deadline.count() == 0)
+        {
+            drain->cv.wait(lock, [&]() { return drain->done; });
+        }
+        else
+        {
+            completed = drain->cv.wait_until(lock, start + deadline, [&]() { return drain->done; });
+        }
+    }
+
+    ShutdownReport report
+    {
+        .completed = completed,
+        .flushed = ASYNC_DISPATCHER ? ASYNC_DISPATCHER->dispatched() - dispatched_before : 0,
+        .dropped = (sink_dropped() - dropped_before) + (completed || !ASYNC_DISPATCHER ? 0 : ASYNC_DISPATCHER->pending()),
+        .elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start)
+    };
+
+    // Anyone still waiting on a flush is let go, later requests are completed by whoever makes them
+    // (the flush thread could be stuck behind the drain, so it gets no longer than the drain did)
+    xlog_background_flusher* stuck_flusher = nullptr;
+    if(BACKGROUND_FLUSHER && completed)
+    {
+        BACKGROUND_FLUSHER->stop();
+    }
+    else if(BACKGROUND_FLUSHER && !BACKGROUND_FLUSHER->stop(start + deadline))
+    {
+        stuck_flusher = BACKGROUND_FLUSHER.release();
+    }
+
+    if(completed && stuck_flusher == nullptr)
+    {
+        drain_thread.join();
+    }
+    else
+    {
+        SHUTDOWN_STRAGGLERS = new shutdown_stragglers{ drain, std::move(drain_thread), stuck_flusher, deadline };
+    }
+
+    // After the flush, so a sink that trips during it is still reported
+    SINK_WATCHDOG.reset();
+
+    // Logging could be what's stuck, so this goes straight to stderr
+    if(!completed)
+    {
+        std::cerr << "xlog: records were still being written " << report.elapsed.count() << "ms into shutdown, " << report.dropped << " records lost" << std::endl;
+    }
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    xlog_report_overhead(LOGGER_SETTINGS.s_profiler);
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    XLogControl::unlink_shared();
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+    SHUTDOWN_REPORT = report;
+    return report;
+}
+
+void XLog::FlushInBackground(std::function<void()> done, bool sync)
+{
+    if(!BACKGROUND_FLUSHER)
+    {
+        done();
+        return;
+    }
+
+    BACKGROUND_FLUSHER->request(sync, std::move(done));
+}
+
+bool XLog::TryFlushInBackground(std::function<void()> done, bool sync)
+{
+    return BACKGROUND_FLUSHER && BACKGROUND_FLUSHER->try_request(sync, done);
+}
+
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+void XLog::SubmitRecord(LoggerType& logger, Severity sev, std::string_view message, const std::source_location sloc)
+#else
+void XLog::SubmitRecord(LoggerType& logger, Severity sev, std::string_view message)
+#endif
+{
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+    set_record_source_location(sloc);
+#endif
+
+    boost::log::record rec = logger.open_record(boost::log::keywords::severity = sev);
+    if(!rec)
+    {
+        return;
+    }
+
+    rec.attribute_values().insert("Message", boost::log::attributes::make_attribute_value(std::string(message)));
+
+    // With async dispatch it's queued like any other record, and without a flush thread there's nowhere else for it to go
+    if(ASYNC_DISPATCHER || !BACKGROUND_FLUSHER || !DISPATCH_FRONTEND_PTR)
+    {
+        boost::log::core::get()->push_record(boost::move(rec));
+        return;
+    }
+
+    // The core only detaches the values for cross-thread sinks, and this is about to be written by another thread
+    for(const auto& [name, value] : rec.attribute_values())
+    {
+        const_cast<boost::log::attribute_value&>(value).detach_from_thread();
+    }
+
+    const boost::log::record_view view = rec.lock();
+    if(!BACKGROUND_FLUSHER->write(view))
+    {
+        DISPATCH_FRONTEND_PTR->consume(view);
+    }
+}
+
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+void XLog::LogBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count, const std::source_location sloc)
+{
+    if(logger.accepts(sev))
+    {
+        LogAcceptedBatch(logger, sev, messages, count, sloc);
+    }
+}
+#else
+void XLog::LogBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count)
+{
+    if(logger.accepts(sev))
+    {
+        LogAcceptedBatch(logger, sev, messages, count);
+    }
+}
+#endif
+
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+void XLog::LogAcceptedBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count, const std::source_location sloc)
+#else
+void XLog::LogAcceptedBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count)
+#endif
+{
+    if(count == 0)
+    {
+        return;
+    }
+
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+    set_record_source_location(sloc);
+#endif
+
+    const boost::shared_ptr<xlog_dispatch_frontend> frontend = DISPATCH_FRONTEND_PTR;
+    if(!frontend)
+    {
+        // Not initialised, so there's only Boost's default sink to go through the core to
+        auto core = boost::log::core::get();
+        for(size_t i = 0; i < count; i++)
+        {
+            boost::log::record rec = logger.open_record(boost::log::keywords::severity = sev);
+            if(rec)
+            {
+                rec.attribute_values().insert("Message", boost::log::attributes::make_attribute_value(std::string(messages[i])));
+                core->push_record(boost::move(rec));
+            }
+        }
+        return;
+    }
+
+    // Whatever happens, the frontend has to stop collecting this thread's records
+    struct batch_scope
+    {
+        explicit batch_scope(xlog_dispatch_frontend& frontend) :
+            frontend(frontend)
+        {
+            frontend.begin_batch();
+        }
+
+        ~batch_scope()
+        {
+            frontend.end_batch();
+        }
+
+        xlog_dispatch_frontend& frontend;
+    } scope(*frontend);
+
+    // The only record opened through the logger (and filtered), the frontend takes the rest without asking again
+    boost::log::record first = logger.open_record(boost::log::keywords::severity = sev);
+    if(!first || !frontend->batch_accepted())
+    {
+        return;
+    }
+
+    // Less the ones that belong to each record, which the core adds again for every record it opens
+    boost::log::attribute_value_set values;
+    for(const auto& [name, value] : first.attribute_values())
+    {
+        if(name != "TimeStamp" && name != "LineID" && name != XLogClock::RAW_TIMESTAMP_ATTRIBUTE_NAME)
+        {
+            values.insert(name, value);
+        }
+    }
+
+    // Handed straight to the frontend, there's nothing for core::push_record() to route
+    auto core = boost::log::core::get();
+    for(size_t i = 0; i < count; i++)
+    {
+        boost::log::record rec = i == 0 ? std::move(first) : core->open_record(values);
+        if(!rec)
+        {
+            continue;
+        }
+
+        rec.attribute_values().insert("Message", boost::log::attributes::make_attribute_value(std::string(messages[i])));
+        frontend->consume(rec.lock());
+    }
 }
 
 void XLog::SetGlobalLoggingLevel(XLog::Severity sev)
 {
     GET_LOGGER_MAP(all_loggers)
-    _DefaultSeverity.store(sev);
-    min_severity_filter& filter = get_sev_filter();
+    XLogControl::block().default_level.store(static_cast<uint32_t>(sev), std::memory_order_relaxed);
 
     for(const auto& [key, value] : all_loggers)
     {
-        filter[key] = sev;
+        value.level->load(std::memory_order_acquire)->store(static_cast<uint32_t>(sev), std::memory_order_relaxed);
     }
 
-    boost::log::core::get()->set_filter(filter);
+    XLogControl::changed();
 }
 
 bool XLog::SetLoggingLevel(XLog::Severity sev, const std::string_view channel)
@@ -291,11 +949,8 @@ bool XLog::SetLoggingLevel(XLog::Severity sev, const std::string_view channel)
 
     if(found != all_loggers.end())
     {
-        found->second.severity = sev;
-
-        min_severity_filter& filter = get_sev_filter();
-        filter[std::string(channel)] = sev;
-        boost::log::core::get()->set_filter(filter);
+        found->second.level->load(std::memory_order_acquire)->store(static_cast<uint32_t>(sev), std::memory_order_relaxed);
+        XLogControl::changed();
 
         return true;
     }
@@ -305,9 +960,58 @@ bool XLog::SetLoggingLevel(XLog::Severity sev, const std::string_view channel)
     }
 }
 
+std::vector<XLog::SinkInformation> XLog::GetAllSinks()
+{
+    std::vector<SinkInformation> rValue;
+    if(DISPATCH_BACKEND_PTR)
+    {
+        for(const auto& sink : DISPATCH_BACKEND_PTR->get_sinks())
+        {
+            rValue.push_back(sink->information());
+        }
+    }
+
+    return rValue;
+}
+
+bool XLog::SetSinkEnabled(const std::string_view sink, bool enabled)
+{
+    auto found = DISPATCH_BACKEND_PTR ? DISPATCH_BACKEND_PTR->find_sink(sink) : nullptr;
+    if(!found)
+    {
+        return false;
+    }
+
+    found->enabled = enabled;
+    INTERNAL() << "Sink '" << sink << "' " << (enabled ? "enabled" : "disabled");
+    return true;
+}
+
+bool XLog::SetSinkLevel(const std::string_view sink, XLog::Severity sev)
+{
+    auto found = DISPATCH_BACKEND_PTR ? DISPATCH_BACKEND_PTR->find_sink(sink) : nullptr;
+    if(!found)
+    {
+        return false;
+    }
+
+    found->level = sev;
+    return true;
+}
+
+XLog::OverloadState XLog::GetOverloadState()
+{
+    if(OVERLOAD_CONTROLLER)
+    {
+        return OVERLOAD_CONTROLLER->state();
+    }
+
+    return OverloadState{ .shedding = false, .level = Severity::INFO, .step = 0, .transitions = 0 };
+}
+
 XLog::Severity XLog::GetGlobalLoggingLevel()
 {
-    return _DefaultSeverity;
+    return static_cast<Severity>(XLogControl::block().default_level.load(std::memory_order_relaxed));
 }
 
 XLog::Severity XLog::GetLoggingLevel(const std::string_view channel)
@@ -322,11 +1026,11 @@ XLog::Severity XLog::GetLoggingLevel(const std::string_view channel)
 
     if(found == all_loggers.end())
     {
-        return _DefaultSeverity;
+        return static_cast<Severity>(XLogControl::block().default_level.load(std::memory_order_relaxed));
     }
     else
     {
-        return found->second.severity;
+        return static_cast<Severity>(found->second.level->load(std::memory_order_acquire)->load(std::memory_order_relaxed));
     }
 }
 
@@ -337,7 +1041,7 @@ std::unordered_map<std::string, XLog::Severity> XLog::GetAllLoggingLevels()
     std::unordered_map<std::string, XLog::Severity> rValue;
     for(const auto& [key, value] : all_loggers)
     {
-        rValue[key] = value.severity;
+        rValue[key] = static_cast<Severity>(value.level->load(std::memory_order_acquire)->load(std::memory_order_relaxed));
     }
 
     return rValue;
@@ -370,6 +1074,9 @@ XLog::fatal_exception::fatal_exception(XLog::LoggerType& logger, const char* wha
 void XLog::fatal_exception::print_fatal(XLog::LoggerType& logger, const std::source_location sloc) const
 {
     CUSTOM_LOG_SEV_SLOC(logger, XLog::Severity::FATAL, sloc) << what();
+
+    // Nothing says the exception will be caught (and std::terminate doesn't run atexit), so the record is written out now
+    flush_within(std::chrono::milliseconds(LOGGER_SETTINGS.s_shutdown.deadline_ms));
 }
 #else
 XLog::fatal_exception::fatal_exception(XLog::LoggerType& logger, const std::string& what_arg) : std::runtime_error(what_arg)
@@ -385,6 +1092,9 @@ XLog::fatal_exception::fatal_exception(XLog::LoggerType& logger, const char* wha
 void XLog::fatal_exception::print_fatal(XLog::LoggerType& logger) const
 {
     CUSTOM_LOG_SEV(logger, XLog::Severity::FATAL) << what();
+
+    // Nothing says the exception will be caught (and std::terminate doesn't run atexit), so the record is written out now
+    flush_within(std::chrono::milliseconds(LOGGER_SETTINGS.s_shutdown.deadline_ms));
 }
 #endif
 
@@ -392,39 +1102,137 @@ void XLog::fatal_exception::print_fatal(XLog::LoggerType& logger) const
 
 #include <filesystem>
 
+#include "xlog_escape.noexport.h"
+
 std::string get_file_name(const std::string_view path)
 {
     return std::filesystem::path(path).filename();
 }
 
+// The '2' severities (and INFO) never print their source location
+static bool severity_has_source_location(XLog::Severity sev)
+{
+    return sev != XLog::Severity::INFO &&
+           sev != XLog::Severity::DEBUG2 &&
+           sev != XLog::Severity::WARNING2 &&
+           sev != XLog::Severity::ERROR2;
+}
+
 void XLogFormatters::default_formatter(const boost::log::record_view& rec, boost::log::formatting_ostream& stream)
 {
-    auto timestamp = boost::log::extract<boost::posix_time::ptime>("TimeStamp", rec);
+    const auto timestamp = XLog::GetRecordTime(rec);
     auto severity = boost::log::extract<XLog::Severity>("Severity", rec);
     auto channel = boost::log::extract<std::string>("Channel", rec);
     auto message = boost::log::extract<std::string>("Message", rec);
 
-    stream  << boost::posix_time::to_simple_string(timestamp.get()) << ' '
+    stream  << boost::posix_time::to_simple_string(timestamp) << ' '
             << '<' << XLog::GetSeverityString(severity.get()) << "> "
             << '[' << channel.get() << "] - ";
 
-#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
-    if(severity != XLog::Severity::INFO &&
-       severity != XLog::Severity::DEBUG2 &&
-       severity != XLog::Severity::WARNING2 &&
-       severity != XLog::Severity::ERROR2)
+    if(severity_has_source_location(severity.get()))
     {
-        auto slc = boost::log::extract<std::source_location>("SourceLocation", rec);
-        if(slc.empty())
+        xlog_source_location source_loc;
+        if(get_record_source_location(rec, source_loc))
         {
-            stream << "[Error: Could not retrieve source line] - ";
+            stream << "[" << source_loc.function << ", " << get_file_name(source_loc.file) << ':' << source_loc.line << "] - ";
         }
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
         else
         {
-            auto source_loc = slc.get();
-            stream << "[" << source_loc.function_name() << ", " << get_file_name(source_loc.file_name()) << ':' << source_loc.line() << "] - ";
+            stream << "[Error: Could not retrieve source line] - ";
         }
-    }
 #endif
+    }
+
+    const XLog::InstanceAttributes* instance = XLog::GetRecordInstance(rec);
+    const XLog::ContextSnapshot* context = XLog::GetRecordContext(rec);
+    const size_t context_size = context != nullptr ? context->size() : 0;
+    if(instance != nullptr || context_size != 0)
+    {
+        stream << '{';
+        if(instance != nullptr)
+        {
+            stream << instance->text();
+        }
+        for(size_t i = 0; i < context_size; i++)
+        {
+            if(i != 0 || instance != nullptr)
+            {
+                stream << ", ";
+            }
+            stream << (*context)[i].key() << '=' << (*context)[i].value();
+        }
+        stream << "} - ";
+    }
+
     stream << message.get();
 }
+
+void XLogFormatters::json_formatter(const boost::log::record_view& rec, boost::log::formatting_ostream& stream)
+{
+    const auto timestamp = XLog::GetRecordTime(rec);
+    auto severity = boost::log::extract<XLog::Severity>("Severity", rec);
+    auto channel = boost::log::extract<std::string>("Channel", rec);
+    auto message = boost::log::extract<std::string>("Message", rec);
+
+    // Reused between records, so once it has grown escaping doesn't allocate
+    thread_local std::string buffer;
+    buffer.clear();
+
+    buffer += "{\"timestamp\":\"";
+    buffer += boost::posix_time::to_iso_extended_string(timestamp);
+    buffer += "\",\"severity\":\"";
+    buffer += XLog::GetSeverityString(severity.get());
+    buffer += "\",\"channel\":\"";
+    XLogEscape::json_escape(channel.get(), buffer);
+    buffer += '"';
+
+    xlog_source_location source_loc;
+    if(severity_has_source_location(severity.get()) && get_record_source_location(rec, source_loc))
+    {
+        buffer += ",\"function\":\"";
+        XLogEscape::json_escape(source_loc.function, buffer);
+        buffer += "\",\"file\":\"";
+        XLogEscape::json_escape(get_file_name(source_loc.file), buffer);
+        buffer += "\",\"line\":";
+        buffer += std::to_string(source_loc.line);
+    }
+
+    const XLog::InstanceAttributes* instance = XLog::GetRecordInstance(rec);
+    if(instance != nullptr)
+    {
+        buffer += instance->json();
+    }
+
+    const XLog::ContextSnapshot* context = XLog::GetRecordContext(rec);
+    if(context != nullptr && !context->empty())
+    {
+        buffer += ",\"context\":{";
+        for(size_t i = 0; i < context->size(); i++)
+        {
+            if(i != 0)
+            {
+                buffer += ',';
+            }
+            buffer += '"';
+            XLogEscape::json_escape((*context)[i].key(), buffer);
+            buffer += "\":\"";
+            XLogEscape::json_escape((*context)[i].value(), buffer);
+            buffer += '"';
+        }
+        buffer += '}';
+    }
+
+    // Most messages end with std::endl, which is just noise inside a JSON string
+    std::string_view msg = message.get();
+    while(!msg.empty() && msg.back() == '\n')
+    {
+        msg.remove_suffix(1);
+    }
+
+    buffer += ",\"message\":\"";
+    XLogEscape::json_escape(msg, buffer);
+    buffer += "\"}";
+
+    stream << buffer;
+}
@@ -6,12 +6,23 @@
 #include <errno.h>
 #include <string.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
 #include <stdexcept>
 #include <string_view>
 #include <type_traits>
 
 #include <boost/log/trivial.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/log/utility/manipulators/add_value.hpp>
 #include <boost/log/sources/severity_channel_logger.hpp>
 
@@ -26,143 +37,1503 @@
 #endif
 #endif
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define XLOG_HAVE_COROUTINES
+#include <coroutine>
+#endif
+
+namespace XLog
+{
+    /*
+     * Why are there DEBUGS, WARNS, and ERRORS where we don't care about source location?
+     *
+     * Well sometimes a log is VERY unique so we don't need it since it's
+     * clear where to look for it!
+     *
+     * While I do sometimes find source location annoying, I recognize that a blanket
+     * option for ON/OFF isn't really suitable, so having multiple macros that
+     * allow you to conditionally apply that is useful in my opinion.
+     *
+     * Of course if you aren't using C++ 20 then it means nothing, but perhaps it can
+     * be argued that using the correct macros makes the eventual transition easier?
+     *
+     * I doubt I'll ever allow FATAL to not have a source location, they should be fairly rare
+     * outside of very specific situations where the error basically stops the program from
+     * executing, so even though that satisfies the "uniqueness" criteria I mentioned before,
+     * I still think source location is 'correct' (whatever that means...)
+     *
+     */
+    enum class Severity
+    {
+        INFO = 0,
+        DEBUG,
+        DEBUG2, // For debugs where we don't really need to know the source location (if enabled)
+        WARNING,
+        WARNING2, // For warnings where we don't really need to know the source location (if enabled)
+        ERROR,
+        ERROR2, // For errors where we don't really need to know the source location (if enabled)
+        FATAL,
+        INTERNAL // For xlog itself, can never be disabled (knowing why your logger failed is *really* important)
+    };
+}
+
+namespace XLog
+{
+    // Keeps a slow or stuck sink from holding up the application (see xlog_guard.noexport.h)
+    struct SinkBreakerSettings
+    {
+        // Write the sink's records from a thread of its own, and trip the sink when it misbehaves?
+        bool enabled = false;
+
+        // A record taking longer than this to write is a strike, as is one the sink fails to write
+        unsigned int budget_ms = 20;
+
+        // Strikes in a row before the sink is tripped (a sink stuck on one record for longer than the budget is tripped straight away)
+        unsigned int max_strikes = 3;
+
+        // A tripped sink is left alone for this long, then the next record is sent to it to see if it's working again
+        unsigned int retry_ms = 10000;
+
+        // Records waiting for the sink's thread, any more are treated as if the sink was tripped
+        size_t max_queued = 4096;
+
+        // Sink that gets the records while this one is tripped ("console", "file", ...), empty drops them
+        std::string fallback = "";
+    };
+}
+
 #ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
 
-namespace XLog
-{
-    struct ExternalLogControlSettings
+namespace XLog
+{
+    struct ExternalLogControlSettings
+    {
+        // Is external log control enabled at runtime?
+        bool enabled = true;
+
+        // Is the log socket modified so that anyone can connect to it?
+        bool allow_anyone_access = true;
+
+        // Is failure to setup the log socket fatal to the application?
+        bool setup_failure_is_fatal = false;
+    };
+}
+
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+namespace XLog
+{
+    struct SharedMemoryControlSettings
+    {
+        // Are channel levels published in /tmp/xlog so xlog-manager can change them without RPCs?
+        bool enabled = true;
+
+        // Is the control file modified so that anyone can change our levels?
+        bool allow_anyone_access = true;
+    };
+}
+
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+#ifdef XLOG_USE_SYSLOG_LOG
+
+#include <boost/log/sinks/syslog_constants.hpp>
+
+namespace XLog
+{
+    struct SyslogSettings
+    {
+        // Is syslog logging enabled at runtime?
+        bool enabled = true;
+
+        // Syslog facility
+        boost::log::sinks::syslog::facility facility = boost::log::sinks::syslog::facility::user;
+
+        // Minimum severity sent to syslog (applied on top of the channel levels, can be changed at runtime)
+        Severity level = Severity::INFO;
+
+        // A stalled syslog socket shouldn't hold up the application, so this is on by default
+        SinkBreakerSettings breaker{ .enabled = true };
+    };
+}
+
+#endif // XLOG_USE_SYSLOG_LOG
+
+#ifdef XLOG_USE_JOURNAL_LOG
+
+namespace XLog
+{
+    struct JournalSettings
+    {
+        // Is journal logging enabled at runtime?
+        bool enabled = true;
+
+        // Minimum severity sent to the journal (applied on top of the channel levels, can be changed at runtime)
+        Severity level = Severity::INFO;
+
+        // Neither should a stalled journald
+        SinkBreakerSettings breaker{ .enabled = true };
+    };
+}
+
+#endif // XLOG_USE_JOURNAL_LOG
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_LOG
+
+namespace XLog
+{
+    struct SharedMemorySettings
+    {
+        // Hand every record to xlog-collector through a shared-memory ring instead of writing it from this process?
+        // When enabled the file, syslog, and journal sinks aren't created, and the console starts disabled
+        bool enabled = false;
+
+        // Size of the ring in bytes (rounded up to a power of two), records are dropped while it is full
+        size_t ring_size = 4 * 1024 * 1024;
+
+        // Is the ring file modified so that a collector running as anyone can drain it?
+        bool allow_anyone_access = true;
+    };
+}
+
+#endif // XLOG_ENABLE_SHARED_MEMORY_LOG
+
+namespace XLog
+{
+    struct ConsoleSettings
+    {
+        // Is console (std::clog) logging enabled?
+        bool enabled = true;
+
+        // Minimum severity sent to the console (applied on top of the channel levels, can be changed at runtime)
+        Severity level = Severity::INFO;
+
+        SinkBreakerSettings breaker{};
+    };
+
+    struct FileSettings
+    {
+        // Is file logging enabled?
+        bool enabled = false;
+
+        // File to append to
+        std::string path;
+
+        // Flush after every record, otherwise only when a buffer fills up, after 'flush_interval_ms' (or on shutdown)
+        bool auto_flush = false;
+
+        // Records are collected into 'buffer_count' buffers of 'buffer_size' bytes, which a writer thread writes out in batches
+        size_t buffer_size = 256 * 1024;
+        size_t buffer_count = 4;
+
+        // A buffer that hasn't filled up is written out after this long
+        unsigned int flush_interval_ms = 1000;
+
+        // fdatasync() the file after a batch at most this often (0 = never)
+        unsigned int sync_interval_ms = 0;
+
+        // Write through io_uring (with registered buffers) when the kernel allows it, otherwise writev()
+        bool use_io_uring = true;
+
+        // Keep an index of the file (<path>.idx) for xlog-query, with an entry about every 'index_interval' bytes
+        bool index = false;
+        size_t index_interval = 256 * 1024;
+
+        // Minimum severity sent to the file (applied on top of the channel levels, can be changed at runtime)
+        Severity level = Severity::INFO;
+
+        SinkBreakerSettings breaker{};
+    };
+
+    struct ChannelFileRoute
+    {
+        // Channel name, or a prefix ending in '*' (i.e. "Net*"), exact names win over prefixes and longer prefixes over shorter ones
+        std::string channel;
+
+        // File the channel's records are appended to, relative to ChannelFilesSettings::directory
+        std::string file;
+    };
+
+    struct ChannelFilesSettings
+    {
+        // Is per-channel file logging enabled?
+        bool enabled = false;
+
+        // Where relative file names go
+        std::string directory = ".";
+
+        std::vector<ChannelFileRoute> routes;
+
+        // Channels without a route get their own '<channel>.log', otherwise they aren't written to any channel file (counted in SinkInformation::unrouted)
+        bool file_per_channel = false;
+
+        // Most files kept open at once, the least recently written is closed to make room
+        size_t max_open_files = 64;
+
+        // Bytes buffered for a file before it's handed to the writer thread
+        size_t buffer_size = 64 * 1024;
+
+        // Records are dropped while this much (across all files) is waiting to be written
+        size_t max_buffered = 16 * 1024 * 1024;
+
+        // Buffers that haven't filled up are written after this long
+        unsigned int flush_interval_ms = 1000;
+
+        // Minimum severity sent to the channel files (applied on top of the channel levels, can be changed at runtime)
+        Severity level = Severity::INFO;
+    };
+
+    struct OverloadSettings
+    {
+        // Watch the sinks & shed records while they can't keep up? (records are never shed otherwise)
+        bool enabled = false;
+
+        // How often the sinks are checked
+        unsigned int check_interval_ms = 250;
+
+        /*
+         * Logging is overloaded when a sink's queue is more than 'high_backlog' full, a sink has taken
+         * longer than 'max_consume_us' per record on average since the last check, or a sink has dropped
+         * anything. It's calm again once every queue is under 'low_backlog', records take less than half
+         * of 'max_consume_us', and nothing is being dropped.
+         */
+        double high_backlog = 0.75;
+        double low_backlog = 0.25;
+        unsigned int max_consume_us = 100;
+
+        // Every check that finds logging overloaded steps up to the next level, records below the
+        // current level are dropped before they're even created, whatever their channel's level is
+        std::vector<Severity> shed_levels = { Severity::DEBUG, Severity::WARNING };
+
+        // How long logging has to stay calm before stepping back down a level
+        unsigned int recovery_ms = 5000;
+    };
+
+    struct AsyncSettings
+    {
+        // Format & write records on a background thread, rather than on the thread that logged them?
+        bool enabled = false;
+
+        // Every thread gets a queue of its own (merged in timestamp order), otherwise they all share one behind a lock
+        bool per_thread_queues = true;
+
+        // Records each queue holds (rounded up to a power of two), a thread whose queue is full writes out everything queued
+        // (in order) before queuing its record
+        size_t queue_capacity = 8192;
+
+        // How long a record is held back in case an older one from another thread is still on its way
+        unsigned int merge_window_us = 100;
+    };
+
+    struct ShutdownSettings
+    {
+        // How long ShutownLogging (and a FATAL record) waits for queued & buffered records to be written (0 = as long as it takes)
+        unsigned int deadline_ms = 3000;
+    };
+
+    struct CrashSettings
+    {
+        // Handle SIGSEGV, SIGBUS, SIGABRT and SIGFPE by writing a crash report (return addresses & the modules they're in)?
+        bool enabled = false;
+
+        // File the report is appended to ("%p" is replaced with the PID), it's only written to stderr if empty
+        std::string path;
+        bool write_stderr = true;
+
+        // Once the report is written, also try to write out whatever the sinks still have queued or buffered. That isn't
+        // async-signal-safe (it can deadlock if the crash was inside a sink), so it's cut short by alarm() after 'flush_deadline_s'
+        bool flush_sinks = false;
+        unsigned int flush_deadline_s = 2;
+    };
+
+    struct TraceSettings
+    {
+        // Record LOG_SCOPE_TIMER scopes? (they're just skipped otherwise)
+        bool enabled = false;
+
+        // Chrome trace (JSON) written when ShutownLogging is called, nothing is written if empty ("%p" is replaced with the PID).
+        // Traces asked for over gRPC are only ever written to new files in this path's directory, and not at all if it's empty
+        std::string path;
+
+        // Scopes kept per thread, a ring of the newest ones (every scope takes 32 bytes, so 2 MiB per thread)
+        size_t max_events_per_thread = 64 * 1024;
+    };
+
+    struct MetricSettings
+    {
+        // Aggregate LOG_COUNTER & LOG_HISTOGRAM? (they're just skipped otherwise)
+        bool enabled = false;
+
+        // How often every metric that changed is summarized as a record on its channel (0 = only at ShutownLogging)
+        unsigned int interval_ms = 10000;
+
+        // Severity of the summary records, they're written if the metric's channel lets it through
+        Severity level = Severity::INFO;
+    };
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    struct ProfilerSettings
+    {
+        // Write a report of where the time spent logging went when ShutownLogging is called?
+        bool report_on_shutdown = true;
+
+        // File the report is appended to, stderr if empty
+        std::string report_path;
+
+        // How many of the most expensive call sites the report lists (every channel is always listed)
+        size_t top_sites = 20;
+    };
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+
+    struct OverloadState
+    {
+        bool shedding;        // Is anything being shed right now?
+        Severity level;       // Records below this are being shed (INFO when nothing is)
+        size_t step;          // How far into OverloadSettings::shed_levels we are, 0 when nothing is shed
+        uint64_t transitions; // How many times the level has changed
+    };
+
+    struct MemoryBudgetSettings
+    {
+        /*
+         * Most bytes xlog's own record buffers (formatted text, compressed blocks, trace buffers) may
+         * hold at once, 0 for no limit. While over budget records below 'keep_level' are dropped
+         * (before they're created where possible), and spare buffers are freed rather than kept.
+         * Everything goes back to normal once usage is under 'resume_ratio' of the budget.
+         */
+        size_t max_bytes = 0;
+        Severity keep_level = Severity::ERROR;
+        double resume_ratio = 0.8;
+
+        // Formatted text buffers each thread keeps for reuse (per formatter), and the largest one that's kept
+        size_t pooled_buffers_per_thread = 8;
+        size_t max_pooled_buffer_size = 64 * 1024;
+    };
+
+    struct MemoryState
+    {
+        uint64_t max_bytes;   // 0 if there's no budget
+        uint64_t used_bytes;
+        uint64_t peak_bytes;
+        uint64_t allocations; // Buffers that had to be allocated because there wasn't a free one
+        bool over_budget;     // Are records below 'keep_level' being dropped right now?
+        Severity keep_level;
+        uint64_t shed;        // Records dropped on their way to the sinks while over budget
+        uint64_t transitions; // How many times the budget has been exceeded
+    };
+
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+    struct CompressedFileSettings
+    {
+        // Is compressed (block) file logging enabled?
+        bool enabled = false;
+
+        // File to append blocks to (conventionally *.xlz), 'zstdcat' turns it back into plain text
+        std::string path;
+
+        // Uncompressed bytes per block, bigger blocks compress better but can't be skipped as precisely
+        size_t block_size = 1024 * 1024;
+
+        // zstd compression level
+        int compression_level = 3;
+
+        // Threads compressing & writing blocks
+        size_t workers = 2;
+
+        // Blocks waiting to be compressed or written before records are dropped instead
+        size_t max_pending_blocks = 16;
+
+        // A block that hasn't filled up after this long is written anyway
+        unsigned int flush_interval_ms = 5000;
+
+        // Add every block to the file's index (<path>.idx) for xlog-query
+        bool index = true;
+
+        // Minimum severity sent to the file (applied on top of the channel levels, can be changed at runtime)
+        Severity level = Severity::INFO;
+    };
+#endif // XLOG_ENABLE_COMPRESSED_FILE_LOG
+
+    // How text-based sinks (console, file, syslog) render each record
+    enum class OutputFormat
+    {
+        TEXT, // XLogFormatters::default_formatter
+        JSON  // XLogFormatters::json_formatter, one JSON object per line
+    };
+
+    // Where record timestamps come from
+    enum class TimestampSource
+    {
+        WALL_CLOCK, // Local wall-clock time read for every record (Boost's local_clock)
+        MONOTONIC,  // CLOCK_MONOTONIC read for every record, converted to wall-clock time when formatted
+        TSC         // Raw CPU timestamp counter, converted when formatted (falls back to MONOTONIC if the TSC isn't invariant)
+    };
+
+    // Every member has a default initializer, so designated initializers can leave out any of them (without -Wmissing-field-initializers)
+    struct LogSettings
+    {
+        Severity s_default_level = Severity::INFO;
+        OutputFormat s_format = OutputFormat::TEXT;
+        TimestampSource s_timestamp_source = TimestampSource::WALL_CLOCK;
+
+        // Also attach Boost's LineID, ProcessID, and ThreadID attributes to every record
+        // None of the xlog formatters use them, so only turn this on for custom formatters/sinks that do
+        bool s_common_attributes = false;
+
+        ConsoleSettings s_console{};
+        FileSettings s_file{};
+        ChannelFilesSettings s_channel_files{};
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+        CompressedFileSettings s_compressed_file{};
+#endif // XLOG_ENABLE_COMPRESSED_FILE_LOG
+
+        OverloadSettings s_overload{};
+        AsyncSettings s_async{};
+        ShutdownSettings s_shutdown{};
+        CrashSettings s_crash{};
+        TraceSettings s_trace{};
+        MetricSettings s_metrics{};
+        MemoryBudgetSettings s_memory{};
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+        ProfilerSettings s_profiler{};
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+        ExternalLogControlSettings s_external_control{};
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+        SharedMemoryControlSettings s_shared_memory_control{};
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_USE_SYSLOG_LOG
+        SyslogSettings s_syslog{};
+#endif // XLOG_USE_SYSLOG_LOG
+#ifdef XLOG_USE_JOURNAL_LOG
+        JournalSettings s_journal{};
+#endif // XLOG_USE_JOURNAL_LOG
+#ifdef XLOG_ENABLE_SHARED_MEMORY_LOG
+        SharedMemorySettings s_shared_memory{};
+#endif // XLOG_ENABLE_SHARED_MEMORY_LOG
+    };
+
+    // Raised while the sinks can't keep up (see OverloadSettings) or xlog is over its memory budget (see MemoryBudgetSettings), INFO (0) otherwise
+    inline std::atomic<uint32_t> OVERLOAD_LEVEL{0};
+
+    /*
+     * Where a channel's level lives, one per channel & never freed, so loggers can hold on to it. It points at the
+     * channel's slot in xlog's control block, and is re-pointed when the block moves into shared memory
+     */
+    typedef std::atomic<std::atomic<uint32_t>*> ChannelLevel;
+
+    /*
+     * A Boost channel logger that also knows the current level of its channel
+     *
+     * The logging macros check accepts() before a record is even opened, so filtered
+     * records cost a few atomic loads rather than a trip through the Boost core. The level
+     * itself lives in xlog's control block (see xlog_control.noexport.h), which is shared
+     * with xlog-manager when the shared-memory control plane is enabled. Loggers only hold
+     * their channel's ChannelLevel, so when the block moves only the channels are re-pointed,
+     * and copies & instance loggers follow without being tracked.
+     */
+    class LoggerType : public boost::log::sources::severity_channel_logger_mt<Severity, std::string>
+    {
+    public:
+        LoggerType() = default;
+
+        // Named parameters (i.e. boost::log::keywords::channel) go straight to the Boost logger
+        template<typename ArgsT>
+        explicit LoggerType(const ArgsT& args) : severity_channel_logger_mt(args)
+        {
+        }
+
+        LoggerType(const LoggerType& other) :
+            severity_channel_logger_mt(static_cast<const severity_channel_logger_mt&>(other)),
+            level(other.level),
+            name(other.name.load(std::memory_order_acquire))
+        {
+        }
+
+        LoggerType(LoggerType&& other) noexcept :
+            severity_channel_logger_mt(std::move(static_cast<severity_channel_logger_mt&>(other))),
+            level(other.level),
+            name(other.name.load(std::memory_order_acquire))
+        {
+        }
+
+        // The channel comes with the rest of the Boost logger, so its level & name do too
+        LoggerType& operator=(const LoggerType& other)
+        {
+            if(this != &other)
+            {
+                severity_channel_logger_mt::operator=(static_cast<const severity_channel_logger_mt&>(other));
+                level = other.level;
+                name.store(other.name.load(std::memory_order_acquire), std::memory_order_release);
+            }
+            return *this;
+        }
+
+        // Boost swaps the two loggers, so 'other' is left with our channel (and level & name)
+        LoggerType& operator=(LoggerType&& other) noexcept
+        {
+            if(this != &other)
+            {
+                severity_channel_logger_mt::operator=(std::move(static_cast<severity_channel_logger_mt&>(other)));
+                std::swap(level, other.level);
+                name.store(other.name.exchange(name.load(std::memory_order_acquire), std::memory_order_acq_rel), std::memory_order_release);
+            }
+            return *this;
+        }
+
+        // The channel's name, kept for the life of the process & shared by every logger of the channel, so it can
+        // be held on to (or compared by address) after the logger is gone; looked up the first time it's needed
+        const std::string& channel_name() const noexcept
+        {
+            const std::string* interned = name.load(std::memory_order_acquire);
+            return interned != nullptr ? *interned : intern_channel_name();
+        }
+
+        bool accepts(Severity sev) const noexcept
+        {
+            if(level == nullptr)
+            {
+                return true;
+            }
+
+            const uint32_t value = static_cast<uint32_t>(sev);
+            return value >= level->load(std::memory_order_acquire)->load(std::memory_order_relaxed) && value >= OVERLOAD_LEVEL.load(std::memory_order_relaxed);
+        }
+
+        // Where this logger's level lives (set before the logger is shared), nullptr lets everything through (i.e. xlog's internal logger)
+        void set_level_slot(const ChannelLevel* slot) noexcept
+        {
+            level = slot;
+        }
+
+    private:
+        const std::string& intern_channel_name() const noexcept;
+
+        const ChannelLevel* level = nullptr;
+        mutable std::atomic<const std::string*> name{nullptr};
+    };
+
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+    enum class CallSiteState : uint32_t
+    {
+        DEFAULT,  // Logs if its channel's level lets it
+        ENABLED,  // Always logs, whatever its channel's level is (overload shedding still applies)
+        DISABLED  // Never logs (unless it's INTERNAL)
+    };
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    // Cheap counter for the overhead profiler (the TSC where there is one), only converted to nanoseconds when reported
+    inline uint64_t ProfileTicks() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    /*
+     * Where the time inside one statement goes, kept per call site
+     *
+     * 'open' is opening the record (attributes & Boost's filtering), 'insert' is everything streamed
+     * into it, and 'push' is the rest, up to the statement returning (formatting & writing for the
+     * synchronous sinks, queueing for the others). The histogram is of whole records, bucket 'i'
+     * counts records that took [2^i, 2^(i+1)) ticks.
+     */
+    struct OverheadCounters
+    {
+        static constexpr size_t BUCKETS = 40;
+
+        std::atomic<uint64_t> records{0};
+        std::atomic<uint64_t> open_ticks{0};
+        std::atomic<uint64_t> insert_ticks{0};
+        std::atomic<uint64_t> push_ticks{0};
+        std::array<std::atomic<uint64_t>, BUCKETS> histogram{};
+
+        void add(uint64_t open, uint64_t insert, uint64_t push) noexcept
+        {
+            const uint64_t total = open + insert + push;
+            const size_t bucket = total == 0 ? 0 : std::min<size_t>(63 - __builtin_clzll(total), BUCKETS - 1);
+
+            records.fetch_add(1, std::memory_order_relaxed);
+            open_ticks.fetch_add(open, std::memory_order_relaxed);
+            insert_ticks.fetch_add(insert, std::memory_order_relaxed);
+            push_ticks.fetch_add(push, std::memory_order_relaxed);
+            histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+
+    /*
+     * A single logging statement, logging to one channel at one severity
+     *
+     * Every CUSTOM_LOG_SEV (and so every LOG_*) creates one the first time it runs with each channel
+     * & severity (see CallSiteStatement) & checks its state before the logger's level, so one statement
+     * can be turned on (or silenced) without touching the rest of its channel. Sites register themselves
+     * with xlog (see xlog_call_sites.cpp), which applies any matching SetCallSiteState() made before the
+     * statement first ran.
+     */
+    class CallSite
+    {
+    public:
+        // 'channel' is the logger's channel_name()
+        CallSite(const char* file, uint32_t line, const char* function, Severity sev, const std::string& channel);
+        ~CallSite();
+
+        CallSite(const CallSite&) = delete;
+        CallSite& operator=(const CallSite&) = delete;
+
+        bool accepts(const LoggerType& logger, Severity sev) const noexcept
+        {
+            switch(static_cast<CallSiteState>(state.load(std::memory_order_relaxed)))
+            {
+                case CallSiteState::ENABLED:
+                    return static_cast<uint32_t>(sev) >= OVERLOAD_LEVEL.load(std::memory_order_relaxed);
+                case CallSiteState::DISABLED:
+                    return sev == Severity::INTERNAL;
+                default:
+                    return logger.accepts(sev);
+            }
+        }
+
+        const char* const file;
+        const uint32_t line;
+        const char* const function;
+        const Severity severity;
+        const std::string& channel;
+
+        std::atomic<uint32_t> state{static_cast<uint32_t>(CallSiteState::DEFAULT)};
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+        OverheadCounters overhead;
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+
+    private:
+        friend class CallSiteStatement;
+
+        // The statement's next site
+        std::atomic<CallSite*> next{nullptr};
+    };
+
+    /*
+     * The call sites of one statement, one for each channel & severity it has logged with, so a
+     * statement that's handed its logger or severity (i.e. a helper function) lists, matches & profiles
+     * each of them on its own. Almost every statement only ever has the one, which is checked first.
+     * Sites are only added (until the statement is destroyed), so they're looked up without a lock.
+     */
+    class CallSiteStatement
+    {
+    public:
+        CallSiteStatement(const char* file, uint32_t line, const char* function) noexcept :
+            file(file),
+            line(line),
+            function(function)
+        {
+        }
+
+        ~CallSiteStatement();
+
+        CallSiteStatement(const CallSiteStatement&) = delete;
+        CallSiteStatement& operator=(const CallSiteStatement&) = delete;
+
+        CallSite& site(const LoggerType& logger, Severity sev)
+        {
+            const std::string& channel = logger.channel_name();
+            for(CallSite* site = sites.load(std::memory_order_acquire); site != nullptr; site = site->next.load(std::memory_order_acquire))
+            {
+                if(&site->channel == &channel && site->severity == sev)
+                {
+                    return *site;
+                }
+            }
+
+            return add_site(channel, sev);
+        }
+
+    private:
+        CallSite& add_site(const std::string& channel, Severity sev);
+
+        const char* const file;
+        const uint32_t line;
+        const char* const function;
+
+        std::mutex mutex;
+        std::atomic<CallSite*> sites{nullptr};
+    };
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    /*
+     * Stands in for Boost's record pump when profiling, so the time between opening the record,
+     * finishing the stream insertion, and pushing it can be taken (see CUSTOM_LOG_SEV)
+     */
+    class ProfiledRecord
+    {
+    public:
+        template<typename OpenFunc>
+        ProfiledRecord(OverheadCounters& counters, LoggerType& logger, OpenFunc&& open) :
+            counters(counters),
+            logger(logger),
+            start(ProfileTicks()),
+            rec(open()),
+            opened(ProfileTicks())
+        {
+            if(rec)
+            {
+                record_stream.attach_record(rec);
+            }
+        }
+
+        ~ProfiledRecord()
+        {
+            if(!rec)
+            {
+                counters.add(opened - start, 0, 0);
+                return;
+            }
+
+            const uint64_t inserted = ProfileTicks();
+
+            // Same as Boost, a record whose insertion threw isn't pushed
+            record_stream.flush();
+            if(std::uncaught_exceptions() <= exceptions)
+            {
+                logger.push_record(std::move(rec));
+            }
+            record_stream.detach_from_record();
+
+            counters.add(opened - start, inserted - opened, ProfileTicks() - inserted);
+        }
+
+        ProfiledRecord(const ProfiledRecord&) = delete;
+        ProfiledRecord& operator=(const ProfiledRecord&) = delete;
+
+        // True the first time only (and only if the record was opened), so the macro's loop runs once
+        bool once() noexcept
+        {
+            const bool first = !done && !!rec;
+            done = true;
+            return first;
+        }
+
+        boost::log::record_ostream& stream() noexcept
+        {
+            return record_stream;
+        }
+
+    private:
+        OverheadCounters& counters;
+        LoggerType& logger;
+        const uint64_t start;
+        boost::log::record rec;
+        const uint64_t opened;
+        boost::log::record_ostream record_stream;
+        const int exceptions = std::uncaught_exceptions();
+        bool done = false;
+    };
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+
+    // Empty fields match anything, 'file', 'function', and 'channel' are globs (i.e. "net_*.cpp")
+    // The file matches on either its full path or its name, the function on its qualified or unqualified name
+    struct CallSiteQuery
+    {
+        std::string file;
+        std::string function;
+        uint32_t line = 0;
+        std::string channel;
+    };
+
+    struct CallSiteInformation
+    {
+        std::string file;
+        uint32_t line;
+        std::string function;
+        std::string channel;
+        Severity severity;
+        CallSiteState state;
+    };
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    struct OverheadInformation
+    {
+        std::string file;
+        uint32_t line;
+        std::string function;
+        std::string channel;
+        Severity severity;
+
+        uint64_t records;   // Records opened by the statement
+        uint64_t open_ns;   // Total time opening them (see OverheadCounters)
+        uint64_t insert_ns; // Total time in their stream insertion
+        uint64_t push_ns;   // Total time pushing them to the sinks
+
+        std::vector<uint64_t> histogram; // Records per bucket of OverheadProfile::bucket_limits_ns
+    };
+
+    struct OverheadProfile
+    {
+        std::vector<uint64_t> bucket_limits_ns; // Upper limit of each histogram bucket
+        std::vector<OverheadInformation> sites; // Statements that have logged anything since the last reset
+    };
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+#endif // XLOG_ENABLE_CALL_SITE_CONTROL
+
+    std::string GetSeverityString(Severity sev) noexcept;
+    LoggerType& GetNamedLogger(const std::string_view channel) noexcept;
+
+    void InitializeLogging(LogSettings settings = {});
+
+    struct ShutdownReport
+    {
+        bool completed;    // Was everything written before the deadline?
+        uint64_t flushed;  // Records still queued for async dispatch that were handed to the sinks (each counted once)
+        uint64_t dropped;  // Records lost while shutting down (dropped by a sink, or still queued at the deadline)
+        std::chrono::milliseconds elapsed;
+    };
+
+    /*
+     * Stops external control, writes out everything still queued or buffered (async dispatch, guarded
+     * sinks, file buffers) within LogSettings::s_shutdown.deadline_ms, then stops xlog's threads.
+     * Also called by atexit(), it's safe to call more than once & from several threads at once (i.e.
+     * a thread waiting on signals, and then atexit), the first call does the work & later ones return
+     * its report. Not for use inside a signal handler itself, 'signal' is the one being handled (if
+     * any), which is logged before everything's written out. Anything still running at the deadline
+     * gets another one at exit, if it's still stuck after that the process ends with std::_Exit().
+     */
+    ShutdownReport ShutownLogging(int signal = -1);
+
+    // Calls 'done' from xlog's flush thread once every record logged before the call has been written by its sinks
+    // (and fdatasync'd, if 'sync'), or straight away if logging isn't running; requests made together share one flush
+    void FlushInBackground(std::function<void()> done, bool sync = false);
+
+    // FlushInBackground(), except it returns false (and 'done' isn't called) if logging isn't running or has been shut down,
+    // so there's nothing to wait for, rather than flushing on the calling thread
+    bool TryFlushInBackground(std::function<void()> done, bool sync = false);
+
+#ifdef XLOG_HAVE_COROUTINES
+    /*
+     * co_await XLog::AsyncFlush() suspends the coroutine until every record logged before it has been
+     * written by its sinks (AsyncFlush(true) until the files have been synced as well), without blocking
+     * the thread it was running on. It's resumed on xlog's flush thread, unless 'resume' is given the
+     * handle to schedule back onto its own executor. If logging isn't running (or has been shut down)
+     * there's nothing to wait for, so the coroutine just carries on without suspending.
+     */
+    class FlushAwaitable
     {
-        // Is external log control enabled at runtime?
-        bool enabled = true;
+    public:
+        FlushAwaitable(bool sync, std::function<void(std::coroutine_handle<>)> resume) :
+            sync(sync),
+            resume(std::move(resume))
+        {
+        }
 
-        // Is the log socket modified so that anyone can connect to it?
-        bool allow_anyone_access = true;
+        bool await_ready() const noexcept { return false; }
 
-        // Is failure to setup the log socket fatal to the application?
-        bool setup_failure_is_fatal = false;
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            // The coroutine (and this awaitable with it) can be gone as soon as the request is made
+            return TryFlushInBackground([handle, resume = std::move(resume)]()
+            {
+                if(resume)
+                {
+                    resume(handle);
+                }
+                else
+                {
+                    handle.resume();
+                }
+            }, sync);
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        bool sync;
+        std::function<void(std::coroutine_handle<>)> resume;
     };
-}
 
-#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    typedef FlushAwaitable FlushResult;
 
-#ifdef XLOG_USE_SYSLOG_LOG
+    inline FlushResult AsyncFlush(bool sync = false, std::function<void(std::coroutine_handle<>)> resume = nullptr)
+    {
+        return FlushAwaitable(sync, std::move(resume));
+    }
+#else
+    // Without coroutines (C++17) the same wait is a future
+    typedef std::future<void> FlushResult;
 
-#include <boost/log/sinks/syslog_constants.hpp>
+    inline FlushResult AsyncFlush(bool sync = false)
+    {
+        auto promise = std::make_shared<std::promise<void>>();
+        FlushResult rValue = promise->get_future();
+        FlushInBackground([promise]() { promise->set_value(); }, sync);
+        return rValue;
+    }
+#endif // XLOG_HAVE_COROUTINES
+
+    void SetGlobalLoggingLevel(Severity sev);
+    bool SetLoggingLevel(Severity sev, const std::string_view channel);
+
+    Severity GetGlobalLoggingLevel();
+    Severity GetLoggingLevel(const std::string_view channel);
+
+    std::unordered_map<std::string, Severity> GetAllLoggingLevels();
+    std::vector<std::string> GetAllLogHandles();
+
+    // A single output ("console", "file", "syslog", "journal", or "shm") & its statistics
+    struct SinkInformation
+    {
+        std::string name;
+        bool enabled;
+        Severity level;
+
+        uint64_t records;    // Records written
+        uint64_t bytes;      // Formatted bytes written
+        uint64_t filtered;   // Records below the sink's level
+        uint64_t dropped;    // Records skipped while the sink was disabled, or lost (i.e. a full shared-memory ring, a compressed block that failed to write, or a tripped sink)
+        uint64_t unrouted;   // Records whose channel isn't routed to any file (per-channel files only), not counted as written
+        uint64_t consume_ns; // Total time spent writing records
+
+        uint64_t trips;      // Times the sink's breaker has tripped (see SinkBreakerSettings)
+        bool tripped;        // Is it tripped right now?
+    };
+
+    std::vector<SinkInformation> GetAllSinks();
+    bool SetSinkEnabled(const std::string_view sink, bool enabled);
+    bool SetSinkLevel(const std::string_view sink, Severity sev);
+
+    OverloadState GetOverloadState();
+    MemoryState GetMemoryState();
+
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+    // Only statements that have run at least once are listed
+    std::vector<CallSiteInformation> GetCallSites(const CallSiteQuery& query = {});
 
+    // Also applies to matching statements that haven't run yet, returns how many of those that have matched
+    // Setting DEFAULT for an empty query puts every statement back to DEFAULT & forgets every earlier call
+    size_t SetCallSiteState(const CallSiteQuery& query, CallSiteState state);
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    OverheadProfile GetOverheadProfile();
+    void ResetOverheadProfile();
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+#endif // XLOG_ENABLE_CALL_SITE_CONTROL
+
+    // Local wall-clock time of a record, whatever the timestamp source is
+    boost::posix_time::ptime GetRecordTime(const boost::log::record_view& rec);
+}
+
+/*
+ * Per-thread context attributes (request IDs, trace IDs, etc)
+ *
+ *  XLog::ScopedContext ctx("req", request_id);
+ *  LOG_INFO() << "Handling request"; // Formatted as "... - {req=1234} - Handling request"
+ *
+ * Each thread has a small fixed-size stack of key/value pairs, pushing & popping
+ * copies into preallocated storage so it never allocates. Records carry a copy of the
+ * stack taken when they're logged (so they can be formatted on any thread, after the
+ * context is gone), which is shared by every record logged until the stack changes
+ * again. Keys or values longer than the limits below are truncated, and pushes beyond
+ * MAX_DEPTH are ignored.
+ *
+ * To carry the context to another thread, take a ContextSnapshot with CaptureContext()
+ * and restore it on the other side with a ScopedContextRestore (or just use BindContext).
+ */
 namespace XLog
 {
-    struct SyslogSettings
+    struct ContextEntry
     {
-        // Is syslog logging enabled at runtime?
-        bool enabled = true;
+        static constexpr size_t MAX_KEY_LENGTH = 32;
+        static constexpr size_t MAX_VALUE_LENGTH = 128;
 
-        // Syslog facility
-        boost::log::sinks::syslog::facility facility = boost::log::sinks::syslog::facility::user;
+        char key_data[MAX_KEY_LENGTH];
+        char value_data[MAX_VALUE_LENGTH];
+        uint8_t key_length = 0;
+        uint8_t value_length = 0;
+
+        std::string_view key() const { return { key_data, key_length }; }
+        std::string_view value() const { return { value_data, value_length }; }
     };
-}
 
-#endif // XLOG_USE_SYSLOG_LOG
+    class ContextStack
+    {
+    public:
+        static constexpr size_t MAX_DEPTH = 16;
 
-#ifdef XLOG_USE_JOURNAL_LOG
+        size_t size() const { return depth; }
+        bool empty() const { return depth == 0; }
+        const ContextEntry& operator[](size_t index) const { return entries[index]; }
+
+        const ContextEntry* begin() const { return entries; }
+        const ContextEntry* end() const { return entries + depth; }
+
+        // Returns false (and pushes nothing) if the stack is full
+        bool push(std::string_view key, std::string_view value) noexcept;
+        void pop() noexcept;
+
+        // Changes every push & pop, so a copy of the stack knows when it's out of date
+        uint64_t generation() const { return changes; }
+
+    private:
+        ContextEntry entries[MAX_DEPTH];
+        size_t depth = 0;
+        uint64_t changes = 0;
+    };
+
+    // Copy of a thread's context, what records carry & what can be moved to another thread
+    typedef std::vector<ContextEntry> ContextSnapshot;
+
+    // The calling thread's context stack
+    ContextStack& GetThreadContext() noexcept;
+
+    // Context of a record as it was when it was logged, or nullptr if it was empty
+    const ContextSnapshot* GetRecordContext(const boost::log::record_view& rec) noexcept;
+
+    class ScopedContext
+    {
+    public:
+        ScopedContext(std::string_view key, std::string_view value) noexcept
+        {
+            pushed = GetThreadContext().push(key, value);
+        }
+
+        ScopedContext(std::string_view key, const char* value) noexcept : ScopedContext(key, std::string_view(value)) {}
+        ScopedContext(std::string_view key, const std::string& value) noexcept : ScopedContext(key, std::string_view(value)) {}
+
+        // Anything fmt can format, written straight into the stack entry
+        template<typename ValueType>
+        ScopedContext(std::string_view key, const ValueType& value) noexcept
+        {
+            char buffer[ContextEntry::MAX_VALUE_LENGTH];
+            auto result = fmt::format_to_n(buffer, sizeof(buffer), "{}", value);
+            pushed = GetThreadContext().push(key, std::string_view(buffer, std::min(result.size, sizeof(buffer))));
+        }
+
+        ~ScopedContext()
+        {
+            if(pushed)
+            {
+                GetThreadContext().pop();
+            }
+        }
+
+        ScopedContext(const ScopedContext&) = delete;
+        ScopedContext& operator=(const ScopedContext&) = delete;
+
+    private:
+        bool pushed = false;
+    };
+
+    ContextSnapshot CaptureContext();
+
+    // Pushes every entry of a snapshot onto this thread's context, pops them again when destroyed
+    class ScopedContextRestore
+    {
+    public:
+        explicit ScopedContextRestore(const ContextSnapshot& snapshot) noexcept;
+        ~ScopedContextRestore();
+
+        ScopedContextRestore(const ScopedContextRestore&) = delete;
+        ScopedContextRestore& operator=(const ScopedContextRestore&) = delete;
+
+    private:
+        size_t pushed = 0;
+    };
+
+    // Wrap a callable so that it runs with the calling thread's current context (i.e. for thread pools)
+    template<typename Func>
+    auto BindContext(Func&& func)
+    {
+        return [snapshot = CaptureContext(), func = std::forward<Func>(func)](auto&&... args) mutable
+        {
+            ScopedContextRestore restore(snapshot);
+            return func(std::forward<decltype(args)>(args)...);
+        };
+    }
+}
 
+/*
+ * Instance loggers
+ *
+ *  GET_LOGGER("Connection")
+ *  ...
+ *  XLog::InstanceLogger logger(__logger, { { "conn", connection_id }, { "peer", peer_address } });
+ *  CUSTOM_LOG_SEV(logger, XLog::Severity::INFO) << "Accepted"; // Formatted as "... [Connection] - {conn=42, peer=10.0.0.7:5123} - Accepted"
+ *
+ * A copy of a channel's logger carrying constant attributes of its own, for objects that live
+ * for a while & log a lot (connections, sessions, shards). The attributes are formatted once, when
+ * the logger is created, for the text & JSON formatters and as journal fields, and its records only
+ * carry a reference to them, so nothing is built per message. Level & call site control still work
+ * per channel, an instance logger is a LoggerType and goes anywhere one does.
+ *
+ * In text they go before the thread's context (in the same braces), in JSON they're an "instance"
+ * object, and the journal gets them as INST_<KEY> fields. The shared-memory transport sends them
+ * ahead of the context, and the collector logs them as context.
+ */
 namespace XLog
 {
-    struct JournalSettings
+    struct InstanceAttribute
     {
-        // Is journal logging enabled at runtime?
-        bool enabled = true;
+        // Anything fmt can format
+        template<typename ValueType>
+        InstanceAttribute(std::string_view key, const ValueType& value) : key(key), value(fmt::format("{}", value))
+        {
+        }
+
+        std::string key;
+        std::string value;
     };
-}
 
-#endif // XLOG_USE_JOURNAL_LOG
+    // An instance logger's attributes, and how they're written out
+    class InstanceAttributes
+    {
+    public:
+        explicit InstanceAttributes(std::vector<InstanceAttribute> attributes);
+
+        const std::vector<InstanceAttribute>& entries() const { return attributes; }
+
+        // "conn=42, peer=10.0.0.7:5123"
+        const std::string& text() const { return text_form; }
+
+        // ,"instance":{"conn":"42","peer":"10.0.0.7:5123"}
+        const std::string& json() const { return json_form; }
+
+        // "INST_CONN=42", "INST_PEER=10.0.0.7:5123" (only filled in with USE_JOURNAL_LOG)
+        const std::vector<std::string>& journal_fields() const { return journal_form; }
+
+    private:
+        std::vector<InstanceAttribute> attributes;
+        std::string text_form;
+        std::string json_form;
+        std::vector<std::string> journal_form;
+    };
+
+    class InstanceLogger : public LoggerType
+    {
+    public:
+        InstanceLogger(const LoggerType& channel, std::vector<InstanceAttribute> attributes);
+
+        const InstanceAttributes& attributes() const { return *instance; }
+
+    private:
+        std::shared_ptr<const InstanceAttributes> instance;
+    };
 
+    // Attributes of the instance logger a record came from, or nullptr if it didn't come from one (or it had none)
+    const InstanceAttributes* GetRecordInstance(const boost::log::record_view& rec) noexcept;
+}
+
+/*
+ * Scope timers
+ *
+ *  void handle_request()
+ *  {
+ *      LOG_SCOPE_TIMER("handle_request");
+ *      ...
+ *  }
+ *
+ * Each timer is gated by its channel's level at its severity (DEBUG unless given), and
+ * while LogSettings::s_trace is enabled appends its begin & end time to a buffer of its thread's
+ * own when the scope ends. WriteTrace() turns every thread's buffer into a Chrome trace (Trace
+ * Event JSON, which Perfetto opens as well), also done by ShutownLogging & over gRPC.
+ *
+ * Names aren't copied, so they have to outlive the trace (i.e. string literals).
+ */
 namespace XLog
 {
-    /*
-     * Why are there DEBUGS, WARNS, and ERRORS where we don't care about source location?
-     *
-     * Well sometimes a log is VERY unique so we don't need it since it's
-     * clear where to look for it!
-     *
-     * While I do sometimes find source location annoying, I recognize that a blanket
-     * option for ON/OFF isn't really suitable, so having multiple macros that
-     * allow you to conditionally apply that is useful in my opinion.
-     *
-     * Of course if you aren't using C++ 20 then it means nothing, but perhaps it can
-     * be argued that using the correct macros makes the eventual transition easier?
-     *
-     * I doubt I'll ever allow FATAL to not have a source location, they should be fairly rare
-     * outside of very specific situations where the error basically stops the program from
-     * executing, so even though that satisfies the "uniqueness" criteria I mentioned before,
-     * I still think source location is 'correct' (whatever that means...)
-     *
-     */
-    enum class Severity
+    // Set while LogSettings::s_trace is enabled
+    inline std::atomic<bool> TRACING{false};
+
+    inline uint64_t TraceClock() noexcept
     {
-        INFO = 0,
-        DEBUG,
-        DEBUG2, // For debugs where we don't really need to know the source location (if enabled)
-        WARNING,
-        WARNING2, // For warnings where we don't really need to know the source location (if enabled)
-        ERROR,
-        ERROR2, // For errors where we don't really need to know the source location (if enabled)
-        FATAL,
-        INTERNAL // For xlog itself, can never be disabled (knowing why your logger failed is *really* important)
-    };
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
 
-    struct LogSettings
+    // Appends a finished scope to the calling thread's buffer
+    void RecordScope(const LoggerType& logger, const char* name, uint64_t begin_ns, uint64_t end_ns) noexcept;
+
+    class ScopeTimer
     {
-        Severity s_default_level = Severity::INFO;
+    public:
+        // Only times the scope if tracing is on & the logger lets 'sev' through (see CUSTOM_SCOPE_TIMER)
+        ScopeTimer(const LoggerType& logger, Severity sev, const char* name) noexcept :
+            logger(TRACING.load(std::memory_order_relaxed) && logger.accepts(sev) ? &logger : nullptr),
+            name(name),
+            begin_ns(this->logger != nullptr ? TraceClock() : 0)
+        {
+        }
 
-#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
-        ExternalLogControlSettings s_external_control;
-#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
-#ifdef XLOG_USE_SYSLOG_LOG
-        SyslogSettings s_syslog;
-#endif // XLOG_USE_SYSLOG_LOG
-#ifdef XLOG_USE_JOURNAL_LOG
-        JournalSettings s_journal;
-#endif // XLOG_USE_JOURNAL_LOG
+        ~ScopeTimer()
+        {
+            if(logger != nullptr)
+            {
+                RecordScope(*logger, name, begin_ns, TraceClock());
+            }
+        }
+
+        ScopeTimer(const ScopeTimer&) = delete;
+        ScopeTimer& operator=(const ScopeTimer&) = delete;
+
+    private:
+        const LoggerType* const logger;
+        const char* const name;
+        const uint64_t begin_ns;
     };
 
-    typedef boost::log::sources::severity_channel_logger_mt<Severity, std::string> LoggerType;
+    struct TraceResult
+    {
+        bool written;     // Could the file be written?
+        uint64_t events;  // Scopes written
+        uint64_t dropped; // Scopes overwritten (or never recorded, over the memory budget) before they could be written
+    };
 
-    std::string GetSeverityString(Severity sev) noexcept;
-    LoggerType& GetNamedLogger(const std::string_view channel) noexcept;
+    // Writes every scope recorded since the last trace to 'path' ("%p" is replaced with the PID) as a Chrome trace, as many of them
+    // as each thread's ring still holds (buffers of threads that have exited are freed once they've been written)
+    TraceResult WriteTrace(const std::string& path);
+}
 
-    void InitializeLogging(LogSettings settings = {});
-    void ShutownLogging(int signal = -1);
+/*
+ * Metrics
+ *
+ *  LOG_COUNTER("requests", 1);
+ *  LOG_HISTOGRAM("request_us", elapsed_us);
+ *
+ * Rather than a record per event, each update is added to a cell of the calling thread's own
+ * (a counter, or log-linear histogram buckets) with plain stores, and every
+ * MetricSettings::interval_ms a background thread sums the cells and logs one summary record per
+ * metric that changed, on the channel of the statement that created it ("requests: 1234 in 10.0s
+ * (123.4/s)" or "request_us: 1234 in 10.0s, mean 52.3, p50 48, p90 96, p99 184, max 416").
+ *
+ * A statement remembers the metric it last used and only looks it up again if its channel or name
+ * changed; statements with the same channel, name & kind share a metric. Metrics only hold their
+ * channel's name, summaries are logged through GetNamedLogger (so instance attributes aren't kept).
+ */
+namespace XLog
+{
+    enum class MetricKind
+    {
+        COUNTER,
+        HISTOGRAM
+    };
 
-    void SetGlobalLoggingLevel(Severity sev);
-    bool SetLoggingLevel(Severity sev, const std::string_view channel);
+    class Metric;
 
-    Severity GetGlobalLoggingLevel();
-    Severity GetLoggingLevel(const std::string_view channel);
+    // Set while LogSettings::s_metrics is enabled
+    inline std::atomic<bool> METRICS{false};
 
-    std::unordered_map<std::string, Severity> GetAllLoggingLevels();
-    std::vector<std::string> GetAllLogHandles();
+    // The metric called 'name' on the logger's channel, created the first time it's asked for
+    Metric& GetMetric(const LoggerType& logger, std::string_view name, MetricKind kind) noexcept;
+
+    // Same, but 'last' is checked first (and updated if it's for a different channel or name)
+    Metric& GetMetric(std::atomic<Metric*>& last, const LoggerType& logger, std::string_view name, MetricKind kind) noexcept;
+
+    void AddToCounter(Metric& metric, uint64_t n) noexcept;
+    void RecordHistogram(Metric& metric, uint64_t value) noexcept;
 }
 
-// Set attribute and return the new value
-// Pretty sure I found this on stackoverflow, but can't recall where
-template<typename ValueType>
-ValueType set_get_attrib(const char* name, ValueType value) {
-    auto attr = boost::log::attribute_cast<boost::log::attributes::mutable_constant<ValueType>>(boost::log::core::get()->get_global_attributes()[name]);
-    attr.set(value);
-    return attr.get();
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+// Location of the statement this thread is logging from, the SourceLocation attribute reads it as the record is opened
+inline thread_local std::source_location XLOG_RECORD_SOURCE_LOCATION;
+
+// Set this thread's record source location and return it
+inline std::source_location set_record_source_location(std::source_location sloc) noexcept
+{
+    XLOG_RECORD_SOURCE_LOCATION = sloc;
+    return sloc;
 }
+#endif
 
+/*
+ * The statement macros below evaluate their 'logger' argument once (it's often XLog::GetNamedLogger(...), for the
+ * _INPLACE macros) and bind it to _xlog_logger, the helpers they use take that name & can evaluate it more than once
+ */
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+// The statement's call sites (the function name has to come from outside the lambda)
+#define XLOG_CALL_SITE_STATEMENT() \
+   ([](const char* _xlog_function) -> XLog::CallSiteStatement& \
+   { \
+      static XLog::CallSiteStatement _xlog_statement(__FILE__, __LINE__, _xlog_function); \
+      return _xlog_statement; \
+   }(__PRETTY_FUNCTION__))
+
+// The statement's call site for the logger's channel & this severity
+#define XLOG_CALL_SITE(logger, sev) XLOG_CALL_SITE_STATEMENT().site((logger), (sev))
+#define XLOG_ACCEPTS(logger, sev) XLOG_CALL_SITE(logger, sev).accepts((logger), (sev))
+#else
+#define XLOG_ACCEPTS(logger, sev) (logger).accepts(sev)
+#endif // XLOG_ENABLE_CALL_SITE_CONTROL
+
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+// Same as the Boost stream macros, except the record is opened, filled, and pushed by a ProfiledRecord
+// (the source location is taken outside of the lambda, so it's still the statement's function)
+#define XLOG_PROFILED_STREAM(logger, sev, sloc, ...) \
+   if(auto& _xlog_logger = (logger); false) {} else \
+   if(XLog::CallSite& _xlog_site = XLOG_CALL_SITE(_xlog_logger, sev); !_xlog_site.accepts(_xlog_logger, (sev))) {} else \
+      for(XLog::ProfiledRecord _xlog_profiled(_xlog_site.overhead, _xlog_logger, [&, _xlog_sloc = sloc]() { return _xlog_logger.open_record((__VA_ARGS__)); }); _xlog_profiled.once();) \
+         _xlog_profiled.stream()
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+
+// The level check comes first, so nothing else (including the source location attribute) is touched for filtered records
 #ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
-#define CUSTOM_LOG_SEV_SLOC(logger, sev, sloc) \
+#define XLOG_STREAM_SLOC(logger, sev, sloc) \
    BOOST_LOG_STREAM_WITH_PARAMS( \
       (logger), \
-         (set_get_attrib("SourceLocation", sloc)) \
+         (set_record_source_location(sloc)) \
          (::boost::log::keywords::severity = (sev)) \
    )
-#define CUSTOM_LOG_SEV(logger, sev) CUSTOM_LOG_SEV_SLOC(logger, sev, std::source_location::current())
+#define CUSTOM_LOG_SEV_SLOC(logger, sev, sloc) if(auto& _xlog_logger = (logger); !_xlog_logger.accepts(sev)) {} else XLOG_STREAM_SLOC(_xlog_logger, sev, sloc)
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+#define CUSTOM_LOG_SEV(logger, sev) XLOG_PROFILED_STREAM(logger, sev, std::source_location::current(), set_record_source_location(_xlog_sloc), ::boost::log::keywords::severity = (sev))
+#else
+#define CUSTOM_LOG_SEV(logger, sev) if(auto& _xlog_logger = (logger); !XLOG_ACCEPTS(_xlog_logger, sev)) {} else XLOG_STREAM_SLOC(_xlog_logger, sev, std::source_location::current())
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+#else
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+#define CUSTOM_LOG_SEV(logger, sev) XLOG_PROFILED_STREAM(logger, sev, 0, ::boost::log::keywords::severity = (sev))
+#else
+#define CUSTOM_LOG_SEV(logger, sev) if(auto& _xlog_logger = (logger); !XLOG_ACCEPTS(_xlog_logger, sev)) {} else BOOST_LOG_SEV(_xlog_logger, sev)
+#endif // XLOG_ENABLE_OVERHEAD_PROFILER
+#endif
+
+namespace XLog
+{
+    /*
+     * Logs 'message' & returns AsyncFlush(sync) behind it, i.e. co_await XLog::Submit(logger, Severity::ERROR, "Lost the database", true);
+     * The record is opened on the calling thread, but never formatted or written there: with async dispatch it's queued
+     * like any other, otherwise it's handed to the flush thread, which writes it before the flush it's waited on with.
+     * Only when logging isn't running (so there's no thread to hand it to) is it written by the caller. LOG_SUBMIT() also
+     * checks the call site, like LOG_INFO() etc.
+     */
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+    void SubmitRecord(LoggerType& logger, Severity sev, std::string_view message, std::source_location sloc);
+
+    inline FlushResult Submit(LoggerType& logger, Severity sev, std::string_view message, bool sync = false, std::source_location sloc = std::source_location::current())
+    {
+        if(logger.accepts(sev))
+        {
+            SubmitRecord(logger, sev, message, sloc);
+        }
+        return AsyncFlush(sync);
+    }
+
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+    // Submit() for a statement's call site (CUSTOM_LOG_SUBMIT)
+    inline FlushResult Submit(CallSiteStatement& statement, LoggerType& logger, Severity sev, std::string_view message, bool sync = false, std::source_location sloc = std::source_location::current())
+    {
+        if(statement.site(logger, sev).accepts(logger, sev))
+        {
+            SubmitRecord(logger, sev, message, sloc);
+        }
+        return AsyncFlush(sync);
+    }
+#endif // XLOG_ENABLE_CALL_SITE_CONTROL
+#else
+    void SubmitRecord(LoggerType& logger, Severity sev, std::string_view message);
+
+    inline FlushResult Submit(LoggerType& logger, Severity sev, std::string_view message, bool sync = false)
+    {
+        if(logger.accepts(sev))
+        {
+            SubmitRecord(logger, sev, message);
+        }
+        return AsyncFlush(sync);
+    }
+
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+    // Submit() for a statement's call site (CUSTOM_LOG_SUBMIT)
+    inline FlushResult Submit(CallSiteStatement& statement, LoggerType& logger, Severity sev, std::string_view message, bool sync = false)
+    {
+        if(statement.site(logger, sev).accepts(logger, sev))
+        {
+            SubmitRecord(logger, sev, message);
+        }
+        return AsyncFlush(sync);
+    }
+#endif // XLOG_ENABLE_CALL_SITE_CONTROL
+#endif
+
+    /*
+     * Logs each of 'messages' as a record of its own (i.e. draining an event queue, or a worker's
+     * results). The level check, the logger's lock & the filters are paid once for the batch: the
+     * first record is opened through the logger, the rest from its channel, severity, source location
+     * & context (each still gets a timestamp & LineID of its own), and they're all handed to xlog's
+     * sinks without being filtered again, to be queued for async dispatch, or written with every sink
+     * taking its lock once, together. LOG_BATCH() also checks the call site, like LOG_INFO() etc.
+     */
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+    void LogBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count, std::source_location sloc = std::source_location::current());
+
+    // Same, but the level has already been checked (CUSTOM_LOG_BATCH)
+    void LogAcceptedBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count, std::source_location sloc = std::source_location::current());
+
+    // Any range of strings (std::vector<std::string>, std::array<const char*, N>, ...)
+    template<typename Range>
+    void LogBatch(LoggerType& logger, Severity sev, const Range& messages, std::source_location sloc = std::source_location::current())
+    {
+        const std::vector<std::string_view> views(std::begin(messages), std::end(messages));
+        LogBatch(logger, sev, views.data(), views.size(), sloc);
+    }
+
+    template<typename Range>
+    void LogAcceptedBatch(LoggerType& logger, Severity sev, const Range& messages, std::source_location sloc = std::source_location::current())
+    {
+        const std::vector<std::string_view> views(std::begin(messages), std::end(messages));
+        LogAcceptedBatch(logger, sev, views.data(), views.size(), sloc);
+    }
 #else
-#define CUSTOM_LOG_SEV(logger, sev) BOOST_LOG_SEV(logger, sev)
+    void LogBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count);
+
+    // Same, but the level has already been checked (CUSTOM_LOG_BATCH)
+    void LogAcceptedBatch(LoggerType& logger, Severity sev, const std::string_view* messages, size_t count);
+
+    // Any range of strings (std::vector<std::string>, std::array<const char*, N>, ...)
+    template<typename Range>
+    void LogBatch(LoggerType& logger, Severity sev, const Range& messages)
+    {
+        const std::vector<std::string_view> views(std::begin(messages), std::end(messages));
+        LogBatch(logger, sev, views.data(), views.size());
+    }
+
+    template<typename Range>
+    void LogAcceptedBatch(LoggerType& logger, Severity sev, const Range& messages)
+    {
+        const std::vector<std::string_view> views(std::begin(messages), std::end(messages));
+        LogAcceptedBatch(logger, sev, views.data(), views.size());
+    }
 #endif
+}
+
+// Gated like CUSTOM_LOG_SEV (the call site, the logger's level & overload shedding), i.e. LOG_BATCH(XLog::Severity::INFO, results);
+#define CUSTOM_LOG_BATCH(logger, sev, messages) \
+   if(auto& _xlog_logger = (logger); !XLOG_ACCEPTS(_xlog_logger, sev)) {} else XLog::LogAcceptedBatch(_xlog_logger, (sev), (messages))
+
+// co_await LOG_SUBMIT(XLog::Severity::ERROR, "Lost the database", true), gated like CUSTOM_LOG_SEV
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+#define CUSTOM_LOG_SUBMIT(logger, sev, message, sync) XLog::Submit(XLOG_CALL_SITE_STATEMENT(), (logger), (sev), (message), (sync))
+#else
+#define CUSTOM_LOG_SUBMIT(logger, sev, message, sync) XLog::Submit((logger), (sev), (message), (sync))
+#endif // XLOG_ENABLE_CALL_SITE_CONTROL
+
+#define XLOG_CONCAT_INNER(a, b) a##b
+#define XLOG_CONCAT(a, b) XLOG_CONCAT_INNER(a, b)
+#define CUSTOM_SCOPE_TIMER(logger, sev, name) \
+   XLog::ScopeTimer XLOG_CONCAT(_xlog_scope_timer_, __LINE__)((logger), (sev), (name))
+
+// The statement's metric, looked up again only when its channel or name changes
+#define XLOG_METRIC(logger, name, kind) \
+   ([&]() -> XLog::Metric& \
+   { \
+      static std::atomic<XLog::Metric*> _xlog_metric{nullptr}; \
+      return XLog::GetMetric(_xlog_metric, (logger), (name), (kind)); \
+   }())
+#define CUSTOM_LOG_COUNTER(logger, name, n) \
+   if(!XLog::METRICS.load(std::memory_order_relaxed)) {} else XLog::AddToCounter(XLOG_METRIC(logger, name, XLog::MetricKind::COUNTER), (n))
+#define CUSTOM_LOG_HISTOGRAM(logger, name, value) \
+   if(!XLog::METRICS.load(std::memory_order_relaxed)) {} else XLog::RecordHistogram(XLOG_METRIC(logger, name, XLog::MetricKind::HISTOGRAM), (value))
 
 #define PRINT_ENUM(var) static_cast<std::underlying_type_t<decltype(var)>>(var)
 
@@ -206,6 +1577,18 @@ inline std::string get_errno_string()
 #define LOG_ERROR_INPLACE(name) CUSTOM_LOG_SEV(XLog::GetNamedLogger(name), XLog::Severity::ERROR)
 #define LOG_ERROR2_INPLACE(name) CUSTOM_LOG_SEV(XLog::GetNamedLogger(name), XLog::Severity::ERROR2)
 
+#define LOG_SCOPE_TIMER(name) CUSTOM_SCOPE_TIMER(__logger, XLog::Severity::DEBUG, name)
+#define LOG_SCOPE_TIMER_SEV(sev, name) CUSTOM_SCOPE_TIMER(__logger, sev, name)
+#define LOG_SCOPE_TIMER_INPLACE(channel, name) CUSTOM_SCOPE_TIMER(XLog::GetNamedLogger(channel), XLog::Severity::DEBUG, name)
+
+#define LOG_COUNTER(name, n) CUSTOM_LOG_COUNTER(__logger, name, n)
+#define LOG_HISTOGRAM(name, value) CUSTOM_LOG_HISTOGRAM(__logger, name, value)
+#define LOG_BATCH(sev, messages) CUSTOM_LOG_BATCH(__logger, sev, messages)
+#define LOG_SUBMIT(sev, message, sync) CUSTOM_LOG_SUBMIT(__logger, sev, message, sync)
+#define LOG_COUNTER_INPLACE(channel, name, n) CUSTOM_LOG_COUNTER(XLog::GetNamedLogger(channel), name, n)
+#define LOG_HISTOGRAM_INPLACE(channel, name, value) CUSTOM_LOG_HISTOGRAM(XLog::GetNamedLogger(channel), name, value)
+#define LOG_BATCH_INPLACE(channel, sev, messages) CUSTOM_LOG_BATCH(XLog::GetNamedLogger(channel), sev, messages)
+
 #define CODE_INFO_INPLACE(name, errc) LOG_INFO_INPLACE(name) << ERRC_STREAM(errc)
 #define CODE_DEBUG_INPLACE(name, errc) LOG_DEBUG_INPLACE(name) << ERRC_STREAM(errc)
 #define CODE_DEBUG2_INPLACE(name, errc) LOG_DEBUG2_INPLACE(name) << ERRC_STREAM(errc)
@@ -299,11 +1682,14 @@ namespace XLog
 #endif
 
 /*
- * Default log formatter
+ * Log formatters
  */
 namespace XLogFormatters
 {
     void default_formatter(const boost::log::record_view& rec, boost::log::formatting_ostream& stream);
+
+    // Same information as the default formatter, but as a single-line JSON object
+    void json_formatter(const boost::log::record_view& rec, boost::log::formatting_ostream& stream);
 }
 
 /*
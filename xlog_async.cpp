@@ -0,0 +1,464 @@
+#include "xlog_async.noexport.h"
+
+#include <queue>
+#include <algorithm>
+
+#include "xlog_clock.noexport.h"
+
+static size_t round_up_pow2(size_t value)
+{
+    size_t rValue = 1;
+    while(rValue < value)
+    {
+        rValue <<= 1;
+    }
+
+    return rValue;
+}
+
+xlog_async_dispatcher::ring::ring(size_t capacity) :
+    mask(capacity - 1),
+    slots(new slot[capacity])
+{
+    charge.set(capacity * sizeof(slot));
+}
+
+bool xlog_async_dispatcher::ring::push(uint64_t stamp, const boost::log::record_view& rec) noexcept
+{
+    const size_t current = head.load(std::memory_order_relaxed);
+    if(current - cached_tail > mask)
+    {
+        cached_tail = tail.load(std::memory_order_acquire);
+        if(current - cached_tail > mask)
+        {
+            return false;
+        }
+    }
+
+    slot& s = slots[current & mask];
+    s.stamp = stamp;
+    s.rec = rec;
+
+    head.store(current + 1, std::memory_order_release);
+    return true;
+}
+
+size_t xlog_async_dispatcher::ring::push_batch(uint64_t stamp, const boost::log::record_view* recs, size_t count) noexcept
+{
+    const size_t current = head.load(std::memory_order_relaxed);
+    if(mask + 1 - (current - cached_tail) < count)
+    {
+        cached_tail = tail.load(std::memory_order_acquire);
+    }
+
+    const size_t room = mask + 1 - (current - cached_tail);
+    count = std::min(count, room);
+    for(size_t i = 0; i < count; i++)
+    {
+        slot& s = slots[(current + i) & mask];
+        s.stamp = stamp;
+        s.rec = recs[i];
+    }
+
+    head.store(current + count, std::memory_order_release);
+    return count;
+}
+
+xlog_async_dispatcher::slot* xlog_async_dispatcher::ring::front() noexcept
+{
+    const size_t current = tail.load(std::memory_order_relaxed);
+    if(current == cached_head)
+    {
+        cached_head = head.load(std::memory_order_acquire);
+        if(current == cached_head)
+        {
+            return nullptr;
+        }
+    }
+
+    return &slots[current & mask];
+}
+
+void xlog_async_dispatcher::ring::pop() noexcept
+{
+    const size_t current = tail.load(std::memory_order_relaxed);
+
+    // Let go of the record here rather than whenever the slot is next used
+    slots[current & mask].rec = boost::log::record_view();
+    tail.store(current + 1, std::memory_order_release);
+}
+
+xlog_async_dispatcher::xlog_async_dispatcher(const XLog::AsyncSettings& settings, boost::shared_ptr<xlog_dispatch_backend> backend) :
+    backend(std::move(backend)),
+    capacity(round_up_pow2(std::max<size_t>(settings.queue_capacity, 64))),
+    per_thread_queues(settings.per_thread_queues),
+    merge_window_ns(static_cast<uint64_t>(settings.merge_window_us) * 1000)
+{
+    if(!per_thread_queues)
+    {
+        shared_ring = std::make_shared<ring>(capacity);
+        rings.push_back(shared_ring);
+        rings_generation++;
+    }
+
+    thread = std::thread(&xlog_async_dispatcher::run, this);
+}
+
+xlog_async_dispatcher::~xlog_async_dispatcher()
+{
+    stop();
+}
+
+// Set while the thread is merging, anything it logs meanwhile (i.e. a sink reporting a problem) can't wait on a merge of its own
+static thread_local bool MERGING = false;
+
+bool xlog_async_dispatcher::push(const boost::log::record_view& rec)
+{
+    while(!stopping.load(std::memory_order_acquire))
+    {
+        bool pushed = false;
+        if(per_thread_queues)
+        {
+            pushed = thread_ring().push(XLogClock::read_monotonic(), rec);
+        }
+        else
+        {
+            // Stamped under the lock, so the one ring stays in stamp order
+            std::scoped_lock lock(shared_ring->producer_mutex);
+            pushed = shared_ring->push(XLogClock::read_monotonic(), rec);
+        }
+
+        if(pushed)
+        {
+            wake_after_push();
+
+            // Raced with stop(), which may already have done its last merge
+            if(stopped.load(std::memory_order_acquire))
+            {
+                write_queued();
+            }
+            return true;
+        }
+
+        if(MERGING)
+        {
+            return false;
+        }
+
+        // Full, writing the record here would put it ahead of the thread's queued ones
+        write_queued();
+    }
+
+    // The caller writes its records itself from now on, so they can't be ahead of the queue either
+    if(!MERGING)
+    {
+        write_queued();
+    }
+    return false;
+}
+
+size_t xlog_async_dispatcher::push_batch(const boost::log::record_view* recs, size_t count)
+{
+    size_t pushed = 0;
+    while(pushed < count && !stopping.load(std::memory_order_acquire))
+    {
+        if(per_thread_queues)
+        {
+            pushed += thread_ring().push_batch(XLogClock::read_monotonic(), recs + pushed, count - pushed);
+        }
+        else
+        {
+            std::scoped_lock lock(shared_ring->producer_mutex);
+            pushed += shared_ring->push_batch(XLogClock::read_monotonic(), recs + pushed, count - pushed);
+        }
+
+        if(pushed != 0)
+        {
+            wake_after_push();
+        }
+
+        if(pushed < count)
+        {
+            if(MERGING)
+            {
+                return pushed;
+            }
+
+            write_queued();
+        }
+    }
+
+    // Whatever didn't make it (we're stopping) is written by the caller, after everything queued
+    if((pushed < count || stopped.load(std::memory_order_acquire)) && !MERGING)
+    {
+        write_queued();
+    }
+
+    return pushed;
+}
+
+void xlog_async_dispatcher::wake_after_push()
+{
+    // Pairs with the fence in park(), either it sees our record or we see it parked
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(parked.load(std::memory_order_relaxed) && parked.exchange(false, std::memory_order_relaxed))
+    {
+        {
+            std::scoped_lock lock(wake_mutex);
+            woken = true;
+        }
+        wake_cv.notify_one();
+    }
+}
+
+void xlog_async_dispatcher::write_queued()
+{
+    std::scoped_lock lock(merge_mutex);
+    merge(XLogClock::read_monotonic());
+}
+
+void xlog_async_dispatcher::drain()
+{
+    std::unique_lock lock(state_mutex);
+    if(stopped.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    const uint64_t target = ++drain_requested;
+    drain_pending.store(target, std::memory_order_release);
+    {
+        std::scoped_lock wake_lock(wake_mutex);
+        woken = true;
+    }
+    wake_cv.notify_one();
+
+    drained_cv.wait(lock, [&]() { return drain_completed >= target || stopped.load(std::memory_order_relaxed); });
+}
+
+void xlog_async_dispatcher::stop()
+{
+    if(stopping.exchange(true, std::memory_order_acq_rel))
+    {
+        return;
+    }
+
+    {
+        std::scoped_lock lock(wake_mutex);
+        woken = true;
+    }
+    wake_cv.notify_one();
+    thread.join();
+
+    {
+        std::scoped_lock lock(merge_mutex);
+        merge(XLogClock::read_monotonic());
+        stopped.store(true, std::memory_order_release);
+    }
+
+    std::scoped_lock lock(state_mutex);
+    drained_cv.notify_all();
+}
+
+size_t xlog_async_dispatcher::pending()
+{
+    std::scoped_lock lock(rings_mutex);
+
+    size_t rValue = 0;
+    for(const auto& r : rings)
+    {
+        const size_t tail = r->tail.load(std::memory_order_acquire);
+        const size_t head = r->head.load(std::memory_order_acquire);
+        rValue += head >= tail ? head - tail : 0;
+    }
+
+    return rValue;
+}
+
+xlog_async_dispatcher::ring& xlog_async_dispatcher::thread_ring()
+{
+    // Closes the ring when its thread exits, the background thread removes it once it's empty
+    struct thread_ring_holder
+    {
+        const xlog_async_dispatcher* owner = nullptr;
+        std::shared_ptr<ring> current;
+
+        ~thread_ring_holder()
+        {
+            if(current)
+            {
+                current->closed.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    thread_local thread_ring_holder holder;
+    if(holder.owner != this)
+    {
+        if(holder.current)
+        {
+            holder.current->closed.store(true, std::memory_order_release);
+        }
+
+        holder.current = std::make_shared<ring>(capacity);
+        holder.owner = this;
+
+        std::scoped_lock lock(rings_mutex);
+        rings.push_back(holder.current);
+        rings_generation++;
+    }
+
+    return *holder.current;
+}
+
+void xlog_async_dispatcher::run()
+{
+    uint64_t drained = 0;
+    while(!stopping.load(std::memory_order_acquire))
+    {
+        const uint64_t requested = drain_pending.load(std::memory_order_acquire);
+
+        bool merged = false;
+        uint64_t oldest_left = UINT64_MAX;
+        {
+            std::scoped_lock lock(merge_mutex);
+
+            // Everything pushed before the drain was asked for is stamped before now, so it doesn't wait out the window
+            const uint64_t now = XLogClock::read_monotonic();
+            merged = merge(requested != drained ? now : now - std::min(now, merge_window_ns), &oldest_left);
+        }
+
+        if(requested != drained)
+        {
+            drained = requested;
+
+            std::scoped_lock lock(state_mutex);
+            drain_completed = drained;
+            drained_cv.notify_all();
+        }
+
+        if(merged)
+        {
+            continue;
+        }
+
+        if(oldest_left == UINT64_MAX)
+        {
+            park(drained);
+            continue;
+        }
+
+        // Only held back by the window, so there's no need to hear about anything newer until it's over
+        const uint64_t now = XLogClock::read_monotonic();
+        const uint64_t due = oldest_left + merge_window_ns;
+        if(due > now)
+        {
+            std::unique_lock lock(wake_mutex);
+            wake_cv.wait_for(lock, std::chrono::nanoseconds(due - now), [&]() {
+                return stopping.load(std::memory_order_acquire) || drain_pending.load(std::memory_order_acquire) != drained;
+            });
+        }
+    }
+
+    std::scoped_lock lock(merge_mutex);
+    merge(XLogClock::read_monotonic());
+}
+
+void xlog_async_dispatcher::park(uint64_t drained)
+{
+    std::unique_lock lock(wake_mutex);
+    woken = false;
+    parked.store(true, std::memory_order_relaxed);
+
+    // Pairs with the fence in wake_after_push(), anything pushed before a producer could have seen us parked is seen here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!any_queued())
+    {
+        wake_cv.wait(lock, [&]() {
+            return woken || stopping.load(std::memory_order_acquire) || drain_pending.load(std::memory_order_acquire) != drained;
+        });
+    }
+
+    parked.store(false, std::memory_order_relaxed);
+}
+
+bool xlog_async_dispatcher::any_queued()
+{
+    std::scoped_lock lock(rings_mutex);
+    return std::any_of(rings.begin(), rings.end(), [](const std::shared_ptr<ring>& r) {
+        return r->head.load(std::memory_order_acquire) != r->tail.load(std::memory_order_relaxed);
+    });
+}
+
+bool xlog_async_dispatcher::merge(uint64_t cutoff, uint64_t* oldest_left)
+{
+    MERGING = true;
+    struct merging_scope
+    {
+        ~merging_scope()
+        {
+            MERGING = false;
+        }
+    } scope;
+
+    {
+        std::scoped_lock lock(rings_mutex);
+
+        // Rings of threads that have exited go once we've emptied them (we're their only consumer)
+        const size_t before = rings.size();
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<ring>& r) { return r->closed.load(std::memory_order_acquire) && r->front() == nullptr; }), rings.end());
+        if(rings.size() != before)
+        {
+            rings_generation++;
+        }
+
+        if(merging_generation != rings_generation)
+        {
+            merging = rings;
+            merging_generation = rings_generation;
+        }
+    }
+
+    // Min-heap of each ring's oldest record
+    typedef std::pair<uint64_t, size_t> head_entry;
+    std::priority_queue<head_entry, std::vector<head_entry>, std::greater<head_entry>> heads;
+    for(size_t i = 0; i < merging.size(); i++)
+    {
+        if(const slot* s = merging[i]->front())
+        {
+            heads.emplace(s->stamp, i);
+        }
+    }
+
+    uint64_t merged = 0;
+    while(!heads.empty() && heads.top().first <= cutoff)
+    {
+        const size_t index = heads.top().second;
+        heads.pop();
+
+        ring& r = *merging[index];
+        try
+        {
+            backend->consume(r.front()->rec);
+        }
+        catch(...)
+        {
+            // Nowhere to report it, and the background thread has to keep going
+        }
+        r.pop();
+        merged++;
+
+        if(const slot* next = r.front())
+        {
+            heads.emplace(next->stamp, index);
+        }
+    }
+
+    if(oldest_left != nullptr)
+    {
+        *oldest_left = heads.empty() ? UINT64_MAX : heads.top().first;
+    }
+
+    dispatched_records.fetch_add(merged, std::memory_order_relaxed);
+    return merged != 0;
+}
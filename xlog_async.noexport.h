@@ -0,0 +1,153 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+#include "xlog_memory.noexport.h"
+
+#include <thread>
+#include <condition_variable>
+
+#include <boost/shared_ptr.hpp>
+
+/*
+ * Asynchronous dispatch
+ *
+ * With AsyncSettings::enabled the dispatch frontend doesn't format or write anything on the logging
+ * thread, it only pushes the record into a queue that a background thread drains into the dispatch
+ * backend. By default every logging thread gets a single-producer ring of its own (created the first
+ * time it logs), so producers never share a cache line with each other, only with the background
+ * thread. AsyncSettings::per_thread_queues = false puts every thread on one ring behind a lock instead.
+ *
+ * Each record is stamped (CLOCK_MONOTONIC) as it's pushed, and the background thread merges the
+ * rings by that stamp, so records come out in the order they were logged across threads. A record is
+ * held back until it's at least 'merge_window_us' old, in case an older one is still being pushed
+ * by another thread; flushing & stopping don't wait for the window. With nothing left to hold back the
+ * background thread parks on a condition variable, and the first push after that wakes it (a ring
+ * only ever goes from empty to non-empty while it's parked), so an idle process costs nothing.
+ *
+ * A thread whose ring is full writes out everything queued itself (in order, its own records
+ * included) & then queues the record, so nothing is ever dropped or written ahead of the thread's
+ * earlier records, the thread just slows down to the speed of the sinks. Threads logging once
+ * we're stopping do the same before writing their records themselves.
+ */
+class xlog_async_dispatcher
+{
+public:
+    xlog_async_dispatcher(const XLog::AsyncSettings& settings, boost::shared_ptr<xlog_dispatch_backend> backend);
+
+    // Stops the background thread (if stop() hasn't already)
+    ~xlog_async_dispatcher();
+
+    // False if the record should be written by the calling thread instead (we're stopping), the queue is empty by then
+    bool push(const boost::log::record_view& rec);
+
+    // Pushes 'recs' with as few stamps (and locks, for the shared ring) as there's room for, returns how many were
+    // pushed, anything after that is for the calling thread to write (we're stopping) & the queue is empty by then
+    size_t push_batch(const boost::log::record_view* recs, size_t count);
+
+    // Waits until everything pushed before the call has been handed to the backend
+    void drain();
+
+    // Writes whatever is left & stops the background thread, records are written by their own thread after this
+    void stop();
+
+    // Records waiting in the queues (approximately, they're changing as it's counted)
+    size_t pending();
+
+    // Records handed to the backend so far
+    uint64_t dispatched() const { return dispatched_records.load(std::memory_order_relaxed); }
+
+private:
+    struct slot
+    {
+        uint64_t stamp;
+        boost::log::record_view rec;
+    };
+
+    /*
+     * Bounded single-producer/single-consumer ring, 'head' is only written by the producer and
+     * 'tail' by the consumer, each caches the other's index so most pushes & pops touch one line
+     */
+    struct ring
+    {
+        explicit ring(size_t capacity);
+
+        bool push(uint64_t stamp, const boost::log::record_view& rec) noexcept;
+
+        // Published with a single store, returns how many fit
+        size_t push_batch(uint64_t stamp, const boost::log::record_view* recs, size_t count) noexcept;
+
+        // Oldest record, nullptr if empty (consumer only)
+        slot* front() noexcept;
+        void pop() noexcept;
+
+        const size_t mask;
+        std::unique_ptr<slot[]> slots;
+        xlog_memory_charge charge;
+
+        alignas(64) std::atomic<size_t> head{0};
+        size_t cached_tail = 0;
+
+        alignas(64) std::atomic<size_t> tail{0};
+        size_t cached_head = 0;
+
+        // Set once its thread has exited, it's removed once it's empty
+        std::atomic<bool> closed{false};
+
+        // Only used when every thread shares the ring
+        std::mutex producer_mutex;
+    };
+
+    ring& thread_ring();
+
+    void run();
+
+    // Hands every record stamped at or before 'cutoff' to the backend in stamp order, true if any were. 'oldest_left' is
+    // set to the stamp of the oldest record still queued (UINT64_MAX if there are none)
+    bool merge(uint64_t cutoff, uint64_t* oldest_left = nullptr);
+
+    // Wakes the background thread if it's parked, called after every push
+    void wake_after_push();
+
+    // Parks the background thread until there's something to merge, a drain is asked for, or we're stopping
+    void park(uint64_t drained);
+
+    // Is anything queued in any ring?
+    bool any_queued();
+
+    // Merges everything queued so far, on the calling thread
+    void write_queued();
+
+    const boost::shared_ptr<xlog_dispatch_backend> backend;
+    const size_t capacity;
+    const bool per_thread_queues;
+    const uint64_t merge_window_ns;
+
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<ring>> rings;
+    uint64_t rings_generation = 0;
+    std::shared_ptr<ring> shared_ring;
+
+    // Only the background thread (or stop(), once it's gone) merges, this is its copy of 'rings'
+    std::mutex merge_mutex;
+    std::vector<std::shared_ptr<ring>> merging;
+    uint64_t merging_generation = ~0ULL;
+
+    std::mutex state_mutex;
+    std::condition_variable drained_cv;
+    uint64_t drain_requested = 0;
+    uint64_t drain_completed = 0;
+    std::atomic<uint64_t> drain_pending{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> stopped{false};
+
+    // Only added to by whoever merges, once per merge
+    std::atomic<uint64_t> dispatched_records{0};
+
+    // Set while the background thread waits for records, the first producer to see it set clears it & wakes it
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    bool woken = false;
+    std::atomic<bool> parked{false};
+
+    std::thread thread;
+};
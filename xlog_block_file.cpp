@@ -0,0 +1,326 @@
+#include "xlog_block_file.noexport.h"
+
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+#include <zstd.h>
+
+#include "xlog_log_internal.noexport.h"
+
+bool read_block_header(const uint8_t* data, size_t size, xlog_block_header& out)
+{
+    if(size < XLOG_BLOCK_HEADER_FRAME_SIZE)
+    {
+        return false;
+    }
+
+    uint32_t magic = 0;
+    uint32_t frame_size = 0;
+    std::memcpy(&magic, data, sizeof(magic));
+    std::memcpy(&frame_size, data + 4, sizeof(frame_size));
+    if(magic != XLOG_BLOCK_FRAME_MAGIC || frame_size != sizeof(xlog_block_header))
+    {
+        return false;
+    }
+
+    std::memcpy(&out, data + 8, sizeof(out));
+    return out.version == XLOG_BLOCK_VERSION;
+}
+
+const char* check_block_sizes(const xlog_block_header& header, const uint8_t* frame, size_t available)
+{
+    if(header.compressed_size > available)
+    {
+        return "frame runs past the end of the block";
+    }
+
+    if(header.uncompressed_size > XLOG_BLOCK_MAX_UNCOMPRESSED_SIZE ||
+       header.uncompressed_size / XLOG_BLOCK_MAX_COMPRESSION_RATIO > header.compressed_size)
+    {
+        return "implausible uncompressed size";
+    }
+
+    // Our frames always record their size, one that doesn't is still bounded by the checks above
+    const unsigned long long content_size = ZSTD_getFrameContentSize(frame, header.compressed_size);
+    if(content_size == ZSTD_CONTENTSIZE_ERROR)
+    {
+        return "not a zstd frame";
+    }
+
+    if(content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != header.uncompressed_size)
+    {
+        return "uncompressed size doesn't match the frame";
+    }
+
+    return nullptr;
+}
+
+xlog_block_file_sink::xlog_block_file_sink(std::string name, xlog_formatter_function formatter, const XLog::CompressedFileSettings& settings) :
+    xlog_sink(std::move(name), formatter),
+    block_size(std::max<size_t>(settings.block_size, 4096)),
+    compression_level(settings.compression_level),
+    max_pending_blocks(std::max<size_t>(settings.max_pending_blocks, 1)),
+    flush_interval(std::max(settings.flush_interval_ms, 1u)),
+    max_spare_texts(std::max<size_t>(settings.workers, 1)),
+    current(std::make_unique<block>()),
+    path(settings.path),
+    file(settings.path, std::ios::out | std::ios::app | std::ios::binary)
+{
+    current->text.reserve(block_size);
+    update_charge();
+
+    // Index entries need absolute offsets, and we're appending
+    std::error_code err;
+    file_position = std::filesystem::file_size(settings.path, err);
+    if(err)
+    {
+        file_position = 0;
+    }
+
+    if(settings.index)
+    {
+        index = std::make_unique<xlog_index_writer>(settings.path);
+    }
+
+    const size_t worker_count = std::max<size_t>(settings.workers, 1);
+    for(size_t i = 0; i < worker_count; i++)
+    {
+        workers.emplace_back(&xlog_block_file_sink::worker, this);
+    }
+}
+
+xlog_block_file_sink::~xlog_block_file_sink()
+{
+    {
+        std::scoped_lock lock(state_mutex);
+        seal_block();
+        stopping = true;
+    }
+    work_cv.notify_all();
+
+    // Workers only stop once there's nothing left to compress, and whoever finishes the last block writes it
+    for(auto& thread : workers)
+    {
+        thread.join();
+    }
+}
+
+bool xlog_block_file_sink::consume(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    std::scoped_lock lock(state_mutex);
+    if(current->text.size() >= block_size)
+    {
+        // The workers (or the disk) can't keep up, dropping is better than holding up the logging thread
+        if(in_flight.size() >= max_pending_blocks)
+        {
+            return false;
+        }
+
+        seal_block();
+    }
+
+    block& open = *current;
+    if(open.header.summary.record_count == 0)
+    {
+        open.opened = std::chrono::steady_clock::now();
+    }
+
+    open.text.append(*text);
+    if(text->empty() || text->back() != '\n')
+    {
+        open.text.push_back('\n');
+    }
+
+    open.header.summary.add(rec);
+    return true;
+}
+
+double xlog_block_file_sink::backlog()
+{
+    std::scoped_lock lock(state_mutex);
+    return static_cast<double>(in_flight.size()) / max_pending_blocks;
+}
+
+void xlog_block_file_sink::flush_unlocked()
+{
+    std::unique_lock lock(state_mutex);
+    seal_block();
+    written_cv.wait(lock, [this]() { return in_flight.empty(); });
+}
+
+void xlog_block_file_sink::seal_block()
+{
+    if(current->header.summary.record_count == 0)
+    {
+        return;
+    }
+
+    std::shared_ptr<block> sealed = std::move(current);
+    in_flight.push_back(sealed);
+    to_compress.push_back(std::move(sealed));
+
+    current = std::make_unique<block>();
+    if(!spare_texts.empty())
+    {
+        current->text = std::move(spare_texts.back());
+        spare_texts.pop_back();
+    }
+    current->text.reserve(block_size);
+    update_charge();
+
+    work_cv.notify_one();
+}
+
+void xlog_block_file_sink::update_charge()
+{
+    // Sealed blocks swap their text for compressed output of (at most) about the same size
+    charge.set((1 + in_flight.size() + spare_texts.size()) * block_size);
+}
+
+void xlog_block_file_sink::worker()
+{
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+
+    std::unique_lock lock(state_mutex);
+    while(true)
+    {
+        if(to_compress.empty())
+        {
+            if(stopping)
+            {
+                break;
+            }
+
+            work_cv.wait_for(lock, flush_interval);
+
+            // Nothing has filled the block for a while, write it out anyway so records don't sit in memory
+            if(!stopping && to_compress.empty() && current->header.summary.record_count != 0 &&
+               std::chrono::steady_clock::now() - current->opened >= flush_interval &&
+               in_flight.size() < max_pending_blocks)
+            {
+                seal_block();
+            }
+
+            continue;
+        }
+
+        std::shared_ptr<block> job = std::move(to_compress.front());
+        to_compress.pop_front();
+        lock.unlock();
+
+        job->compressed.resize(ZSTD_compressBound(job->text.size()));
+        const size_t compressed_size = ZSTD_compressCCtx(context, job->compressed.data(), job->compressed.size(), job->text.data(), job->text.size(), compression_level);
+        if(ZSTD_isError(compressed_size))
+        {
+            INTERNAL() << "Failed to compress log block (" << job->header.summary.record_count << " records lost) -> " << ZSTD_getErrorName(compressed_size);
+            count_dropped(job->header.summary.record_count);
+            job->compressed.clear();
+        }
+        else
+        {
+            job->compressed.resize(compressed_size);
+        }
+
+        job->header.version = XLOG_BLOCK_VERSION;
+        job->header.compressed_size = job->compressed.size();
+        job->header.uncompressed_size = job->text.size();
+
+        lock.lock();
+        job->compressed_done = true;
+        if(spare_texts.size() < max_spare_texts && !XLOG_OVER_BUDGET.load(std::memory_order_relaxed))
+        {
+            job->text.clear();
+            spare_texts.push_back(std::move(job->text));
+        }
+        std::string().swap(job->text);
+        update_charge();
+        lock.unlock();
+
+        write_finished_blocks();
+        lock.lock();
+    }
+
+    lock.unlock();
+    ZSTD_freeCCtx(context);
+}
+
+void xlog_block_file_sink::discard_partial_block()
+{
+    // We're appending, so whatever part of the block did get out has to be cut off again before the next one
+    file.close();
+    std::error_code err;
+    std::filesystem::resize_file(path, file_position, err);
+    if(err)
+    {
+        INTERNAL() << "Failed to truncate " << path << " after a failed write -> " << err.message();
+        // Whatever is there now is where the next block's index entry will point
+        const uintmax_t size = std::filesystem::file_size(path, err);
+        if(!err)
+        {
+            file_position = size;
+        }
+    }
+    file.open(path, std::ios::out | std::ios::app | std::ios::binary);
+}
+
+void xlog_block_file_sink::write_finished_blocks()
+{
+    std::scoped_lock writing(write_mutex);
+
+    while(true)
+    {
+        std::shared_ptr<block> next;
+        {
+            std::scoped_lock lock(state_mutex);
+            if(in_flight.empty() || !in_flight.front()->compressed_done)
+            {
+                break;
+            }
+
+            // Stays in flight until it's written, so flush_unlocked() waits for it
+            next = in_flight.front();
+        }
+
+        if(!next->compressed.empty())
+        {
+            const uint32_t frame_header[2] = { XLOG_BLOCK_FRAME_MAGIC, static_cast<uint32_t>(sizeof(xlog_block_header)) };
+            const bool written =
+                file.write(reinterpret_cast<const char*>(frame_header), sizeof(frame_header)).good() &&
+                file.write(reinterpret_cast<const char*>(&next->header), sizeof(next->header)).good() &&
+                file.write(next->compressed.data(), next->compressed.size()).good() &&
+                file.flush().good();
+
+            const uint64_t length = XLOG_BLOCK_HEADER_FRAME_SIZE + next->compressed.size();
+            if(!written)
+            {
+                INTERNAL() << "Failed to write log block to " << path << " (" << next->header.summary.record_count << " records lost)";
+                count_dropped(next->header.summary.record_count);
+                discard_partial_block();
+            }
+            else if(index)
+            {
+                index->add(xlog_index_entry
+                {
+                    .offset = file_position,
+                    .length = length,
+                    .flags = XLOG_INDEX_COMPRESSED,
+                    .reserved = 0,
+                    .summary = next->header.summary
+                });
+            }
+
+            if(written)
+            {
+                file_position += length;
+            }
+        }
+
+        {
+            std::scoped_lock lock(state_mutex);
+            in_flight.pop_front();
+            update_charge();
+        }
+        written_cv.notify_all();
+    }
+}
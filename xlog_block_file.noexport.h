@@ -0,0 +1,137 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+#include "xlog_index.noexport.h"
+#include "xlog_memory.noexport.h"
+
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <string_view>
+#include <condition_variable>
+
+/*
+ * Compressed block files (*.xlz)
+ *
+ * Records are formatted exactly as for the plain file sink, collected into blocks of about
+ * CompressedFileSettings::block_size bytes, and each block is compressed on its own by a small
+ * pool of worker threads, so logging threads only ever append to a buffer.
+ *
+ * On disk every block is two zstd frames back to back:
+ *  - A skippable frame (XLOG_BLOCK_FRAME_MAGIC) holding an xlog_block_header, whose summary
+ *    says what the block covers (time range, severities, channels) so readers can skip whole
+ *    blocks without decompressing them
+ *  - A regular zstd frame holding the block's text
+ *
+ * zstd decoders ignore skippable frames, so 'zstdcat log.xlz' gives back the same text the
+ * plain file sink would have written. Blocks are always written in order, and since each is
+ * self-contained a file can simply be appended to by the next run. Each block also gets an
+ * entry in the file's index (see xlog_index.noexport.h) if CompressedFileSettings::index is set.
+ */
+
+// zstd's skippable frame magics are 0x184D2A50 - 0x184D2A5F, this one is ours
+constexpr uint32_t XLOG_BLOCK_FRAME_MAGIC = 0x184D2A5B;
+constexpr uint32_t XLOG_BLOCK_VERSION = 1;
+
+// Little-endian, follows the skippable frame's magic & size (both uint32)
+struct xlog_block_header
+{
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t compressed_size;   // Of the zstd frame straight after this one
+    uint64_t uncompressed_size;
+    xlog_record_summary summary;
+};
+
+static_assert(sizeof(xlog_block_header) == 80);
+
+// Skippable frame magic + size + header
+constexpr size_t XLOG_BLOCK_HEADER_FRAME_SIZE = 8 + sizeof(xlog_block_header);
+
+// Readers won't decompress a block claiming more text than this (blocks only go past block_size by their last record)
+constexpr uint64_t XLOG_BLOCK_MAX_UNCOMPRESSED_SIZE = uint64_t(256) * 1024 * 1024;
+
+// Nor one claiming more than zstd could possibly have compressed into its frame (a 128KB RLE block is 4 bytes)
+constexpr uint64_t XLOG_BLOCK_MAX_COMPRESSION_RATIO = 32 * 1024;
+
+// Reads the header frame at the start of 'data', false if it isn't one of our blocks (or is cut off)
+bool read_block_header(const uint8_t* data, size_t size, xlog_block_header& out);
+
+// The header's sizes decide how much a reader allocates for the block, so check them against the zstd frame they
+// describe ('available' bytes at 'frame') first. nullptr if they can be trusted, otherwise why not
+const char* check_block_sizes(const xlog_block_header& header, const uint8_t* frame, size_t available);
+
+class xlog_block_file_sink final : public xlog_sink
+{
+public:
+    xlog_block_file_sink(std::string name, xlog_formatter_function formatter, const XLog::CompressedFileSettings& settings);
+
+    // Writes out whatever is left, then stops the workers
+    ~xlog_block_file_sink() override;
+
+    bool is_open() const { return file.is_open(); }
+
+    double backlog() override;
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
+
+    // Seals the current block and waits until everything sealed so far is on disk
+    void flush_unlocked() override;
+
+    // Everything is behind 'state_mutex' anyway, and a worker can log (INTERNAL) while a flush waits for it
+    bool concurrent() const override { return true; }
+
+private:
+    struct block
+    {
+        std::string text;
+        xlog_block_header header{};
+        std::chrono::steady_clock::time_point opened;
+
+        std::string compressed;
+        bool compressed_done = false;
+    };
+
+    // Need 'state_mutex' held
+    void seal_block();
+    void update_charge();
+
+    void worker();
+    void write_finished_blocks();
+
+    // Need 'write_mutex' held, cuts the file back to 'file_position' after a failed write
+    void discard_partial_block();
+
+    const size_t block_size;
+    const int compression_level;
+    const size_t max_pending_blocks;
+    const std::chrono::milliseconds flush_interval;
+    const size_t max_spare_texts;
+
+    std::mutex state_mutex;
+    std::condition_variable work_cv;
+    std::condition_variable written_cv;
+    bool stopping = false;
+
+    std::unique_ptr<block> current;
+
+    // Sealed blocks in file order, and the ones still waiting for a worker
+    std::deque<std::shared_ptr<block>> in_flight;
+    std::deque<std::shared_ptr<block>> to_compress;
+
+    // Text buffers of written blocks, reused for the next ones (unless we're over the memory budget)
+    std::vector<std::string> spare_texts;
+
+    // Every block buffer we hold, counted as 'block_size' each
+    xlog_memory_charge charge;
+
+    // Only one thread writes at a time, always the oldest finished blocks
+    std::mutex write_mutex;
+    const std::string path;
+    std::ofstream file;
+    uint64_t file_position;
+    std::unique_ptr<xlog_index_writer> index;
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,214 @@
+#include "xlog_call_sites.noexport.h"
+
+#include <mutex>
+#include <algorithm>
+
+#include <fnmatch.h>
+
+/*
+ * Call site registry
+ *
+ * Sites add themselves the first time their statement runs and remove themselves when they're
+ * destroyed (i.e. a shared library being unloaded). Every SetCallSiteState() is kept as a rule
+ * so that statements which haven't run yet still pick it up, later rules win over earlier ones.
+ */
+struct xlog_call_site_registry
+{
+    std::mutex mutex;
+    std::vector<XLog::CallSite*> sites;
+    std::vector<std::pair<XLog::CallSiteQuery, XLog::CallSiteState>> rules;
+};
+
+// Never destroyed, sites in static storage can still be removing themselves after everything else has gone
+static xlog_call_site_registry& call_site_registry()
+{
+    static xlog_call_site_registry* registry = new xlog_call_site_registry();
+    return *registry;
+}
+
+static bool glob_match(const std::string& pattern, std::string_view value)
+{
+    return fnmatch(pattern.c_str(), std::string(value).c_str(), 0) == 0;
+}
+
+static bool same_query(const XLog::CallSiteQuery& a, const XLog::CallSiteQuery& b)
+{
+    return a.file == b.file && a.function == b.function && a.line == b.line && a.channel == b.channel;
+}
+
+static bool query_is_empty(const XLog::CallSiteQuery& query)
+{
+    return query.file.empty() && query.function.empty() && query.line == 0 && query.channel.empty();
+}
+
+static bool file_matches(const std::string& pattern, std::string_view file)
+{
+    if(glob_match(pattern, file))
+    {
+        return true;
+    }
+
+    const size_t slash = file.rfind('/');
+    return slash != std::string_view::npos && glob_match(pattern, file.substr(slash + 1));
+}
+
+// 'function' is __PRETTY_FUNCTION__ (i.e. "void Net::Connection::send(const Buffer&)"), which matches as is, as "Net::Connection::send", or as "send"
+static bool function_matches(const std::string& pattern, std::string_view function)
+{
+    if(glob_match(pattern, function))
+    {
+        return true;
+    }
+
+    std::string_view name = function.substr(0, function.find('('));
+    const size_t space = name.rfind(' ');
+    if(space != std::string_view::npos)
+    {
+        name.remove_prefix(space + 1);
+    }
+
+    if(glob_match(pattern, name))
+    {
+        return true;
+    }
+
+    const size_t scope = name.rfind("::");
+    return scope != std::string_view::npos && glob_match(pattern, name.substr(scope + 2));
+}
+
+static bool site_matches(const XLog::CallSiteQuery& query, const XLog::CallSite& site)
+{
+    return (query.file.empty() || file_matches(query.file, site.file))
+        && (query.function.empty() || function_matches(query.function, site.function))
+        && (query.line == 0 || query.line == site.line)
+        && (query.channel.empty() || glob_match(query.channel, site.channel));
+}
+
+XLog::CallSite::CallSite(const char* file, uint32_t line, const char* function, Severity sev, const std::string& channel) :
+    file(file),
+    line(line),
+    function(function),
+    severity(sev),
+    channel(channel)
+{
+    auto& registry = call_site_registry();
+    std::scoped_lock lock(registry.mutex);
+    registry.sites.push_back(this);
+
+    for(const auto& [query, rule_state] : registry.rules)
+    {
+        if(site_matches(query, *this))
+        {
+            state.store(static_cast<uint32_t>(rule_state), std::memory_order_relaxed);
+        }
+    }
+}
+
+XLog::CallSite::~CallSite()
+{
+    auto& registry = call_site_registry();
+    std::scoped_lock lock(registry.mutex);
+
+    // Statics are destroyed in reverse, so searching from the back usually finds it straight away
+    auto found = std::find(registry.sites.rbegin(), registry.sites.rend(), this);
+    if(found != registry.sites.rend())
+    {
+        registry.sites.erase(std::next(found).base());
+    }
+}
+
+XLog::CallSiteStatement::~CallSiteStatement()
+{
+    CallSite* site = sites.load(std::memory_order_relaxed);
+    while(site != nullptr)
+    {
+        CallSite* next = site->next.load(std::memory_order_relaxed);
+        delete site;
+        site = next;
+    }
+}
+
+XLog::CallSite& XLog::CallSiteStatement::add_site(const std::string& channel, Severity sev)
+{
+    std::scoped_lock lock(mutex);
+
+    // Another thread may have added it meanwhile, new sites go on the end so the first stays first
+    std::atomic<CallSite*>* tail = &sites;
+    for(CallSite* site = tail->load(std::memory_order_acquire); site != nullptr; site = tail->load(std::memory_order_acquire))
+    {
+        if(&site->channel == &channel && site->severity == sev)
+        {
+            return *site;
+        }
+        tail = &site->next;
+    }
+
+    CallSite* site = new CallSite(file, line, function, sev, channel);
+    tail->store(site, std::memory_order_release);
+    return *site;
+}
+
+std::vector<XLog::CallSiteInformation> XLog::GetCallSites(const CallSiteQuery& query)
+{
+    auto& registry = call_site_registry();
+    std::scoped_lock lock(registry.mutex);
+
+    std::vector<CallSiteInformation> rValue;
+    for(const CallSite* site : registry.sites)
+    {
+        if(site_matches(query, *site))
+        {
+            rValue.push_back(CallSiteInformation
+            {
+                .file = site->file,
+                .line = site->line,
+                .function = site->function,
+                .channel = site->channel,
+                .severity = site->severity,
+                .state = static_cast<CallSiteState>(site->state.load(std::memory_order_relaxed))
+            });
+        }
+    }
+
+    return rValue;
+}
+
+size_t XLog::SetCallSiteState(const CallSiteQuery& query, CallSiteState state)
+{
+    auto& registry = call_site_registry();
+    std::scoped_lock lock(registry.mutex);
+
+    if(state == CallSiteState::DEFAULT && query_is_empty(query))
+    {
+        registry.rules.clear();
+    }
+    else
+    {
+        // The same query again replaces the old rule rather than piling up
+        registry.rules.erase(std::remove_if(registry.rules.begin(), registry.rules.end(), [&](const auto& rule) { return same_query(rule.first, query); }), registry.rules.end());
+        registry.rules.emplace_back(query, state);
+    }
+
+    size_t matched = 0;
+    for(CallSite* site : registry.sites)
+    {
+        if(site_matches(query, *site))
+        {
+            site->state.store(static_cast<uint32_t>(state), std::memory_order_relaxed);
+            matched++;
+        }
+    }
+
+    return matched;
+}
+
+void xlog_for_each_call_site(const std::function<void(XLog::CallSite&)>& func)
+{
+    auto& registry = call_site_registry();
+    std::scoped_lock lock(registry.mutex);
+
+    for(XLog::CallSite* site : registry.sites)
+    {
+        func(*site);
+    }
+}
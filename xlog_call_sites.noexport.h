@@ -0,0 +1,8 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <functional>
+
+// Calls 'func' for every registered call site, with the registry locked (so sites can't go away meanwhile)
+void xlog_for_each_call_site(const std::function<void(XLog::CallSite&)>& func);
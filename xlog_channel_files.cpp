@@ -0,0 +1,330 @@
+#include "xlog_channel_files.noexport.h"
+
+#include <cctype>
+#include <algorithm>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/log/attributes/value_extraction.hpp>
+
+#include "xlog_log_internal.noexport.h"
+
+// Channel names can be anything, file names can't
+static std::string channel_file_name(const std::string& channel)
+{
+    std::string name = channel.empty() ? "default" : channel;
+    for(char& c : name)
+    {
+        if(!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_' && c != '.')
+        {
+            c = '_';
+        }
+    }
+
+    return name + ".log";
+}
+
+xlog_channel_file_sink::xlog_channel_file_sink(std::string name, xlog_formatter_function formatter, const XLog::ChannelFilesSettings& settings) :
+    xlog_sink(std::move(name), formatter),
+    directory(settings.directory),
+    file_per_channel(settings.file_per_channel),
+    max_open_files(std::max<size_t>(settings.max_open_files, 1)),
+    buffer_size(std::max<size_t>(settings.buffer_size, 1)),
+    max_buffered(std::max(settings.max_buffered, settings.buffer_size)),
+    flush_interval(std::max(settings.flush_interval_ms, 1u))
+{
+    for(const auto& route : settings.routes)
+    {
+        if(!route.channel.empty() && route.channel.back() == '*')
+        {
+            prefix_routes.emplace_back(route.channel.substr(0, route.channel.size() - 1), route.file);
+        }
+        else
+        {
+            exact_routes.emplace(route.channel, route.file);
+        }
+    }
+
+    std::stable_sort(prefix_routes.begin(), prefix_routes.end(), [](const auto& a, const auto& b) { return a.first.size() > b.first.size(); });
+
+    thread = std::thread(&xlog_channel_file_sink::writer, this);
+}
+
+xlog_channel_file_sink::~xlog_channel_file_sink()
+{
+    {
+        std::scoped_lock lock(state_mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    thread.join();
+
+    for(auto* file : open_files)
+    {
+        ::close(file->fd);
+    }
+}
+
+bool xlog_channel_file_sink::consume(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    static const std::string NO_CHANNEL;
+    auto channel = boost::log::extract<std::string>("Channel", rec);
+
+    std::unique_lock lock(state_mutex);
+    const size_t id = resolve(channel.empty() ? NO_CHANNEL : channel.get());
+    if(id == NO_FILE)
+    {
+        unrouted.fetch_add(1, std::memory_order_relaxed);
+        unrouted_bytes.fetch_add(text->size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    // The writer (or the disk) can't keep up, dropping is better than holding up the logging thread
+    if(buffered + text->size() + 1 > max_buffered)
+    {
+        return false;
+    }
+
+    output_file& file = files[id];
+    const size_t before = file.buffer.size();
+    file.buffer.append(*text);
+    if(text->empty() || text->back() != '\n')
+    {
+        file.buffer.push_back('\n');
+    }
+    buffered += file.buffer.size() - before;
+
+    if(file.buffer.size() >= buffer_size && !file.ready)
+    {
+        file.ready = true;
+        ready.push_back(&file);
+
+        lock.unlock();
+        work_cv.notify_one();
+    }
+
+    return true;
+}
+
+void xlog_channel_file_sink::flush_unlocked()
+{
+    std::unique_lock lock(state_mutex);
+    const uint64_t target = ++flush_requested;
+    work_cv.notify_one();
+    written_cv.wait(lock, [&]() { return flush_completed >= target; });
+}
+
+double xlog_channel_file_sink::backlog()
+{
+    std::scoped_lock lock(state_mutex);
+    return static_cast<double>(buffered) / max_buffered;
+}
+
+XLog::SinkInformation xlog_channel_file_sink::information() const
+{
+    XLog::SinkInformation info = xlog_sink::information();
+
+    // Read after the totals, so at worst a record that's just been counted as unrouted is still in 'records'
+    const uint64_t skipped = unrouted.load(std::memory_order_relaxed);
+    const uint64_t skipped_bytes = unrouted_bytes.load(std::memory_order_relaxed);
+
+    info.unrouted = skipped;
+    info.records -= std::min(info.records, skipped);
+    info.bytes -= std::min(info.bytes, skipped_bytes);
+    return info;
+}
+
+size_t xlog_channel_file_sink::resolve(const std::string& channel)
+{
+    auto found = channel_files.find(channel);
+    if(found != channel_files.end())
+    {
+        return found->second;
+    }
+
+    size_t id = NO_FILE;
+    const std::string path = route_path(channel);
+    if(!path.empty())
+    {
+        // Several channels can share a file
+        auto existing = path_files.find(path);
+        if(existing != path_files.end())
+        {
+            id = existing->second;
+        }
+        else
+        {
+            id = files.size();
+            files.emplace_back().path = path;
+            path_files.emplace(path, id);
+        }
+    }
+
+    channel_files.emplace(channel, id);
+    return id;
+}
+
+std::string xlog_channel_file_sink::route_path(const std::string& channel) const
+{
+    std::string file;
+
+    auto exact = exact_routes.find(channel);
+    if(exact != exact_routes.end())
+    {
+        file = exact->second;
+    }
+    else
+    {
+        auto prefix = std::find_if(prefix_routes.begin(), prefix_routes.end(), [&](const auto& route)
+        {
+            return channel.compare(0, route.first.size(), route.first) == 0;
+        });
+
+        if(prefix != prefix_routes.end())
+        {
+            file = prefix->second;
+        }
+        else if(file_per_channel)
+        {
+            file = channel_file_name(channel);
+        }
+    }
+
+    if(file.empty())
+    {
+        return file;
+    }
+
+    return (std::filesystem::path(directory) / file).lexically_normal().string();
+}
+
+void xlog_channel_file_sink::writer()
+{
+    std::vector<output_file*> batch;
+    auto last_full_write = std::chrono::steady_clock::now();
+
+    std::unique_lock lock(state_mutex);
+    while(true)
+    {
+        work_cv.wait_for(lock, flush_interval, [this]() { return stopping || !ready.empty() || flush_requested != flush_completed; });
+
+        // Full buffers go straight away, everything else waits for a flush or the interval
+        const uint64_t flush_target = flush_requested;
+        const bool everything = stopping || flush_target != flush_completed || std::chrono::steady_clock::now() - last_full_write >= flush_interval;
+
+        batch.clear();
+        if(everything)
+        {
+            for(auto& file : files)
+            {
+                if(!file.buffer.empty())
+                {
+                    batch.push_back(&file);
+                }
+            }
+            last_full_write = std::chrono::steady_clock::now();
+        }
+        else
+        {
+            batch.swap(ready);
+        }
+        ready.clear();
+
+        for(auto* file : batch)
+        {
+            // Swapped rather than copied, both buffers keep their capacity
+            buffered -= file->buffer.size();
+            file->writing.swap(file->buffer);
+            file->ready = false;
+        }
+
+        lock.unlock();
+        for(auto* file : batch)
+        {
+            write_out(*file);
+        }
+        lock.lock();
+
+        if(everything)
+        {
+            flush_completed = flush_target;
+            written_cv.notify_all();
+
+            if(stopping)
+            {
+                break;
+            }
+        }
+    }
+}
+
+void xlog_channel_file_sink::write_out(output_file& file)
+{
+    const int fd = open_file(file);
+    if(fd < 0)
+    {
+        file.writing.clear();
+        return;
+    }
+
+    const char* data = file.writing.data();
+    size_t remaining = file.writing.size();
+    while(remaining != 0)
+    {
+        const ssize_t written = ::write(fd, data, remaining);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            if(!file.reported_error)
+            {
+                file.reported_error = true;
+                INTERNAL_ERRNO() << "; Failed to write to channel file '" << file.path << "'";
+            }
+            break;
+        }
+
+        data += written;
+        remaining -= static_cast<size_t>(written);
+    }
+
+    file.writing.clear();
+}
+
+int xlog_channel_file_sink::open_file(output_file& file)
+{
+    if(file.fd >= 0)
+    {
+        open_files.splice(open_files.begin(), open_files, file.lru);
+        return file.fd;
+    }
+
+    if(open_files.size() >= max_open_files)
+    {
+        output_file* oldest = open_files.back();
+        open_files.pop_back();
+        ::close(oldest->fd);
+        oldest->fd = -1;
+    }
+
+    file.fd = ::open(file.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(file.fd < 0)
+    {
+        // Only said once per file, it's likely to keep failing
+        if(!file.reported_error)
+        {
+            file.reported_error = true;
+            INTERNAL_ERRNO() << "; Failed to open channel file '" << file.path << "'";
+        }
+        return -1;
+    }
+
+    open_files.push_front(&file);
+    file.lru = open_files.begin();
+    return file.fd;
+}
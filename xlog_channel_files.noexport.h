@@ -0,0 +1,106 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+
+#include <list>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <condition_variable>
+
+/*
+ * Per-channel files
+ *
+ * One sink that sends each record to a file picked by its channel (ChannelFilesSettings::routes),
+ * rather than one Boost sink & filter per file, so the cost per record is a single lookup no
+ * matter how many channels or files there are. Which file a channel goes to is only worked out
+ * the first time the channel is seen.
+ *
+ * Logging threads just append to the file's buffer. A single writer thread writes buffers out
+ * once they fill up (or every flush_interval_ms), and keeps at most max_open_files descriptors
+ * open, closing the least recently written file when it needs another.
+ */
+class xlog_channel_file_sink final : public xlog_sink
+{
+public:
+    xlog_channel_file_sink(std::string name, xlog_formatter_function formatter, const XLog::ChannelFilesSettings& settings);
+
+    // Writes out whatever is left, then closes everything
+    ~xlog_channel_file_sink() override;
+
+    double backlog() override;
+
+    // Records whose channel has no file are taken (so they aren't dropped) but counted as unrouted rather than written
+    XLog::SinkInformation information() const override;
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
+
+    // Waits until everything buffered so far has been written
+    void flush_unlocked() override;
+
+    // Everything is behind 'state_mutex' anyway, and the writer thread can log (INTERNAL) while a flush waits for it
+    bool concurrent() const override { return true; }
+
+private:
+    static constexpr size_t NO_FILE = SIZE_MAX;
+
+    struct output_file
+    {
+        std::string path;
+
+        // Filled by consume(), under 'state_mutex'
+        std::string buffer;
+        bool ready = false;
+
+        // Writer thread only
+        std::string writing;
+        int fd = -1;
+        bool reported_error = false;
+        std::list<output_file*>::iterator lru;
+    };
+
+    // Needs 'state_mutex' held, NO_FILE if the channel isn't written anywhere
+    size_t resolve(const std::string& channel);
+    std::string route_path(const std::string& channel) const;
+
+    void writer();
+    void write_out(output_file& file);
+
+    // Opens the file if it isn't already (closing another if there are too many open), -1 if it can't be opened
+    int open_file(output_file& file);
+
+    const std::string directory;
+    const bool file_per_channel;
+    const size_t max_open_files;
+    const size_t buffer_size;
+    const size_t max_buffered;
+    const std::chrono::milliseconds flush_interval;
+
+    std::unordered_map<std::string, std::string> exact_routes;
+    std::vector<std::pair<std::string, std::string>> prefix_routes; // Longest first
+
+    std::mutex state_mutex;
+    std::condition_variable work_cv;
+    std::condition_variable written_cv;
+    bool stopping = false;
+
+    // A deque so a file never moves once the writer has a pointer to it
+    std::deque<output_file> files;
+    std::unordered_map<std::string, size_t> channel_files;
+    std::unordered_map<std::string, size_t> path_files;
+
+    std::vector<output_file*> ready;
+    size_t buffered = 0;
+    uint64_t flush_requested = 0;
+    uint64_t flush_completed = 0;
+
+    std::atomic<uint64_t> unrouted{0};
+    std::atomic<uint64_t> unrouted_bytes{0};
+
+    // Writer thread only, most recently written first
+    std::list<output_file*> open_files;
+
+    std::thread thread;
+};
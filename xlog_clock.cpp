@@ -0,0 +1,293 @@
+#include "xlog_clock.noexport.h"
+
+#include <cmath>
+#include <mutex>
+#include <atomic>
+
+#include <boost/log/attributes/attribute_value_impl.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#ifdef XLOG_CLOCK_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+#include "xlog_log_internal.noexport.h"
+
+namespace
+{
+    // How often the raw -> wall conversion is recalibrated against CLOCK_REALTIME
+    constexpr int64_t RECALIBRATION_INTERVAL_NS = 1000000000;
+
+    // How long setup() spins to get a first estimate of the TSC frequency
+    constexpr uint64_t INITIAL_CALIBRATION_NS = 2000000;
+
+    XLog::TimestampSource SOURCE = XLog::TimestampSource::WALL_CLOCK;
+
+    /*
+     * wall_ns = anchor_wall_ns + (raw - anchor_raw) * ns_per_tick
+     *
+     * Formatting can happen on any thread, so the anchor is published under a seqlock
+     * (readers retry if the sequence is odd or changed under them); recalibration
+     * itself is serialized by a mutex that readers only ever try_lock.
+     */
+    struct clock_calibration
+    {
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<uint64_t> anchor_raw{0};
+        std::atomic<int64_t> anchor_wall_ns{0};
+        std::atomic<double> ns_per_tick{1.0};
+
+        // First calibration point, the frequency estimate is taken over the whole time since then
+        uint64_t base_raw = 0;
+        uint64_t base_monotonic_ns = 0;
+
+        std::mutex recalibration_mutex;
+    };
+
+    clock_calibration CALIBRATION;
+
+    const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+
+    uint64_t read_raw()
+    {
+#ifdef XLOG_CLOCK_HAVE_TSC
+        if(SOURCE == XLog::TimestampSource::TSC)
+        {
+            return XLogClock::read_tsc();
+        }
+#endif
+        return XLogClock::read_monotonic();
+    }
+
+#ifdef XLOG_CLOCK_HAVE_TSC
+    // Only trust the TSC if it ticks at a constant rate through frequency & power state changes
+    bool tsc_is_invariant()
+    {
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        {
+            return false;
+        }
+
+        return (edx & (1u << 8)) != 0;
+    }
+#endif
+
+    void publish(uint64_t raw, int64_t wall_ns, double ns_per_tick)
+    {
+        CALIBRATION.sequence.fetch_add(1, std::memory_order_acq_rel);
+        CALIBRATION.anchor_raw.store(raw, std::memory_order_relaxed);
+        CALIBRATION.anchor_wall_ns.store(wall_ns, std::memory_order_relaxed);
+        CALIBRATION.ns_per_tick.store(ns_per_tick, std::memory_order_relaxed);
+        CALIBRATION.sequence.fetch_add(1, std::memory_order_release);
+    }
+
+    void recalibrate()
+    {
+        std::unique_lock lock(CALIBRATION.recalibration_mutex, std::try_to_lock);
+        if(!lock.owns_lock())
+        {
+            // Someone else is already on it
+            return;
+        }
+
+        const uint64_t monotonic_ns = XLogClock::read_monotonic();
+        const uint64_t raw = read_raw();
+        const int64_t wall_ns = XLogClock::read_realtime();
+
+        double ns_per_tick = 1.0;
+        if(SOURCE == XLog::TimestampSource::TSC && raw > CALIBRATION.base_raw)
+        {
+            ns_per_tick = static_cast<double>(monotonic_ns - CALIBRATION.base_monotonic_ns) / static_cast<double>(raw - CALIBRATION.base_raw);
+        }
+
+        publish(raw, wall_ns, ns_per_tick);
+    }
+
+    // Local time offset from UTC, cached per thread & refreshed every minute so DST changes are picked up
+    int64_t local_utc_offset_s(int64_t utc_seconds)
+    {
+        thread_local int64_t cached_minute = INT64_MIN;
+        thread_local int64_t cached_offset = 0;
+
+        const int64_t minute = utc_seconds / 60;
+        if(minute != cached_minute)
+        {
+            time_t t = static_cast<time_t>(utc_seconds);
+            tm local;
+            ::localtime_r(&t, &local);
+
+            cached_offset = local.tm_gmtoff;
+            cached_minute = minute;
+        }
+
+        return cached_offset;
+    }
+
+    template<typename ReadFunc>
+    class raw_timestamp_attribute_impl final : public boost::log::attribute::impl
+    {
+    public:
+        boost::log::attribute_value get_value() override
+        {
+            return boost::log::attribute_value(new boost::log::attributes::attribute_value_impl<XLogClock::RawTimestamp>(XLogClock::RawTimestamp{ ReadFunc{}() }));
+        }
+    };
+
+    struct monotonic_reader
+    {
+        uint64_t operator()() const { return XLogClock::read_monotonic(); }
+    };
+
+#ifdef XLOG_CLOCK_HAVE_TSC
+    struct tsc_reader
+    {
+        uint64_t operator()() const { return XLogClock::read_tsc(); }
+    };
+#endif
+}
+
+XLog::TimestampSource XLogClock::setup(XLog::TimestampSource requested)
+{
+    SOURCE = requested;
+
+    if(SOURCE == XLog::TimestampSource::TSC)
+    {
+#ifdef XLOG_CLOCK_HAVE_TSC
+        if(!tsc_is_invariant())
+        {
+            INTERNAL() << "TSC is not invariant on this CPU, using CLOCK_MONOTONIC for timestamps instead";
+            SOURCE = XLog::TimestampSource::MONOTONIC;
+        }
+#else
+        INTERNAL() << "TSC timestamps are not supported on this architecture, using CLOCK_MONOTONIC instead";
+        SOURCE = XLog::TimestampSource::MONOTONIC;
+#endif
+    }
+
+    if(SOURCE == XLog::TimestampSource::WALL_CLOCK)
+    {
+        return SOURCE;
+    }
+
+    CALIBRATION.base_monotonic_ns = read_monotonic();
+    CALIBRATION.base_raw = read_raw();
+
+    double ns_per_tick = 1.0;
+    if(SOURCE == XLog::TimestampSource::TSC)
+    {
+        // Spin briefly to get a first frequency estimate, recalibration refines it over a much longer window
+        uint64_t monotonic_ns = 0;
+        do
+        {
+            monotonic_ns = read_monotonic();
+        } while(monotonic_ns - CALIBRATION.base_monotonic_ns < INITIAL_CALIBRATION_NS);
+
+        ns_per_tick = static_cast<double>(monotonic_ns - CALIBRATION.base_monotonic_ns) / static_cast<double>(read_raw() - CALIBRATION.base_raw);
+    }
+
+    const uint64_t raw = read_raw();
+    publish(raw, XLogClock::read_realtime(), ns_per_tick);
+
+    return SOURCE;
+}
+
+XLog::TimestampSource XLogClock::source()
+{
+    return SOURCE;
+}
+
+boost::log::attribute XLogClock::make_raw_timestamp_attribute()
+{
+#ifdef XLOG_CLOCK_HAVE_TSC
+    if(SOURCE == XLog::TimestampSource::TSC)
+    {
+        return boost::log::attribute(new raw_timestamp_attribute_impl<tsc_reader>());
+    }
+#endif
+
+    return boost::log::attribute(new raw_timestamp_attribute_impl<monotonic_reader>());
+}
+
+int64_t XLogClock::to_wall_ns(RawTimestamp raw)
+{
+    while(true)
+    {
+        const uint32_t sequence = CALIBRATION.sequence.load(std::memory_order_acquire);
+        if(sequence & 1)
+        {
+            continue;
+        }
+
+        const uint64_t anchor_raw = CALIBRATION.anchor_raw.load(std::memory_order_relaxed);
+        const int64_t anchor_wall_ns = CALIBRATION.anchor_wall_ns.load(std::memory_order_relaxed);
+        const double ns_per_tick = CALIBRATION.ns_per_tick.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(CALIBRATION.sequence.load(std::memory_order_relaxed) != sequence)
+        {
+            continue;
+        }
+
+        const int64_t elapsed_ns = static_cast<int64_t>(std::llround(static_cast<double>(static_cast<int64_t>(raw.ticks - anchor_raw)) * ns_per_tick));
+        if(elapsed_ns > RECALIBRATION_INTERVAL_NS)
+        {
+            recalibrate();
+        }
+
+        return anchor_wall_ns + elapsed_ns;
+    }
+}
+
+boost::posix_time::ptime XLogClock::to_local_time(int64_t wall_ns)
+{
+    // Floor rather than truncate so times before the epoch don't go weird (they shouldn't happen anyway)
+    int64_t seconds = wall_ns / 1000000000;
+    int64_t remainder_ns = wall_ns % 1000000000;
+    if(remainder_ns < 0)
+    {
+        seconds--;
+        remainder_ns += 1000000000;
+    }
+
+    return EPOCH
+        + boost::posix_time::seconds(seconds + local_utc_offset_s(seconds))
+        + boost::posix_time::microseconds(remainder_ns / 1000);
+}
+
+int64_t XLogClock::record_wall_ns(const boost::log::record_view& rec)
+{
+    auto raw = boost::log::extract<RawTimestamp>(RAW_TIMESTAMP_ATTRIBUTE_NAME, rec);
+    if(!raw.empty())
+    {
+        return to_wall_ns(raw.get());
+    }
+
+    auto timestamp = boost::log::extract<boost::posix_time::ptime>("TimeStamp", rec);
+    if(timestamp.empty())
+    {
+        return read_realtime();
+    }
+
+    // TimeStamp is local time, close enough to undo the offset using the one at that (local) time
+    const int64_t local_ns = (timestamp.get() - EPOCH).total_nanoseconds();
+    return local_ns - local_utc_offset_s(local_ns / 1000000000) * 1000000000LL;
+}
+
+boost::posix_time::ptime XLog::GetRecordTime(const boost::log::record_view& rec)
+{
+    auto timestamp = boost::log::extract<boost::posix_time::ptime>("TimeStamp", rec);
+    if(!timestamp.empty())
+    {
+        return timestamp.get();
+    }
+
+    auto raw = boost::log::extract<XLogClock::RawTimestamp>(XLogClock::RAW_TIMESTAMP_ATTRIBUTE_NAME, rec);
+    if(raw.empty())
+    {
+        return boost::posix_time::microsec_clock::local_time();
+    }
+
+    return XLogClock::to_local_time(XLogClock::to_wall_ns(raw.get()));
+}
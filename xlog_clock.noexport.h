@@ -0,0 +1,72 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <time.h>
+
+#include <cstdint>
+
+#include <boost/log/attributes/attribute.hpp>
+#include <boost/log/core/record_view.hpp>
+
+/*
+ * Cheap record timestamps
+ *
+ * Rather than asking the OS for the (local) wall clock on every record, the hot path
+ * just reads a raw counter (the TSC, or CLOCK_MONOTONIC where the TSC isn't usable)
+ * and the conversion to wall-clock time happens when the record is formatted.
+ * The conversion is recalibrated against CLOCK_REALTIME about once a second, from
+ * whichever thread happens to be formatting at the time.
+ */
+namespace XLogClock
+{
+    // What gets attached to records as "RawTimeStamp"
+    struct RawTimestamp
+    {
+        uint64_t ticks;
+    };
+
+    constexpr char RAW_TIMESTAMP_ATTRIBUTE_NAME[] = "RawTimeStamp";
+
+    // Picks the source actually used for 'requested' (TSC falls back to MONOTONIC if it isn't invariant)
+    // and sets up the initial calibration, only call this once during initialization
+    XLog::TimestampSource setup(XLog::TimestampSource requested);
+
+    // The source picked by setup()
+    XLog::TimestampSource source();
+
+    // Attribute that attaches a RawTimestamp from the configured source to each record
+    boost::log::attribute make_raw_timestamp_attribute();
+
+    // Raw counter value -> nanoseconds since the epoch (UTC)
+    int64_t to_wall_ns(RawTimestamp raw);
+
+    // Nanoseconds since the epoch (UTC) -> local wall-clock time
+    boost::posix_time::ptime to_local_time(int64_t wall_ns);
+
+    // Nanoseconds since the epoch (UTC) a record was logged at, whatever the timestamp source is
+    int64_t record_wall_ns(const boost::log::record_view& rec);
+
+    inline int64_t read_realtime()
+    {
+        timespec ts;
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    inline uint64_t read_monotonic()
+    {
+        timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define XLOG_CLOCK_HAVE_TSC
+
+    inline uint64_t read_tsc()
+    {
+        return __builtin_ia32_rdtsc();
+    }
+#endif
+}
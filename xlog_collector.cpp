@@ -0,0 +1,292 @@
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <iostream>
+#include <filesystem>
+
+#include <signal.h>
+
+#include "xlog.h"
+#include "xlog_shm.noexport.h"
+#include "xlog_clock.noexport.h"
+#include "xlog_paths.noexport.h"
+
+#include <boost/log/core.hpp>
+#include <boost/log/attributes/constant.hpp>
+#include <boost/log/sources/record_ostream.hpp>
+
+#include <CLI/CLI.hpp>
+
+/*
+ * xlog-collector
+ *
+ * Drains the shared-memory rings (/tmp/xlog/<pid>-<progname>.ring) of every process using
+ * the shared-memory transport, and writes their records through our own sinks. Each record
+ * keeps its channel, severity, timestamp, source location & context, and gets the PID and
+ * program name of the process it came from added to its context.
+ *
+ * Rings are unlinked once their process has exited & they've been drained, so the
+ * collector can be (re)started at any time without losing what's already in them. A record
+ * the process died while writing is skipped, and the ones after it are still collected; only
+ * if it died in the instant between reserving an entry & writing its length is the rest of
+ * the ring lost.
+ */
+
+GET_LOGGER("xlog-collector")
+
+static std::atomic<bool> RUNNING = true;
+
+static void stop_collecting(int)
+{
+    RUNNING = false;
+}
+
+struct collected_ring
+{
+    std::unique_ptr<xlog_ring> ring;
+    int pid;
+    std::string program;
+    uint64_t dropped;
+};
+
+static bool process_is_alive(int pid)
+{
+    return ::kill(pid, 0) == 0 || errno == EPERM;
+}
+
+// Push a record from another process into our own logging core, as if it had been logged here
+static void replay_record(const collected_ring& source, const xlog_ring_decoded& decoded)
+{
+    XLog::ScopedContext pid_ctx("pid", source.pid);
+    XLog::ScopedContext program_ctx("program", source.program);
+
+    // Not ScopedContext since there can be up to MAX_DEPTH of them (and the stack will just ignore any extras)
+    XLog::ContextStack& context = XLog::GetThreadContext();
+    size_t pushed = 0;
+    for(size_t i = 0; i < decoded.context_count; i++)
+    {
+        if(context.push(decoded.context[i][0], decoded.context[i][1]))
+        {
+            pushed++;
+        }
+    }
+
+    // Source attributes win over our own global ones (TimeStamp, SourceLocation)
+    boost::log::attribute_set attributes;
+    attributes.insert("Channel", boost::log::attributes::constant<std::string>(std::string(decoded.channel)));
+    attributes.insert("Severity", boost::log::attributes::constant<XLog::Severity>(decoded.severity));
+    attributes.insert("TimeStamp", boost::log::attributes::constant<boost::posix_time::ptime>(XLogClock::to_local_time(decoded.wall_ns)));
+    if(!decoded.file.empty())
+    {
+        attributes.insert(REMOTE_SOURCE_LOCATION_ATTRIBUTE_NAME, boost::log::attributes::constant<xlog_remote_source_location>(xlog_remote_source_location
+        {
+            .file = std::string(decoded.file),
+            .function = std::string(decoded.function),
+            .line = decoded.line
+        }));
+    }
+
+    auto core = boost::log::core::get();
+    boost::log::record rec = core->open_record(attributes);
+    if(rec)
+    {
+        boost::log::record_ostream stream(rec);
+        stream << decoded.message;
+        stream.flush();
+        core->push_record(std::move(rec));
+    }
+
+    for(size_t i = 0; i < pushed; i++)
+    {
+        context.pop();
+    }
+}
+
+// Pick up any rings we aren't draining yet
+static void scan_for_rings(std::map<std::string, collected_ring>& rings)
+{
+    std::error_code err;
+    auto itr = std::filesystem::directory_iterator(BASE_RUNTIME_PATH, err);
+    if(err)
+    {
+        return;
+    }
+
+    for(const auto& file : itr)
+    {
+        if(file.path().extension() != ".ring" || rings.count(file.path()) != 0)
+        {
+            continue;
+        }
+
+        auto ring = xlog_ring::open(file.path());
+        if(!ring)
+        {
+            continue;
+        }
+
+        const xlog_ring_header& header = ring->header();
+        collected_ring collected
+        {
+            .ring = std::move(ring),
+            .pid = header.pid,
+            .program = std::string(header.program, strnlen(header.program, sizeof(header.program))),
+            .dropped = 0
+        };
+
+        LOG_DEBUG2() << "Collecting from " << collected.program << " (PID " << collected.pid << ")";
+        rings.emplace(file.path(), std::move(collected));
+    }
+}
+
+// Returns how many records were drained, removes rings belonging to processes that have exited
+static size_t drain_rings(std::map<std::string, collected_ring>& rings, size_t batch)
+{
+    size_t drained = 0;
+
+    for(auto itr = rings.begin(); itr != rings.end();)
+    {
+        collected_ring& collected = itr->second;
+        xlog_ring& ring = *collected.ring;
+
+        const size_t count = ring.drain([&collected](const uint8_t* data, size_t length)
+        {
+            xlog_ring_decoded decoded;
+            if(decode_ring_record(data, length, decoded))
+            {
+                replay_record(collected, decoded);
+            }
+        }, batch);
+        drained += count;
+
+        const uint64_t dropped = ring.header().dropped.load(std::memory_order_relaxed);
+        if(dropped != collected.dropped)
+        {
+            LOG_WARN2() << collected.program << " (PID " << collected.pid << ") dropped " << (dropped - collected.dropped) << " records, its ring was full";
+            collected.dropped = dropped;
+        }
+
+        if(ring.corrupt())
+        {
+            LOG_ERROR2() << "Ring of " << collected.program << " (PID " << collected.pid << ") is corrupt, ignoring the rest of it";
+        }
+
+        // Checked after draining, so anything written just before the process exited is still picked up
+        if(count == 0 && !process_is_alive(collected.pid))
+        {
+            // A reserved entry that never got published (the process died mid-record) stops the drain, step over it & keep going
+            if(!ring.empty() && ring.skip_unpublished())
+            {
+                LOG_WARN2() << collected.program << " (PID " << collected.pid << ") exited part way through writing a record, skipped it";
+                ++itr;
+                continue;
+            }
+
+            if(!ring.empty())
+            {
+                LOG_WARN2() << collected.program << " (PID " << collected.pid << ") exited part way through reserving a record, the rest of its ring is lost";
+            }
+
+            LOG_DEBUG2() << "Finished collecting from " << collected.program << " (PID " << collected.pid << ")";
+
+            std::error_code err;
+            std::filesystem::remove(itr->first, err);
+            itr = rings.erase(itr);
+            continue;
+        }
+
+        ++itr;
+    }
+
+    return drained;
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app{"xlog Shared-Memory Log Collector"};
+
+    bool json = false;
+    bool no_console = false;
+    std::string file_path;
+    bool once = false;
+    int poll_ms = 5;
+    int scan_ms = 500;
+    size_t batch = 256;
+#ifdef XLOG_USE_SYSLOG_LOG
+    bool use_syslog = false;
+#endif
+#ifdef XLOG_USE_JOURNAL_LOG
+    bool use_journal = false;
+#endif
+
+    app.add_flag("--json", json, "Write records as JSON objects rather than text");
+    app.add_flag("--no-console", no_console, "Don't write records to the console");
+    app.add_option("-f, --file", file_path, "Append records to this file");
+#ifdef XLOG_USE_SYSLOG_LOG
+    app.add_flag("--syslog", use_syslog, "Send records to syslog");
+#endif
+#ifdef XLOG_USE_JOURNAL_LOG
+    app.add_flag("--journal", use_journal, "Send records to the journal");
+#endif
+    app.add_flag("--once", once, "Drain whatever is in the rings right now, then exit");
+    app.add_option("--poll-ms", poll_ms, "How long to sleep when every ring is empty");
+    app.add_option("--scan-ms", scan_ms, "How often to look for new rings");
+    app.add_option("--batch", batch, "Maximum records drained from one ring before moving to the next");
+
+    CLI11_PARSE(app, argc, argv);
+
+    XLog::LogSettings settings;
+    settings.s_format = json ? XLog::OutputFormat::JSON : XLog::OutputFormat::TEXT;
+    settings.s_console.enabled = !no_console;
+    if(!file_path.empty())
+    {
+        settings.s_file.enabled = true;
+        settings.s_file.path = file_path;
+    }
+#ifdef XLOG_USE_SYSLOG_LOG
+    settings.s_syslog.enabled = use_syslog;
+#endif
+#ifdef XLOG_USE_JOURNAL_LOG
+    settings.s_journal.enabled = use_journal;
+#endif
+
+    XLog::InitializeLogging(settings);
+
+    std::signal(SIGINT, stop_collecting);
+    std::signal(SIGTERM, stop_collecting);
+
+    std::map<std::string, collected_ring> rings;
+    auto last_scan = std::chrono::steady_clock::time_point{};
+
+    while(RUNNING)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if(now - last_scan >= std::chrono::milliseconds(scan_ms))
+        {
+            scan_for_rings(rings);
+            last_scan = now;
+        }
+
+        if(drain_rings(rings, batch) == 0)
+        {
+            if(once)
+            {
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+        }
+    }
+
+    // Whatever is left over from the processes we know about
+    while(drain_rings(rings, batch) != 0)
+    {
+    }
+
+    boost::log::core::get()->flush();
+    XLog::ShutownLogging();
+
+    return 0;
+}
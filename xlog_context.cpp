@@ -0,0 +1,129 @@
+#include "xlog.h"
+
+#include <cstring>
+
+#include <boost/log/attributes/attribute.hpp>
+#include <boost/log/attributes/attribute_value_impl.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+
+// Name of the (thread) attribute that snapshots each thread's context stack
+static const char CONTEXT_ATTRIBUTE_NAME[] = "Context";
+
+/*
+ * Boost asks a thread attribute for its value when a record is opened, on the thread that's
+ * logging, so that's when the stack is copied. The copy is kept until the stack changes, so
+ * records logged under the same context share it (and only pay for a reference count), and
+ * an empty stack gives no value at all.
+ */
+class context_attribute_impl : public boost::log::attribute::impl
+{
+public:
+    explicit context_attribute_impl(const XLog::ContextStack& stack) : stack(stack)
+    {
+    }
+
+    boost::log::attribute_value get_value() override
+    {
+        if(stack.empty())
+        {
+            return boost::log::attribute_value();
+        }
+
+        if(!snapshot || snapshot_generation != stack.generation())
+        {
+            snapshot = new boost::log::attributes::attribute_value_impl<XLog::ContextSnapshot>(XLog::ContextSnapshot(stack.begin(), stack.end()));
+            snapshot_generation = stack.generation();
+        }
+
+        return boost::log::attribute_value(snapshot);
+    }
+
+private:
+    const XLog::ContextStack& stack;
+
+    boost::intrusive_ptr<boost::log::attribute_value::impl> snapshot;
+    uint64_t snapshot_generation = 0;
+};
+
+bool XLog::ContextStack::push(std::string_view key, std::string_view value) noexcept
+{
+    if(depth >= MAX_DEPTH)
+    {
+        return false;
+    }
+
+    ContextEntry& entry = entries[depth];
+
+    entry.key_length = static_cast<uint8_t>(std::min(key.size(), ContextEntry::MAX_KEY_LENGTH));
+    std::memcpy(entry.key_data, key.data(), entry.key_length);
+
+    entry.value_length = static_cast<uint8_t>(std::min(value.size(), ContextEntry::MAX_VALUE_LENGTH));
+    std::memcpy(entry.value_data, value.data(), entry.value_length);
+
+    depth++;
+    changes++;
+    return true;
+}
+
+void XLog::ContextStack::pop() noexcept
+{
+    if(depth > 0)
+    {
+        depth--;
+        changes++;
+    }
+}
+
+XLog::ContextStack& XLog::GetThreadContext() noexcept
+{
+    thread_local ContextStack stack;
+
+    // Registered once per thread, the attribute only ever runs on this thread
+    thread_local bool registered = []()
+    {
+        boost::log::core::get()->add_thread_attribute(CONTEXT_ATTRIBUTE_NAME, boost::log::attribute(new context_attribute_impl(stack)));
+        return true;
+    }();
+    (void)registered;
+
+    return stack;
+}
+
+const XLog::ContextSnapshot* XLog::GetRecordContext(const boost::log::record_view& rec) noexcept
+{
+    auto context = boost::log::extract<ContextSnapshot>(CONTEXT_ATTRIBUTE_NAME, rec);
+    if(context.empty())
+    {
+        return nullptr;
+    }
+
+    return context.get_ptr();
+}
+
+XLog::ContextSnapshot XLog::CaptureContext()
+{
+    const ContextStack& stack = GetThreadContext();
+    return ContextSnapshot(stack.begin(), stack.end());
+}
+
+XLog::ScopedContextRestore::ScopedContextRestore(const ContextSnapshot& snapshot) noexcept
+{
+    ContextStack& stack = GetThreadContext();
+    for(const auto& entry : snapshot)
+    {
+        if(!stack.push(entry.key(), entry.value()))
+        {
+            break;
+        }
+        pushed++;
+    }
+}
+
+XLog::ScopedContextRestore::~ScopedContextRestore()
+{
+    ContextStack& stack = GetThreadContext();
+    for(size_t i = 0; i < pushed; i++)
+    {
+        stack.pop();
+    }
+}
@@ -0,0 +1,190 @@
+#include "xlog_control.noexport.h"
+
+#include <deque>
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xlog_log_internal.noexport.h"
+
+extern const char* __progname;
+
+namespace
+{
+    // Used until (unless) the block is shared, constant initialized (zeroed) so loggers created during static initialization can use it
+    xlog_control_block LOCAL_BLOCK{};
+
+    std::atomic<xlog_control_block*> CURRENT_BLOCK{&LOCAL_BLOCK};
+
+    // Path of the shared mapping, empty if the block isn't shared
+    std::string SHARED_PATH;
+
+    // Slots for channels that don't fit in the block, a deque so they never move
+    std::deque<std::atomic<uint32_t>>& private_slots()
+    {
+        static std::deque<std::atomic<uint32_t>> slots;
+        return slots;
+    }
+}
+
+xlog_control_channel* xlog_control_block::find_channel(std::string_view channel)
+{
+    const uint32_t count = std::min<uint32_t>(channel_count.load(std::memory_order_acquire), XLOG_CONTROL_MAX_CHANNELS);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(channels[i].get_name() == channel)
+        {
+            return &channels[i];
+        }
+    }
+
+    return nullptr;
+}
+
+xlog_control_block& XLogControl::block()
+{
+    return *CURRENT_BLOCK.load(std::memory_order_acquire);
+}
+
+std::atomic<uint32_t>* XLogControl::add_channel(std::string_view channel)
+{
+    xlog_control_block& current = block();
+    const uint32_t default_level = current.default_level.load(std::memory_order_relaxed);
+    const uint32_t count = current.channel_count.load(std::memory_order_relaxed);
+
+    if(count >= XLOG_CONTROL_MAX_CHANNELS || channel.size() > xlog_control_channel::MAX_NAME_LENGTH)
+    {
+        INTERNAL() << "Channel '" << channel << "' doesn't fit in the control block, its level can only be changed from this process";
+        return &private_slots().emplace_back(default_level);
+    }
+
+    xlog_control_channel& slot = current.channels[count];
+    slot.level.store(default_level, std::memory_order_relaxed);
+    slot.name_length = static_cast<uint32_t>(channel.size());
+    std::memcpy(slot.name, channel.data(), channel.size());
+
+    // Published after the slot is filled in, so anyone reading the count sees a complete slot
+    current.channel_count.store(count + 1, std::memory_order_release);
+    changed();
+
+    return &slot.level;
+}
+
+void XLogControl::changed()
+{
+    block().generation.fetch_add(1, std::memory_order_release);
+}
+
+bool XLogControl::share(const std::string& path, bool allow_anyone_access)
+{
+    // Replace rather than reuse, a leftover file with the same name belonged to a process that had our PID
+    ::unlink(path.c_str());
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(fd < 0)
+    {
+        INTERNAL_ERRNO() << "; Failed to create control block '" << path << "'";
+        return false;
+    }
+
+    // xlog-manager has to be able to write to it
+    if(allow_anyone_access && ::fchmod(fd, (S_IRUSR | S_IWUSR) | (S_IRGRP | S_IWGRP) | (S_IROTH | S_IWOTH)) < 0)
+    {
+        INTERNAL_ERRNO() << "; Failed to modify permissions for control block";
+    }
+
+    if(::ftruncate(fd, sizeof(xlog_control_block)) < 0)
+    {
+        INTERNAL_ERRNO() << "; Failed to resize control block";
+        ::close(fd);
+        ::unlink(path.c_str());
+        return false;
+    }
+
+    void* mapping = ::mmap(nullptr, sizeof(xlog_control_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        INTERNAL_ERRNO() << "; Failed to map control block";
+        ::unlink(path.c_str());
+        return false;
+    }
+
+    const xlog_control_block& local = block();
+    auto* shared = static_cast<xlog_control_block*>(mapping);
+
+    shared->version = XLOG_CONTROL_VERSION;
+    shared->pid = ::getpid();
+    std::strncpy(shared->program, __progname, sizeof(shared->program) - 1);
+    shared->default_level.store(local.default_level.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    const uint32_t count = local.channel_count.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        shared->channels[i].level.store(local.channels[i].level.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        shared->channels[i].name_length = local.channels[i].name_length;
+        std::memcpy(shared->channels[i].name, local.channels[i].name, local.channels[i].name_length);
+    }
+    shared->channel_count.store(count, std::memory_order_relaxed);
+
+    // Written last, xlog-manager ignores the block until the magic is there
+    std::atomic_thread_fence(std::memory_order_release);
+    shared->magic = XLOG_CONTROL_MAGIC;
+
+    SHARED_PATH = path;
+    CURRENT_BLOCK.store(shared, std::memory_order_release);
+    return true;
+}
+
+void XLogControl::unlink_shared()
+{
+    if(!SHARED_PATH.empty())
+    {
+        ::unlink(SHARED_PATH.c_str());
+        SHARED_PATH.clear();
+    }
+}
+
+std::unique_ptr<xlog_control_mapping> xlog_control_mapping::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat info;
+    if(::fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) != sizeof(xlog_control_block))
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void* mapping = ::mmap(nullptr, sizeof(xlog_control_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    auto* mapped = static_cast<xlog_control_block*>(mapping);
+    const bool has_magic = mapped->magic == XLOG_CONTROL_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if(!has_magic || mapped->version != XLOG_CONTROL_VERSION)
+    {
+        ::munmap(mapping, sizeof(xlog_control_block));
+        return nullptr;
+    }
+
+    return std::unique_ptr<xlog_control_mapping>(new xlog_control_mapping(mapped));
+}
+
+xlog_control_mapping::~xlog_control_mapping()
+{
+    ::munmap(mapped, sizeof(xlog_control_block));
+}
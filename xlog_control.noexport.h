@@ -0,0 +1,101 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Channel levels ("control block")
+ *
+ * Every channel gets a slot holding its current level, which its loggers read directly
+ * (see XLog::LoggerType::accepts). The block starts out in process memory, and when the
+ * shared-memory control plane is enabled InitializeLogging moves it into a file mapped
+ * from /tmp/xlog/<pid>-<progname>.control, so xlog-manager can read and change levels by
+ * writing to the mapping without any RPCs.
+ *
+ * Only the owning process adds channels (appending the slot, then publishing the new
+ * channel_count), but anyone may store a level. Whoever changes something bumps the
+ * generation afterwards, so readers can tell whether what they read is still current.
+ */
+
+constexpr uint32_t XLOG_CONTROL_MAGIC = 0x4c544358; // "XCTL"
+constexpr uint32_t XLOG_CONTROL_VERSION = 1;
+
+constexpr size_t XLOG_CONTROL_MAX_CHANNELS = 1024;
+
+struct xlog_control_channel
+{
+    static constexpr size_t MAX_NAME_LENGTH = 120;
+
+    std::atomic<uint32_t> level; // XLog::Severity
+    uint32_t name_length;
+    char name[MAX_NAME_LENGTH];
+
+    std::string_view get_name() const { return { name, name_length }; }
+};
+
+static_assert(sizeof(xlog_control_channel) == 128);
+
+struct xlog_control_block
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    char program[64];
+
+    alignas(64) std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> default_level; // XLog::Severity, given to new channels
+    std::atomic<uint32_t> channel_count;
+
+    alignas(64) xlog_control_channel channels[XLOG_CONTROL_MAX_CHANNELS];
+
+    // Slot for a channel, nullptr if it doesn't have one
+    xlog_control_channel* find_channel(std::string_view channel);
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Control block levels must be lock-free to be shared between processes");
+
+namespace XLogControl
+{
+    // The block currently in use (either process memory or the mapping)
+    xlog_control_block& block();
+
+    // Slot for a new channel, which starts at the current default level
+    // Channels that don't fit in the block (too many, or the name is too long) get a private slot instead,
+    // which works the same but can't be seen from outside the process
+    // Not thread safe, the caller serializes adding channels
+    std::atomic<uint32_t>* add_channel(std::string_view channel);
+
+    // Let anyone watching the block know it has changed
+    void changed();
+
+    // Copies the block into a new shared mapping and uses that from then on, false if it couldn't be set up
+    // Slots keep their index, so existing loggers are pointed at the same slot in the new block afterwards (XLog::ChannelLevel)
+    // Not thread safe with add_channel()
+    bool share(const std::string& path, bool allow_anyone_access);
+
+    // Removes the shared mapping's file (the mapping itself stays, loggers still point into it)
+    void unlink_shared();
+}
+
+// Another process's control block, used by xlog-manager
+class xlog_control_mapping
+{
+public:
+    static std::unique_ptr<xlog_control_mapping> open(const std::string& path);
+    ~xlog_control_mapping();
+
+    xlog_control_mapping(const xlog_control_mapping&) = delete;
+    xlog_control_mapping& operator=(const xlog_control_mapping&) = delete;
+
+    xlog_control_block& block() const { return *mapped; }
+
+private:
+    explicit xlog_control_mapping(xlog_control_block* mapped) : mapped(mapped) {}
+
+    xlog_control_block* const mapped;
+};
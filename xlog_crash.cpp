@@ -0,0 +1,533 @@
+#include "xlog_crash.noexport.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
+
+#include <ctime>
+#include <cerrno>
+#include <string>
+#include <iterator>
+#include <atomic>
+#include <cstring>
+#include <climits>
+
+#include <boost/log/core.hpp>
+
+static constexpr int HANDLED_SIGNALS[] = { SIGSEGV, SIGBUS, SIGABRT, SIGFPE };
+static constexpr size_t MAX_FRAMES = 64;
+static constexpr size_t MAX_MODULE_PATH = 256;
+static constexpr size_t ALT_STACK_SIZE = 64 * 1024;
+
+// Everything the handler touches is set up (and sized) in advance
+static struct sigaction PREVIOUS_ACTIONS[std::size(HANDLED_SIGNALS)];
+static char CRASH_PATH[PATH_MAX];
+static bool WRITE_STDERR = true;
+static bool FLUSH_SINKS = false;
+static unsigned int FLUSH_DEADLINE_S = 2;
+static long UTC_OFFSET_S = 0;
+
+static bool INSTALLED = false;
+static std::atomic<bool> SINKS_RUNNING{false};
+static std::atomic<pid_t> CRASHING_THREAD{0};
+
+static void* FRAMES[MAX_FRAMES];
+static uintptr_t FRAME_BASES[MAX_FRAMES];
+static char FRAME_MODULES[MAX_FRAMES][MAX_MODULE_PATH];
+
+static char MAPS_CHUNK[4096];
+static char MAPS_LINE[PATH_MAX + 128];
+static char REPORT[MAX_FRAMES * (MAX_MODULE_PATH + 64) + 512];
+
+// Appends to REPORT, anything past the end is cut off
+struct crash_report
+{
+    size_t size = 0;
+
+    void append(const char* text, size_t length)
+    {
+        const size_t room = sizeof(REPORT) - size;
+        length = length < room ? length : room;
+        std::memcpy(REPORT + size, text, length);
+        size += length;
+    }
+
+    void append(const char* text)
+    {
+        append(text, std::strlen(text));
+    }
+
+    void append_char(char c)
+    {
+        append(&c, 1);
+    }
+
+    void append_unsigned(uint64_t value, size_t min_digits = 1)
+    {
+        char digits[20];
+        size_t count = 0;
+        do
+        {
+            digits[count++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while(value != 0 && count < sizeof(digits));
+
+        for(; min_digits > count; min_digits--)
+        {
+            append_char('0');
+        }
+        while(count != 0)
+        {
+            append_char(digits[--count]);
+        }
+    }
+
+    void append_signed(int64_t value)
+    {
+        if(value < 0)
+        {
+            append_char('-');
+            append_unsigned(static_cast<uint64_t>(-(value + 1)) + 1);
+        }
+        else
+        {
+            append_unsigned(static_cast<uint64_t>(value));
+        }
+    }
+
+    void append_hex(uintptr_t value)
+    {
+        static const char HEX[] = "0123456789abcdef";
+
+        char digits[sizeof(uintptr_t) * 2];
+        size_t count = 0;
+        do
+        {
+            digits[count++] = HEX[value & 0xF];
+            value >>= 4;
+        } while(value != 0);
+
+        append("0x");
+        while(count != 0)
+        {
+            append_char(digits[--count]);
+        }
+    }
+};
+
+static const char* signal_name(int sig)
+{
+    switch(sig)
+    {
+        case SIGSEGV:
+            return "SIGSEGV";
+        case SIGBUS:
+            return "SIGBUS";
+        case SIGABRT:
+            return "SIGABRT";
+        case SIGFPE:
+            return "SIGFPE";
+        default:
+            return "signal";
+    }
+}
+
+// Same layout as boost::posix_time::to_simple_string, in local time as of setup
+static void append_timestamp(crash_report& report, const timespec& now)
+{
+    static const char* const MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+    const int64_t seconds = static_cast<int64_t>(now.tv_sec) + UTC_OFFSET_S;
+    int64_t days = seconds / 86400;
+    int64_t second_of_day = seconds % 86400;
+    if(second_of_day < 0)
+    {
+        second_of_day += 86400;
+        days--;
+    }
+
+    // Days since 1970-01-01 to a civil date (H. Hinnant's days_from_civil, inverted)
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const int64_t day_of_era = days - era * 146097;
+    const int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const int64_t mp = (5 * day_of_year + 2) / 153;
+    const int64_t day = day_of_year - (153 * mp + 2) / 5 + 1;
+    const int64_t month = mp < 10 ? mp + 3 : mp - 9;
+    const int64_t year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+
+    report.append_signed(year);
+    report.append_char('-');
+    report.append(MONTHS[month - 1]);
+    report.append_char('-');
+    report.append_unsigned(static_cast<uint64_t>(day), 2);
+    report.append_char(' ');
+    report.append_unsigned(static_cast<uint64_t>(second_of_day / 3600), 2);
+    report.append_char(':');
+    report.append_unsigned(static_cast<uint64_t>(second_of_day / 60 % 60), 2);
+    report.append_char(':');
+    report.append_unsigned(static_cast<uint64_t>(second_of_day % 60), 2);
+    report.append_char('.');
+    report.append_unsigned(static_cast<uint64_t>(now.tv_nsec / 1000), 6);
+}
+
+static uintptr_t parse_hex(const char*& text)
+{
+    uintptr_t value = 0;
+    while(true)
+    {
+        const char c = *text;
+        if(c >= '0' && c <= '9')
+        {
+            value = value * 16 + static_cast<uintptr_t>(c - '0');
+        }
+        else if(c >= 'a' && c <= 'f')
+        {
+            value = value * 16 + static_cast<uintptr_t>(c - 'a' + 10);
+        }
+        else
+        {
+            return value;
+        }
+        text++;
+    }
+}
+
+static const char* skip_field(const char* text)
+{
+    while(*text != ' ' && *text != '\0')
+    {
+        text++;
+    }
+    while(*text == ' ')
+    {
+        text++;
+    }
+    return text;
+}
+
+// "start-end perms offset dev inode    path", fills in the frames that fall within it
+static void match_maps_line(const char* line, size_t frames)
+{
+    const char* cursor = line;
+    const uintptr_t start = parse_hex(cursor);
+    if(*cursor != '-')
+    {
+        return;
+    }
+    cursor++;
+    const uintptr_t end = parse_hex(cursor);
+
+    cursor = skip_field(cursor);                 // -> perms
+    cursor = skip_field(cursor);                 // -> offset
+    const uintptr_t offset = parse_hex(cursor);
+    cursor = skip_field(cursor);                 // -> dev
+    cursor = skip_field(cursor);                 // -> inode
+    const char* path = skip_field(cursor);
+
+    for(size_t i = 0; i < frames; i++)
+    {
+        const uintptr_t address = reinterpret_cast<uintptr_t>(FRAMES[i]);
+        if(FRAME_MODULES[i][0] != '\0' || address < start || address >= end || *path == '\0')
+        {
+            continue;
+        }
+
+        FRAME_BASES[i] = start - offset;
+        const size_t length = std::strlen(path);
+        const size_t copied = length < MAX_MODULE_PATH - 1 ? length : MAX_MODULE_PATH - 1;
+        std::memcpy(FRAME_MODULES[i], path, copied);
+        FRAME_MODULES[i][copied] = '\0';
+    }
+}
+
+// /proc/self/maps is read a chunk at a time, lines longer than MAPS_LINE are cut short
+static void find_frame_modules(size_t frames)
+{
+    for(size_t i = 0; i < frames; i++)
+    {
+        FRAME_BASES[i] = 0;
+        FRAME_MODULES[i][0] = '\0';
+    }
+
+    const int fd = ::open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return;
+    }
+
+    size_t line_size = 0;
+    while(true)
+    {
+        const ssize_t got = ::read(fd, MAPS_CHUNK, sizeof(MAPS_CHUNK));
+        if(got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(got <= 0)
+        {
+            break;
+        }
+
+        for(ssize_t i = 0; i < got; i++)
+        {
+            if(MAPS_CHUNK[i] == '\n')
+            {
+                MAPS_LINE[line_size] = '\0';
+                match_maps_line(MAPS_LINE, frames);
+                line_size = 0;
+            }
+            else if(line_size < sizeof(MAPS_LINE) - 1)
+            {
+                MAPS_LINE[line_size++] = MAPS_CHUNK[i];
+            }
+        }
+    }
+
+    ::close(fd);
+}
+
+static void write_all(int fd, const char* data, size_t size)
+{
+    while(size != 0)
+    {
+        const ssize_t written = ::write(fd, data, size);
+        if(written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(written <= 0)
+        {
+            return;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+static uintptr_t context_pc(void* ucontext)
+{
+    const ucontext_t* context = static_cast<const ucontext_t*>(ucontext);
+#if defined(__x86_64__)
+    return static_cast<uintptr_t>(context->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__i386__)
+    return static_cast<uintptr_t>(context->uc_mcontext.gregs[REG_EIP]);
+#elif defined(__aarch64__)
+    return static_cast<uintptr_t>(context->uc_mcontext.pc);
+#else
+    (void)context;
+    return 0;
+#endif
+}
+
+static void crash_handler(int sig, siginfo_t* info, void* ucontext)
+{
+    const int saved_errno = errno;
+    const pid_t tid = static_cast<pid_t>(::syscall(SYS_gettid));
+
+    // Only the first thread to crash writes a report, the rest wait for it to end the process
+    pid_t expected = 0;
+    if(!CRASHING_THREAD.compare_exchange_strong(expected, tid) && expected != tid)
+    {
+        while(true)
+        {
+            ::pause();
+        }
+    }
+
+    if(expected == 0)
+    {
+        timespec now{};
+        ::clock_gettime(CLOCK_REALTIME, &now);
+
+        // Frames before the one that was interrupted are the handler & the kernel's trampoline
+        const int captured = ::backtrace(FRAMES, static_cast<int>(MAX_FRAMES));
+        size_t frames = captured > 0 ? static_cast<size_t>(captured) : 0;
+        const uintptr_t pc = context_pc(ucontext);
+        for(size_t i = 0; pc != 0 && i < frames; i++)
+        {
+            if(reinterpret_cast<uintptr_t>(FRAMES[i]) == pc)
+            {
+                std::memmove(FRAMES, FRAMES + i, (frames - i) * sizeof(void*));
+                frames -= i;
+                break;
+            }
+        }
+        find_frame_modules(frames);
+
+        // si_addr is only the faulting address when the kernel raised it, otherwise it's who sent it (i.e. abort())
+        const bool sent = info->si_code <= 0;
+        const uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+
+        crash_report report;
+        append_timestamp(report, now);
+        report.append(" <FATAL> [xlog] - Caught ");
+        report.append(signal_name(sig));
+        report.append(" (code ");
+        report.append_signed(info->si_code);
+        if(sent)
+        {
+            report.append(") sent by pid ");
+            report.append_signed(info->si_pid);
+        }
+        else
+        {
+            report.append(") at ");
+            report.append_hex(address);
+        }
+        report.append(", pid ");
+        report.append_unsigned(static_cast<uint64_t>(::getpid()));
+        report.append(", thread ");
+        report.append_unsigned(static_cast<uint64_t>(tid));
+        report.append("\ncrash signal=");
+        report.append_signed(sig);
+        report.append(" code=");
+        report.append_signed(info->si_code);
+        if(sent)
+        {
+            report.append(" sender=");
+            report.append_signed(info->si_pid);
+        }
+        else
+        {
+            report.append(" address=");
+            report.append_hex(address);
+        }
+        report.append(" pid=");
+        report.append_unsigned(static_cast<uint64_t>(::getpid()));
+        report.append(" tid=");
+        report.append_unsigned(static_cast<uint64_t>(tid));
+        report.append(" time=");
+        report.append_signed(static_cast<int64_t>(now.tv_sec));
+        report.append_char('\n');
+
+        for(size_t i = 0; i < frames; i++)
+        {
+            report.append("frame ");
+            report.append_unsigned(i);
+            report.append_char(' ');
+            report.append_hex(reinterpret_cast<uintptr_t>(FRAMES[i]));
+            report.append_char(' ');
+            report.append_hex(FRAME_BASES[i]);
+            report.append_char(' ');
+            report.append(FRAME_MODULES[i][0] != '\0' ? FRAME_MODULES[i] : "?");
+            report.append_char('\n');
+        }
+        report.append("end\n");
+
+        if(WRITE_STDERR)
+        {
+            write_all(STDERR_FILENO, REPORT, report.size);
+        }
+        if(CRASH_PATH[0] != '\0')
+        {
+            const int fd = ::open(CRASH_PATH, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if(fd >= 0)
+            {
+                write_all(fd, REPORT, report.size);
+                ::fsync(fd);
+                ::close(fd);
+            }
+        }
+
+        // The report is safely out, anything past here may not return (hence the alarm)
+        if(FLUSH_SINKS && SINKS_RUNNING.load(std::memory_order_acquire))
+        {
+            struct sigaction alarm_action{};
+            alarm_action.sa_handler = SIG_DFL;
+            ::sigaction(SIGALRM, &alarm_action, nullptr);
+            ::alarm(FLUSH_DEADLINE_S);
+            boost::log::core::get()->flush();
+            ::alarm(0);
+        }
+    }
+
+    // Whatever handled the signal before us (most likely the default, a core dump) gets it as soon as we return
+    for(size_t i = 0; i < std::size(HANDLED_SIGNALS); i++)
+    {
+        if(HANDLED_SIGNALS[i] == sig)
+        {
+            ::sigaction(sig, &PREVIOUS_ACTIONS[i], nullptr);
+        }
+    }
+    errno = saved_errno;
+    ::raise(sig);
+}
+
+void xlog_crash_setup(const XLog::CrashSettings& settings)
+{
+    // Installing twice would save our own handler as the previous one
+    if(!settings.enabled || INSTALLED)
+    {
+        return;
+    }
+    INSTALLED = true;
+
+    std::string path;
+    for(size_t i = 0; i < settings.path.size(); i++)
+    {
+        if(settings.path[i] == '%' && i + 1 < settings.path.size() && settings.path[i + 1] == 'p')
+        {
+            path += std::to_string(::getpid());
+            i++;
+        }
+        else
+        {
+            path += settings.path[i];
+        }
+    }
+    if(path.size() >= sizeof(CRASH_PATH))
+    {
+        path.clear();
+    }
+    std::memcpy(CRASH_PATH, path.c_str(), path.size() + 1);
+
+    WRITE_STDERR = settings.write_stderr;
+    FLUSH_SINKS = settings.flush_sinks;
+    FLUSH_DEADLINE_S = settings.flush_deadline_s != 0 ? settings.flush_deadline_s : 1;
+
+    const time_t now = ::time(nullptr);
+    tm local{};
+    if(::localtime_r(&now, &local) != nullptr)
+    {
+        UTC_OFFSET_S = local.tm_gmtoff;
+    }
+
+    // The first call loads libgcc's unwinder, which would allocate if it happened in the handler
+    void* warm_up[1];
+    ::backtrace(warm_up, 1);
+
+    // So a stack overflow (on the thread that initialized logging) still has somewhere to run the handler
+    static char* ALT_STACK = new char[ALT_STACK_SIZE];
+    stack_t alt_stack{};
+    alt_stack.ss_sp = ALT_STACK;
+    alt_stack.ss_size = ALT_STACK_SIZE;
+    ::sigaltstack(&alt_stack, nullptr);
+
+    struct sigaction action{};
+    action.sa_sigaction = &crash_handler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+
+    // A crash while handling a crash kills the process rather than recursing
+    sigemptyset(&action.sa_mask);
+    for(int sig : HANDLED_SIGNALS)
+    {
+        sigaddset(&action.sa_mask, sig);
+    }
+
+    for(size_t i = 0; i < std::size(HANDLED_SIGNALS); i++)
+    {
+        ::sigaction(HANDLED_SIGNALS[i], &action, &PREVIOUS_ACTIONS[i]);
+    }
+
+    SINKS_RUNNING.store(true, std::memory_order_release);
+}
+
+void xlog_crash_shutdown()
+{
+    SINKS_RUNNING.store(false, std::memory_order_release);
+}
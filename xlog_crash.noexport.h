@@ -0,0 +1,37 @@
+#pragma once
+
+#include "xlog.h"
+
+/*
+ * Crash handler (LogSettings::s_crash)
+ *
+ * Handles SIGSEGV, SIGBUS, SIGABRT and SIGFPE on an alternate stack of its own, and writes a
+ * crash report to stderr and/or CrashSettings::path. Nothing in the handler allocates, locks or
+ * formats through the C library: the report is built in a static buffer with our own integer
+ * formatting, the return addresses come from backtrace() (called once at setup so libgcc is
+ * already loaded), and the module each address is in comes from reading /proc/self/maps with
+ * open & read, so libraries dlopen'd after setup are still found. Addresses are never symbolized
+ * in the process, `xlog-manager --symbolize <report>` does that later.
+ *
+ * Once the report is written the previous handler is put back and the signal raised again, so
+ * core dumps (or whatever handler was there before) still happen.
+ *
+ * A report looks like:
+ *     2026-Oct-18 12:34:56.789012 <FATAL> [xlog] - Caught SIGSEGV (code 1) at 0x0, pid 1234, thread 1240
+ *     crash signal=11 code=1 address=0x0 pid=1234 tid=1240 time=1792326896
+ *     frame 0 0x55d3c1a2b3c4 0x55d3c1a00000 /usr/bin/server
+ *     frame 1 0x7f12a4029d90 0x7f12a4000000 /usr/lib/x86_64-linux-gnu/libc.so.6
+ *     end
+ *
+ * Each frame is "frame <n> <address> <module base> <module path>", where the base is where the
+ * module's file offset 0 is mapped (so address - base is the address within the file), and a
+ * frame whose module wasn't found has a base of 0x0 and a path of "?". A signal that was sent
+ * (kill, abort) rather than raised by a fault has "sent by pid <n>" and "sender=<n>" in place of
+ * the address.
+ */
+
+// Installs the handler if LogSettings::s_crash.enabled, called by InitializeLogging
+void xlog_crash_setup(const XLog::CrashSettings& settings);
+
+// Stops the handler trying to flush the sinks (the handler itself stays installed), called by ShutownLogging
+void xlog_crash_shutdown();
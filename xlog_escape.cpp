@@ -0,0 +1,444 @@
+#include "xlog_escape.noexport.h"
+
+#include <cctype>
+#include <cstdint>
+
+#ifdef XLOG_ESCAPE_HAVE_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+    // What an invalid UTF-8 sequence turns into
+    constexpr std::string_view REPLACEMENT_ESCAPED = "\\ufffd";
+    constexpr std::string_view REPLACEMENT_UTF8 = "\xEF\xBF\xBD";
+
+    // Both of these take (data, position, size) and return the position of the
+    // next byte they care about, or 'size' if there isn't one
+    typedef size_t (*find_fn)(const char*, size_t, size_t);
+
+    inline bool needs_escape(unsigned char c)
+    {
+        return c < 0x20 || c == '"' || c == '\\' || c >= 0x80;
+    }
+
+    // Length of the valid UTF-8 sequence starting at 'p', or 0 if it is invalid
+    // Follows the well-formed byte sequence table in the Unicode standard (no overlongs or surrogates)
+    size_t utf8_sequence_length(const unsigned char* p, size_t remaining)
+    {
+        const unsigned char lead = p[0];
+        if(lead < 0x80)
+        {
+            return 1;
+        }
+
+        size_t length = 0;
+
+        // Bounds of the second byte, which is the only one that varies
+        unsigned char lower = 0x80;
+        unsigned char upper = 0xBF;
+
+        if(lead >= 0xC2 && lead <= 0xDF)
+        {
+            length = 2;
+        }
+        else if(lead == 0xE0)
+        {
+            length = 3;
+            lower = 0xA0;
+        }
+        else if((lead >= 0xE1 && lead <= 0xEC) || lead == 0xEE || lead == 0xEF)
+        {
+            length = 3;
+        }
+        else if(lead == 0xED)
+        {
+            length = 3;
+            upper = 0x9F;
+        }
+        else if(lead == 0xF0)
+        {
+            length = 4;
+            lower = 0x90;
+        }
+        else if(lead >= 0xF1 && lead <= 0xF3)
+        {
+            length = 4;
+        }
+        else if(lead == 0xF4)
+        {
+            length = 4;
+            upper = 0x8F;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if(remaining < length || p[1] < lower || p[1] > upper)
+        {
+            return 0;
+        }
+
+        for(size_t i = 2; i < length; i++)
+        {
+            if((p[i] & 0xC0) != 0x80)
+            {
+                return 0;
+            }
+        }
+
+        return length;
+    }
+
+    // Escape the byte (or UTF-8 sequence) at in[pos], returns the number of bytes consumed
+    size_t escape_special(std::string_view in, size_t pos, std::string& out)
+    {
+        const unsigned char c = static_cast<unsigned char>(in[pos]);
+        switch(c)
+        {
+            case '"':
+                out += "\\\"";
+                return 1;
+            case '\\':
+                out += "\\\\";
+                return 1;
+            case '\b':
+                out += "\\b";
+                return 1;
+            case '\f':
+                out += "\\f";
+                return 1;
+            case '\n':
+                out += "\\n";
+                return 1;
+            case '\r':
+                out += "\\r";
+                return 1;
+            case '\t':
+                out += "\\t";
+                return 1;
+        }
+
+        if(c < 0x20)
+        {
+            const char escaped[] = { '\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xF] };
+            out.append(escaped, sizeof(escaped));
+            return 1;
+        }
+
+        if(c < 0x80)
+        {
+            out += static_cast<char>(c);
+            return 1;
+        }
+
+        const size_t length = utf8_sequence_length(reinterpret_cast<const unsigned char*>(in.data()) + pos, in.size() - pos);
+        if(length == 0)
+        {
+            out += REPLACEMENT_ESCAPED;
+            return 1;
+        }
+
+        out.append(in.data() + pos, length);
+        return length;
+    }
+
+    void json_escape_with(find_fn find_special, std::string_view in, std::string& out)
+    {
+        out.reserve(out.size() + in.size());
+
+        size_t pos = 0;
+        while(pos < in.size())
+        {
+            const size_t next = find_special(in.data(), pos, in.size());
+            out.append(in.data() + pos, next - pos);
+            pos = next;
+
+            if(pos < in.size())
+            {
+                pos += escape_special(in, pos, out);
+            }
+        }
+    }
+
+    bool utf8_validate_with(find_fn find_non_ascii, std::string_view in)
+    {
+        const auto* data = reinterpret_cast<const unsigned char*>(in.data());
+
+        size_t pos = 0;
+        while(true)
+        {
+            pos = find_non_ascii(in.data(), pos, in.size());
+            if(pos >= in.size())
+            {
+                return true;
+            }
+
+            const size_t length = utf8_sequence_length(data + pos, in.size() - pos);
+            if(length == 0)
+            {
+                return false;
+            }
+            pos += length;
+        }
+    }
+
+    size_t find_special_scalar(const char* data, size_t pos, size_t size)
+    {
+        while(pos < size && !needs_escape(static_cast<unsigned char>(data[pos])))
+        {
+            pos++;
+        }
+        return pos;
+    }
+
+    size_t find_non_ascii_scalar(const char* data, size_t pos, size_t size)
+    {
+        // Check 8 bytes at a time, even without SIMD this is a lot quicker than byte-by-byte
+        constexpr uint64_t HIGH_BITS = 0x8080808080808080ULL;
+        while(pos + sizeof(uint64_t) <= size)
+        {
+            uint64_t word;
+            __builtin_memcpy(&word, data + pos, sizeof(word));
+            if((word & HIGH_BITS) != 0)
+            {
+                break;
+            }
+            pos += sizeof(word);
+        }
+
+        while(pos < size && static_cast<unsigned char>(data[pos]) < 0x80)
+        {
+            pos++;
+        }
+        return pos;
+    }
+
+#ifdef XLOG_ESCAPE_HAVE_X86
+    /*
+     * A signed compare against 0x20 catches both control characters *and* every byte >= 0x80
+     * (they're negative when treated as signed), so one compare covers everything that isn't
+     * plain printable ASCII, then we only need to add '"' and '\'.
+     */
+    __attribute__((target("sse2")))
+    size_t find_special_sse2(const char* data, size_t pos, size_t size)
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i space = _mm_set1_epi8(0x20);
+
+        while(pos + 16 <= size)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+            const __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                _mm_cmplt_epi8(chunk, space));
+
+            const int mask = _mm_movemask_epi8(special);
+            if(mask != 0)
+            {
+                return pos + __builtin_ctz(static_cast<unsigned>(mask));
+            }
+            pos += 16;
+        }
+
+        return find_special_scalar(data, pos, size);
+    }
+
+    __attribute__((target("sse2")))
+    size_t find_non_ascii_sse2(const char* data, size_t pos, size_t size)
+    {
+        while(pos + 16 <= size)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+            const int mask = _mm_movemask_epi8(chunk);
+            if(mask != 0)
+            {
+                return pos + __builtin_ctz(static_cast<unsigned>(mask));
+            }
+            pos += 16;
+        }
+
+        return find_non_ascii_scalar(data, pos, size);
+    }
+
+    __attribute__((target("avx2")))
+    size_t find_special_avx2(const char* data, size_t pos, size_t size)
+    {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i space = _mm256_set1_epi8(0x20);
+
+        while(pos + 32 <= size)
+        {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+            const __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+                _mm256_cmpgt_epi8(space, chunk));
+
+            const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+            if(mask != 0)
+            {
+                return pos + __builtin_ctz(mask);
+            }
+            pos += 32;
+        }
+
+        return find_special_sse2(data, pos, size);
+    }
+
+    __attribute__((target("avx2")))
+    size_t find_non_ascii_avx2(const char* data, size_t pos, size_t size)
+    {
+        while(pos + 32 <= size)
+        {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+            const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(chunk));
+            if(mask != 0)
+            {
+                return pos + __builtin_ctz(mask);
+            }
+            pos += 32;
+        }
+
+        return find_non_ascii_sse2(data, pos, size);
+    }
+#endif // XLOG_ESCAPE_HAVE_X86
+
+    struct escape_implementation
+    {
+        find_fn find_special;
+        find_fn find_non_ascii;
+        const char* name;
+    };
+
+    const escape_implementation& get_implementation()
+    {
+        static const escape_implementation IMPL = []()
+        {
+#ifdef XLOG_ESCAPE_HAVE_X86
+            if(XLogEscape::cpu_has_avx2())
+            {
+                return escape_implementation{ find_special_avx2, find_non_ascii_avx2, "avx2" };
+            }
+
+            if(__builtin_cpu_supports("sse2"))
+            {
+                return escape_implementation{ find_special_sse2, find_non_ascii_sse2, "sse2" };
+            }
+#endif
+            return escape_implementation{ find_special_scalar, find_non_ascii_scalar, "scalar" };
+        }();
+
+        return IMPL;
+    }
+}
+
+void XLogEscape::json_escape(std::string_view in, std::string& out)
+{
+    json_escape_with(get_implementation().find_special, in, out);
+}
+
+bool XLogEscape::utf8_validate(std::string_view in)
+{
+    return utf8_validate_with(get_implementation().find_non_ascii, in);
+}
+
+void XLogEscape::utf8_sanitize(std::string_view in, std::string& out)
+{
+    // Almost everything we log is valid, so check first and copy in one go
+    if(utf8_validate(in))
+    {
+        out.append(in);
+        return;
+    }
+
+    const find_fn find_non_ascii = get_implementation().find_non_ascii;
+    const auto* data = reinterpret_cast<const unsigned char*>(in.data());
+
+    out.reserve(out.size() + in.size());
+
+    size_t pos = 0;
+    while(pos < in.size())
+    {
+        const size_t next = find_non_ascii(in.data(), pos, in.size());
+        out.append(in.data() + pos, next - pos);
+        pos = next;
+
+        if(pos < in.size())
+        {
+            const size_t length = utf8_sequence_length(data + pos, in.size() - pos);
+            if(length == 0)
+            {
+                out += REPLACEMENT_UTF8;
+                pos++;
+            }
+            else
+            {
+                out.append(in.data() + pos, length);
+                pos += length;
+            }
+        }
+    }
+}
+
+void XLogEscape::journal_field_name(std::string_view prefix, std::string_view key, std::string& out)
+{
+    out += prefix;
+    for(char c : key)
+    {
+        if(std::isalnum(static_cast<unsigned char>(c)))
+        {
+            out += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        }
+        else
+        {
+            out += '_';
+        }
+    }
+}
+
+const char* XLogEscape::implementation_name()
+{
+    return get_implementation().name;
+}
+
+void XLogEscape::json_escape_scalar(std::string_view in, std::string& out)
+{
+    json_escape_with(find_special_scalar, in, out);
+}
+
+bool XLogEscape::utf8_validate_scalar(std::string_view in)
+{
+    return utf8_validate_with(find_non_ascii_scalar, in);
+}
+
+#ifdef XLOG_ESCAPE_HAVE_X86
+void XLogEscape::json_escape_sse2(std::string_view in, std::string& out)
+{
+    json_escape_with(find_special_sse2, in, out);
+}
+
+bool XLogEscape::utf8_validate_sse2(std::string_view in)
+{
+    return utf8_validate_with(find_non_ascii_sse2, in);
+}
+
+void XLogEscape::json_escape_avx2(std::string_view in, std::string& out)
+{
+    json_escape_with(find_special_avx2, in, out);
+}
+
+bool XLogEscape::utf8_validate_avx2(std::string_view in)
+{
+    return utf8_validate_with(find_non_ascii_avx2, in);
+}
+
+bool XLogEscape::cpu_has_avx2()
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif // XLOG_ESCAPE_HAVE_X86
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/*
+ * String escaping & UTF-8 validation for structured output (JSON lines, journal fields)
+ *
+ * The public entry points pick the widest implementation the CPU supports the first
+ * time they are called (AVX2 -> SSE2 -> scalar), the per-implementation versions are
+ * only exposed so the benchmark can compare them against each other.
+ *
+ * Everything appends to 'out' rather than returning a new string, so callers can
+ * reuse the same buffer for every field of a record.
+ */
+namespace XLogEscape
+{
+    // Append 'in' to 'out' as the body of a JSON string (no surrounding quotes)
+    // Invalid UTF-8 sequences are replaced with �
+    void json_escape(std::string_view in, std::string& out);
+
+    // True if 'in' is entirely valid UTF-8
+    bool utf8_validate(std::string_view in);
+
+    // Append 'in' to 'out', replacing invalid UTF-8 sequences with U+FFFD
+    void utf8_sanitize(std::string_view in, std::string& out);
+
+    // Append 'prefix' then 'key' as a journal field name (uppercase letters, digits & underscores)
+    void journal_field_name(std::string_view prefix, std::string_view key, std::string& out);
+
+    // Name of the implementation picked by runtime dispatch ("avx2", "sse2" or "scalar")
+    const char* implementation_name();
+
+    void json_escape_scalar(std::string_view in, std::string& out);
+    bool utf8_validate_scalar(std::string_view in);
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define XLOG_ESCAPE_HAVE_X86
+
+    void json_escape_sse2(std::string_view in, std::string& out);
+    bool utf8_validate_sse2(std::string_view in);
+
+    // Only safe to call if cpu_has_avx2() is true
+    void json_escape_avx2(std::string_view in, std::string& out);
+    bool utf8_validate_avx2(std::string_view in);
+
+    bool cpu_has_avx2();
+#endif
+}
@@ -0,0 +1,567 @@
+#include "xlog_file_writer.noexport.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef XLOG_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+// One write of a batch, what's left of it if the kernel only took part
+struct xlog_pending_write
+{
+    size_t buffer;
+    const char* data;
+    size_t length;
+};
+
+#ifdef XLOG_HAVE_IO_URING
+
+// Just enough of an io_uring for the writer, glibc has no wrappers (and liburing would be another dependency)
+class xlog_io_uring
+{
+public:
+    // nullptr if the kernel won't give us a ring, 'buffers' are registered if it'll let us
+    static std::unique_ptr<xlog_io_uring> create(unsigned int entries, const std::vector<iovec>& buffers);
+    ~xlog_io_uring();
+
+    // Appends everything in 'writes' to 'fd' in order (then fdatasyncs it if 'sync'), waiting until it's all done. A write the
+    // file fails doesn't make this fail, only the ring itself failing does, which leaves what hasn't been written in 'writes'
+    bool write(int fd, std::vector<xlog_pending_write>& writes, bool sync);
+
+private:
+    xlog_io_uring() = default;
+
+    // Queues an entry, the caller makes sure there's room
+    io_uring_sqe& next_sqe();
+
+    int ring_fd = -1;
+    bool fixed_buffers = false;
+    unsigned int sq_entries = 0;
+
+    void* sq_map = MAP_FAILED;
+    size_t sq_map_size = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_map_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned int* sq_tail = nullptr;
+    unsigned int* sq_mask = nullptr;
+    unsigned int* sq_array = nullptr;
+    unsigned int* cq_head = nullptr;
+    unsigned int* cq_tail = nullptr;
+    unsigned int* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+};
+
+std::unique_ptr<xlog_io_uring> xlog_io_uring::create(unsigned int entries, const std::vector<iovec>& buffers)
+{
+    std::unique_ptr<xlog_io_uring> rValue(new xlog_io_uring());
+
+    io_uring_params params{};
+    rValue->ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if(rValue->ring_fd < 0)
+    {
+        return nullptr;
+    }
+    rValue->sq_entries = params.sq_entries;
+
+    // Writes go to offset -1 (the file's position, which O_APPEND keeps at the end), older kernels take it literally
+    if((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+    {
+        return nullptr;
+    }
+
+    rValue->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    rValue->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single_map)
+    {
+        rValue->sq_map_size = rValue->cq_map_size = std::max(rValue->sq_map_size, rValue->cq_map_size);
+    }
+
+    rValue->sq_map = ::mmap(nullptr, rValue->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rValue->ring_fd, IORING_OFF_SQ_RING);
+    if(rValue->sq_map == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    if(!single_map)
+    {
+        rValue->cq_map = ::mmap(nullptr, rValue->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rValue->ring_fd, IORING_OFF_CQ_RING);
+        if(rValue->cq_map == MAP_FAILED)
+        {
+            return nullptr;
+        }
+    }
+
+    rValue->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    rValue->sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, rValue->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rValue->ring_fd, IORING_OFF_SQES));
+    if(rValue->sqes == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    char* sq = static_cast<char*>(rValue->sq_map);
+    char* cq = static_cast<char*>(single_map ? rValue->sq_map : rValue->cq_map);
+    rValue->sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    rValue->sq_mask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    rValue->sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+    rValue->cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    rValue->cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    rValue->cq_mask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    rValue->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Pinned once rather than on every write, can fail under a low RLIMIT_MEMLOCK (we just use plain writes then)
+    rValue->fixed_buffers = ::syscall(__NR_io_uring_register, rValue->ring_fd, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned int>(buffers.size())) == 0;
+
+    return rValue;
+}
+
+xlog_io_uring::~xlog_io_uring()
+{
+    if(sqes != MAP_FAILED)
+    {
+        ::munmap(sqes, sqes_size);
+    }
+    if(cq_map != MAP_FAILED)
+    {
+        ::munmap(cq_map, cq_map_size);
+    }
+    if(sq_map != MAP_FAILED)
+    {
+        ::munmap(sq_map, sq_map_size);
+    }
+    if(ring_fd >= 0)
+    {
+        ::close(ring_fd);
+    }
+}
+
+io_uring_sqe& xlog_io_uring::next_sqe()
+{
+    // We're the only submitter, and the kernel has consumed everything we queued before (we always wait)
+    const unsigned int tail = *sq_tail;
+    const unsigned int index = tail & *sq_mask;
+
+    io_uring_sqe& sqe = sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+bool xlog_io_uring::write(int fd, std::vector<xlog_pending_write>& writes, bool sync)
+{
+    constexpr uint64_t SYNC_USER_DATA = ~0ULL;
+
+    while(!writes.empty() || sync)
+    {
+        // Only as many as fit, whatever doesn't goes in the next round
+        const size_t count = std::min<size_t>(writes.size(), sq_entries - (sync ? 1 : 0));
+        for(size_t i = 0; i < count; i++)
+        {
+            const xlog_pending_write& pending = writes[i];
+
+            io_uring_sqe& sqe = next_sqe();
+            sqe.opcode = fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uint64_t>(pending.data);
+            sqe.len = static_cast<uint32_t>(pending.length);
+            sqe.off = static_cast<uint64_t>(-1);
+            sqe.buf_index = fixed_buffers ? static_cast<uint16_t>(pending.buffer) : 0;
+            sqe.user_data = i;
+
+            // Appends have no offset to keep them in order, so each one waits for the one before it
+            sqe.flags = i + 1 < count ? IOSQE_IO_LINK : 0;
+        }
+
+        // Drained, so it only starts once every write before it has finished
+        const bool sync_now = sync && count == writes.size();
+        if(sync_now)
+        {
+            io_uring_sqe& sqe = next_sqe();
+            sqe.opcode = IORING_OP_FSYNC;
+            sqe.flags = IOSQE_IO_DRAIN;
+            sqe.fd = fd;
+            sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+            sqe.user_data = SYNC_USER_DATA;
+        }
+
+        unsigned int to_submit = static_cast<unsigned int>(count + (sync_now ? 1 : 0));
+        unsigned int to_complete = to_submit;
+
+        // Writes we haven't seen complete are left as -ECANCELED
+        std::vector<int> results(count, -ECANCELED);
+        bool broken = false;
+        while(to_complete > 0)
+        {
+            const int entered = static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, to_complete, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if(entered < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                broken = true;
+                break;
+            }
+            to_submit -= std::min<unsigned int>(to_submit, static_cast<unsigned int>(entered));
+
+            unsigned int head = *cq_head;
+            const unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for(; head != tail; head++, to_complete--)
+            {
+                const io_uring_cqe& cqe = cqes[head & *cq_mask];
+                if(cqe.user_data != SYNC_USER_DATA)
+                {
+                    results[cqe.user_data] = cqe.res;
+                }
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        // The chain stops at the first write that didn't finish (everything linked after it is cancelled), anything
+        // before that is in the file and must never be written again, it and the rest go again in order
+        size_t done = 0;
+        size_t progress = 0;
+        for(; done < count; done++)
+        {
+            const int res = results[done];
+            if(res < 0)
+            {
+                break;
+            }
+
+            xlog_pending_write& pending = writes[done];
+            progress += static_cast<size_t>(res);
+            if(static_cast<size_t>(res) < pending.length)
+            {
+                pending.data += res;
+                pending.length -= res;
+                break;
+            }
+        }
+        writes.erase(writes.begin(), writes.begin() + done);
+
+        // Only the ring failing is reason to give it up, what's left in 'writes' is everything we haven't seen finish
+        if(broken)
+        {
+            return false;
+        }
+
+        // The file failed us (i.e. ENOSPC) rather than the ring, once nothing gets through that part of the file is lost,
+        // there's no one to tell from here (the same as writev)
+        if(progress == 0 && done < count && results[done] != -EINTR && results[done] != -EAGAIN && results[done] != -ECANCELED)
+        {
+            writes.clear();
+            sync = false;
+        }
+
+        // Anything written again was written after the sync, so it needs another one (a failed sync isn't retried)
+        sync = sync && (!sync_now || !writes.empty());
+    }
+
+    return true;
+}
+
+#else
+
+class xlog_io_uring
+{
+};
+
+#endif // XLOG_HAVE_IO_URING
+
+xlog_file_writer::xlog_file_writer(const std::string& path, const XLog::FileSettings& settings) :
+    buffer_size((std::max<size_t>(settings.buffer_size, 4096) + 4095) & ~size_t(4095)),
+    flush_interval(std::max(settings.flush_interval_ms, 1u)),
+    sync_interval(settings.sync_interval_ms),
+    storage(nullptr, &std::free)
+{
+    // Appending, so anything else writing to the file (another process, or logrotate truncating it) can't be overwritten
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        return;
+    }
+
+    const off_t end = ::lseek(fd, 0, SEEK_END);
+    append_position = end > 0 ? static_cast<uint64_t>(end) : 0;
+    written_position.store(append_position, std::memory_order_relaxed);
+
+    // Page aligned so every buffer can be registered (and pinned) as is
+    const size_t count = std::max<size_t>(settings.buffer_count, 2);
+    storage.reset(static_cast<char*>(std::aligned_alloc(4096, count * buffer_size)));
+    if(!storage)
+    {
+        // Same as failing to open it, the sink reports it
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+
+    std::vector<iovec> registered;
+    for(size_t i = 0; i < count; i++)
+    {
+        buffers.push_back(buffer{ .data = storage.get() + i * buffer_size, .opened = {} });
+        registered.push_back(iovec{ buffers.back().data, buffer_size });
+        free_buffers.push_back(count - 1 - i);
+    }
+    current = buffers.size();
+    charge.set(count * buffer_size);
+
+#ifdef XLOG_HAVE_IO_URING
+    if(settings.use_io_uring)
+    {
+        // A batch is at most every buffer plus the sync
+        ring = xlog_io_uring::create(static_cast<unsigned int>(count + 1), registered);
+    }
+#endif // XLOG_HAVE_IO_URING
+
+    thread = std::thread(&xlog_file_writer::writer, this);
+}
+
+xlog_file_writer::~xlog_file_writer()
+{
+    if(fd < 0)
+    {
+        return;
+    }
+
+    {
+        std::scoped_lock lock(state_mutex);
+        seal_buffer();
+        stopping = true;
+    }
+    work_cv.notify_all();
+
+    // The writer only stops once everything sealed is written
+    thread.join();
+    ::close(fd);
+}
+
+void xlog_file_writer::append(std::string_view text, bool newline)
+{
+    if(fd < 0)
+    {
+        return;
+    }
+
+    std::unique_lock lock(state_mutex);
+    while(!text.empty() || newline)
+    {
+        if(text.empty())
+        {
+            text = "\n";
+            newline = false;
+        }
+
+        buffer& open = open_buffer(lock);
+        const size_t length = std::min(text.size(), buffer_size - open.used);
+        std::memcpy(open.data + open.used, text.data(), length);
+        open.used += length;
+        append_position += length;
+        text.remove_prefix(length);
+
+        if(open.used == buffer_size)
+        {
+            seal_buffer();
+        }
+    }
+}
+
+void xlog_file_writer::flush()
+{
+    if(fd < 0)
+    {
+        return;
+    }
+
+    std::unique_lock lock(state_mutex);
+    seal_buffer();
+
+    const uint64_t target = append_position;
+    written_cv.wait(lock, [&]() { return written_position.load(std::memory_order_relaxed) >= target; });
+}
+
+void xlog_file_writer::sync()
+{
+    if(fd >= 0)
+    {
+        ::fdatasync(fd);
+    }
+}
+
+double xlog_file_writer::backlog()
+{
+    if(fd < 0)
+    {
+        return 0.0;
+    }
+
+    std::scoped_lock lock(state_mutex);
+    return static_cast<double>(buffers.size() - free_buffers.size() - (current < buffers.size() ? 1 : 0)) / buffers.size();
+}
+
+xlog_file_writer::buffer& xlog_file_writer::open_buffer(std::unique_lock<std::mutex>& lock)
+{
+    if(current < buffers.size())
+    {
+        return buffers[current];
+    }
+
+    // Every buffer is waiting to be written, the disk can't keep up so we have to wait for it
+    written_cv.wait(lock, [&]() { return !free_buffers.empty(); });
+
+    current = free_buffers.back();
+    free_buffers.pop_back();
+
+    buffer& open = buffers[current];
+    open.used = 0;
+    open.offset = append_position;
+    open.opened = std::chrono::steady_clock::now();
+    return open;
+}
+
+void xlog_file_writer::seal_buffer()
+{
+    if(current >= buffers.size() || buffers[current].used == 0)
+    {
+        return;
+    }
+
+    sealed.push_back(current);
+    current = buffers.size();
+    work_cv.notify_one();
+}
+
+void xlog_file_writer::writer()
+{
+    auto last_sync = std::chrono::steady_clock::now();
+
+    std::unique_lock lock(state_mutex);
+    while(true)
+    {
+        if(sealed.empty())
+        {
+            if(stopping)
+            {
+                break;
+            }
+
+            work_cv.wait_for(lock, flush_interval);
+
+            // Nothing has filled the buffer for a while, write it out anyway so records don't sit in memory
+            if(current < buffers.size() && std::chrono::steady_clock::now() - buffers[current].opened >= flush_interval)
+            {
+                seal_buffer();
+            }
+
+            continue;
+        }
+
+        std::vector<size_t> batch(sealed.begin(), sealed.end());
+        sealed.clear();
+        const bool last = stopping;
+        lock.unlock();
+
+        const auto now = std::chrono::steady_clock::now();
+        const bool sync = sync_interval.count() > 0 && (last || now - last_sync >= sync_interval);
+        if(sync)
+        {
+            last_sync = now;
+        }
+
+        // Failed writes lose their part of the file, the same as a stream in a failed state
+        write_batch(batch, sync);
+
+        lock.lock();
+        const buffer& end = buffers[batch.back()];
+        written_position.store(end.offset + end.used, std::memory_order_release);
+        for(size_t index : batch)
+        {
+            buffers[index].used = 0;
+            free_buffers.push_back(index);
+        }
+        written_cv.notify_all();
+    }
+}
+
+void xlog_file_writer::write_batch(const std::vector<size_t>& batch, bool sync)
+{
+    std::vector<xlog_pending_write> writes;
+    for(size_t index : batch)
+    {
+        writes.push_back(xlog_pending_write{ index, buffers[index].data, buffers[index].used });
+    }
+
+#ifdef XLOG_HAVE_IO_URING
+    if(ring)
+    {
+        if(ring->write(fd, writes, sync))
+        {
+            return;
+        }
+
+        // The ring is broken so it's gone for good, only what it didn't write goes through writev (it's O_APPEND, anything
+        // written twice would be in the file twice)
+        ring.reset();
+    }
+#endif // XLOG_HAVE_IO_URING
+
+    write_batch_writev(writes, sync);
+}
+
+void xlog_file_writer::write_batch_writev(const std::vector<xlog_pending_write>& writes, bool sync)
+{
+    // Sealed buffers are consecutive in the file, so the whole batch is one write (unless the kernel takes less)
+    std::vector<iovec> iov;
+    for(const xlog_pending_write& pending : writes)
+    {
+        iov.push_back(iovec{ const_cast<char*>(pending.data), pending.length });
+    }
+
+    size_t first = 0;
+    while(first < iov.size())
+    {
+        const ssize_t written = ::writev(fd, iov.data() + first, static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX)));
+        if(written <= 0)
+        {
+            if(written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        for(size_t left = written; left > 0 && first < iov.size();)
+        {
+            const size_t taken = std::min(left, iov[first].iov_len);
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + taken;
+            iov[first].iov_len -= taken;
+            left -= taken;
+            if(iov[first].iov_len == 0)
+            {
+                first++;
+            }
+        }
+    }
+
+    if(sync)
+    {
+        ::fdatasync(fd);
+    }
+}
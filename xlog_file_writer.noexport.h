@@ -0,0 +1,115 @@
+#pragma once
+
+#include "xlog.h"
+#include "xlog_memory.noexport.h"
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string_view>
+#include <condition_variable>
+
+#if __has_include(<linux/io_uring.h>)
+#define XLOG_HAVE_IO_URING
+#endif
+
+/*
+ * Batched file writer (used by the file sink)
+ *
+ * Records are copied into one of FileSettings::buffer_count buffers of 'buffer_size' bytes, and
+ * a buffer that's full (or has been open for 'flush_interval_ms') is handed to a writer thread.
+ * The writer takes every buffer waiting at once and writes them with a single submission, so the
+ * thread consuming records only ever copies, it never makes a syscall unless every buffer is
+ * still being written (the disk can't keep up) or it's asked to flush.
+ *
+ * With FileSettings::use_io_uring the buffers are registered with an io_uring and written with
+ * IORING_OP_WRITE_FIXED, one entry per buffer plus an fsync (drained behind the writes) every
+ * 'sync_interval_ms'. If the kernel doesn't let us have a ring (too old, or blocked by seccomp)
+ * the batch is written with writev & fdatasync instead, and if the ring itself fails later on
+ * whatever it hadn't written yet is. A write the file fails (i.e. ENOSPC) only loses that part
+ * of the file, the same as it would with writev.
+ *
+ * The file is opened with O_APPEND and every write goes to the end of it (offset -1 for io_uring,
+ * with the batch's writes linked so they land in order), so nothing anyone else appends (or a
+ * truncate from logrotate) is overwritten. Offsets are still counted from the end of the file as
+ * it was when opened, so the index assumes only we append to it.
+ */
+
+class xlog_io_uring;
+struct xlog_pending_write;
+
+class xlog_file_writer
+{
+public:
+    xlog_file_writer(const std::string& path, const XLog::FileSettings& settings);
+
+    // Writes out whatever is left, then stops the writer thread
+    ~xlog_file_writer();
+
+    bool is_open() const { return fd >= 0; }
+    bool using_io_uring() const { return ring != nullptr; }
+
+    // Copies 'text' (and a newline if asked) to the end of the file, only called by one thread at a time
+    void append(std::string_view text, bool newline);
+
+    // Hands over the buffer being filled and waits until everything appended so far is in the file
+    void flush();
+
+    // fdatasync()s everything written so far, safe to call from any thread
+    void sync();
+
+    // Bytes appended & bytes actually written, as offsets into the file
+    uint64_t appended() const { return append_position; }
+    uint64_t written() const { return written_position.load(std::memory_order_acquire); }
+
+    // How many buffers are waiting for (or being written by) the writer thread (0 - 1)
+    double backlog();
+
+private:
+    struct buffer
+    {
+        char* data;
+        size_t used = 0;
+        uint64_t offset = 0;
+        std::chrono::steady_clock::time_point opened;
+    };
+
+    // Need 'state_mutex' held
+    buffer& open_buffer(std::unique_lock<std::mutex>& lock);
+    void seal_buffer();
+
+    void writer();
+
+    // Writes 'batch' (consecutive buffers in file order), and syncs the file if 'sync'
+    void write_batch(const std::vector<size_t>& batch, bool sync);
+    void write_batch_writev(const std::vector<xlog_pending_write>& writes, bool sync);
+
+    const size_t buffer_size;
+    const std::chrono::milliseconds flush_interval;
+    const std::chrono::milliseconds sync_interval;
+
+    int fd = -1;
+    std::unique_ptr<char, void(*)(void*)> storage;
+    std::vector<buffer> buffers;
+    xlog_memory_charge charge;
+    std::unique_ptr<xlog_io_uring> ring;
+
+    std::mutex state_mutex;
+    std::condition_variable work_cv;
+    std::condition_variable written_cv;
+    bool stopping = false;
+
+    // Buffer being filled (buffers.size() if none), ones waiting for the writer, and ones free to fill
+    size_t current;
+    std::deque<size_t> sealed;
+    std::vector<size_t> free_buffers;
+
+    // Only touched by the appending thread
+    uint64_t append_position = 0;
+
+    std::atomic<uint64_t> written_position{0};
+
+    std::thread thread;
+};
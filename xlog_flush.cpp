@@ -0,0 +1,146 @@
+#include "xlog_flush.noexport.h"
+
+#include <algorithm>
+
+xlog_background_flusher::xlog_background_flusher(boost::shared_ptr<xlog_dispatch_frontend> frontend, boost::shared_ptr<xlog_dispatch_backend> backend) :
+    frontend(std::move(frontend)),
+    backend(std::move(backend))
+{
+    thread = std::thread(&xlog_background_flusher::run, this);
+}
+
+xlog_background_flusher::~xlog_background_flusher()
+{
+    stop();
+}
+
+void xlog_background_flusher::request(bool sync, std::function<void()> done)
+{
+    if(try_request(sync, done))
+    {
+        return;
+    }
+
+    // Stopped, and everything logged before that has already been flushed
+    std::vector<pending_request> late{ pending_request{ sync, std::move(done) } };
+    complete(late);
+}
+
+bool xlog_background_flusher::try_request(bool sync, std::function<void()>& done)
+{
+    std::scoped_lock lock(mutex);
+    if(stopped)
+    {
+        return false;
+    }
+
+    queue.push_back(pending_request{ sync, std::move(done) });
+    cv.notify_one();
+    return true;
+}
+
+bool xlog_background_flusher::write(const boost::log::record_view& rec)
+{
+    std::scoped_lock lock(mutex);
+    if(stopped)
+    {
+        return false;
+    }
+
+    records.push_back(rec);
+    cv.notify_one();
+    return true;
+}
+
+void xlog_background_flusher::stop()
+{
+    {
+        std::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+
+    // Whatever was queued is flushed & completed before the thread exits
+    if(thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+bool xlog_background_flusher::stop(std::chrono::steady_clock::time_point until)
+{
+    {
+        std::unique_lock lock(mutex);
+        stopping = true;
+        cv.notify_one();
+
+        if(!stopped_cv.wait_until(lock, until, [&]() { return stopped; }))
+        {
+            return false;
+        }
+    }
+
+    if(thread.joinable())
+    {
+        thread.join();
+    }
+
+    return true;
+}
+
+void xlog_background_flusher::run()
+{
+    std::unique_lock lock(mutex);
+    while(true)
+    {
+        cv.wait(lock, [&]() { return stopping || !queue.empty() || !records.empty(); });
+
+        std::vector<pending_request> requests;
+        requests.swap(queue);
+        std::vector<boost::log::record_view> writing;
+        writing.swap(records);
+        if(stopping && requests.empty() && writing.empty())
+        {
+            stopped = true;
+            stopped_cv.notify_all();
+            break;
+        }
+
+        lock.unlock();
+        complete(requests, writing);
+        lock.lock();
+    }
+}
+
+void xlog_background_flusher::complete(std::vector<pending_request>& requests, const std::vector<boost::log::record_view>& records)
+{
+    if(!records.empty())
+    {
+        backend->consume_batch(records.data(), records.size());
+    }
+
+    if(requests.empty())
+    {
+        return;
+    }
+
+    // Goes through the frontend, so records still queued by async dispatch are written first
+    frontend->flush();
+
+    if(std::any_of(requests.begin(), requests.end(), [](const pending_request& r) { return r.sync; }))
+    {
+        backend->sync();
+    }
+
+    for(auto& r : requests)
+    {
+        try
+        {
+            r.done();
+        }
+        catch(...)
+        {
+            // Not ours to handle, and the thread has to keep going
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+
+#include <boost/shared_ptr.hpp>
+
+/*
+ * Background flushing (XLog::FlushInBackground, and the awaitables & futures built on it)
+ *
+ * Requests are queued for a single flush thread, which flushes the dispatch frontend (so async
+ * dispatch is drained into the sinks, and the sinks write out what they've buffered), syncs the
+ * files if any of the requests asked for it, then completes every request that was queued before
+ * it started. However many coroutines are waiting, a burst of requests costs one flush.
+ *
+ * It doesn't go through the logging core, whose flush() shuts out logging until it's done, while
+ * a sink's own threads may log (INTERNAL) before they can finish what the flush is waiting for.
+ *
+ * Completions are called on the flush thread, so they should only hand the work back to whoever
+ * is waiting (resume a coroutine, set a promise) rather than doing it there.
+ *
+ * Without async dispatch, XLog::Submit hands its record to the flush thread as well, which writes
+ * it before the next flush, so the submitting coroutine never formats or writes anything itself.
+ */
+class xlog_background_flusher
+{
+public:
+    xlog_background_flusher(boost::shared_ptr<xlog_dispatch_frontend> frontend, boost::shared_ptr<xlog_dispatch_backend> backend);
+
+    // Stops the thread (if stop() hasn't already)
+    ~xlog_background_flusher();
+
+    // 'done' is called once everything logged before the call has been flushed (and synced if 'sync')
+    void request(bool sync, std::function<void()> done);
+
+    // request(), but false (and 'done' isn't called) once we've stopped, rather than flushing on the calling thread
+    bool try_request(bool sync, std::function<void()>& done);
+
+    // Writes 'rec' (detached from its thread) on the flush thread, before any request made after this;
+    // false once we've stopped, then it's the caller's to write
+    bool write(const boost::log::record_view& rec);
+
+    // Completes everything still queued and stops the thread, later requests complete straight away
+    void stop();
+
+    // stop(), but gives up waiting for the thread at 'until', false if it's still running (and using this)
+    bool stop(std::chrono::steady_clock::time_point until);
+
+private:
+    struct pending_request
+    {
+        bool sync;
+        std::function<void()> done;
+    };
+
+    void run();
+
+    // Writes 'records', flushes once for all of 'requests', then completes them
+    void complete(std::vector<pending_request>& requests, const std::vector<boost::log::record_view>& records = {});
+
+    const boost::shared_ptr<xlog_dispatch_frontend> frontend;
+    const boost::shared_ptr<xlog_dispatch_backend> backend;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable stopped_cv;
+    std::vector<pending_request> queue;
+    std::vector<boost::log::record_view> records;
+    bool stopping = false;
+    bool stopped = false;
+
+    std::thread thread;
+};
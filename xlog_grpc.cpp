@@ -1,4 +1,8 @@
 #include "xlog_grpc.noexport.h"
+#include "xlog_trace.noexport.h"
+
+#include <cerrno>
+#include <cstring>
 
 ::grpc::Status xlog_grpc_server::GetDefaultLogLevel(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::SeverityMessage* response)
 {
@@ -65,3 +69,205 @@
 
     return ::grpc::Status::OK;
 }
+
+::grpc::Status xlog_grpc_server::GetAllSinks(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::AllSinksMessage* response)
+{
+    for(const auto& sink : XLog::GetAllSinks())
+    {
+        auto* msg = response->add_sinks();
+        msg->set_name(sink.name);
+        msg->set_enabled(sink.enabled);
+        msg->mutable_level()->CopyFrom(make_severity_message(sink.level));
+        msg->set_records(sink.records);
+        msg->set_bytes(sink.bytes);
+        msg->set_filtered(sink.filtered);
+        msg->set_dropped(sink.dropped);
+        msg->set_consume_ns(sink.consume_ns);
+        msg->set_trips(sink.trips);
+        msg->set_tripped(sink.tripped);
+        msg->set_unrouted(sink.unrouted);
+    }
+
+    return ::grpc::Status::OK;
+}
+
+::grpc::Status xlog_grpc_server::SetSinkEnabled(::grpc::ServerContext* context, const ::xlogProto::SetSinkEnabledMessage* request, ::xlogProto::Void* response)
+{
+    if(!XLog::SetSinkEnabled(request->name(), request->enabled()))
+    {
+        return { ::grpc::StatusCode::NOT_FOUND, "No sink with the given name" };
+    }
+
+    return ::grpc::Status::OK;
+}
+
+::grpc::Status xlog_grpc_server::SetSinkSeverity(::grpc::ServerContext* context, const ::xlogProto::SetSinkSeverityMessage* request, ::xlogProto::Void* response)
+{
+    if(request->severity().value() == xlogProto::Severity::SEV_UNKNOWN)
+    {
+        return { ::grpc::StatusCode::INVALID_ARGUMENT, "Severity is set as unknown, please use a known severity" };
+    }
+
+    if(!XLog::SetSinkLevel(request->name(), severity_from_message(request->severity())))
+    {
+        return { ::grpc::StatusCode::NOT_FOUND, "No sink with the given name" };
+    }
+
+    return ::grpc::Status::OK;
+}
+
+::grpc::Status xlog_grpc_server::GetOverloadState(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::OverloadStateMessage* response)
+{
+    const auto state = XLog::GetOverloadState();
+    response->set_shedding(state.shedding);
+    response->mutable_level()->CopyFrom(make_severity_message(state.level));
+    response->set_step(state.step);
+    response->set_transitions(state.transitions);
+
+    return ::grpc::Status::OK;
+}
+
+::grpc::Status xlog_grpc_server::GetMemoryState(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::MemoryStateMessage* response)
+{
+    const auto state = XLog::GetMemoryState();
+    response->set_max_bytes(state.max_bytes);
+    response->set_used_bytes(state.used_bytes);
+    response->set_peak_bytes(state.peak_bytes);
+    response->set_allocations(state.allocations);
+    response->set_over_budget(state.over_budget);
+    response->mutable_keep_level()->CopyFrom(make_severity_message(state.keep_level));
+    response->set_shed(state.shed);
+    response->set_transitions(state.transitions);
+
+    return ::grpc::Status::OK;
+}
+
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+static XLog::CallSiteQuery call_site_query_from_message(const ::xlogProto::CallSiteQueryMessage& message)
+{
+    return XLog::CallSiteQuery
+    {
+        .file = message.file(),
+        .function = message.function(),
+        .line = message.line(),
+        .channel = message.channel()
+    };
+}
+#endif
+
+::grpc::Status xlog_grpc_server::GetCallSites(::grpc::ServerContext* context, const ::xlogProto::CallSiteQueryMessage* request, ::xlogProto::CallSitesMessage* response)
+{
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+    for(const auto& site : XLog::GetCallSites(call_site_query_from_message(*request)))
+    {
+        auto* msg = response->add_sites();
+        msg->set_file(site.file);
+        msg->set_line(site.line);
+        msg->set_function(site.function);
+        msg->set_channel(site.channel);
+        msg->mutable_level()->CopyFrom(make_severity_message(site.severity));
+        msg->set_state(static_cast<::xlogProto::CallSiteState>(site.state));
+    }
+
+    return ::grpc::Status::OK;
+#else
+    return { ::grpc::StatusCode::UNIMPLEMENTED, "Built without call site control" };
+#endif
+}
+
+::grpc::Status xlog_grpc_server::SetCallSiteState(::grpc::ServerContext* context, const ::xlogProto::SetCallSiteStateMessage* request, ::xlogProto::CallSiteCountMessage* response)
+{
+#ifdef XLOG_ENABLE_CALL_SITE_CONTROL
+    XLog::CallSiteState state;
+    switch(request->state())
+    {
+        case ::xlogProto::CallSiteState::CALL_SITE_DEFAULT: state = XLog::CallSiteState::DEFAULT; break;
+        case ::xlogProto::CallSiteState::CALL_SITE_ENABLED: state = XLog::CallSiteState::ENABLED; break;
+        case ::xlogProto::CallSiteState::CALL_SITE_DISABLED: state = XLog::CallSiteState::DISABLED; break;
+        default:
+            return { ::grpc::StatusCode::INVALID_ARGUMENT, "Unknown call site state" };
+    }
+
+    response->set_matched(XLog::SetCallSiteState(call_site_query_from_message(request->query()), state));
+    return ::grpc::Status::OK;
+#else
+    return { ::grpc::StatusCode::UNIMPLEMENTED, "Built without call site control" };
+#endif
+}
+
+::grpc::Status xlog_grpc_server::GetOverheadProfile(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::OverheadProfileMessage* response)
+{
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    const auto profile = XLog::GetOverheadProfile();
+    for(const uint64_t limit : profile.bucket_limits_ns)
+    {
+        response->add_bucket_limits_ns(limit);
+    }
+
+    for(const auto& site : profile.sites)
+    {
+        auto* msg = response->add_sites();
+        msg->set_file(site.file);
+        msg->set_line(site.line);
+        msg->set_function(site.function);
+        msg->set_channel(site.channel);
+        msg->mutable_level()->CopyFrom(make_severity_message(site.severity));
+        msg->set_records(site.records);
+        msg->set_open_ns(site.open_ns);
+        msg->set_insert_ns(site.insert_ns);
+        msg->set_push_ns(site.push_ns);
+        for(const uint64_t count : site.histogram)
+        {
+            msg->add_histogram(count);
+        }
+    }
+
+    return ::grpc::Status::OK;
+#else
+    return { ::grpc::StatusCode::UNIMPLEMENTED, "Built without the overhead profiler" };
+#endif
+}
+
+::grpc::Status xlog_grpc_server::ResetOverheadProfile(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::Void* response)
+{
+#ifdef XLOG_ENABLE_OVERHEAD_PROFILER
+    XLog::ResetOverheadProfile();
+    return ::grpc::Status::OK;
+#else
+    return { ::grpc::StatusCode::UNIMPLEMENTED, "Built without the overhead profiler" };
+#endif
+}
+
+::grpc::Status xlog_grpc_server::WriteTrace(::grpc::ServerContext* context, const ::xlogProto::TraceRequestMessage* request, ::xlogProto::TraceResultMessage* response)
+{
+    if(request->path().empty())
+    {
+        return { ::grpc::StatusCode::INVALID_ARGUMENT, "No file name given for the trace" };
+    }
+
+    // Anyone who can reach the socket can ask, so only the file name is used, and only under TraceSettings::path's directory
+    std::string path;
+    int error = 0;
+    const auto result = xlog_trace_write_requested(request->path(), path, error);
+    if(!result.written)
+    {
+        switch(error)
+        {
+            case 0:
+                return { ::grpc::StatusCode::INTERNAL, "Failed to write the trace to '" + path + "'" };
+            case EACCES:
+                return { ::grpc::StatusCode::FAILED_PRECONDITION, "No trace path is configured, so there's nowhere to write the trace" };
+            case EINVAL:
+                return { ::grpc::StatusCode::INVALID_ARGUMENT, "'" + request->path() + "' isn't a file name" };
+            case EEXIST:
+                return { ::grpc::StatusCode::ALREADY_EXISTS, "'" + path + "' already exists" };
+            default:
+                return { ::grpc::StatusCode::INTERNAL, "Failed to open '" + path + "' -> " + std::strerror(error) };
+        }
+    }
+
+    response->set_events(result.events);
+    response->set_dropped(result.dropped);
+    response->set_path(path);
+    return ::grpc::Status::OK;
+}
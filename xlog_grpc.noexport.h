@@ -9,4 +9,14 @@ public:
     ::grpc::Status SetChannelSeverity(::grpc::ServerContext* context, const ::xlogProto::SetChannelSeverityMessage* request, ::xlogProto::Void* response) override;
     ::grpc::Status GetAllLogLevels(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::AllLogLevelsMessage* response) override;
     ::grpc::Status GetAllLogHandles(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::AllLogHandlesMessage* response) override;
+    ::grpc::Status GetAllSinks(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::AllSinksMessage* response) override;
+    ::grpc::Status SetSinkEnabled(::grpc::ServerContext* context, const ::xlogProto::SetSinkEnabledMessage* request, ::xlogProto::Void* response) override;
+    ::grpc::Status SetSinkSeverity(::grpc::ServerContext* context, const ::xlogProto::SetSinkSeverityMessage* request, ::xlogProto::Void* response) override;
+    ::grpc::Status GetOverloadState(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::OverloadStateMessage* response) override;
+    ::grpc::Status GetMemoryState(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::MemoryStateMessage* response) override;
+    ::grpc::Status GetCallSites(::grpc::ServerContext* context, const ::xlogProto::CallSiteQueryMessage* request, ::xlogProto::CallSitesMessage* response) override;
+    ::grpc::Status SetCallSiteState(::grpc::ServerContext* context, const ::xlogProto::SetCallSiteStateMessage* request, ::xlogProto::CallSiteCountMessage* response) override;
+    ::grpc::Status GetOverheadProfile(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::OverheadProfileMessage* response) override;
+    ::grpc::Status ResetOverheadProfile(::grpc::ServerContext* context, const ::xlogProto::Void* request, ::xlogProto::Void* response) override;
+    ::grpc::Status WriteTrace(::grpc::ServerContext* context, const ::xlogProto::TraceRequestMessage* request, ::xlogProto::TraceResultMessage* response) override;
 };
@@ -1,7 +1,6 @@
 #include "xlog_grpc_util.noexport.h"
 
-#include <regex>
-#include <iostream>
+#include <algorithm>
 #include <filesystem>
 
 #include <fcntl.h>
@@ -10,10 +9,6 @@
 
 #include "xlog_log_internal.noexport.h"
 
-extern const char* __progname;
-
-static auto SOCKET_REGEX = std::regex(R"(^([0-9]+)-(.+)\.socket$)");
-
 xlogProto::SeverityMessage make_severity_message(XLog::Severity severity)
 {
     xlogProto::SeverityMessage msg;
@@ -89,71 +84,28 @@ XLog::Severity severity_from_message(const xlogProto::SeverityMessage& msg)
 std::string GET_THIS_PROGRAM_LOG_SOCKET_LOCATION()
 {
     // Might as well cache it since it should probably never change
-    static auto CACHED = fmt::format("{0}/{1}-{2}.socket", BASE_SOCKET_PATH, getpid(), __progname);
+    static auto CACHED = GET_THIS_PROGRAM_RUNTIME_FILE("socket");
     return CACHED;
 }
 
 std::vector<xlog_socket_candidate> TRY_GET_PROGRAM_LOG_SOCKET(const std::string& program_name, int pid)
 {
-    std::vector<xlog_socket_candidate> candidates;
-
-    std::error_code err;
-    auto itr = std::filesystem::directory_iterator(BASE_SOCKET_PATH, std::filesystem::directory_options::skip_permission_denied, err);
-    if(err)
-    {
-        INTERNAL_CODE(err) << "; Failed to get directory iterator";
-        return candidates;
-    }
+    // Match on the name first, it's free, checking the file type might need a stat()
+    std::vector<xlog_socket_candidate> candidates = FIND_RUNTIME_FILES("socket", program_name, pid);
 
-    for(const auto& sockFile : itr)
+    auto not_sockets = std::remove_if(candidates.begin(), candidates.end(), [](const xlog_socket_candidate& candidate)
     {
-        bool is_socket = sockFile.is_socket(err);
-        if(err)
+        std::error_code err;
+        bool is_socket = std::filesystem::is_socket(candidate.path, err);
+        if(err || !is_socket)
         {
-            INTERNAL_CODE(err) << "; Failed to check if file is socket";
+            INTERNAL() << "'" << candidate.path << "' is not a socket, ignoring it";
+            return true;
         }
 
-        if(!is_socket)
-        {
-            std::cout << "File is not socket" << std::endl;
-            continue;
-        }
-
-        std::string match_name = sockFile.path().filename();
-
-        std::smatch sock_match;
-        if(std::regex_search(match_name, sock_match, SOCKET_REGEX))
-        {
-            if(sock_match.size() != 3)
-            {
-                INTERNAL_CODE(err) << "; sock_match size != 3 (" << sock_match.size() << ')';
-                continue;
-            }
-
-            if(sock_match[2].compare(program_name) == 0)
-            {
-                std::string captured_pid(sock_match[1]);
-                auto cand = xlog_socket_candidate
-                {
-                    .path = sockFile.path(),
-                    .program_name = program_name,
-                    .pid = std::atoi(captured_pid.c_str())
-                };
-
-                if(pid < 0)
-                {
-                    candidates.emplace_back(std::move(cand));
-                }
-                else
-                {
-                    if(cand.pid == pid)
-                    {
-                        candidates.emplace_back(std::move(cand));
-                    }
-                }
-            }
-        }
-    }
+        return false;
+    });
+    candidates.erase(not_sockets, candidates.end());
 
     return candidates;
 }
@@ -162,25 +114,12 @@ bool TRY_SETUP_THIS_PROGRAM_SOCKET()
 {
     const auto LOG_SOCKET = GET_THIS_PROGRAM_LOG_SOCKET_LOCATION();
 
-    std::error_code err;
-    if(!std::filesystem::exists(BASE_SOCKET_PATH, err))
+    if(!TRY_SETUP_RUNTIME_DIRECTORY())
     {
-        std::filesystem::create_directories(BASE_SOCKET_PATH, err);
-        if(err)
-        {
-            INTERNAL_CODE(err) << "; Failed to create directory";
-            return false;
-        }
-    }
-    else
-    {
-        if(!std::filesystem::is_directory(BASE_SOCKET_PATH, err))
-        {
-            INTERNAL_CODE(err) << "; Base socket path is not a directory";
-            return false;
-        }
+        return false;
     }
 
+    std::error_code err;
     auto socket_exists = std::filesystem::exists(LOG_SOCKET, err);
     if(err)
     {
@@ -1,19 +1,14 @@
 #include "xlog.h"
+#include "xlog_paths.noexport.h"
 #include "xlog.grpc.pb.h"
 
-constexpr char BASE_SOCKET_PATH[] = "/tmp/xlog";
-
-struct xlog_socket_candidate
-{
-    std::string path;
-    std::string program_name;
-    int pid;
-};
+typedef xlog_runtime_file xlog_socket_candidate;
 
 xlogProto::SeverityMessage make_severity_message(XLog::Severity severity);
 XLog::Severity severity_from_message(const xlogProto::SeverityMessage& msg);
 
 std::string GET_THIS_PROGRAM_LOG_SOCKET_LOCATION();
+// An empty 'program_name' matches every program, a negative 'pid' matches every instance
 std::vector<xlog_socket_candidate> TRY_GET_PROGRAM_LOG_SOCKET(const std::string& program_name, int pid = -1);
 bool TRY_SETUP_THIS_PROGRAM_SOCKET();
 void TRY_SHUTDOWN_THIS_PROGRAM_SOCKET();
@@ -0,0 +1,365 @@
+#include "xlog_guard.noexport.h"
+
+#include <boost/log/attributes/value_extraction.hpp>
+
+#include "xlog_log_internal.noexport.h"
+
+static std::string milliseconds_string(std::chrono::steady_clock::duration duration)
+{
+    return std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()) + "ms";
+}
+
+xlog_guarded_sink::xlog_guarded_sink(std::shared_ptr<xlog_sink> sink, const XLog::SinkBreakerSettings& breaker) :
+    xlog_sink(sink->name(), sink->formatter()),
+    settings
+    {
+        .budget = std::chrono::milliseconds(std::max(breaker.budget_ms, 1u)),
+        .retry = std::chrono::milliseconds(breaker.retry_ms),
+        .max_strikes = std::max(breaker.max_strikes, 1u),
+        .max_queued = std::max<size_t>(breaker.max_queued, 1)
+    },
+    shared(std::make_shared<shared_state>())
+{
+    shared->sink = std::move(sink);
+    thread = std::thread(&xlog_guarded_sink::writer, shared, settings);
+}
+
+xlog_guarded_sink::~xlog_guarded_sink()
+{
+    std::unique_lock lock(shared->mutex);
+    shared->stopping = true;
+    shared->work_cv.notify_all();
+
+    // Whatever is still queued gets written, unless the sink is stuck, in which case it's tripped & the queue diverted
+    while(!shared->stopped)
+    {
+        shared->idle_cv.wait_for(lock, settings.budget);
+        check_stuck(*shared, settings, std::chrono::steady_clock::now());
+
+        if(shared->state == breaker_state::OPEN && shared->busy_since != std::chrono::steady_clock::time_point{})
+        {
+            break;
+        }
+    }
+
+    const bool stopped = shared->stopped;
+    lock.unlock();
+
+    // It has its own reference to everything it uses
+    if(stopped)
+    {
+        thread.join();
+    }
+    else
+    {
+        thread.detach();
+    }
+}
+
+void xlog_guarded_sink::set_fallback(std::shared_ptr<xlog_sink> sink)
+{
+    std::scoped_lock lock(shared->mutex);
+    shared->fallback = std::move(sink);
+}
+
+XLog::SinkInformation xlog_guarded_sink::information() const
+{
+    // What was actually written comes from the sink itself, what never reached it from us
+    XLog::SinkInformation info = shared->sink->information();
+    const XLog::SinkInformation own = xlog_sink::information();
+
+    info.name = own.name;
+    info.enabled = own.enabled;
+    info.level = own.level;
+    info.filtered = own.filtered;
+
+    std::scoped_lock lock(shared->mutex);
+    info.dropped += own.dropped + shared->lost;
+    info.trips = shared->trips;
+    info.tripped = shared->state != breaker_state::CLOSED;
+    return info;
+}
+
+double xlog_guarded_sink::backlog()
+{
+    std::scoped_lock lock(shared->mutex);
+    return static_cast<double>(shared->queue.size()) / settings.max_queued;
+}
+
+void xlog_guarded_sink::sync()
+{
+    shared->sink->sync();
+}
+
+std::vector<std::string> xlog_guarded_sink::check()
+{
+    std::unique_lock lock(shared->mutex);
+    check_stuck(*shared, settings, std::chrono::steady_clock::now());
+
+    // The writer diverts the queue itself, unless it's the one that's stuck
+    if(shared->state == breaker_state::OPEN && !shared->queue.empty())
+    {
+        divert_queue(*shared, lock);
+    }
+
+    std::vector<std::string> reports;
+    reports.swap(shared->reports);
+    return reports;
+}
+
+bool xlog_guarded_sink::consume(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    std::unique_lock lock(shared->mutex);
+
+    // Once it has been left alone for long enough (and isn't still stuck), this record finds out if the sink works again
+    if(shared->state == breaker_state::OPEN && std::chrono::steady_clock::now() >= shared->open_until &&
+       shared->busy_since == std::chrono::steady_clock::time_point{} && shared->queue.empty())
+    {
+        shared->state = breaker_state::PROBING;
+    }
+    else if(shared->state != breaker_state::CLOSED || shared->queue.size() >= settings.max_queued)
+    {
+        lock.unlock();
+        divert(*shared, rec, text);
+        return false;
+    }
+
+    shared->queue.push_back(queued_record{ rec, text });
+    lock.unlock();
+    shared->work_cv.notify_one();
+    return true;
+}
+
+void xlog_guarded_sink::flush_unlocked()
+{
+    std::unique_lock lock(shared->mutex);
+    if(shared->state == breaker_state::OPEN)
+    {
+        return;
+    }
+
+    const uint64_t target = ++shared->flush_requested;
+    shared->work_cv.notify_one();
+
+    // Checked here as well as by the watchdog, which is stopped before the final flush
+    while(shared->flush_completed < target && shared->state != breaker_state::OPEN && !shared->stopped)
+    {
+        shared->idle_cv.wait_for(lock, settings.budget);
+        check_stuck(*shared, settings, std::chrono::steady_clock::now());
+    }
+}
+
+void xlog_guarded_sink::writer(std::shared_ptr<shared_state> shared, breaker_settings settings)
+{
+    std::unique_lock lock(shared->mutex);
+    while(true)
+    {
+        shared->work_cv.wait(lock, [&]() { return shared->stopping || !shared->queue.empty() || shared->flush_requested != shared->flush_completed; });
+
+        if(!shared->queue.empty())
+        {
+            queued_record record = std::move(shared->queue.front());
+            shared->queue.pop_front();
+
+            const auto start = std::chrono::steady_clock::now();
+            shared->busy_since = start;
+            lock.unlock();
+
+            const bool written = shared->sink->deliver(record.rec, record.text);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            record = queued_record{};
+
+            lock.lock();
+            shared->busy_since = {};
+
+            const bool strike = !written || elapsed > settings.budget;
+            if(shared->state == breaker_state::PROBING)
+            {
+                if(strike)
+                {
+                    shared->state = breaker_state::OPEN;
+                    shared->open_until = std::chrono::steady_clock::now() + settings.retry;
+                }
+                else
+                {
+                    shared->state = breaker_state::CLOSED;
+                    shared->strikes = 0;
+                    shared->reports.push_back("Sink '" + shared->sink->name() + "' has recovered");
+                }
+            }
+            else if(shared->state == breaker_state::CLOSED)
+            {
+                if(!strike)
+                {
+                    shared->strikes = 0;
+                }
+                else if(++shared->strikes >= settings.max_strikes)
+                {
+                    const std::string what = written ? "took longer than " + milliseconds_string(settings.budget) + " to write" : "failed to write";
+                    trip(*shared, settings, what + " " + std::to_string(settings.max_strikes) + " records in a row");
+                }
+            }
+
+            if(shared->state == breaker_state::OPEN)
+            {
+                divert_queue(*shared, lock);
+            }
+
+            shared->idle_cv.notify_all();
+            continue;
+        }
+
+        if(shared->flush_requested != shared->flush_completed)
+        {
+            const uint64_t target = shared->flush_requested;
+            if(shared->state != breaker_state::OPEN)
+            {
+                shared->busy_since = std::chrono::steady_clock::now();
+                lock.unlock();
+                shared->sink->flush();
+                lock.lock();
+                shared->busy_since = {};
+            }
+
+            shared->flush_completed = target;
+            shared->idle_cv.notify_all();
+            continue;
+        }
+
+        if(shared->stopping)
+        {
+            break;
+        }
+    }
+
+    shared->stopped = true;
+    shared->idle_cv.notify_all();
+}
+
+void xlog_guarded_sink::trip(shared_state& shared, const breaker_settings& settings, const std::string& reason)
+{
+    shared.state = breaker_state::OPEN;
+    shared.open_until = std::chrono::steady_clock::now() + settings.retry;
+    shared.strikes = 0;
+    shared.trips++;
+
+    const std::string where = shared.fallback ? "sending its records to '" + shared.fallback->name() + "'" : "dropping its records";
+    shared.reports.push_back("Sink '" + shared.sink->name() + "' tripped (" + reason + "), " + where + " for " + milliseconds_string(settings.retry));
+}
+
+void xlog_guarded_sink::check_stuck(shared_state& shared, const breaker_settings& settings, std::chrono::steady_clock::time_point now)
+{
+    if(shared.busy_since == std::chrono::steady_clock::time_point{} || now - shared.busy_since <= settings.budget)
+    {
+        return;
+    }
+
+    if(shared.state == breaker_state::CLOSED)
+    {
+        trip(shared, settings, "stuck writing for " + milliseconds_string(now - shared.busy_since));
+    }
+    else if(shared.state == breaker_state::PROBING)
+    {
+        // Still broken, it was already reported when it tripped
+        shared.state = breaker_state::OPEN;
+        shared.open_until = now + settings.retry;
+    }
+}
+
+void xlog_guarded_sink::divert_queue(shared_state& shared, std::unique_lock<std::mutex>& lock)
+{
+    std::deque<queued_record> queue;
+    queue.swap(shared.queue);
+    shared.lost += queue.size();
+
+    lock.unlock();
+    for(const auto& record : queue)
+    {
+        divert(shared, record.rec, record.text);
+    }
+    lock.lock();
+}
+
+void xlog_guarded_sink::divert(shared_state& shared, const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    // A fallback that is itself tripped (or falls back to us) drops the record rather than passing it around forever
+    thread_local bool diverting = false;
+
+    const std::shared_ptr<xlog_sink>& fallback = shared.fallback;
+    if(!fallback || diverting)
+    {
+        return;
+    }
+
+    // It already gets the record itself
+    auto severity = boost::log::extract<XLog::Severity>("Severity", rec);
+    const XLog::Severity sev = severity.empty() ? XLog::Severity::INTERNAL : severity.get();
+    if(fallback->enabled.load(std::memory_order_relaxed) && sev >= fallback->level.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    diverting = true;
+
+    const xlog_formatter_function formatter = fallback->formatter();
+    if(formatter == nullptr || (text && formatter == shared.sink->formatter()))
+    {
+        fallback->deliver(rec, formatter == nullptr ? nullptr : text);
+    }
+    else
+    {
+        // Rare enough (only while tripped, and only if the fallback formats differently) not to bother reusing buffers
+        auto formatted = std::make_shared<std::string>();
+        boost::log::formatting_ostream stream(*formatted);
+        formatter(rec, stream);
+        stream.flush();
+        fallback->deliver(rec, std::move(formatted));
+    }
+
+    diverting = false;
+}
+
+xlog_sink_watchdog::xlog_sink_watchdog(std::vector<std::shared_ptr<xlog_guarded_sink>> sinks) :
+    sinks(std::move(sinks))
+{
+    thread = std::thread(&xlog_sink_watchdog::run, this);
+}
+
+xlog_sink_watchdog::~xlog_sink_watchdog()
+{
+    {
+        std::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+}
+
+void xlog_sink_watchdog::run()
+{
+    auto interval = std::chrono::milliseconds(1000);
+    for(const auto& sink : sinks)
+    {
+        interval = std::min(interval, sink->budget() / 2);
+    }
+    interval = std::max(interval, std::chrono::milliseconds(1));
+
+    std::unique_lock lock(mutex);
+    bool last_round = false;
+    while(!last_round)
+    {
+        // One more round once we're stopping, so nothing that has already happened goes unreported
+        last_round = stop_cv.wait_for(lock, interval, [this]() { return stopping; });
+        lock.unlock();
+
+        for(const auto& sink : sinks)
+        {
+            for(const auto& report : sink->check())
+            {
+                INTERNAL() << report;
+            }
+        }
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+#include <boost/shared_ptr.hpp>
+
+/*
+ * Sink circuit breaker
+ *
+ * A sink with SinkBreakerSettings::enabled is wrapped in an xlog_guarded_sink, which hands its
+ * records to a thread of its own through a bounded queue, so a sink stuck on a stalled socket
+ * (syslog) or daemon (journald) holds up that thread rather than the application.
+ *
+ * Every record that takes longer than 'budget_ms' to write, or that the sink fails to write, is a
+ * strike, and 'max_strikes' in a row trips the sink. The watchdog also trips a sink whose thread
+ * has been stuck on a single record for longer than the budget. While tripped the sink's records
+ * (including anything still queued) go to the fallback sink, or are dropped if there isn't one.
+ * After 'retry_ms' the next record is let through as a probe: if it's written in time the sink
+ * is closed again, otherwise it stays tripped for another 'retry_ms'.
+ *
+ * Trips & recoveries are logged as INTERNAL by the watchdog thread, never from inside the
+ * dispatcher, and counted in the sink's information.
+ */
+class xlog_guarded_sink final : public xlog_sink
+{
+public:
+    xlog_guarded_sink(std::shared_ptr<xlog_sink> sink, const XLog::SinkBreakerSettings& breaker);
+
+    // Waits (a little) for the sink's thread, then leaves it behind if it's stuck
+    ~xlog_guarded_sink() override;
+
+    // Where records go while tripped, set before the sink is used
+    void set_fallback(std::shared_ptr<xlog_sink> sink);
+
+    XLog::SinkInformation information() const override;
+    double backlog() override;
+
+    // Straight to the sink, it only touches what has already been written
+    void sync() override;
+
+    // Trips the sink if its thread has been stuck for too long, returns what has happened since the last check
+    std::vector<std::string> check();
+
+    std::chrono::milliseconds budget() const { return settings.budget; }
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
+
+    // Waits for everything queued to be written & the sink flushed, unless the sink is (or gets) tripped
+    void flush_unlocked() override;
+
+    // The queue has its own lock
+    bool concurrent() const override { return true; }
+
+private:
+    enum class breaker_state
+    {
+        CLOSED,
+        OPEN,
+        PROBING
+    };
+
+    struct queued_record
+    {
+        boost::log::record_view rec;
+        xlog_formatted_text text;
+    };
+
+    struct breaker_settings
+    {
+        std::chrono::milliseconds budget;
+        std::chrono::milliseconds retry;
+        uint32_t max_strikes;
+        size_t max_queued;
+    };
+
+    /*
+     * Everything the writer thread touches, shared with it so a thread that is still stuck
+     * when the sink is destroyed can be left behind without pointing at freed memory
+     */
+    struct shared_state
+    {
+        std::shared_ptr<xlog_sink> sink;
+        std::shared_ptr<xlog_sink> fallback;
+
+        std::mutex mutex;
+        std::condition_variable work_cv;
+        std::condition_variable idle_cv;
+        bool stopping = false;
+        bool stopped = false;
+
+        std::deque<queued_record> queue;
+        std::chrono::steady_clock::time_point busy_since{}; // When the record being written was picked up, default if idle
+        uint64_t flush_requested = 0;
+        uint64_t flush_completed = 0;
+
+        breaker_state state = breaker_state::CLOSED;
+        std::chrono::steady_clock::time_point open_until{};
+        uint32_t strikes = 0;
+        uint64_t trips = 0;
+        uint64_t lost = 0; // Taken off the queue without being written (diverted or dropped)
+
+        std::vector<std::string> reports;
+    };
+
+    static void writer(std::shared_ptr<shared_state> shared, breaker_settings settings);
+
+    // Need 'mutex' held
+    static void trip(shared_state& shared, const breaker_settings& settings, const std::string& reason);
+    static void check_stuck(shared_state& shared, const breaker_settings& settings, std::chrono::steady_clock::time_point now);
+
+    // Sends queued records to the fallback sink, needs 'mutex' held (which is let go while they're sent)
+    static void divert_queue(shared_state& shared, std::unique_lock<std::mutex>& lock);
+
+    // Hands a record to the fallback sink (formatted for it), if there is one
+    static void divert(shared_state& shared, const boost::log::record_view& rec, const xlog_formatted_text& text);
+
+    const breaker_settings settings;
+    const std::shared_ptr<shared_state> shared;
+    std::thread thread;
+};
+
+/*
+ * One thread for all guarded sinks, checks every half a budget (at most) for sinks that
+ * are stuck & logs their trips
+ */
+class xlog_sink_watchdog
+{
+public:
+    explicit xlog_sink_watchdog(std::vector<std::shared_ptr<xlog_guarded_sink>> sinks);
+    ~xlog_sink_watchdog();
+
+private:
+    void run();
+
+    const std::vector<std::shared_ptr<xlog_guarded_sink>> sinks;
+
+    std::mutex mutex;
+    std::condition_variable stop_cv;
+    bool stopping = false;
+
+    std::thread thread;
+};
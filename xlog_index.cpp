@@ -0,0 +1,83 @@
+#include "xlog_index.noexport.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include <boost/log/attributes/value_extraction.hpp>
+
+#include "xlog_clock.noexport.h"
+
+void xlog_record_summary::add(XLog::Severity sev, std::string_view channel, int64_t wall_ns)
+{
+    if(record_count == 0)
+    {
+        first_ns = wall_ns;
+        last_ns = wall_ns;
+    }
+
+    // Records aren't always in timestamp order (i.e. replayed by xlog-collector), so this is a range rather than first & last
+    record_count++;
+    first_ns = std::min(first_ns, wall_ns);
+    last_ns = std::max(last_ns, wall_ns);
+    severity_mask |= 1u << static_cast<uint32_t>(sev);
+
+    const size_t bit = xlog_channel_bit(channel);
+    channel_bitmap[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+void xlog_record_summary::add(const boost::log::record_view& rec)
+{
+    auto severity = boost::log::extract<XLog::Severity>("Severity", rec);
+    auto channel = boost::log::extract<std::string>("Channel", rec);
+
+    add(severity.empty() ? XLog::Severity::INTERNAL : severity.get(),
+        channel.empty() ? std::string_view() : std::string_view(channel.get()),
+        XLogClock::record_wall_ns(rec));
+}
+
+xlog_index_writer::xlog_index_writer(const std::string& log_path)
+{
+    const std::string path = xlog_index_path(log_path);
+
+    std::error_code err;
+    const bool is_new = !std::filesystem::exists(path, err) || std::filesystem::file_size(path, err) == 0;
+
+    file.open(path, std::ios::out | std::ios::app | std::ios::binary);
+    if(file.is_open() && is_new)
+    {
+        const uint32_t header[2] = { XLOG_INDEX_MAGIC, XLOG_INDEX_VERSION };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.flush();
+    }
+}
+
+void xlog_index_writer::add(const xlog_index_entry& entry)
+{
+    // Flushed straight away, an entry is only useful to anyone else once it's in the file
+    file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    file.flush();
+}
+
+bool read_index(const std::string& index_path, std::vector<xlog_index_entry>& out)
+{
+    std::ifstream file(index_path, std::ios::in | std::ios::binary);
+    if(!file.is_open())
+    {
+        return false;
+    }
+
+    uint32_t header[2] = {};
+    if(!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != XLOG_INDEX_MAGIC || header[1] != XLOG_INDEX_VERSION)
+    {
+        return false;
+    }
+
+    // A partly written entry at the end is just ignored
+    xlog_index_entry entry;
+    while(file.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+    {
+        out.push_back(entry);
+    }
+
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <string_view>
+
+#include <boost/log/core/record_view.hpp>
+
+/*
+ * Log file index (<log file>.idx)
+ *
+ * The file sinks can describe what they've written in a sidecar file, one fixed-size entry
+ * per stretch of the log (a compressed block, or every FileSettings::index_interval bytes of
+ * a plain file) saying where it is and what it covers. xlog-query uses it to only look at the
+ * parts of a log that can match, rather than reading the whole thing.
+ *
+ * Entries are only added once the data they describe has been written, so anything after the
+ * last entry just hasn't been indexed yet (or the process died before it could be).
+ */
+
+constexpr uint32_t XLOG_INDEX_MAGIC = 0x58444958; // "XIDX"
+constexpr uint32_t XLOG_INDEX_VERSION = 1;
+
+constexpr size_t XLOG_SUMMARY_CHANNEL_BITS = 256;
+
+// Which bit of a channel bitmap a channel sets (FNV-1a)
+inline size_t xlog_channel_bit(std::string_view channel)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for(char c : channel)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+
+    return hash % XLOG_SUMMARY_CHANNEL_BITS;
+}
+
+// What a stretch of log covers, little-endian on disk
+struct xlog_record_summary
+{
+    uint32_t record_count;
+    uint32_t severity_mask;     // Bit per XLog::Severity present
+    int64_t first_ns;           // Wall-clock nanoseconds since the epoch (UTC) of the earliest & latest record
+    int64_t last_ns;
+    uint64_t channel_bitmap[XLOG_SUMMARY_CHANNEL_BITS / 64]; // Bit per channel (xlog_channel_bit), may have false positives
+
+    void add(XLog::Severity sev, std::string_view channel, int64_t wall_ns);
+    void add(const boost::log::record_view& rec);
+
+    bool has_severity(XLog::Severity sev) const { return (severity_mask & (1u << static_cast<uint32_t>(sev))) != 0; }
+    bool may_have_channel(size_t bit) const { return (channel_bitmap[bit / 64] & (uint64_t(1) << (bit % 64))) != 0; }
+};
+
+static_assert(sizeof(xlog_record_summary) == 56);
+
+enum xlog_index_flags : uint32_t
+{
+    XLOG_INDEX_COMPRESSED = 1 // The entry is a compressed block (see xlog_block_file.noexport.h)
+};
+
+struct xlog_index_entry
+{
+    uint64_t offset; // In the log file
+    uint64_t length;
+    uint32_t flags;
+    uint32_t reserved;
+    xlog_record_summary summary;
+};
+
+static_assert(sizeof(xlog_index_entry) == 80);
+
+inline std::string xlog_index_path(const std::string& log_path)
+{
+    return log_path + ".idx";
+}
+
+// Appends entries to the index of a log file, starting a new index if there isn't one
+class xlog_index_writer
+{
+public:
+    explicit xlog_index_writer(const std::string& log_path);
+
+    bool is_open() const { return file.is_open(); }
+    void add(const xlog_index_entry& entry);
+
+private:
+    std::ofstream file;
+};
+
+// Every entry of an index, false if it doesn't exist or isn't an index
+bool read_index(const std::string& index_path, std::vector<xlog_index_entry>& out);
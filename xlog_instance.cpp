@@ -0,0 +1,97 @@
+#include "xlog.h"
+
+#include <boost/log/attributes/constant.hpp>
+#include <boost/log/attributes/attribute_cast.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+
+#include "xlog_escape.noexport.h"
+
+// Name of the (logger) attribute pointing at an instance logger's attributes
+static const char INSTANCE_ATTRIBUTE_NAME[] = "Instance";
+
+XLog::InstanceAttributes::InstanceAttributes(std::vector<InstanceAttribute> attributes) :
+    attributes(std::move(attributes))
+{
+    if(this->attributes.empty())
+    {
+        return;
+    }
+
+    json_form += ",\"instance\":{";
+    for(size_t i = 0; i < this->attributes.size(); i++)
+    {
+        const InstanceAttribute& attribute = this->attributes[i];
+        if(i != 0)
+        {
+            text_form += ", ";
+            json_form += ',';
+        }
+
+        text_form += attribute.key;
+        text_form += '=';
+        text_form += attribute.value;
+
+        json_form += '"';
+        XLogEscape::json_escape(attribute.key, json_form);
+        json_form += "\":\"";
+        XLogEscape::json_escape(attribute.value, json_form);
+        json_form += '"';
+
+#ifdef XLOG_USE_JOURNAL_LOG
+        std::string field;
+        XLogEscape::journal_field_name("INST_", attribute.key, field);
+        field += '=';
+        XLogEscape::utf8_sanitize(attribute.value, field);
+        journal_form.push_back(std::move(field));
+#endif
+    }
+    json_form += '}';
+}
+
+typedef boost::log::attributes::constant<std::shared_ptr<const XLog::InstanceAttributes>> instance_attribute;
+
+// An instance logger made from another one gets the other's attributes first
+static std::vector<XLog::InstanceAttribute> inherit_attributes(const XLog::LoggerType& channel, std::vector<XLog::InstanceAttribute> attributes)
+{
+    const auto parent_attributes = channel.get_attributes();
+    auto found = parent_attributes.find(INSTANCE_ATTRIBUTE_NAME);
+    if(found == parent_attributes.end())
+    {
+        return attributes;
+    }
+
+    auto parent = boost::log::attribute_cast<instance_attribute>(found->second);
+    if(!parent)
+    {
+        return attributes;
+    }
+
+    std::vector<XLog::InstanceAttribute> rValue = parent.get()->entries();
+    rValue.insert(rValue.end(), std::make_move_iterator(attributes.begin()), std::make_move_iterator(attributes.end()));
+    return rValue;
+}
+
+XLog::InstanceLogger::InstanceLogger(const LoggerType& channel, std::vector<InstanceAttribute> attributes) :
+    LoggerType(channel),
+    instance(std::make_shared<const InstanceAttributes>(inherit_attributes(channel, std::move(attributes))))
+{
+    // Records share the one attribute value (and keep it alive while they're queued), so it's never copied per record
+    auto added = add_attribute(INSTANCE_ATTRIBUTE_NAME, instance_attribute(instance));
+    if(!added.second)
+    {
+        // Copied from the parent instance logger
+        remove_attribute(added.first);
+        add_attribute(INSTANCE_ATTRIBUTE_NAME, instance_attribute(instance));
+    }
+}
+
+const XLog::InstanceAttributes* XLog::GetRecordInstance(const boost::log::record_view& rec) noexcept
+{
+    auto instance = boost::log::extract<std::shared_ptr<const InstanceAttributes>>(INSTANCE_ATTRIBUTE_NAME, rec);
+    if(instance.empty() || instance.get()->entries().empty())
+    {
+        return nullptr;
+    }
+
+    return instance.get().get();
+}
@@ -1,10 +1,14 @@
 #include "xlog_journal.noexport.h"
 
 #include "xlog.h"
+#include "xlog_escape.noexport.h"
 
 #undef LOG_INFO
 #undef LOG_DEBUG
 
+#include <vector>
+
+#include <sys/uio.h>
 #include <systemd/sd-journal.h>
 
 #include <boost/log/attributes/value_extraction.hpp>
@@ -37,52 +41,98 @@ int sev2priority(XLog::Severity sev)
     return LOG_EMERG;
 }
 
-#include <fmt/core.h>
+static iovec make_iovec(const std::string& field)
+{
+    return iovec{ const_cast<char*>(field.data()), field.size() };
+}
 
-#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+bool xlog_journal_backend::consume(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    auto sev = boost::log::extract<XLog::Severity>("Severity", rec);
+    auto channel = boost::log::extract<std::string>("Channel", rec);
+    auto message = boost::log::extract<std::string>("Message", rec);
 
-#define XLOG_GET_FILE fmt::format("CODE_FILE={0}", location.file_name())
-#define XLOG_GET_LINE fmt::format("CODE_LINE={0}", location.line())
-#define XLOG_GET_FUNC fmt::format("CODE_FUNC={0}", location.function_name())
+    // Reused between records so we aren't allocating new field strings every time
+    thread_local std::string message_field;
+    thread_local std::string channel_field;
+    thread_local std::string priority_field;
+    thread_local std::vector<std::string> context_fields;
+    thread_local std::vector<iovec> fields;
 
-#define XLOG_USE_STR(var) var.c_str()
+    // journald stores anything that isn't valid UTF-8 as a binary blob, which journalctl then refuses to print
+    message_field.assign("MESSAGE=");
+    XLogEscape::utf8_sanitize(message.get(), message_field);
 
-#define XLOG_GET_SOURCE_LOCATION auto location = boost::log::extract<std::source_location>("SourceLocation", rec).get();
+    channel_field.assign("CHANNEL=");
+    channel_field += channel.get();
 
-#else
+    priority_field.assign("PRIORITY=");
+    priority_field += std::to_string(sev2priority(sev.get()));
 
-#define XLOG_GET_FILE ""
-#define XLOG_GET_LINE ""
-#define XLOG_GET_FUNC ""
+    fields.clear();
+    fields.push_back(make_iovec(message_field));
+    fields.push_back(make_iovec(channel_field));
+    fields.push_back(make_iovec(priority_field));
 
-#define XLOG_USE_STR(var) ""
+    // Already built when the instance logger was created
+    const XLog::InstanceAttributes* instance = XLog::GetRecordInstance(rec);
+    if(instance != nullptr)
+    {
+        for(const std::string& field : instance->journal_fields())
+        {
+            fields.push_back(make_iovec(field));
+        }
+    }
 
-#define XLOG_GET_SOURCE_LOCATION
+    const XLog::ContextSnapshot* context = XLog::GetRecordContext(rec);
+    if(context != nullptr)
+    {
+        if(context_fields.size() < context->size())
+        {
+            context_fields.resize(context->size());
+        }
+
+        for(size_t i = 0; i < context->size(); i++)
+        {
+            std::string& field = context_fields[i];
+            field.clear();
+            XLogEscape::journal_field_name("CTX_", (*context)[i].key(), field);
+            field += '=';
+            XLogEscape::utf8_sanitize((*context)[i].value(), field);
+            fields.push_back(make_iovec(field));
+        }
+    }
 
-#endif // XLOG_LOGGING_USE_SOURCE_LOCATION
+    // sd_journal_sendv_with_location() wants "FIELD=value" strings, and the function name without the prefix
+    thread_local std::string file_field;
+    thread_local std::string line_field;
+    thread_local std::string func;
 
-void xlog_journal_backend::consume(const boost::log::record_view& rec)
-{
-    auto sev = boost::log::extract<XLog::Severity>("Severity", rec);
-    auto channel = boost::log::extract<std::string>("Channel", rec);
-    auto message = boost::log::extract<std::string>("Message", rec);
+    const char* file_ptr = "";
+    const char* line_ptr = "";
+    const char* func_ptr = "";
 
-    XLOG_GET_SOURCE_LOCATION
-    const std::string _file = XLOG_GET_FILE;
-    const std::string _line = XLOG_GET_LINE;
-    const std::string _func = XLOG_GET_FUNC;
-
-    auto result = sd_journal_send_with_location(
-        XLOG_USE_STR(_file),
-        XLOG_USE_STR(_line),
-        XLOG_USE_STR(_func),
-        "MESSAGE=%s", message.get().c_str(),
-        "CHANNEL=%s", channel.get().c_str(),
-        "PRIORITY=%i", sev2priority(sev.get()),
-        NULL);
-
-    if(result != 0)
+    xlog_source_location location;
+    if(get_record_source_location(rec, location))
     {
-        // TODO - Do something with this information
+        file_field.assign("CODE_FILE=");
+        file_field += location.file;
+        line_field.assign("CODE_LINE=");
+        line_field += std::to_string(location.line);
+        func.assign(location.function);
+
+        file_ptr = file_field.c_str();
+        line_ptr = line_field.c_str();
+        func_ptr = func.c_str();
     }
+
+    auto result = sd_journal_sendv_with_location(
+        file_ptr,
+        line_ptr,
+        func_ptr,
+        fields.data(),
+        static_cast<int>(fields.size()));
+
+    // Lost (i.e. journald isn't running), repeated failures trip the sink if it has a breaker
+    return result >= 0;
 }
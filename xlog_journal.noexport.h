@@ -1,14 +1,13 @@
 #pragma once
 
-#include <boost/log/sinks/basic_sink_backend.hpp>
+#include "xlog_sinks.noexport.h"
 
-class xlog_journal_backend final :
-    public boost::log::sinks::basic_sink_backend<
-        boost::log::sinks::combine_requirements<
-            boost::log::sinks::synchronized_feeding
-        >::type
-    >
+// Sends records straight to journald with their attributes as fields, so it doesn't need formatted text
+class xlog_journal_backend final : public xlog_sink
 {
 public:
-    void consume(const boost::log::record_view& rec);
+    xlog_journal_backend() : xlog_sink("journal", nullptr) {}
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
 };
@@ -12,7 +12,7 @@ static XLog::LoggerType INTERNAL_LOGGER{boost::log::keywords::channel = INTERNAL
 
 #else
 
-#define INTERNAL() if(false)CUSTOM_LOG_SEV(INTERNAL_LOGGER, XLog::Severity::INTERNAL)
+#define INTERNAL() if(true) {} else CUSTOM_LOG_SEV(INTERNAL_LOGGER, XLog::Severity::INTERNAL)
 #define INTERNAL_CODE(errc) INTERNAL() << ERRC_STREAM(errc)
 #define INTERNAL_ERRNO() INTERNAL() << ERRNO_STREAM
 
@@ -1,9 +1,31 @@
+#include <map>
 #include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
 #include <iostream>
+#include <algorithm>
 
+#include <elf.h>
+
+#include "xlog.h"
+#include "xlog_paths.noexport.h"
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
 #include "xlog_grpc_util.noexport.h"
 
 #include <grpcpp/create_channel.h>
+#include <grpcpp/completion_queue.h>
+#include <grpcpp/support/async_unary_call.h>
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#include "xlog_control.noexport.h"
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
 
 #include <cli/cli.h>
 #include <cli/loopscheduler.h>
@@ -19,60 +41,41 @@ void to_lower(std::string& value)
     }
 }
 
-std::string log_level_to_string(xlogProto::Severity sev)
-{
-    switch(sev)
-    {
-        case xlogProto::Severity::SEV_INFO:
-            return "INFO";
-        case xlogProto::Severity::SEV_DEBUG:
-            return "DEBUG";
-        case xlogProto::Severity::SEV_WARNING:
-            return "WARNING";
-        case xlogProto::Severity::SEV_ERROR:
-            return "ERROR";
-        case xlogProto::Severity::SEV_FATAL:
-            return "FATAL";
-    }
-
-    return "UNKNOWN";
-}
-
-bool string_to_log_level(std::string val, xlogProto::Severity& sev_out)
+// Levels given to xlog-manager are always the source location variants (DEBUG rather than DEBUG2, etc)
+bool string_to_severity(std::string val, XLog::Severity& sev_out)
 {
     to_lower(val);
 
     if(val.compare("info") == 0)
     {
-        sev_out = xlogProto::Severity::SEV_INFO;
+        sev_out = XLog::Severity::INFO;
         return true;
     }
 
     if(val.compare("debug") == 0)
     {
-        sev_out = xlogProto::Severity::SEV_DEBUG;
+        sev_out = XLog::Severity::DEBUG;
         return true;
     }
 
     if(val.compare("warning") == 0 || val.compare("warn") == 0)
     {
-        sev_out = xlogProto::Severity::SEV_WARNING;
+        sev_out = XLog::Severity::WARNING;
         return true;
     }
 
     if(val.compare("error") == 0 || val.compare("err") == 0)
     {
-        sev_out = xlogProto::Severity::SEV_ERROR;
+        sev_out = XLog::Severity::ERROR;
         return true;
     }
 
     if(val.compare("fatal") == 0)
     {
-        sev_out = xlogProto::Severity::SEV_FATAL;
+        sev_out = XLog::Severity::FATAL;
         return true;
     }
 
-    sev_out = xlogProto::Severity::SEV_UNKNOWN;
     return false;
 }
 
@@ -88,6 +91,40 @@ std::string bool_to_enabled(bool val)
     }
 }
 
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+std::string log_level_to_string(xlogProto::Severity sev)
+{
+    switch(sev)
+    {
+        case xlogProto::Severity::SEV_INFO:
+            return "INFO";
+        case xlogProto::Severity::SEV_DEBUG:
+            return "DEBUG";
+        case xlogProto::Severity::SEV_WARNING:
+            return "WARNING";
+        case xlogProto::Severity::SEV_ERROR:
+            return "ERROR";
+        case xlogProto::Severity::SEV_FATAL:
+            return "FATAL";
+    }
+
+    return "UNKNOWN";
+}
+
+bool string_to_log_level(const std::string& val, xlogProto::Severity& sev_out)
+{
+    XLog::Severity sev;
+    if(!string_to_severity(val, sev))
+    {
+        sev_out = xlogProto::Severity::SEV_UNKNOWN;
+        return false;
+    }
+
+    sev_out = make_severity_message(sev).value();
+    return true;
+}
+
 typedef std::unique_ptr<xlogProto::RuntimeLogManagement::Stub>& StubRef;
 
 void GetGlobalLevel(StubRef stub, std::ostream& out)
@@ -232,168 +269,1946 @@ void SetChannelLevel(StubRef stub, std::ostream& out, const std::string& channel
     }
 }
 
-int main(int argc, char** argv)
+void GetAllSinks(StubRef stub, std::ostream& out)
 {
-    CLI::App app{"xlog External Management Tool"};
-
-    std::string app_name;
-    int app_pid = -1;
+    grpc::ClientContext context;
+    xlogProto::Void _vd;
 
-    // Command options
-    bool use_shell = false;
+    xlogProto::AllSinksMessage message;
+    auto status = stub->GetAllSinks(&context, _vd, &message);
+    if(!status.ok())
+    {
+        out << "Failed to call stub 'GetAllSinks' -> " << status.error_message() << std::endl;
+    }
+    else
+    {
+        for(const auto& sink : message.sinks())
+        {
+            const double average_us = sink.records() == 0 ? 0.0 : (sink.consume_ns() / 1000.0) / sink.records();
 
-    bool get_default_level = false;
-    std::string get_channel_level;
-    bool get_all_levels = false;
-    bool get_all_handles = false;
+            out
+                << "Sink = " << sink.name()
+                << " (" << bool_to_enabled(sink.enabled()) << ")"
+                << ", Log Level = " << log_level_to_string(sink.level().value())
+                << ", Records = " << sink.records()
+                << ", Bytes = " << sink.bytes()
+                << ", Filtered = " << sink.filtered()
+                << ", Dropped = " << sink.dropped()
+                << ", Avg Write = " << average_us << "us"
+                << ", Trips = " << sink.trips() << (sink.tripped() ? " (tripped)" : "");
+            if(sink.unrouted() != 0)
+            {
+                out << ", Unrouted = " << sink.unrouted();
+            }
+            out << std::endl;
+        }
+    }
+}
 
-    std::string set_default_level;
-    std::tuple<std::string, std::string> set_channel_level;
+void SetSinkEnabled(StubRef stub, std::ostream& out, const std::string& sink, bool enabled)
+{
+    grpc::ClientContext context;
+    xlogProto::Void _vd;
 
-    auto name_opt = app.add_option("NAME", app_name, "Name of the application to manage")
-        ->required(true);
+    xlogProto::SetSinkEnabledMessage setMessage;
+    setMessage.set_name(sink);
+    setMessage.set_enabled(enabled);
 
-    app.add_option("-p, --pid", app_pid, "PID of the application to manage")
-        ->needs(name_opt)
-        ->required(false);
+    auto status = stub->SetSinkEnabled(&context, setMessage, &_vd);
+    if(!status.ok())
+    {
+        out << "Failed to call stub 'SetSinkEnabled' -> " << status.error_message() << std::endl;
+    }
+}
 
-    // Direct commands
-    auto command_group = app.add_option_group("Actions", "Actions to execute on an xlog instance")
-        ->require_option(0, 1)
-        ->ignore_case();
-    auto shell_opt = command_group->add_flag("--shell", use_shell, "Enter a telnet-style shell to execute commands");
+void SetSinkLevel(StubRef stub, std::ostream& out, const std::string& sink, const std::string& level)
+{
+    grpc::ClientContext context;
+    xlogProto::Void _vd;
 
-    auto get_default_level_opt = command_group->add_flag("--get-default-level", get_default_level, "Get the default/global log level");
-    auto get_channel_level_opt = command_group->add_option("--get-channel-level", get_channel_level, "Get the level of a specific log channel");
-    auto get_all_levels_opt = command_group->add_flag("--get-all-levels", get_all_levels, "Get all log channels and their associated severity");
-    auto get_all_handles_opt = command_group->add_flag("--get-all-channels", get_all_handles, "Get all log channels");
+    xlogProto::SeverityMessage severity;
+    severity.set_use_source_location(true);
 
-    auto set_default_level_opt = command_group->add_option("--set-default-level", set_default_level, "Set the default/global log level");
-    auto set_channel_level_opt = command_group->add_option("--set-channel-level", set_channel_level, "Set the level of a specific log channel");
+    xlogProto::Severity sev;
+    if(!string_to_log_level(level, sev))
+    {
+        out << "Could not convert log level string to valid log level" << std::endl;
+        return;
+    }
+    severity.set_value(sev);
 
-    app.footer(
-R"""(
-Valid Log Levels:
-    INFO
-    DEBUG
-    WARNING  or  WARN
-    ERROR    or  ERR
-    FATAL
+    xlogProto::SetSinkSeverityMessage setMessage;
+    setMessage.set_name(sink);
+    setMessage.mutable_severity()->CopyFrom(severity);
 
-Log levels are case insensitive for ease of use
-)""");
+    auto status = stub->SetSinkSeverity(&context, setMessage, &_vd);
+    if(!status.ok())
+    {
+        out << "Failed to call stub 'SetSinkSeverity' -> " << status.error_message() << std::endl;
+    }
+}
 
-    CLI11_PARSE(app, argc, argv);
+void GetOverloadState(StubRef stub, std::ostream& out)
+{
+    grpc::ClientContext context;
+    xlogProto::Void _vd;
 
-    auto candidates = TRY_GET_PROGRAM_LOG_SOCKET(app_name, app_pid);
-    if(candidates.empty())
+    xlogProto::OverloadStateMessage message;
+    auto status = stub->GetOverloadState(&context, _vd, &message);
+    if(!status.ok())
     {
-        // No candidates
-        std::cout << "No candidates to connect to" << std::endl;
-        return 1;
+        out << "Failed to call stub 'GetOverloadState' -> " << status.error_message() << std::endl;
     }
-    else if(candidates.size() != 1)
+    else if(!message.shedding())
     {
-        // Can't work out which candidate
-        std::cout << "Multiple candidates for connection:" << std::endl;
-        for(const auto& cnd : candidates)
-        {
-            std::cout << "PID " << cnd.pid << std::endl;
-        }
-        return 1;
+        out << "Not shedding, Transitions = " << message.transitions() << std::endl;
     }
+    else
+    {
+        out
+            << "Shedding below " << log_level_to_string(message.level().value())
+            << " (step " << message.step() << ")"
+            << ", Transitions = " << message.transitions()
+            << std::endl;
+    }
+}
 
-    xlog_socket_candidate socket = candidates.front();
-    auto channel = grpc::CreateChannel(fmt::format("unix://{0}", socket.path), grpc::InsecureChannelCredentials());
-    auto stub = xlogProto::RuntimeLogManagement::NewStub(channel);
-
-    // Default to using shell
-    if(command_group->count_all() == 0)
+void print_memory_state(const xlogProto::MemoryStateMessage& message, std::ostream& out)
+{
+    out << "Used = " << message.used_bytes() << " bytes";
+    if(message.max_bytes() != 0)
     {
-        use_shell = true;
+        out << " of " << message.max_bytes();
     }
+    out
+        << ", Peak = " << message.peak_bytes()
+        << ", Allocations = " << message.allocations()
+        << std::endl;
 
-    if(use_shell)
+    if(message.over_budget())
     {
-        auto root_menu = std::make_unique<cli::Menu>("xlog");
+        out << "Over budget, dropping records below " << log_level_to_string(message.keep_level().value());
+    }
+    else
+    {
+        out << "Within budget";
+    }
+    out
+        << ", Shed = " << message.shed()
+        << ", Transitions = " << message.transitions()
+        << std::endl;
+}
 
-        root_menu->Insert(
-            "GetGlobalLevel",
-            [&stub](std::ostream& out) { GetGlobalLevel(stub, out); },
-            "Get the global/default logging level");
+void GetMemoryState(StubRef stub, std::ostream& out)
+{
+    grpc::ClientContext context;
+    xlogProto::Void _vd;
 
-        root_menu->Insert(
-            "GetChannelLevel",
-            [&stub](std::ostream& out, const std::string& channel) { GetChannelLevel(stub, out, channel); },
-            "Get logging level for the given channel");
+    xlogProto::MemoryStateMessage message;
+    auto status = stub->GetMemoryState(&context, _vd, &message);
+    if(!status.ok())
+    {
+        out << "Failed to call stub 'GetMemoryState' -> " << status.error_message() << std::endl;
+    }
+    else
+    {
+        print_memory_state(message, out);
+    }
+}
 
-        root_menu->Insert(
-            "GetAllLevels",
-            [&stub](std::ostream& out) { GetAllLogLevels(stub, out); },
-            "Get all log handles & their severities");
+// "file=net_*.cpp,func=send,line=42,channel=net" (commas or spaces), a bare value is a file & "*" is everything
+bool string_to_call_site_query(const std::string& val, xlogProto::CallSiteQueryMessage& query_out, std::ostream& out)
+{
+    query_out.Clear();
 
-        root_menu->Insert(
-            "GetAllHandles",
-            [&stub](std::ostream& out) { GetAllHandles(stub, out); },
-            "Get all log handles");
+    size_t start = 0;
+    while(start < val.size())
+    {
+        const size_t end = std::min(val.find_first_of(", ", start), val.size());
+        const std::string part = val.substr(start, end - start);
+        start = end + 1;
 
-        root_menu->Insert(
-            "SetGlobalLevel",
-            [&stub](std::ostream& out, const std::string& level) { SetGlobalLevel(stub, out, level); },
-            "Set the global/default log level");
+        if(part.empty() || part == "*")
+        {
+            continue;
+        }
 
-        root_menu->Insert(
-            "SetChannelLevel",
-            [&stub](std::ostream& out, const std::string& channel, const std::string& level) { SetChannelLevel(stub, out, channel, level); },
-            "Set logging level for the given channel");
+        const size_t equals = part.find('=');
+        std::string key = equals == std::string::npos ? "file" : part.substr(0, equals);
+        const std::string value = equals == std::string::npos ? part : part.substr(equals + 1);
+        to_lower(key);
 
-        cli::Cli cli(std::move(root_menu));
-        cli.StdExceptionHandler(
-                [](std::ostream& out, const std::string& cmd, const std::exception& e)
-                {
-                    out << "Exception caught in cli handler: "
-                        << e.what()
-                        << " handling command: "
-                        << cmd
-                        << ".\n";
-                }
-            );
+        if(key == "file")
+        {
+            query_out.set_file(value);
+        }
+        else if(key == "func" || key == "function")
+        {
+            query_out.set_function(value);
+        }
+        else if(key == "line")
+        {
+            try
+            {
+                query_out.set_line(static_cast<uint32_t>(std::stoul(value)));
+            }
+            catch(const std::exception&)
+            {
+                out << "'" << value << "' isn't a line number" << std::endl;
+                return false;
+            }
+        }
+        else if(key == "channel")
+        {
+            query_out.set_channel(value);
+        }
+        else
+        {
+            out << "Unknown call site field '" << key << "', expected file, func, line, or channel" << std::endl;
+            return false;
+        }
+    }
 
-        cli::LoopScheduler loop;
-        cli::CliLocalTerminalSession session(cli, loop, std::cout);
-        session.ExitAction(
-                [&loop](auto& out)
-                {
-                    loop.Stop();
-                }
-            );
+    return true;
+}
 
-        loop.Run();
+std::string call_site_state_to_string(xlogProto::CallSiteState state)
+{
+    switch(state)
+    {
+        case xlogProto::CallSiteState::CALL_SITE_ENABLED:
+            return "enabled";
+        case xlogProto::CallSiteState::CALL_SITE_DISABLED:
+            return "disabled";
+        default:
+            return "default";
     }
-    else if(get_default_level)
+}
+
+void GetCallSites(StubRef stub, std::ostream& out, const std::string& query)
+{
+    grpc::ClientContext context;
+
+    xlogProto::CallSiteQueryMessage queryMessage;
+    if(!string_to_call_site_query(query, queryMessage, out))
     {
-        GetGlobalLevel(stub, std::cout);
+        return;
     }
-    else if(*get_channel_level_opt)
+
+    xlogProto::CallSitesMessage message;
+    auto status = stub->GetCallSites(&context, queryMessage, &message);
+    if(!status.ok())
     {
-        GetChannelLevel(stub, std::cout, get_channel_level);
+        out << "Failed to call stub 'GetCallSites' -> " << status.error_message() << std::endl;
     }
-    else if(get_all_levels)
+    else
     {
-        GetAllLogLevels(stub, std::cout);
+        for(const auto& site : message.sites())
+        {
+            out
+                << site.file() << ":" << site.line()
+                << " [" << call_site_state_to_string(site.state()) << "]"
+                << ", Channel = " << site.channel()
+                << ", Log Level = " << log_level_to_string(site.level().value())
+                << ", Function = " << site.function()
+                << std::endl;
+        }
     }
-    else if(get_all_handles)
+}
+
+void SetCallSiteState(StubRef stub, std::ostream& out, const std::string& query, xlogProto::CallSiteState state)
+{
+    grpc::ClientContext context;
+
+    xlogProto::SetCallSiteStateMessage setMessage;
+    if(!string_to_call_site_query(query, *setMessage.mutable_query(), out))
     {
-        GetAllHandles(stub, std::cout);
+        return;
     }
-    else if(*set_default_level_opt)
+    setMessage.set_state(state);
+
+    xlogProto::CallSiteCountMessage message;
+    auto status = stub->SetCallSiteState(&context, setMessage, &message);
+    if(!status.ok())
     {
-        SetGlobalLevel(stub, std::cout, set_default_level);
+        out << "Failed to call stub 'SetCallSiteState' -> " << status.error_message() << std::endl;
     }
-    else if(*set_channel_level_opt)
+    else
     {
-        SetChannelLevel(stub, std::cout, std::get<0>(set_channel_level), std::get<1>(set_channel_level));
+        out << "Matched " << message.matched() << " call sites" << std::endl;
+    }
+}
+
+std::string duration_to_string(double ns)
+{
+    if(ns < 1000.0)
+    {
+        return fmt::format("{:.0f}ns", ns);
+    }
+    else if(ns < 1000000.0)
+    {
+        return fmt::format("{:.1f}us", ns / 1000.0);
+    }
+    else if(ns < 1000000000.0)
+    {
+        return fmt::format("{:.1f}ms", ns / 1000000.0);
+    }
+
+    return fmt::format("{:.2f}s", ns / 1000000000.0);
+}
+
+// Upper limit of the histogram bucket that the 'fraction' of records fall into
+uint64_t histogram_percentile(const google::protobuf::RepeatedField<uint64_t>& histogram, const google::protobuf::RepeatedField<uint64_t>& limits, uint64_t records, double fraction)
+{
+    const uint64_t wanted = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * records + 0.5));
+
+    uint64_t seen = 0;
+    for(int i = 0; i < histogram.size() && i < limits.size(); i++)
+    {
+        seen += histogram[i];
+        if(seen >= wanted)
+        {
+            return limits[i];
+        }
+    }
+
+    return limits.empty() ? 0 : limits[limits.size() - 1];
+}
+
+uint64_t overhead_total_ns(const xlogProto::OverheadSiteMessage& site)
+{
+    return site.open_ns() + site.insert_ns() + site.push_ns();
+}
+
+// Adds 'site' onto 'totals', which keeps the first site's file, line, etc
+void overhead_merge(xlogProto::OverheadSiteMessage& totals, const xlogProto::OverheadSiteMessage& site)
+{
+    if(totals.records() == 0)
+    {
+        totals = site;
+        return;
+    }
+
+    totals.set_records(totals.records() + site.records());
+    totals.set_open_ns(totals.open_ns() + site.open_ns());
+    totals.set_insert_ns(totals.insert_ns() + site.insert_ns());
+    totals.set_push_ns(totals.push_ns() + site.push_ns());
+
+    totals.mutable_histogram()->Resize(std::max(totals.histogram_size(), site.histogram_size()), 0);
+    for(int i = 0; i < site.histogram_size(); i++)
+    {
+        totals.set_histogram(i, totals.histogram(i) + site.histogram(i));
+    }
+}
+
+// Every channel, then the 'top' call sites that have spent the longest inside xlog
+void print_overhead_profile(const xlogProto::OverheadProfileMessage& profile, size_t top, std::ostream& out)
+{
+    std::map<std::string, xlogProto::OverheadSiteMessage> channels;
+    for(const auto& site : profile.sites())
+    {
+        overhead_merge(channels[site.channel()], site);
+    }
+
+    for(const auto& [channel, totals] : channels)
+    {
+        out
+            << "Channel = " << channel
+            << ", Records = " << totals.records()
+            << ", Total = " << duration_to_string(overhead_total_ns(totals))
+            << ", Avg = " << duration_to_string(static_cast<double>(overhead_total_ns(totals)) / totals.records())
+            << ", p50 <= " << duration_to_string(histogram_percentile(totals.histogram(), profile.bucket_limits_ns(), totals.records(), 0.5))
+            << ", p99 <= " << duration_to_string(histogram_percentile(totals.histogram(), profile.bucket_limits_ns(), totals.records(), 0.99))
+            << std::endl;
+    }
+
+    std::vector<const xlogProto::OverheadSiteMessage*> sites;
+    for(const auto& site : profile.sites())
+    {
+        sites.push_back(&site);
+    }
+
+    std::sort(sites.begin(), sites.end(), [](const auto* a, const auto* b) { return overhead_total_ns(*a) > overhead_total_ns(*b); });
+    sites.resize(std::min(sites.size(), top));
+
+    for(const auto* site : sites)
+    {
+        const double records = static_cast<double>(site->records());
+        out
+            << site->file() << ":" << site->line() << " [" << site->channel() << ", " << log_level_to_string(site->level().value()) << "]"
+            << ", Records = " << site->records()
+            << ", Total = " << duration_to_string(overhead_total_ns(*site))
+            << ", Avg Open = " << duration_to_string(site->open_ns() / records)
+            << ", Avg Insert = " << duration_to_string(site->insert_ns() / records)
+            << ", Avg Push = " << duration_to_string(site->push_ns() / records)
+            << ", p99 <= " << duration_to_string(histogram_percentile(site->histogram(), profile.bucket_limits_ns(), site->records(), 0.99))
+            << ", Function = " << site->function()
+            << std::endl;
+    }
+}
+
+void GetOverheadProfile(StubRef stub, std::ostream& out, size_t top)
+{
+    grpc::ClientContext context;
+    xlogProto::Void _vd;
+
+    xlogProto::OverheadProfileMessage message;
+    auto status = stub->GetOverheadProfile(&context, _vd, &message);
+    if(!status.ok())
+    {
+        out << "Failed to call stub 'GetOverheadProfile' -> " << status.error_message() << std::endl;
+    }
+    else
+    {
+        print_overhead_profile(message, top, out);
+    }
+}
+
+void ResetOverheadProfile(StubRef stub, std::ostream& out)
+{
+    grpc::ClientContext context;
+    xlogProto::Void _vd;
+    xlogProto::Void _vd2;
+
+    auto status = stub->ResetOverheadProfile(&context, _vd, &_vd2);
+    if(!status.ok())
+    {
+        out << "Failed to call stub 'ResetOverheadProfile' -> " << status.error_message() << std::endl;
+    }
+}
+
+// The process only takes a file name, which it writes in the directory of its own trace path
+xlogProto::TraceRequestMessage make_trace_request(const std::string& name)
+{
+    xlogProto::TraceRequestMessage request;
+    request.set_path(name);
+    return request;
+}
+
+void print_trace_result(const xlogProto::TraceResultMessage& result, std::ostream& out)
+{
+    out << "Wrote " << result.events() << " scopes";
+    if(result.dropped() != 0)
+    {
+        out << " (" << result.dropped() << " dropped)";
+    }
+    out << " to '" << result.path() << "'";
+    out << std::endl;
+}
+
+void WriteTrace(StubRef stub, std::ostream& out, const std::string& name)
+{
+    grpc::ClientContext context;
+    xlogProto::TraceResultMessage result;
+
+    auto status = stub->WriteTrace(&context, make_trace_request(name), &result);
+    if(!status.ok())
+    {
+        out << "Failed to call stub 'WriteTrace' -> " << status.error_message() << std::endl;
+    }
+    else
+    {
+        print_trace_result(result, out);
+    }
+}
+
+/*
+ * Fleet mode (--all)
+ *
+ * The same call goes to every matching process at once over a single completion queue,
+ * each call with its own deadline so a stuck process only costs the timeout rather than
+ * holding up everything else, then the replies are aggregated.
+ */
+
+template<typename Reply>
+struct fleet_call
+{
+    xlog_socket_candidate target;
+    std::unique_ptr<xlogProto::RuntimeLogManagement::Stub> stub;
+    grpc::ClientContext context;
+    grpc::Status status;
+    Reply reply;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<Reply>> reader;
+};
+
+template<typename Reply>
+using fleet_results = std::vector<std::unique_ptr<fleet_call<Reply>>>;
+
+// 'prepare' picks the RPC, i.e. [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetAllSinks(context, request, queue); }
+template<typename Reply, typename Request, typename PrepareFunc>
+fleet_results<Reply> fleet_run(const std::vector<xlog_socket_candidate>& targets, const Request& request, std::chrono::milliseconds timeout, PrepareFunc&& prepare)
+{
+    grpc::CompletionQueue queue;
+    fleet_results<Reply> calls;
+    calls.reserve(targets.size());
+
+    const auto deadline = std::chrono::system_clock::now() + timeout;
+    for(const auto& target : targets)
+    {
+        auto call = std::make_unique<fleet_call<Reply>>();
+        call->target = target;
+        call->stub = xlogProto::RuntimeLogManagement::NewStub(grpc::CreateChannel(fmt::format("unix://{0}", target.path), grpc::InsecureChannelCredentials()));
+        call->context.set_deadline(deadline);
+
+        call->reader = prepare(*call->stub, &call->context, request, &queue);
+        call->reader->StartCall();
+        call->reader->Finish(&call->reply, &call->status, call.get());
+
+        calls.push_back(std::move(call));
+    }
+
+    void* tag = nullptr;
+    bool ok = false;
+    for(size_t pending = calls.size(); pending > 0 && queue.Next(&tag, &ok); pending--)
+    {
+    }
+
+    queue.Shutdown();
+    while(queue.Next(&tag, &ok))
+    {
+    }
+
+    std::sort(calls.begin(), calls.end(), [](const auto& a, const auto& b) { return a->target.pid < b->target.pid; });
+    return calls;
+}
+
+std::string pid_list(const std::vector<int>& pids)
+{
+    std::string rValue;
+    for(int pid : pids)
+    {
+        if(!rValue.empty())
+        {
+            rValue += ", ";
+        }
+        rValue += std::to_string(pid);
+    }
+
+    return rValue;
+}
+
+// Prints every process that didn't answer, returns true if they all did
+template<typename Reply>
+bool fleet_report(const fleet_results<Reply>& calls, std::ostream& out)
+{
+    size_t succeeded = 0;
+    for(const auto& call : calls)
+    {
+        if(call->status.ok())
+        {
+            succeeded++;
+        }
+        else
+        {
+            out << "PID " << call->target.pid << " (" << call->target.program_name << ") failed -> " << call->status.error_message() << std::endl;
+        }
+    }
+
+    out << "Succeeded for " << succeeded << " of " << calls.size() << " processes" << std::endl;
+    return succeeded == calls.size();
+}
+
+template<typename Reply>
+void fleet_print_levels(const fleet_results<Reply>& calls, std::ostream& out)
+{
+    std::map<std::string, std::vector<int>> by_level;
+    for(const auto& call : calls)
+    {
+        if(call->status.ok())
+        {
+            by_level[log_level_to_string(call->reply.value())].push_back(call->target.pid);
+        }
+    }
+
+    for(const auto& [level, pids] : by_level)
+    {
+        out << "Level: " << level << " -> " << pids.size() << " processes (PIDs " << pid_list(pids) << ")" << std::endl;
+    }
+}
+
+bool FleetGetGlobalLevel(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out)
+{
+    auto calls = fleet_run<xlogProto::SeverityMessage>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetDefaultLogLevel(context, request, queue); });
+
+    fleet_print_levels(calls, out);
+    return fleet_report(calls, out);
+}
+
+bool FleetGetChannelLevel(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, const std::string& channel)
+{
+    xlogProto::LogChannel channelMessage;
+    channelMessage.set_channel(channel);
+
+    auto calls = fleet_run<xlogProto::SeverityMessage>(targets, channelMessage, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetChannelLogLevel(context, request, queue); });
+
+    fleet_print_levels(calls, out);
+    return fleet_report(calls, out);
+}
+
+bool FleetGetAllLogLevels(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out)
+{
+    auto calls = fleet_run<xlogProto::AllLogLevelsMessage>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetAllLogLevels(context, request, queue); });
+
+    // Handle -> level -> how many processes have it at that level
+    std::map<std::string, std::map<std::string, size_t>> levels;
+    for(const auto& call : calls)
+    {
+        if(!call->status.ok())
+        {
+            continue;
+        }
+
+        for(const auto& [handle, sev] : call->reply.values())
+        {
+            if(!handle.empty())
+            {
+                levels[handle][log_level_to_string(sev.value())]++;
+            }
+        }
+    }
+
+    for(const auto& [handle, counts] : levels)
+    {
+        out << "Handle = " << handle << ", Log Level =";
+        for(const auto& [level, count] : counts)
+        {
+            out << ' ' << level << " (" << count << ')';
+        }
+        out << std::endl;
+    }
+
+    return fleet_report(calls, out);
+}
+
+bool FleetGetAllHandles(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out)
+{
+    auto calls = fleet_run<xlogProto::AllLogHandlesMessage>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetAllLogHandles(context, request, queue); });
+
+    std::map<std::string, size_t> handles;
+    for(const auto& call : calls)
+    {
+        if(!call->status.ok())
+        {
+            continue;
+        }
+
+        for(const auto& handle : call->reply.values())
+        {
+            if(!handle.empty())
+            {
+                handles[handle]++;
+            }
+        }
+    }
+
+    for(const auto& [handle, count] : handles)
+    {
+        out << "Handle = " << handle << " (" << count << " processes)" << std::endl;
+    }
+
+    return fleet_report(calls, out);
+}
+
+bool FleetSetGlobalLevel(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, const std::string& level)
+{
+    xlogProto::SeverityMessage severity;
+    severity.set_use_source_location(true);
+
+    xlogProto::Severity sev;
+    if(!string_to_log_level(level, sev))
+    {
+        out << "Could not convert log level string to valid log level" << std::endl;
+        return false;
+    }
+    severity.set_value(sev);
+
+    auto calls = fleet_run<xlogProto::Void>(targets, severity, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncSetDefaultLogLevel(context, request, queue); });
+
+    return fleet_report(calls, out);
+}
+
+bool FleetSetChannelLevel(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, const std::string& channel, const std::string& level)
+{
+    xlogProto::SeverityMessage severity;
+    severity.set_use_source_location(true);
+
+    xlogProto::Severity sev;
+    if(!string_to_log_level(level, sev))
+    {
+        out << "Could not convert log level string to valid log level" << std::endl;
+        return false;
+    }
+    severity.set_value(sev);
+
+    xlogProto::SetChannelSeverityMessage setMessage;
+    setMessage.set_channel(channel);
+    setMessage.mutable_severity()->CopyFrom(severity);
+
+    auto calls = fleet_run<xlogProto::Void>(targets, setMessage, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncSetChannelSeverity(context, request, queue); });
+
+    return fleet_report(calls, out);
+}
+
+bool FleetGetAllSinks(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out)
+{
+    auto calls = fleet_run<xlogProto::AllSinksMessage>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetAllSinks(context, request, queue); });
+
+    struct sink_totals
+    {
+        size_t processes = 0;
+        size_t enabled = 0;
+        std::map<std::string, size_t> levels;
+
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        uint64_t filtered = 0;
+        uint64_t dropped = 0;
+        uint64_t consume_ns = 0;
+
+        uint64_t trips = 0;
+        size_t tripped = 0;
+
+        uint64_t unrouted = 0;
+    };
+
+    std::map<std::string, sink_totals> sinks;
+    for(const auto& call : calls)
+    {
+        if(!call->status.ok())
+        {
+            continue;
+        }
+
+        for(const auto& sink : call->reply.sinks())
+        {
+            sink_totals& totals = sinks[sink.name()];
+            totals.processes++;
+            totals.enabled += sink.enabled() ? 1 : 0;
+            totals.levels[log_level_to_string(sink.level().value())]++;
+            totals.records += sink.records();
+            totals.bytes += sink.bytes();
+            totals.filtered += sink.filtered();
+            totals.dropped += sink.dropped();
+            totals.consume_ns += sink.consume_ns();
+            totals.trips += sink.trips();
+            totals.tripped += sink.tripped() ? 1 : 0;
+            totals.unrouted += sink.unrouted();
+        }
+    }
+
+    for(const auto& [name, totals] : sinks)
+    {
+        const double average_us = totals.records == 0 ? 0.0 : (totals.consume_ns / 1000.0) / totals.records;
+
+        out
+            << "Sink = " << name
+            << " (enabled in " << totals.enabled << " of " << totals.processes << ")"
+            << ", Log Level =";
+        for(const auto& [level, count] : totals.levels)
+        {
+            out << ' ' << level << " (" << count << ')';
+        }
+        out
+            << ", Records = " << totals.records
+            << ", Bytes = " << totals.bytes
+            << ", Filtered = " << totals.filtered
+            << ", Dropped = " << totals.dropped
+            << ", Avg Write = " << average_us << "us"
+            << ", Trips = " << totals.trips << " (tripped in " << totals.tripped << ")";
+        if(totals.unrouted != 0)
+        {
+            out << ", Unrouted = " << totals.unrouted;
+        }
+        out << std::endl;
+    }
+
+    return fleet_report(calls, out);
+}
+
+bool FleetSetSinkEnabled(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, const std::string& sink, bool enabled)
+{
+    xlogProto::SetSinkEnabledMessage setMessage;
+    setMessage.set_name(sink);
+    setMessage.set_enabled(enabled);
+
+    auto calls = fleet_run<xlogProto::Void>(targets, setMessage, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncSetSinkEnabled(context, request, queue); });
+
+    return fleet_report(calls, out);
+}
+
+bool FleetSetSinkLevel(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, const std::string& sink, const std::string& level)
+{
+    xlogProto::SeverityMessage severity;
+    severity.set_use_source_location(true);
+
+    xlogProto::Severity sev;
+    if(!string_to_log_level(level, sev))
+    {
+        out << "Could not convert log level string to valid log level" << std::endl;
+        return false;
+    }
+    severity.set_value(sev);
+
+    xlogProto::SetSinkSeverityMessage setMessage;
+    setMessage.set_name(sink);
+    setMessage.mutable_severity()->CopyFrom(severity);
+
+    auto calls = fleet_run<xlogProto::Void>(targets, setMessage, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncSetSinkSeverity(context, request, queue); });
+
+    return fleet_report(calls, out);
+}
+
+bool FleetGetOverloadState(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out)
+{
+    auto calls = fleet_run<xlogProto::OverloadStateMessage>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetOverloadState(context, request, queue); });
+
+    std::map<std::string, std::vector<int>> by_state;
+    for(const auto& call : calls)
+    {
+        if(call->status.ok())
+        {
+            const auto& reply = call->reply;
+            by_state[reply.shedding() ? "Shedding below " + log_level_to_string(reply.level().value()) : "Not shedding"].push_back(call->target.pid);
+        }
+    }
+
+    for(const auto& [state, pids] : by_state)
+    {
+        out << state << " -> " << pids.size() << " processes (PIDs " << pid_list(pids) << ")" << std::endl;
+    }
+
+    return fleet_report(calls, out);
+}
+
+bool FleetGetMemoryState(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out)
+{
+    auto calls = fleet_run<xlogProto::MemoryStateMessage>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetMemoryState(context, request, queue); });
+
+    for(const auto& call : calls)
+    {
+        if(call->status.ok())
+        {
+            out << "PID " << call->target.pid << ": ";
+            print_memory_state(call->reply, out);
+        }
+    }
+
+    return fleet_report(calls, out);
+}
+
+bool FleetGetCallSites(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, const std::string& query)
+{
+    xlogProto::CallSiteQueryMessage queryMessage;
+    if(!string_to_call_site_query(query, queryMessage, out))
+    {
+        return false;
+    }
+
+    auto calls = fleet_run<xlogProto::CallSitesMessage>(targets, queryMessage, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetCallSites(context, request, queue); });
+
+    // The same statement in every instance of a program is the same site
+    std::map<std::pair<std::string, uint32_t>, std::map<std::string, std::vector<int>>> sites;
+    for(const auto& call : calls)
+    {
+        if(!call->status.ok())
+        {
+            continue;
+        }
+
+        for(const auto& site : call->reply.sites())
+        {
+            sites[std::make_pair(site.file(), site.line())][call_site_state_to_string(site.state())].push_back(call->target.pid);
+        }
+    }
+
+    for(const auto& [where, by_state] : sites)
+    {
+        out << where.first << ":" << where.second;
+        for(const auto& [state, pids] : by_state)
+        {
+            out << ", " << state << " in " << pids.size() << " (PIDs " << pid_list(pids) << ")";
+        }
+        out << std::endl;
+    }
+
+    return fleet_report(calls, out);
+}
+
+bool FleetSetCallSiteState(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, const std::string& query, xlogProto::CallSiteState state)
+{
+    xlogProto::SetCallSiteStateMessage setMessage;
+    if(!string_to_call_site_query(query, *setMessage.mutable_query(), out))
+    {
+        return false;
+    }
+    setMessage.set_state(state);
+
+    auto calls = fleet_run<xlogProto::CallSiteCountMessage>(targets, setMessage, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncSetCallSiteState(context, request, queue); });
+
+    uint64_t matched = 0;
+    for(const auto& call : calls)
+    {
+        if(call->status.ok())
+        {
+            matched += call->reply.matched();
+        }
+    }
+    out << "Matched " << matched << " call sites" << std::endl;
+
+    return fleet_report(calls, out);
+}
+
+bool FleetGetOverheadProfile(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, size_t top)
+{
+    auto calls = fleet_run<xlogProto::OverheadProfileMessage>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncGetOverheadProfile(context, request, queue); });
+
+    // The same statement in every instance is one site, bucket limits only differ by each process's tick calibration
+    xlogProto::OverheadProfileMessage combined;
+    std::map<std::pair<std::string, uint32_t>, xlogProto::OverheadSiteMessage> sites;
+    for(const auto& call : calls)
+    {
+        if(!call->status.ok())
+        {
+            continue;
+        }
+
+        if(combined.bucket_limits_ns_size() == 0)
+        {
+            combined.mutable_bucket_limits_ns()->CopyFrom(call->reply.bucket_limits_ns());
+        }
+
+        for(const auto& site : call->reply.sites())
+        {
+            overhead_merge(sites[std::make_pair(site.file(), site.line())], site);
+        }
+    }
+
+    for(auto& [where, site] : sites)
+    {
+        *combined.add_sites() = std::move(site);
+    }
+
+    print_overhead_profile(combined, top, out);
+    return fleet_report(calls, out);
+}
+
+bool FleetResetOverheadProfile(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out)
+{
+    auto calls = fleet_run<xlogProto::Void>(targets, xlogProto::Void{}, timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncResetOverheadProfile(context, request, queue); });
+
+    return fleet_report(calls, out);
+}
+
+bool FleetWriteTrace(const std::vector<xlog_socket_candidate>& targets, std::chrono::milliseconds timeout, std::ostream& out, std::string name)
+{
+    // Processes sharing a trace directory would otherwise all ask for the same file, which only the first gets
+    if(name.find("%p") == std::string::npos)
+    {
+        const std::filesystem::path file(name);
+        name = file.stem().string() + "-%p" + file.extension().string();
+    }
+
+    auto calls = fleet_run<xlogProto::TraceResultMessage>(targets, make_trace_request(name), timeout,
+        [](auto& stub, auto* context, const auto& request, auto* queue) { return stub.PrepareAsyncWriteTrace(context, request, queue); });
+
+    for(const auto& call : calls)
+    {
+        if(call->status.ok())
+        {
+            out << "PID " << call->target.pid << ": ";
+            print_trace_result(call->reply, out);
+        }
+    }
+
+    return fleet_report(calls, out);
+}
+
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+/*
+ * Control block
+ *
+ * Levels are read & written straight from the process's control block (see xlog_control.noexport.h),
+ * so there's nothing to wait on and the process doesn't need a gRPC server at all. The process picks
+ * up a new level the next time it logs, we bump the generation so anything watching knows it changed.
+ */
+
+std::string control_level_to_string(const std::atomic<uint32_t>& level)
+{
+    return XLog::GetSeverityString(static_cast<XLog::Severity>(level.load(std::memory_order_relaxed)));
+}
+
+uint32_t control_channel_count(const xlog_control_block& block)
+{
+    return std::min<uint32_t>(block.channel_count.load(std::memory_order_acquire), XLOG_CONTROL_MAX_CHANNELS);
+}
+
+void ControlGetGlobalLevel(xlog_control_block& block, std::ostream& out)
+{
+    out
+        << "Level: " << control_level_to_string(block.default_level) << std::endl;
+}
+
+void ControlGetChannelLevel(xlog_control_block& block, std::ostream& out, const std::string& channel)
+{
+    // Same as asking the process, a channel it doesn't have yet would get the default level
+    xlog_control_channel* slot = block.find_channel(channel);
+
+    out
+        << "Level: " << control_level_to_string(slot != nullptr ? slot->level : block.default_level) << std::endl;
+}
+
+void ControlGetAllLogLevels(xlog_control_block& block, std::ostream& out)
+{
+    const uint32_t count = control_channel_count(block);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        out
+            << "Handle = " << block.channels[i].get_name()
+            << ", Log Level = " << control_level_to_string(block.channels[i].level)
+            << std::endl;
+    }
+}
+
+void ControlGetAllHandles(xlog_control_block& block, std::ostream& out)
+{
+    const uint32_t count = control_channel_count(block);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        out
+            << "Handle = " << block.channels[i].get_name()
+            << std::endl;
+    }
+}
+
+void ControlSetGlobalLevel(xlog_control_block& block, std::ostream& out, const std::string& level)
+{
+    XLog::Severity sev;
+    if(!string_to_severity(level, sev))
+    {
+        out << "Could not convert log level string to valid log level" << std::endl;
+        return;
+    }
+
+    block.default_level.store(static_cast<uint32_t>(sev), std::memory_order_relaxed);
+
+    const uint32_t count = control_channel_count(block);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        block.channels[i].level.store(static_cast<uint32_t>(sev), std::memory_order_relaxed);
+    }
+
+    block.generation.fetch_add(1, std::memory_order_release);
+}
+
+void ControlSetChannelLevel(xlog_control_block& block, std::ostream& out, const std::string& channel, const std::string& level)
+{
+    XLog::Severity sev;
+    if(!string_to_severity(level, sev))
+    {
+        out << "Could not convert log level string to valid log level" << std::endl;
+        return;
+    }
+
+    xlog_control_channel* slot = block.find_channel(channel);
+    if(slot == nullptr)
+    {
+        out << "Failed to set severity for channel '" << channel << "', the process doesn't have it" << std::endl;
+        return;
+    }
+
+    slot->level.store(static_cast<uint32_t>(sev), std::memory_order_relaxed);
+    block.generation.fetch_add(1, std::memory_order_release);
+}
+
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+// Everything we found for one process
+struct managed_process
+{
+    int pid = -1;
+    std::string program_name;
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    std::unique_ptr<xlog_control_mapping> control;
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    std::string socket_path;
+    std::unique_ptr<xlogProto::RuntimeLogManagement::Stub> stub;
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+};
+
+std::vector<managed_process> find_processes(const std::string& program_name, int pid)
+{
+    std::map<int, managed_process> found;
+
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    for(const auto& file : FIND_RUNTIME_FILES("control", program_name, pid))
+    {
+        // Left behind by a process that died without cleaning up, or one that's still setting it up
+        auto control = xlog_control_mapping::open(file.path);
+        if(!control)
+        {
+            continue;
+        }
+
+        managed_process& process = found[file.pid];
+        process.pid = file.pid;
+        process.program_name = file.program_name;
+        process.control = std::move(control);
+    }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    for(const auto& socket : TRY_GET_PROGRAM_LOG_SOCKET(program_name, pid))
+    {
+        managed_process& process = found[socket.pid];
+        process.pid = socket.pid;
+        process.program_name = socket.program_name;
+        process.socket_path = socket.path;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    std::vector<managed_process> processes;
+    for(auto& [found_pid, process] : found)
+    {
+        processes.push_back(std::move(process));
+    }
+
+    return processes;
+}
+
+/*
+ * Level actions go through the control block when the process has one, and over gRPC otherwise
+ */
+
+void no_route(std::ostream& out)
+{
+    out << "This process can't be managed from here" << std::endl;
+}
+
+void ProcessGetGlobalLevel(managed_process& process, std::ostream& out)
+{
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    if(process.control)
+    {
+        ControlGetGlobalLevel(process.control->block(), out);
+        return;
+    }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    if(process.stub)
+    {
+        GetGlobalLevel(process.stub, out);
+        return;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    no_route(out);
+}
+
+void ProcessGetChannelLevel(managed_process& process, std::ostream& out, const std::string& channel)
+{
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    if(process.control)
+    {
+        ControlGetChannelLevel(process.control->block(), out, channel);
+        return;
+    }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    if(process.stub)
+    {
+        GetChannelLevel(process.stub, out, channel);
+        return;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    no_route(out);
+}
+
+void ProcessGetAllLogLevels(managed_process& process, std::ostream& out)
+{
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    if(process.control)
+    {
+        ControlGetAllLogLevels(process.control->block(), out);
+        return;
+    }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    if(process.stub)
+    {
+        GetAllLogLevels(process.stub, out);
+        return;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    no_route(out);
+}
+
+void ProcessGetAllHandles(managed_process& process, std::ostream& out)
+{
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    if(process.control)
+    {
+        ControlGetAllHandles(process.control->block(), out);
+        return;
+    }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    if(process.stub)
+    {
+        GetAllHandles(process.stub, out);
+        return;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    no_route(out);
+}
+
+void ProcessSetGlobalLevel(managed_process& process, std::ostream& out, const std::string& level)
+{
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    if(process.control)
+    {
+        ControlSetGlobalLevel(process.control->block(), out, level);
+        return;
+    }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    if(process.stub)
+    {
+        SetGlobalLevel(process.stub, out, level);
+        return;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    no_route(out);
+}
+
+void ProcessSetChannelLevel(managed_process& process, std::ostream& out, const std::string& channel, const std::string& level)
+{
+#ifdef XLOG_ENABLE_SHARED_MEMORY_CONTROL
+    if(process.control)
+    {
+        ControlSetChannelLevel(process.control->block(), out, channel, level);
+        return;
+    }
+#endif // XLOG_ENABLE_SHARED_MEMORY_CONTROL
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    if(process.stub)
+    {
+        SetChannelLevel(process.stub, out, channel, level);
+        return;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    no_route(out);
+}
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+// Sinks & call sites are only reachable over gRPC
+bool has_stub(const managed_process& process, std::ostream& out)
+{
+    if(!process.stub)
+    {
+        out << "Sinks and call sites can only be managed over gRPC, and this process doesn't have a log socket" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+struct crash_frame
+{
+    size_t index;
+    uintptr_t address;
+    uintptr_t base;
+    std::string module;
+};
+
+// Shared objects & PIE executables are linked at 0, so their addresses are relative to where they were loaded
+bool is_position_independent(const std::string& module)
+{
+    std::ifstream file(module, std::ios::binary);
+    unsigned char header[EI_NIDENT + sizeof(Elf64_Half)];
+    if(!file.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, ELFMAG, SELFMAG) != 0)
+    {
+        return true;
+    }
+
+    // e_type follows e_ident in both ELF classes, in the file's byte order
+    const Elf64_Half type = header[EI_DATA] == ELFDATA2MSB
+        ? static_cast<Elf64_Half>((header[EI_NIDENT] << 8) | header[EI_NIDENT + 1])
+        : static_cast<Elf64_Half>(header[EI_NIDENT] | (header[EI_NIDENT + 1] << 8));
+    return type != ET_EXEC;
+}
+
+std::string shell_quote(const std::string& value)
+{
+    std::string rValue = "'";
+    for(char c : value)
+    {
+        if(c == '\'')
+        {
+            rValue += "'\\''";
+        }
+        else
+        {
+            rValue += c;
+        }
+    }
+    rValue += '\'';
+    return rValue;
+}
+
+// Runs addr2line once per module, "function at file:line" for each frame (in the order given)
+std::vector<std::string> symbolize_frames(const std::vector<crash_frame>& frames)
+{
+    std::vector<std::string> rValue(frames.size(), "??");
+
+    std::map<std::string, std::vector<size_t>> modules;
+    for(size_t i = 0; i < frames.size(); i++)
+    {
+        if(frames[i].module != "?")
+        {
+            modules[frames[i].module].push_back(i);
+        }
+    }
+
+    for(const auto& [module, indexes] : modules)
+    {
+        const bool relative = is_position_independent(module);
+
+        std::string command = "addr2line -C -f -e " + shell_quote(module);
+        for(size_t i : indexes)
+        {
+            // Other than the frame that crashed they're return addresses, one back is the call itself
+            uintptr_t address = frames[i].address - (frames[i].index != 0 ? 1 : 0);
+            if(relative)
+            {
+                address -= frames[i].base;
+            }
+            command += fmt::format(" {:#x}", address);
+        }
+        command += " 2>/dev/null";
+
+        FILE* pipe = ::popen(command.c_str(), "r");
+        if(pipe == nullptr)
+        {
+            continue;
+        }
+
+        std::string output;
+        char chunk[4096];
+        size_t got;
+        while((got = std::fread(chunk, 1, sizeof(chunk), pipe)) != 0)
+        {
+            output.append(chunk, got);
+        }
+        ::pclose(pipe);
+
+        // Two lines per address, the function and then file:line
+        std::istringstream lines(output);
+        for(size_t i : indexes)
+        {
+            std::string function, location;
+            if(!std::getline(lines, function) || !std::getline(lines, location))
+            {
+                break;
+            }
+            rValue[i] = function + " at " + location;
+        }
+    }
+
+    return rValue;
+}
+
+// "0x..." as written by the crash handler, false (rather than throwing) for anything else
+bool parse_crash_address(std::string_view text, uintptr_t& value)
+{
+    if(text.rfind("0x", 0) == 0)
+    {
+        text.remove_prefix(2);
+    }
+
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, 16);
+    return error == std::errc() && end == text.data() + text.size() && !text.empty();
+}
+
+// Reads crash reports written by LogSettings::s_crash, and prints them with every frame symbolized
+bool SymbolizeCrashReport(const std::string& path, std::ostream& out)
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        out << "Failed to open crash report '" << path << "'" << std::endl;
+        return false;
+    }
+
+    std::vector<crash_frame> frames;
+    bool found_report = false;
+
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.rfind("frame ", 0) == 0)
+        {
+            std::istringstream fields(line.substr(6));
+            crash_frame frame;
+            std::string address, base;
+            if(fields >> frame.index >> address >> base && std::getline(fields >> std::ws, frame.module) &&
+               parse_crash_address(address, frame.address) && parse_crash_address(base, frame.base))
+            {
+                frames.push_back(std::move(frame));
+            }
+            else
+            {
+                // Written while crashing, so it could be cut short or garbled, it's still worth seeing as is
+                out << line << std::endl;
+            }
+        }
+        else if(line == "end")
+        {
+            const auto symbols = symbolize_frames(frames);
+            for(size_t i = 0; i < frames.size(); i++)
+            {
+                out << fmt::format("#{:<3} {:#018x} in {} ({})", frames[i].index, frames[i].address, symbols[i], frames[i].module) << std::endl;
+            }
+            out << std::endl;
+            frames.clear();
+            found_report = true;
+        }
+        else if(line.rfind("crash ", 0) != 0)
+        {
+            // The FATAL line (or whatever else was in the file), the "crash" line is just for us
+            out << line << std::endl;
+        }
+    }
+
+    if(!found_report)
+    {
+        out << "No crash report found in '" << path << "'" << std::endl;
+    }
+
+    return found_report;
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app{"xlog External Management Tool"};
+
+    std::string app_name;
+    int app_pid = -1;
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    bool all_instances = false;
+    int timeout_ms = 2000;
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    // Command options
+    bool use_shell = false;
+
+    bool get_default_level = false;
+    std::string get_channel_level;
+    bool get_all_levels = false;
+    bool get_all_handles = false;
+
+    std::string set_default_level;
+    std::tuple<std::string, std::string> set_channel_level;
+
+    std::string symbolize;
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    bool get_all_sinks = false;
+    std::string enable_sink;
+    std::string disable_sink;
+    std::tuple<std::string, std::string> set_sink_level;
+    bool get_overload_state = false;
+    bool get_memory_state = false;
+    std::string get_call_sites;
+    std::string enable_call_sites;
+    std::string disable_call_sites;
+    std::string reset_call_sites;
+    bool get_overhead = false;
+    bool reset_overhead = false;
+    size_t top_sites = 20;
+    std::string write_trace;
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    // Only --symbolize works without an application
+    auto name_opt = app.add_option("NAME", app_name, "Name of the application to manage");
+
+    auto pid_opt = app.add_option("-p, --pid", app_pid, "PID of the application to manage")
+        ->needs(name_opt)
+        ->required(false);
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    app.add_flag("-a, --all", all_instances, "Run the action on every instance of the application at once (NAME may be '*' for every application)")
+        ->excludes(pid_opt);
+
+    app.add_option("-t, --timeout-ms", timeout_ms, "How long each instance has to answer in --all mode");
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    // Direct commands
+    auto command_group = app.add_option_group("Actions", "Actions to execute on an xlog instance")
+        ->require_option(0, 1)
+        ->ignore_case();
+    auto shell_opt = command_group->add_flag("--shell", use_shell, "Enter a telnet-style shell to execute commands");
+
+    auto get_default_level_opt = command_group->add_flag("--get-default-level", get_default_level, "Get the default/global log level");
+    auto get_channel_level_opt = command_group->add_option("--get-channel-level", get_channel_level, "Get the level of a specific log channel");
+    auto get_all_levels_opt = command_group->add_flag("--get-all-levels", get_all_levels, "Get all log channels and their associated severity");
+    auto get_all_handles_opt = command_group->add_flag("--get-all-channels", get_all_handles, "Get all log channels");
+
+    auto set_default_level_opt = command_group->add_option("--set-default-level", set_default_level, "Set the default/global log level");
+    auto set_channel_level_opt = command_group->add_option("--set-channel-level", set_channel_level, "Set the level of a specific log channel");
+    auto symbolize_opt = command_group->add_option("--symbolize", symbolize, "Print the crash reports in a file (LogSettings::s_crash) with function names & source lines, no application needed");
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    auto get_all_sinks_opt = command_group->add_flag("--get-all-sinks", get_all_sinks, "Get all log sinks, their state, and statistics");
+    auto enable_sink_opt = command_group->add_option("--enable-sink", enable_sink, "Enable a sink (console, file, syslog, journal)");
+    auto disable_sink_opt = command_group->add_option("--disable-sink", disable_sink, "Disable a sink (console, file, syslog, journal)");
+    auto set_sink_level_opt = command_group->add_option("--set-sink-level", set_sink_level, "Set the minimum level of a specific sink");
+    command_group->add_flag("--get-overload-state", get_overload_state, "Get whether records are being shed because logging can't keep up");
+    command_group->add_flag("--get-memory-state", get_memory_state, "Get how much memory xlog's buffers are using, and whether records are being shed to stay within its budget");
+    auto get_call_sites_opt = command_group->add_option("--get-call-sites", get_call_sites, "List the logging statements matching a call site query");
+    auto enable_call_sites_opt = command_group->add_option("--enable-call-sites", enable_call_sites, "Always log the statements matching a call site query, whatever their channel's level");
+    auto disable_call_sites_opt = command_group->add_option("--disable-call-sites", disable_call_sites, "Never log the statements matching a call site query");
+    auto reset_call_sites_opt = command_group->add_option("--reset-call-sites", reset_call_sites, "Put the statements matching a call site query back to their channel's level ('*' for all)");
+    command_group->add_flag("--get-overhead", get_overhead, "Get how long logging has taken, per channel & for the most expensive call sites (needs the overhead profiler)");
+    command_group->add_flag("--reset-overhead", reset_overhead, "Start the overhead profile over");
+    auto write_trace_opt = command_group->add_option("--write-trace", write_trace, "Write the scope timers recorded so far to a Chrome trace, a new file with this name in the directory of the process's trace path ('%p' is replaced with the PID)");
+
+    app.add_option("--top", top_sites, "How many call sites --get-overhead lists");
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    app.footer(
+R"""(
+Valid Log Levels:
+    INFO
+    DEBUG
+    WARNING  or  WARN
+    ERROR    or  ERR
+    FATAL
+
+Log levels are case insensitive for ease of use
+
+Call Site Queries:
+    file=net_*.cpp,func=send,line=42,channel=net
+    Any field can be left out, file & func are globs, a bare value is a file, and '*' is every call site
+)""");
+
+    CLI11_PARSE(app, argc, argv);
+
+    // Works on the report alone, the process that wrote it is long gone
+    if(*symbolize_opt)
+    {
+        return SymbolizeCrashReport(symbolize, std::cout) ? 0 : 1;
+    }
+
+    if(!*name_opt)
+    {
+        std::cerr << "NAME is required (see --help)" << std::endl;
+        return 1;
+    }
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    // Fleet mode is gRPC only, so processes without a log socket are left out
+    if(all_instances)
+    {
+        // Discovered once up front, every call then goes out at the same time
+        const auto targets = TRY_GET_PROGRAM_LOG_SOCKET(app_name == "*" ? std::string() : app_name);
+        if(targets.empty())
+        {
+            std::cout << "No candidates to connect to" << std::endl;
+            return 1;
+        }
+
+        const std::chrono::milliseconds timeout(timeout_ms);
+        bool success = false;
+
+        if(command_group->count_all() == 0 || use_shell)
+        {
+            std::cerr << "The shell isn't available with --all, give an action instead" << std::endl;
+            return 1;
+        }
+        else if(get_default_level)
+        {
+            success = FleetGetGlobalLevel(targets, timeout, std::cout);
+        }
+        else if(*get_channel_level_opt)
+        {
+            success = FleetGetChannelLevel(targets, timeout, std::cout, get_channel_level);
+        }
+        else if(get_all_levels)
+        {
+            success = FleetGetAllLogLevels(targets, timeout, std::cout);
+        }
+        else if(get_all_handles)
+        {
+            success = FleetGetAllHandles(targets, timeout, std::cout);
+        }
+        else if(*set_default_level_opt)
+        {
+            success = FleetSetGlobalLevel(targets, timeout, std::cout, set_default_level);
+        }
+        else if(*set_channel_level_opt)
+        {
+            success = FleetSetChannelLevel(targets, timeout, std::cout, std::get<0>(set_channel_level), std::get<1>(set_channel_level));
+        }
+        else if(get_all_sinks)
+        {
+            success = FleetGetAllSinks(targets, timeout, std::cout);
+        }
+        else if(*enable_sink_opt)
+        {
+            success = FleetSetSinkEnabled(targets, timeout, std::cout, enable_sink, true);
+        }
+        else if(*disable_sink_opt)
+        {
+            success = FleetSetSinkEnabled(targets, timeout, std::cout, disable_sink, false);
+        }
+        else if(*set_sink_level_opt)
+        {
+            success = FleetSetSinkLevel(targets, timeout, std::cout, std::get<0>(set_sink_level), std::get<1>(set_sink_level));
+        }
+        else if(get_overload_state)
+        {
+            success = FleetGetOverloadState(targets, timeout, std::cout);
+        }
+        else if(get_memory_state)
+        {
+            success = FleetGetMemoryState(targets, timeout, std::cout);
+        }
+        else if(*get_call_sites_opt)
+        {
+            success = FleetGetCallSites(targets, timeout, std::cout, get_call_sites);
+        }
+        else if(*enable_call_sites_opt)
+        {
+            success = FleetSetCallSiteState(targets, timeout, std::cout, enable_call_sites, xlogProto::CallSiteState::CALL_SITE_ENABLED);
+        }
+        else if(*disable_call_sites_opt)
+        {
+            success = FleetSetCallSiteState(targets, timeout, std::cout, disable_call_sites, xlogProto::CallSiteState::CALL_SITE_DISABLED);
+        }
+        else if(*reset_call_sites_opt)
+        {
+            success = FleetSetCallSiteState(targets, timeout, std::cout, reset_call_sites, xlogProto::CallSiteState::CALL_SITE_DEFAULT);
+        }
+        else if(get_overhead)
+        {
+            success = FleetGetOverheadProfile(targets, timeout, std::cout, top_sites);
+        }
+        else if(reset_overhead)
+        {
+            success = FleetResetOverheadProfile(targets, timeout, std::cout);
+        }
+        else if(*write_trace_opt)
+        {
+            success = FleetWriteTrace(targets, timeout, std::cout, write_trace);
+        }
+        else
+        {
+            std::cerr << "Given command is unknown or invalid" << std::endl;
+            return 1;
+        }
+
+        return success ? 0 : 1;
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    auto candidates = find_processes(app_name, app_pid);
+    if(candidates.empty())
+    {
+        // No candidates
+        std::cout << "No candidates to connect to" << std::endl;
+        return 1;
+    }
+    else if(candidates.size() != 1)
+    {
+        // Can't work out which candidate
+        std::cout << "Multiple candidates for connection:" << std::endl;
+        for(const auto& cnd : candidates)
+        {
+            std::cout << "PID " << cnd.pid << std::endl;
+        }
+        return 1;
+    }
+
+    managed_process& process = candidates.front();
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    if(!process.socket_path.empty())
+    {
+        auto channel = grpc::CreateChannel(fmt::format("unix://{0}", process.socket_path), grpc::InsecureChannelCredentials());
+        process.stub = xlogProto::RuntimeLogManagement::NewStub(channel);
+    }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+    // Default to using shell
+    if(command_group->count_all() == 0)
+    {
+        use_shell = true;
+    }
+
+    if(use_shell)
+    {
+        auto root_menu = std::make_unique<cli::Menu>("xlog");
+
+        root_menu->Insert(
+            "GetGlobalLevel",
+            [&process](std::ostream& out) { ProcessGetGlobalLevel(process, out); },
+            "Get the global/default logging level");
+
+        root_menu->Insert(
+            "GetChannelLevel",
+            [&process](std::ostream& out, const std::string& channel) { ProcessGetChannelLevel(process, out, channel); },
+            "Get logging level for the given channel");
+
+        root_menu->Insert(
+            "GetAllLevels",
+            [&process](std::ostream& out) { ProcessGetAllLogLevels(process, out); },
+            "Get all log handles & their severities");
+
+        root_menu->Insert(
+            "GetAllHandles",
+            [&process](std::ostream& out) { ProcessGetAllHandles(process, out); },
+            "Get all log handles");
+
+        root_menu->Insert(
+            "SetGlobalLevel",
+            [&process](std::ostream& out, const std::string& level) { ProcessSetGlobalLevel(process, out, level); },
+            "Set the global/default log level");
+
+        root_menu->Insert(
+            "SetChannelLevel",
+            [&process](std::ostream& out, const std::string& channel, const std::string& level) { ProcessSetChannelLevel(process, out, channel, level); },
+            "Set logging level for the given channel");
+
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+        // Sinks can only be managed over gRPC
+        if(process.stub)
+        {
+            root_menu->Insert(
+                "GetAllSinks",
+                [&process](std::ostream& out) { GetAllSinks(process.stub, out); },
+                "Get all log sinks, their state, and statistics");
+
+            root_menu->Insert(
+                "EnableSink",
+                [&process](std::ostream& out, const std::string& sink) { SetSinkEnabled(process.stub, out, sink, true); },
+                "Enable the given sink");
+
+            root_menu->Insert(
+                "DisableSink",
+                [&process](std::ostream& out, const std::string& sink) { SetSinkEnabled(process.stub, out, sink, false); },
+                "Disable the given sink");
+
+            root_menu->Insert(
+                "SetSinkLevel",
+                [&process](std::ostream& out, const std::string& sink, const std::string& level) { SetSinkLevel(process.stub, out, sink, level); },
+                "Set the minimum logging level for the given sink");
+
+            root_menu->Insert(
+                "GetOverloadState",
+                [&process](std::ostream& out) { GetOverloadState(process.stub, out); },
+                "Get whether records are being shed because logging can't keep up");
+
+            root_menu->Insert(
+                "GetMemoryState",
+                [&process](std::ostream& out) { GetMemoryState(process.stub, out); },
+                "Get how much memory xlog's buffers are using, and whether records are being shed to stay within its budget");
+
+            root_menu->Insert(
+                "GetCallSites",
+                [&process](std::ostream& out, const std::string& query) { GetCallSites(process.stub, out, query); },
+                "List the logging statements matching a call site query (i.e. file=net_*.cpp,line=42 or *)");
+
+            root_menu->Insert(
+                "EnableCallSites",
+                [&process](std::ostream& out, const std::string& query) { SetCallSiteState(process.stub, out, query, xlogProto::CallSiteState::CALL_SITE_ENABLED); },
+                "Always log the statements matching a call site query");
+
+            root_menu->Insert(
+                "DisableCallSites",
+                [&process](std::ostream& out, const std::string& query) { SetCallSiteState(process.stub, out, query, xlogProto::CallSiteState::CALL_SITE_DISABLED); },
+                "Never log the statements matching a call site query");
+
+            root_menu->Insert(
+                "ResetCallSites",
+                [&process](std::ostream& out, const std::string& query) { SetCallSiteState(process.stub, out, query, xlogProto::CallSiteState::CALL_SITE_DEFAULT); },
+                "Put the statements matching a call site query back to their channel's level");
+
+            root_menu->Insert(
+                "GetOverhead",
+                [&process, top_sites](std::ostream& out) { GetOverheadProfile(process.stub, out, top_sites); },
+                "Get how long logging has taken, per channel & for the most expensive call sites");
+
+            root_menu->Insert(
+                "ResetOverhead",
+                [&process](std::ostream& out) { ResetOverheadProfile(process.stub, out); },
+                "Start the overhead profile over");
+
+            root_menu->Insert(
+                "WriteTrace",
+                [&process](std::ostream& out, const std::string& name) { WriteTrace(process.stub, out, name); },
+                "Write the scope timers recorded so far to a new Chrome trace with this name, next to the process's trace path");
+        }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+
+        cli::Cli cli(std::move(root_menu));
+        cli.StdExceptionHandler(
+                [](std::ostream& out, const std::string& cmd, const std::exception& e)
+                {
+                    out << "Exception caught in cli handler: "
+                        << e.what()
+                        << " handling command: "
+                        << cmd
+                        << ".\n";
+                }
+            );
+
+        cli::LoopScheduler loop;
+        cli::CliLocalTerminalSession session(cli, loop, std::cout);
+        session.ExitAction(
+                [&loop](auto& out)
+                {
+                    loop.Stop();
+                }
+            );
+
+        loop.Run();
+    }
+    else if(get_default_level)
+    {
+        ProcessGetGlobalLevel(process, std::cout);
+    }
+    else if(*get_channel_level_opt)
+    {
+        ProcessGetChannelLevel(process, std::cout, get_channel_level);
+    }
+    else if(get_all_levels)
+    {
+        ProcessGetAllLogLevels(process, std::cout);
+    }
+    else if(get_all_handles)
+    {
+        ProcessGetAllHandles(process, std::cout);
+    }
+    else if(*set_default_level_opt)
+    {
+        ProcessSetGlobalLevel(process, std::cout, set_default_level);
+    }
+    else if(*set_channel_level_opt)
+    {
+        ProcessSetChannelLevel(process, std::cout, std::get<0>(set_channel_level), std::get<1>(set_channel_level));
+    }
+#ifdef XLOG_ENABLE_EXTERNAL_LOG_CONTROL
+    else if(get_all_sinks)
+    {
+        if(has_stub(process, std::cout))
+        {
+            GetAllSinks(process.stub, std::cout);
+        }
+    }
+    else if(*enable_sink_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            SetSinkEnabled(process.stub, std::cout, enable_sink, true);
+        }
+    }
+    else if(*disable_sink_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            SetSinkEnabled(process.stub, std::cout, disable_sink, false);
+        }
+    }
+    else if(*set_sink_level_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            SetSinkLevel(process.stub, std::cout, std::get<0>(set_sink_level), std::get<1>(set_sink_level));
+        }
+    }
+    else if(get_overload_state)
+    {
+        if(has_stub(process, std::cout))
+        {
+            GetOverloadState(process.stub, std::cout);
+        }
+    }
+    else if(get_memory_state)
+    {
+        if(has_stub(process, std::cout))
+        {
+            GetMemoryState(process.stub, std::cout);
+        }
+    }
+    else if(*get_call_sites_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            GetCallSites(process.stub, std::cout, get_call_sites);
+        }
+    }
+    else if(*enable_call_sites_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            SetCallSiteState(process.stub, std::cout, enable_call_sites, xlogProto::CallSiteState::CALL_SITE_ENABLED);
+        }
+    }
+    else if(*disable_call_sites_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            SetCallSiteState(process.stub, std::cout, disable_call_sites, xlogProto::CallSiteState::CALL_SITE_DISABLED);
+        }
+    }
+    else if(*reset_call_sites_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            SetCallSiteState(process.stub, std::cout, reset_call_sites, xlogProto::CallSiteState::CALL_SITE_DEFAULT);
+        }
+    }
+    else if(get_overhead)
+    {
+        if(has_stub(process, std::cout))
+        {
+            GetOverheadProfile(process.stub, std::cout, top_sites);
+        }
+    }
+    else if(reset_overhead)
+    {
+        if(has_stub(process, std::cout))
+        {
+            ResetOverheadProfile(process.stub, std::cout);
+        }
+    }
+    else if(*write_trace_opt)
+    {
+        if(has_stub(process, std::cout))
+        {
+            WriteTrace(process.stub, std::cout, write_trace);
+        }
     }
+#endif // XLOG_ENABLE_EXTERNAL_LOG_CONTROL
     else
     {
         std::cerr << "Given command is unknown or invalid" << std::endl;
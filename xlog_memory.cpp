@@ -0,0 +1,206 @@
+#include "xlog_memory.noexport.h"
+
+#include <mutex>
+#include <algorithm>
+
+#include "xlog_overload.noexport.h"
+
+struct xlog_memory_budget
+{
+    std::atomic<uint64_t> max_bytes{0};
+    std::atomic<uint64_t> resume_bytes{0};
+    std::atomic<XLog::Severity> keep_level{XLog::Severity::ERROR};
+    std::atomic<size_t> pooled_buffers{8};
+    std::atomic<size_t> max_pooled_size{64 * 1024};
+
+    std::atomic<uint64_t> used{0};
+    std::atomic<uint64_t> peak{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> shed{0};
+    std::atomic<uint64_t> transitions{0};
+
+    // Only taken when going over (or back under) the budget
+    std::mutex mutex;
+};
+
+// Never destroyed, thread-local pools release their buffers after everything else has gone
+static xlog_memory_budget& memory_budget()
+{
+    static xlog_memory_budget* budget = new xlog_memory_budget();
+    return *budget;
+}
+
+static void update_budget_state(xlog_memory_budget& budget)
+{
+    std::scoped_lock lock(budget.mutex);
+
+    const uint64_t max_bytes = budget.max_bytes.load(std::memory_order_relaxed);
+    const uint64_t used = budget.used.load(std::memory_order_relaxed);
+    const bool over = XLOG_OVER_BUDGET.load(std::memory_order_relaxed);
+
+    if(!over && max_bytes != 0 && used > max_bytes)
+    {
+        XLOG_OVER_BUDGET.store(true, std::memory_order_relaxed);
+        xlog_set_shed_level(xlog_shed_source::MEMORY_BUDGET, budget.keep_level.load(std::memory_order_relaxed));
+        budget.transitions.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if(over && (max_bytes == 0 || used <= budget.resume_bytes.load(std::memory_order_relaxed)))
+    {
+        XLOG_OVER_BUDGET.store(false, std::memory_order_relaxed);
+        xlog_set_shed_level(xlog_shed_source::MEMORY_BUDGET, XLog::Severity::INFO);
+    }
+}
+
+static void charge_bytes(size_t bytes) noexcept
+{
+    auto& budget = memory_budget();
+    const uint64_t used = budget.used.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    uint64_t peak = budget.peak.load(std::memory_order_relaxed);
+    while(used > peak && !budget.peak.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+    {
+    }
+
+    const uint64_t max_bytes = budget.max_bytes.load(std::memory_order_relaxed);
+    if(max_bytes != 0 && used > max_bytes && !XLOG_OVER_BUDGET.load(std::memory_order_relaxed))
+    {
+        update_budget_state(budget);
+    }
+}
+
+static void release_bytes(size_t bytes) noexcept
+{
+    auto& budget = memory_budget();
+    const uint64_t used = budget.used.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+
+    if(XLOG_OVER_BUDGET.load(std::memory_order_relaxed) && used <= budget.resume_bytes.load(std::memory_order_relaxed))
+    {
+        update_budget_state(budget);
+    }
+}
+
+void xlog_memory_setup(const XLog::MemoryBudgetSettings& settings)
+{
+    auto& budget = memory_budget();
+    const double resume_ratio = std::clamp(settings.resume_ratio, 0.0, 1.0);
+
+    budget.max_bytes.store(settings.max_bytes, std::memory_order_relaxed);
+    budget.resume_bytes.store(static_cast<uint64_t>(settings.max_bytes * resume_ratio), std::memory_order_relaxed);
+    budget.keep_level.store(settings.keep_level, std::memory_order_relaxed);
+    budget.pooled_buffers.store(settings.pooled_buffers_per_thread, std::memory_order_relaxed);
+    budget.max_pooled_size.store(settings.max_pooled_buffer_size, std::memory_order_relaxed);
+
+    // Buffers charged before now (i.e. by INTERNAL records) may already be over it
+    update_budget_state(budget);
+}
+
+bool xlog_memory_sheds(XLog::Severity sev) noexcept
+{
+    if(!XLOG_OVER_BUDGET.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+
+    auto& budget = memory_budget();
+    if(sev >= budget.keep_level.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+
+    budget.shed.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+xlog_memory_charge::~xlog_memory_charge()
+{
+    set(0);
+}
+
+void xlog_memory_charge::set(size_t new_bytes) noexcept
+{
+    if(new_bytes > bytes)
+    {
+        charge_bytes(new_bytes - bytes);
+    }
+    else if(new_bytes < bytes)
+    {
+        release_bytes(bytes - new_bytes);
+    }
+
+    bytes = new_bytes;
+}
+
+xlog_formatted_text xlog_text_pool::format(xlog_formatter_function formatter, const boost::log::record_view& rec, boost::log::formatting_ostream& stream)
+{
+    std::shared_ptr<buffer> buf = acquire();
+    buf->text.clear();
+
+    stream.attach(buf->text);
+    formatter(rec, stream);
+    stream.flush();
+    stream.detach();
+
+    buf->charge.set(buf->text.capacity());
+
+    // Shares the buffer's use count, which is how we know when the sinks are done with it
+    return xlog_formatted_text(buf, &buf->text);
+}
+
+std::shared_ptr<xlog_text_pool::buffer> xlog_text_pool::acquire()
+{
+    auto& budget = memory_budget();
+    const bool over_budget = XLOG_OVER_BUDGET.load(std::memory_order_relaxed);
+    const size_t max_pooled_size = budget.max_pooled_size.load(std::memory_order_relaxed);
+
+    for(size_t i = 0; i < buffers.size(); i++)
+    {
+        const size_t index = (next + i) % buffers.size();
+        if(buffers[index].use_count() != 1)
+        {
+            continue;
+        }
+
+        // The last sink to let go of it did so with a release, so what it read happens before what we write
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        std::shared_ptr<buffer> found = buffers[index];
+        if(over_budget || found->text.capacity() > max_pooled_size)
+        {
+            // Used one last time, then freed rather than kept
+            buffers.erase(buffers.begin() + index);
+            next = buffers.empty() ? 0 : index % buffers.size();
+        }
+        else
+        {
+            next = (index + 1) % buffers.size();
+        }
+
+        return found;
+    }
+
+    budget.allocations.fetch_add(1, std::memory_order_relaxed);
+
+    auto fresh = std::make_shared<buffer>();
+    if(!over_budget && buffers.size() < budget.pooled_buffers.load(std::memory_order_relaxed))
+    {
+        buffers.push_back(fresh);
+    }
+
+    return fresh;
+}
+
+XLog::MemoryState XLog::GetMemoryState()
+{
+    auto& budget = memory_budget();
+    return MemoryState
+    {
+        .max_bytes = budget.max_bytes.load(std::memory_order_relaxed),
+        .used_bytes = budget.used.load(std::memory_order_relaxed),
+        .peak_bytes = budget.peak.load(std::memory_order_relaxed),
+        .allocations = budget.allocations.load(std::memory_order_relaxed),
+        .over_budget = XLOG_OVER_BUDGET.load(std::memory_order_relaxed),
+        .keep_level = budget.keep_level.load(std::memory_order_relaxed),
+        .shed = budget.shed.load(std::memory_order_relaxed),
+        .transitions = budget.transitions.load(std::memory_order_relaxed)
+    };
+}
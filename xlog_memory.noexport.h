@@ -0,0 +1,74 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/*
+ * Memory budget
+ *
+ * Every buffer xlog holds on to for records (formatted text, compressed blocks, trace chunks) is
+ * charged against MemoryBudgetSettings::max_bytes while it exists. The charge that takes usage over
+ * the budget raises XLog::OVERLOAD_LEVEL to 'keep_level', so the loggers stop creating records below
+ * it, and records below it that were already on their way are dropped by the dispatcher before
+ * they're formatted. While over budget pools don't keep spare buffers and optional buffers (trace
+ * chunks) aren't allocated at all. The release that takes usage under 'resume_ratio' of the budget
+ * puts the level back.
+ *
+ * Nothing is ever logged from here (charges happen inside the dispatcher), GetMemoryState() counts
+ * how often the budget has been exceeded instead.
+ */
+
+// Applies LogSettings::s_memory, called by InitializeLogging
+void xlog_memory_setup(const XLog::MemoryBudgetSettings& settings);
+
+// Set while over budget, checked by the dispatcher for every record
+inline std::atomic<bool> XLOG_OVER_BUDGET{false};
+
+// True if a record of 'sev' should be dropped because we're over budget (and counts it)
+bool xlog_memory_sheds(XLog::Severity sev) noexcept;
+
+// Bytes charged against the budget for as long as it lives (or until it's changed)
+class xlog_memory_charge
+{
+public:
+    xlog_memory_charge() = default;
+    ~xlog_memory_charge();
+
+    xlog_memory_charge(const xlog_memory_charge&) = delete;
+    xlog_memory_charge& operator=(const xlog_memory_charge&) = delete;
+
+    void set(size_t bytes) noexcept;
+    size_t get() const noexcept { return bytes; }
+
+private:
+    size_t bytes = 0;
+};
+
+/*
+ * Formatted text buffers of one thread & formatter
+ *
+ * Buffers stay with the thread that formatted into them: one goes back into use once every sink
+ * has let go of it (its use count is back to 1), so sink threads never free or hand back anything,
+ * they only drop their reference. If every pooled buffer is still held (i.e. queued by a guarded
+ * sink) the record gets a buffer of its own, which is freed by whoever drops it last.
+ */
+class xlog_text_pool
+{
+public:
+    xlog_formatted_text format(xlog_formatter_function formatter, const boost::log::record_view& rec, boost::log::formatting_ostream& stream);
+
+private:
+    struct buffer
+    {
+        std::string text;
+        xlog_memory_charge charge;
+    };
+
+    std::shared_ptr<buffer> acquire();
+
+    std::vector<std::shared_ptr<buffer>> buffers;
+    size_t next = 0;
+};
@@ -0,0 +1,368 @@
+#include "xlog_metrics.noexport.h"
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "xlog_memory.noexport.h"
+
+static constexpr size_t LINEAR_BUCKETS = 16;
+static constexpr unsigned int SUB_BUCKET_BITS = 3;
+static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+static constexpr size_t HISTOGRAM_BUCKETS = LINEAR_BUCKETS + (64 - 4) * SUB_BUCKETS;
+
+static size_t bucket_index(uint64_t value)
+{
+    if(value < LINEAR_BUCKETS)
+    {
+        return static_cast<size_t>(value);
+    }
+
+    const unsigned int exponent = 63 - static_cast<unsigned int>(__builtin_clzll(value));
+    const size_t sub_bucket = static_cast<size_t>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return LINEAR_BUCKETS + (exponent - 4) * SUB_BUCKETS + sub_bucket;
+}
+
+// The middle of the bucket (or its only value, below LINEAR_BUCKETS)
+static uint64_t bucket_value(size_t index)
+{
+    if(index < LINEAR_BUCKETS)
+    {
+        return index;
+    }
+
+    const unsigned int exponent = static_cast<unsigned int>((index - LINEAR_BUCKETS) / SUB_BUCKETS) + 4;
+    const uint64_t width = uint64_t(1) << (exponent - SUB_BUCKET_BITS);
+    const uint64_t lower = (uint64_t(1) << exponent) + ((index - LINEAR_BUCKETS) % SUB_BUCKETS) * width;
+    return lower + width / 2;
+}
+
+struct xlog_metric_totals
+{
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    std::vector<uint64_t> buckets;
+};
+
+// Only ever written by its thread
+struct xlog_metric_cell
+{
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+    xlog_memory_charge charge;
+
+    void add_to(xlog_metric_totals& totals) const
+    {
+        totals.count += count.load(std::memory_order_relaxed);
+        totals.sum += sum.load(std::memory_order_relaxed);
+        for(size_t i = 0; buckets && i < HISTOGRAM_BUCKETS; i++)
+        {
+            totals.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+class XLog::Metric
+{
+public:
+    Metric(const std::string& channel, std::string name, MetricKind kind, size_t id) :
+        channel(channel),
+        name(std::move(name)),
+        kind(kind),
+        id(id)
+    {
+        if(kind == MetricKind::HISTOGRAM)
+        {
+            retired.buckets.resize(HISTOGRAM_BUCKETS);
+            reported.buckets.resize(HISTOGRAM_BUCKETS);
+        }
+    }
+
+    // Interned (LoggerType::channel_name()), so it outlives any logger
+    const std::string& channel;
+    const std::string name;
+    const MetricKind kind;
+    const size_t id;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<xlog_metric_cell>> cells;
+
+    // What exited threads had added
+    xlog_metric_totals retired;
+
+    // Totals as of the last summary, only touched by the reporter
+    xlog_metric_totals reported;
+
+    xlog_metric_totals totals()
+    {
+        std::scoped_lock lock(mutex);
+        xlog_metric_totals rValue = retired;
+        for(const auto& cell : cells)
+        {
+            cell->add_to(rValue);
+        }
+        return rValue;
+    }
+};
+
+struct xlog_metric_registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<XLog::Metric>> metrics;
+    std::map<std::tuple<const std::string*, std::string, XLog::MetricKind>, XLog::Metric*, std::less<>> by_name;
+};
+
+// Leaked, threads can still be exiting (and retiring their cells) while statics are destroyed
+static xlog_metric_registry& metric_registry()
+{
+    static xlog_metric_registry* reg = new xlog_metric_registry;
+    return *reg;
+}
+
+// The calling thread's cells, by metric id
+struct xlog_metric_thread
+{
+    std::vector<xlog_metric_cell*> cells;
+    std::vector<XLog::Metric*> metrics;
+
+    // Folds the thread's cells into their metrics & frees them
+    ~xlog_metric_thread()
+    {
+        for(size_t i = 0; i < cells.size(); i++)
+        {
+            if(cells[i] == nullptr)
+            {
+                continue;
+            }
+
+            XLog::Metric& metric = *metrics[i];
+            std::scoped_lock lock(metric.mutex);
+            cells[i]->add_to(metric.retired);
+            metric.cells.erase(std::remove_if(metric.cells.begin(), metric.cells.end(), [&](const auto& cell) { return cell.get() == cells[i]; }), metric.cells.end());
+        }
+    }
+};
+
+static thread_local xlog_metric_thread THREAD_METRICS;
+
+static xlog_metric_cell& thread_cell(XLog::Metric& metric)
+{
+    auto& local = THREAD_METRICS;
+    if(metric.id < local.cells.size() && local.cells[metric.id] != nullptr)
+    {
+        return *local.cells[metric.id];
+    }
+
+    auto cell = std::make_unique<xlog_metric_cell>();
+    size_t bytes = sizeof(xlog_metric_cell);
+    if(metric.kind == XLog::MetricKind::HISTOGRAM)
+    {
+        cell->buckets = std::make_unique<std::atomic<uint64_t>[]>(HISTOGRAM_BUCKETS);
+        bytes += HISTOGRAM_BUCKETS * sizeof(std::atomic<uint64_t>);
+    }
+    cell->charge.set(bytes);
+
+    if(metric.id >= local.cells.size())
+    {
+        local.cells.resize(metric.id + 1, nullptr);
+        local.metrics.resize(metric.id + 1, nullptr);
+    }
+    local.cells[metric.id] = cell.get();
+    local.metrics[metric.id] = &metric;
+
+    std::scoped_lock lock(metric.mutex);
+    metric.cells.push_back(std::move(cell));
+    return *local.cells[metric.id];
+}
+
+// Only the cell's thread writes to it, so there's no need for an atomic add
+static void add_relaxed(std::atomic<uint64_t>& value, uint64_t n)
+{
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+XLog::Metric& XLog::GetMetric(const LoggerType& logger, std::string_view name, MetricKind kind) noexcept
+{
+    const std::string& channel = logger.channel_name();
+
+    auto& reg = metric_registry();
+    std::scoped_lock lock(reg.mutex);
+
+    auto key = std::make_tuple(&channel, std::string(name), kind);
+    auto found = reg.by_name.find(key);
+    if(found != reg.by_name.end())
+    {
+        return *found->second;
+    }
+
+    reg.metrics.push_back(std::make_unique<Metric>(channel, std::string(name), kind, reg.metrics.size()));
+    reg.by_name.emplace(std::move(key), reg.metrics.back().get());
+    return *reg.metrics.back();
+}
+
+XLog::Metric& XLog::GetMetric(std::atomic<Metric*>& last, const LoggerType& logger, std::string_view name, MetricKind kind) noexcept
+{
+    // Metrics are never freed, so whatever's in 'last' is safe to look at
+    Metric* metric = last.load(std::memory_order_acquire);
+    if(metric != nullptr && &metric->channel == &logger.channel_name() && metric->name == name && metric->kind == kind)
+    {
+        return *metric;
+    }
+
+    metric = &GetMetric(logger, name, kind);
+    last.store(metric, std::memory_order_release);
+    return *metric;
+}
+
+void XLog::AddToCounter(Metric& metric, uint64_t n) noexcept
+{
+    xlog_metric_cell& cell = thread_cell(metric);
+    add_relaxed(cell.count, 1);
+    add_relaxed(cell.sum, n);
+}
+
+void XLog::RecordHistogram(Metric& metric, uint64_t value) noexcept
+{
+    xlog_metric_cell& cell = thread_cell(metric);
+    add_relaxed(cell.count, 1);
+    add_relaxed(cell.sum, value);
+    if(cell.buckets)
+    {
+        add_relaxed(cell.buckets[bucket_index(value)], 1);
+    }
+}
+
+// Smallest bucket value that at least 'fraction' of 'count' are at or below
+static uint64_t percentile(const std::vector<uint64_t>& buckets, uint64_t count, double fraction)
+{
+    const uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(static_cast<double>(count) * fraction + 0.5));
+    uint64_t seen = 0;
+    for(size_t i = 0; i < buckets.size(); i++)
+    {
+        seen += buckets[i];
+        if(seen >= target)
+        {
+            return bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+static std::string summarize(const XLog::Metric& metric, const xlog_metric_totals& now, const xlog_metric_totals& before, double seconds)
+{
+    const uint64_t count = now.count - before.count;
+    const uint64_t sum = now.sum - before.sum;
+
+    if(metric.kind == XLog::MetricKind::COUNTER)
+    {
+        return fmt::format("{}: {} in {:.1f}s ({:.1f}/s)", metric.name, sum, seconds, seconds > 0 ? static_cast<double>(sum) / seconds : 0.0);
+    }
+
+    std::vector<uint64_t> buckets(HISTOGRAM_BUCKETS);
+    size_t highest = 0;
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        buckets[i] = now.buckets[i] - before.buckets[i];
+        if(buckets[i] != 0)
+        {
+            highest = i;
+        }
+    }
+
+    return fmt::format("{}: {} in {:.1f}s, mean {:.1f}, p50 {}, p90 {}, p99 {}, max {}",
+        metric.name, count, seconds, static_cast<double>(sum) / static_cast<double>(count),
+        percentile(buckets, count, 0.5), percentile(buckets, count, 0.9), percentile(buckets, count, 0.99), bucket_value(highest));
+}
+
+xlog_metric_reporter::xlog_metric_reporter(const XLog::MetricSettings& settings) :
+    settings(settings),
+    last_report(std::chrono::steady_clock::now())
+{
+    thread = std::thread(&xlog_metric_reporter::run, this);
+}
+
+xlog_metric_reporter::~xlog_metric_reporter()
+{
+    {
+        std::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+
+    XLog::METRICS.store(false, std::memory_order_relaxed);
+    report();
+}
+
+void xlog_metric_reporter::run()
+{
+    std::unique_lock lock(mutex);
+    while(true)
+    {
+        if(settings.interval_ms == 0)
+        {
+            stop_cv.wait(lock, [this]() { return stopping; });
+        }
+        else
+        {
+            stop_cv.wait_for(lock, std::chrono::milliseconds(settings.interval_ms), [this]() { return stopping; });
+        }
+
+        if(stopping)
+        {
+            break;
+        }
+
+        lock.unlock();
+        report();
+        lock.lock();
+    }
+}
+
+void xlog_metric_reporter::report()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(now - last_report).count();
+    last_report = now;
+
+    std::vector<XLog::Metric*> metrics;
+    {
+        auto& reg = metric_registry();
+        std::scoped_lock lock(reg.mutex);
+        for(const auto& metric : reg.metrics)
+        {
+            metrics.push_back(metric.get());
+        }
+    }
+
+    for(XLog::Metric* metric : metrics)
+    {
+        xlog_metric_totals totals = metric->totals();
+        if(totals.count == metric->reported.count)
+        {
+            continue;
+        }
+
+        XLog::LoggerType& logger = XLog::GetNamedLogger(metric->channel);
+        if(logger.accepts(settings.level))
+        {
+            BOOST_LOG_SEV(logger, settings.level) << summarize(*metric, totals, metric->reported, seconds);
+        }
+        metric->reported = std::move(totals);
+    }
+}
+
+std::unique_ptr<xlog_metric_reporter> xlog_metrics_setup(const XLog::MetricSettings& settings)
+{
+    XLog::METRICS.store(settings.enabled, std::memory_order_relaxed);
+    if(!settings.enabled)
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<xlog_metric_reporter>(settings);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+/*
+ * Metric aggregation (LOG_COUNTER & LOG_HISTOGRAM)
+ *
+ * Every thread that updates a metric gets a cell of its own for it the first time it does, so an
+ * update is a couple of relaxed loads & stores to memory no other thread writes. The cells belong
+ * to the metric rather than the thread: a thread that exits folds its cells into the metric's
+ * retired totals and frees them, so threads coming & going don't leave cells behind.
+ *
+ * Histograms are log-linear: values below 16 get a bucket each, then every power of two is split
+ * into 8 buckets, which keeps any percentile within 1/16 of the real value with 496 buckets for the
+ * whole of uint64_t.
+ *
+ * The reporter sums every metric's cells each MetricSettings::interval_ms, and logs what changed
+ * since the last time (one record per metric, on its channel). It only reads the cells, so the
+ * totals keep growing & a summary is the difference between two of them.
+ */
+class xlog_metric_reporter
+{
+public:
+    explicit xlog_metric_reporter(const XLog::MetricSettings& settings);
+
+    // Stops the thread, and reports whatever changed since the last summary
+    ~xlog_metric_reporter();
+
+private:
+    void run();
+
+    // Logs a summary for every metric that changed since the last call
+    void report();
+
+    const XLog::MetricSettings settings;
+    std::chrono::steady_clock::time_point last_report;
+
+    std::mutex mutex;
+    std::condition_variable stop_cv;
+    bool stopping = false;
+
+    std::thread thread;
+};
+
+// Applies LogSettings::s_metrics, called by InitializeLogging (nullptr if there's nothing to report)
+std::unique_ptr<xlog_metric_reporter> xlog_metrics_setup(const XLog::MetricSettings& settings);
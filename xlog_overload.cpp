@@ -0,0 +1,148 @@
+#include "xlog_overload.noexport.h"
+
+#include <array>
+#include <sstream>
+
+#include "xlog_log_internal.noexport.h"
+
+struct xlog_shed_levels
+{
+    std::mutex mutex;
+    std::array<uint32_t, 2> levels{};
+};
+
+void xlog_set_shed_level(xlog_shed_source source, XLog::Severity level)
+{
+    // Never destroyed, the memory budget can still recover while buffers are freed at exit
+    static xlog_shed_levels* shed = new xlog_shed_levels();
+
+    std::scoped_lock lock(shed->mutex);
+    shed->levels[static_cast<size_t>(source)] = static_cast<uint32_t>(level);
+    XLog::OVERLOAD_LEVEL.store(std::max(shed->levels[0], shed->levels[1]), std::memory_order_relaxed);
+}
+
+xlog_overload_controller::xlog_overload_controller(const XLog::OverloadSettings& settings, boost::shared_ptr<xlog_dispatch_backend> backend) :
+    settings(settings),
+    backend(std::move(backend))
+{
+    thread = std::thread(&xlog_overload_controller::run, this);
+}
+
+xlog_overload_controller::~xlog_overload_controller()
+{
+    {
+        std::scoped_lock lock(mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+
+    xlog_set_shed_level(xlog_shed_source::OVERLOAD_CONTROLLER, XLog::Severity::INFO);
+}
+
+XLog::OverloadState xlog_overload_controller::state()
+{
+    std::scoped_lock lock(mutex);
+    return XLog::OverloadState
+    {
+        .shedding = step != 0,
+        .level = step == 0 ? XLog::Severity::INFO : settings.shed_levels[step - 1],
+        .step = step,
+        .transitions = transitions
+    };
+}
+
+void xlog_overload_controller::run()
+{
+    const auto interval = std::chrono::milliseconds(std::max(settings.check_interval_ms, 1u));
+    const auto recovery = std::chrono::milliseconds(settings.recovery_ms);
+    const uint64_t max_consume_ns = static_cast<uint64_t>(settings.max_consume_us) * 1000;
+
+    const auto sinks = backend->get_sinks();
+    std::vector<sink_sample> last(sinks.size());
+    for(size_t i = 0; i < sinks.size(); i++)
+    {
+        const auto info = sinks[i]->information();
+        last[i] = sink_sample{ info.records, info.dropped, info.consume_ns };
+    }
+
+    auto calm_since = std::chrono::steady_clock::now();
+
+    std::unique_lock lock(mutex);
+    while(!stop_cv.wait_for(lock, interval, [this]() { return stopping; }))
+    {
+        lock.unlock();
+
+        bool overloaded = false;
+        bool calm = true;
+        std::ostringstream reason;
+
+        for(size_t i = 0; i < sinks.size(); i++)
+        {
+            const auto info = sinks[i]->information();
+            const sink_sample current{ info.records, info.dropped, info.consume_ns };
+            const sink_sample previous = last[i];
+            last[i] = current;
+
+            // Disabled & tripped sinks count everything as dropped, which says nothing about load
+            if(!info.enabled || info.tripped)
+            {
+                continue;
+            }
+
+            const uint64_t records = current.records - previous.records;
+            const uint64_t dropped = current.dropped - previous.dropped;
+            const uint64_t per_record_ns = records == 0 ? 0 : (current.consume_ns - previous.consume_ns) / records;
+            const double backlog = sinks[i]->backlog();
+
+            const bool sink_overloaded = backlog >= settings.high_backlog || (max_consume_ns != 0 && per_record_ns > max_consume_ns) || dropped != 0;
+            if(sink_overloaded)
+            {
+                reason << (overloaded ? ", " : "") << info.name << ": " << static_cast<int>(backlog * 100) << "% backlog, "
+                       << per_record_ns / 1000 << "us per record, " << dropped << " dropped";
+                overloaded = true;
+            }
+
+            if(sink_overloaded || backlog > settings.low_backlog || (max_consume_ns != 0 && per_record_ns * 2 > max_consume_ns))
+            {
+                calm = false;
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if(!calm)
+        {
+            calm_since = now;
+        }
+
+        lock.lock();
+        if(overloaded && step < settings.shed_levels.size())
+        {
+            set_step(step + 1, reason.str());
+        }
+        else if(calm && step != 0 && now - calm_since >= recovery)
+        {
+            set_step(step - 1, "calm for " + std::to_string(settings.recovery_ms) + "ms");
+            calm_since = now;
+        }
+    }
+}
+
+void xlog_overload_controller::set_step(size_t next_step, const std::string& reason)
+{
+    const bool rising = next_step > step;
+    step = next_step;
+    transitions++;
+
+    const XLog::Severity level = step == 0 ? XLog::Severity::INFO : settings.shed_levels[step - 1];
+    xlog_set_shed_level(xlog_shed_source::OVERLOAD_CONTROLLER, level);
+
+    if(step == 0)
+    {
+        INTERNAL() << "Logging has recovered (" << reason << "), back to the configured levels";
+    }
+    else
+    {
+        INTERNAL() << (rising ? "Logging is overloaded (" : "Logging is recovering (") << reason << "), dropping records below " << XLog::GetSeverityString(level);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+#include <boost/shared_ptr.hpp>
+
+// Both can shed records, XLog::OVERLOAD_LEVEL is whichever level is higher
+enum class xlog_shed_source
+{
+    OVERLOAD_CONTROLLER,
+    MEMORY_BUDGET
+};
+
+void xlog_set_shed_level(xlog_shed_source source, XLog::Severity level);
+
+/*
+ * Overload controller
+ *
+ * Checks every sink each OverloadSettings::check_interval_ms: how full its queue is, how long it
+ * has been taking per record, and whether it has dropped anything. While logging is overloaded
+ * XLog::OVERLOAD_LEVEL is stepped up through OverloadSettings::shed_levels, so the loggers drop
+ * low severity records before they're created, and once things have stayed calm for recovery_ms
+ * it's stepped back down, one level at a time, until the channel levels are all that's left.
+ *
+ * Every change is logged as INTERNAL (which is never shed).
+ */
+class xlog_overload_controller
+{
+public:
+    xlog_overload_controller(const XLog::OverloadSettings& settings, boost::shared_ptr<xlog_dispatch_backend> backend);
+
+    // Stops checking & puts the configured levels back
+    ~xlog_overload_controller();
+
+    XLog::OverloadState state();
+
+private:
+    struct sink_sample
+    {
+        uint64_t records = 0;
+        uint64_t dropped = 0;
+        uint64_t consume_ns = 0;
+    };
+
+    void run();
+
+    // Moves to 'next_step' of shed_levels (0 being none), 'reason' says why
+    void set_step(size_t next_step, const std::string& reason);
+
+    const XLog::OverloadSettings settings;
+    const boost::shared_ptr<xlog_dispatch_backend> backend;
+
+    std::mutex mutex;
+    std::condition_variable stop_cv;
+    bool stopping = false;
+
+    size_t step = 0;
+    uint64_t transitions = 0;
+
+    std::thread thread;
+};
@@ -0,0 +1,106 @@
+#include "xlog_paths.noexport.h"
+
+#include <charconv>
+#include <filesystem>
+
+#include <unistd.h>
+#include <fmt/core.h>
+
+#include "xlog_log_internal.noexport.h"
+
+extern const char* __progname;
+
+std::string GET_THIS_PROGRAM_RUNTIME_FILE(std::string_view extension)
+{
+    return fmt::format("{0}/{1}-{2}.{3}", BASE_RUNTIME_PATH, getpid(), __progname, extension);
+}
+
+bool PARSE_RUNTIME_FILE_NAME(std::string_view filename, std::string_view extension, int& pid, std::string_view& program)
+{
+    // Needs at least "<digit>-<char>.<extension>"
+    if(filename.size() < extension.size() + 4 ||
+       filename.substr(filename.size() - extension.size()) != extension ||
+       filename[filename.size() - extension.size() - 1] != '.')
+    {
+        return false;
+    }
+    filename.remove_suffix(extension.size() + 1);
+
+    const auto dash = filename.find('-');
+    if(dash == std::string_view::npos || dash == 0 || dash + 1 == filename.size())
+    {
+        return false;
+    }
+
+    auto result = std::from_chars(filename.data(), filename.data() + dash, pid);
+    if(result.ec != std::errc{} || result.ptr != filename.data() + dash)
+    {
+        return false;
+    }
+
+    program = filename.substr(dash + 1);
+    return true;
+}
+
+std::vector<xlog_runtime_file> FIND_RUNTIME_FILES(std::string_view extension, const std::string& program_name, int pid)
+{
+    std::vector<xlog_runtime_file> files;
+
+    std::error_code err;
+    auto itr = std::filesystem::directory_iterator(BASE_RUNTIME_PATH, std::filesystem::directory_options::skip_permission_denied, err);
+    if(err)
+    {
+        INTERNAL_CODE(err) << "; Failed to get directory iterator";
+        return files;
+    }
+
+    for(const auto& file : itr)
+    {
+        const std::string filename = file.path().filename();
+
+        int file_pid = -1;
+        std::string_view file_program;
+        if(!PARSE_RUNTIME_FILE_NAME(filename, extension, file_pid, file_program))
+        {
+            continue;
+        }
+
+        if((!program_name.empty() && file_program != program_name) || (pid >= 0 && file_pid != pid))
+        {
+            continue;
+        }
+
+        files.emplace_back(xlog_runtime_file
+        {
+            .path = file.path(),
+            .program_name = std::string(file_program),
+            .pid = file_pid
+        });
+    }
+
+    return files;
+}
+
+bool TRY_SETUP_RUNTIME_DIRECTORY()
+{
+    std::error_code err;
+    if(!std::filesystem::exists(BASE_RUNTIME_PATH, err))
+    {
+        std::filesystem::create_directories(BASE_RUNTIME_PATH, err);
+        if(err)
+        {
+            INTERNAL_CODE(err) << "; Failed to create directory";
+            return false;
+        }
+    }
+    else
+    {
+        if(!std::filesystem::is_directory(BASE_RUNTIME_PATH, err))
+        {
+            INTERNAL_CODE(err) << "; Base runtime path is not a directory";
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+// Where per-process runtime files (control sockets, shared memory rings, etc) live
+constexpr char BASE_RUNTIME_PATH[] = "/tmp/xlog";
+
+// <BASE_RUNTIME_PATH>/<pid>-<progname>.<extension>
+std::string GET_THIS_PROGRAM_RUNTIME_FILE(std::string_view extension);
+
+// Splits a "<pid>-<progname>.<extension>" file name (without any directory), false if it doesn't look like one
+bool PARSE_RUNTIME_FILE_NAME(std::string_view filename, std::string_view extension, int& pid, std::string_view& program);
+
+struct xlog_runtime_file
+{
+    std::string path;
+    std::string program_name;
+    int pid;
+};
+
+// Runtime files with the given extension, an empty 'program_name' matches every program, a negative 'pid' matches every instance
+std::vector<xlog_runtime_file> FIND_RUNTIME_FILES(std::string_view extension, const std::string& program_name, int pid = -1);
+
+// Make sure BASE_RUNTIME_PATH exists and is a directory
+bool TRY_SETUP_RUNTIME_DIRECTORY();
@@ -0,0 +1,241 @@
+#include "xlog_profiler.noexport.h"
+
+#include <time.h>
+
+#include <map>
+#include <fstream>
+#include <iostream>
+
+#include "xlog_call_sites.noexport.h"
+#include "xlog_log_internal.noexport.h"
+
+namespace
+{
+    uint64_t monotonic_ns()
+    {
+        timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    // Taken when the library is loaded, the tick rate is measured over everything since
+    struct tick_calibration
+    {
+        uint64_t ticks = XLog::ProfileTicks();
+        uint64_t ns = monotonic_ns();
+    };
+
+    const tick_calibration CALIBRATION;
+
+    double ns_per_tick()
+    {
+        const uint64_t ticks = XLog::ProfileTicks();
+        const uint64_t ns = monotonic_ns();
+        if(ticks <= CALIBRATION.ticks)
+        {
+            return 1.0;
+        }
+
+        return static_cast<double>(ns - CALIBRATION.ns) / static_cast<double>(ticks - CALIBRATION.ticks);
+    }
+
+    std::string duration_string(double ns)
+    {
+        if(ns < 1000.0)
+        {
+            return fmt::format("{:.0f}ns", ns);
+        }
+        else if(ns < 1000000.0)
+        {
+            return fmt::format("{:.1f}us", ns / 1000.0);
+        }
+        else if(ns < 1000000000.0)
+        {
+            return fmt::format("{:.1f}ms", ns / 1000000.0);
+        }
+
+        return fmt::format("{:.2f}s", ns / 1000000000.0);
+    }
+
+    struct overhead_totals
+    {
+        uint64_t records = 0;
+        uint64_t total_ns = 0;
+        std::vector<uint64_t> histogram;
+
+        void add(const XLog::OverheadInformation& site)
+        {
+            records += site.records;
+            total_ns += site.open_ns + site.insert_ns + site.push_ns;
+
+            histogram.resize(site.histogram.size());
+            for(size_t i = 0; i < site.histogram.size(); i++)
+            {
+                histogram[i] += site.histogram[i];
+            }
+        }
+    };
+
+    // Upper limit of the bucket that the 'fraction' of records fall into
+    uint64_t percentile_ns(const std::vector<uint64_t>& histogram, const std::vector<uint64_t>& limits, uint64_t records, double fraction)
+    {
+        const uint64_t wanted = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * records + 0.5));
+
+        uint64_t seen = 0;
+        for(size_t i = 0; i < histogram.size() && i < limits.size(); i++)
+        {
+            seen += histogram[i];
+            if(seen >= wanted)
+            {
+                return limits[i];
+            }
+        }
+
+        return limits.empty() ? 0 : limits.back();
+    }
+}
+
+XLog::OverheadProfile XLog::GetOverheadProfile()
+{
+    const double scale = ns_per_tick();
+
+    OverheadProfile profile;
+    for(size_t i = 0; i < OverheadCounters::BUCKETS; i++)
+    {
+        profile.bucket_limits_ns.push_back(static_cast<uint64_t>(static_cast<double>(2ULL << i) * scale + 0.5));
+    }
+
+    xlog_for_each_call_site([&](CallSite& site)
+    {
+        const OverheadCounters& counters = site.overhead;
+        const uint64_t records = counters.records.load(std::memory_order_relaxed);
+        if(records == 0)
+        {
+            return;
+        }
+
+        OverheadInformation info
+        {
+            .file = site.file,
+            .line = site.line,
+            .function = site.function,
+            .channel = site.channel,
+            .severity = site.severity,
+            .records = records,
+            .open_ns = static_cast<uint64_t>(counters.open_ticks.load(std::memory_order_relaxed) * scale),
+            .insert_ns = static_cast<uint64_t>(counters.insert_ticks.load(std::memory_order_relaxed) * scale),
+            .push_ns = static_cast<uint64_t>(counters.push_ticks.load(std::memory_order_relaxed) * scale),
+            .histogram = std::vector<uint64_t>(counters.histogram.size())
+        };
+
+        for(size_t i = 0; i < counters.histogram.size(); i++)
+        {
+            info.histogram[i] = counters.histogram[i].load(std::memory_order_relaxed);
+        }
+
+        profile.sites.push_back(std::move(info));
+    });
+
+    return profile;
+}
+
+void XLog::ResetOverheadProfile()
+{
+    // Records in flight may land either side of this, which doesn't matter for a profile
+    xlog_for_each_call_site([](CallSite& site)
+    {
+        OverheadCounters& counters = site.overhead;
+        counters.records.store(0, std::memory_order_relaxed);
+        counters.open_ticks.store(0, std::memory_order_relaxed);
+        counters.insert_ticks.store(0, std::memory_order_relaxed);
+        counters.push_ticks.store(0, std::memory_order_relaxed);
+        for(auto& bucket : counters.histogram)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    });
+}
+
+void xlog_write_overhead_report(std::ostream& out, const XLog::OverheadProfile& profile, size_t top_sites)
+{
+    overhead_totals everything;
+    std::map<std::string, overhead_totals> channels;
+    for(const auto& site : profile.sites)
+    {
+        everything.add(site);
+        channels[site.channel].add(site);
+    }
+
+    out << "xlog overhead: " << everything.records << " records from " << profile.sites.size()
+        << " call sites, " << duration_string(everything.total_ns) << " inside xlog" << std::endl;
+
+    for(const auto& [channel, totals] : channels)
+    {
+        out
+            << "  Channel = " << channel
+            << ", Records = " << totals.records
+            << ", Total = " << duration_string(totals.total_ns)
+            << ", Avg = " << duration_string(static_cast<double>(totals.total_ns) / totals.records)
+            << ", p50 <= " << duration_string(percentile_ns(totals.histogram, profile.bucket_limits_ns, totals.records, 0.5))
+            << ", p99 <= " << duration_string(percentile_ns(totals.histogram, profile.bucket_limits_ns, totals.records, 0.99))
+            << std::endl;
+    }
+
+    std::vector<const XLog::OverheadInformation*> sites;
+    for(const auto& site : profile.sites)
+    {
+        sites.push_back(&site);
+    }
+
+    // Most time overall first, that's what converting a statement would save
+    std::sort(sites.begin(), sites.end(), [](const auto* a, const auto* b)
+    {
+        return a->open_ns + a->insert_ns + a->push_ns > b->open_ns + b->insert_ns + b->push_ns;
+    });
+    sites.resize(std::min(sites.size(), top_sites));
+
+    for(const auto* site : sites)
+    {
+        const double records = static_cast<double>(site->records);
+        out
+            << "  " << site->file << ":" << site->line << " [" << site->channel << ", " << XLog::GetSeverityString(site->severity) << "]"
+            << ", Records = " << site->records
+            << ", Total = " << duration_string(site->open_ns + site->insert_ns + site->push_ns)
+            << ", Avg Open = " << duration_string(site->open_ns / records)
+            << ", Avg Insert = " << duration_string(site->insert_ns / records)
+            << ", Avg Push = " << duration_string(site->push_ns / records)
+            << ", p99 <= " << duration_string(percentile_ns(site->histogram, profile.bucket_limits_ns, site->records, 0.99))
+            << ", Function = " << site->function
+            << std::endl;
+    }
+}
+
+void xlog_report_overhead(const XLog::ProfilerSettings& settings)
+{
+    if(!settings.report_on_shutdown)
+    {
+        return;
+    }
+
+    const XLog::OverheadProfile profile = XLog::GetOverheadProfile();
+    if(profile.sites.empty())
+    {
+        return;
+    }
+
+    if(settings.report_path.empty())
+    {
+        xlog_write_overhead_report(std::cerr, profile, settings.top_sites);
+        return;
+    }
+
+    std::ofstream file(settings.report_path, std::ios::app);
+    if(!file)
+    {
+        INTERNAL() << "Failed to open '" << settings.report_path << "' for the overhead report, writing it to stderr instead";
+        xlog_write_overhead_report(std::cerr, profile, settings.top_sites);
+        return;
+    }
+
+    xlog_write_overhead_report(file, profile, settings.top_sites);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <ostream>
+
+/*
+ * Overhead profiler
+ *
+ * With -DENABLE_OVERHEAD_PROFILER every statement's record is handled by an XLog::ProfiledRecord
+ * (see CUSTOM_LOG_SEV), which reads the cycle counter around opening, filling, and pushing the
+ * record and adds the difference to its call site's OverheadCounters. Nothing is aggregated on
+ * the logging path beyond those few relaxed atomic adds, ticks are converted to nanoseconds (and
+ * sites grouped by channel) only when a profile is asked for.
+ */
+
+// Per channel totals, then the 'top_sites' call sites that have spent the longest inside xlog
+void xlog_write_overhead_report(std::ostream& out, const XLog::OverheadProfile& profile, size_t top_sites);
+
+// Writes the report to ProfilerSettings::report_path (or stderr), called by ShutownLogging
+void xlog_report_overhead(const XLog::ProfilerSettings& settings);
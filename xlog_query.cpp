@@ -0,0 +1,964 @@
+#include <mutex>
+#include <cctype>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <algorithm>
+#include <string_view>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xlog.h"
+#include "xlog_clock.noexport.h"
+#include "xlog_index.noexport.h"
+
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+#include "xlog_block_file.noexport.h"
+
+#include <zstd.h>
+#endif
+
+#include <CLI/CLI.hpp>
+
+/*
+ * xlog-query
+ *
+ * Finds records in logs written by the file (or compressed file) sink, by time range,
+ * channel, severity and/or text, and prints them in file order.
+ *
+ * Each file is mapped and split into regions: the entries of its index (<file>.idx) if it
+ * has one, every block of a compressed file, or roughly equal chunks of a plain file. Any
+ * region whose summary can't match is skipped without being read, the rest are scanned in
+ * parallel.
+ *
+ * Times are local, the same as the timestamps in the log itself.
+ */
+
+namespace
+{
+    // Local wall-clock time in microseconds since 1970-01-01, what the logs print
+    typedef int64_t local_time_us;
+
+    constexpr int64_t US_PER_SECOND = 1000000;
+
+    // Howard Hinnant's days_from_civil
+    int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+    {
+        y -= m <= 2;
+        const int64_t era = (y >= 0 ? y : y - 399) / 400;
+        const unsigned yoe = static_cast<unsigned>(y - era * 400);
+        const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + static_cast<int64_t>(doe) - 719468;
+    }
+
+    bool parse_digits(std::string_view str, size_t pos, size_t count, unsigned& out)
+    {
+        if(pos + count > str.size())
+        {
+            return false;
+        }
+
+        out = 0;
+        for(size_t i = pos; i < pos + count; i++)
+        {
+            if(str[i] < '0' || str[i] > '9')
+            {
+                return false;
+            }
+            out = out * 10 + static_cast<unsigned>(str[i] - '0');
+        }
+
+        return true;
+    }
+
+    bool parse_month_name(std::string_view str, size_t pos, unsigned& out)
+    {
+        static constexpr const char* MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+        if(pos + 3 > str.size())
+        {
+            return false;
+        }
+
+        for(unsigned i = 0; i < 12; i++)
+        {
+            if(str.compare(pos, 3, MONTHS[i]) == 0)
+            {
+                out = i + 1;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /*
+     * Parses the timestamps xlog writes, and what people are likely to type:
+     *  - YYYY-Mon-DD HH:MM:SS[.ffffff] (text format)
+     *  - YYYY-MM-DDTHH:MM:SS[.ffffff] (JSON format, 'T' can also be a space)
+     * Seconds are optional, as is the whole time of day. 'length' is how much of 'str' was used.
+     */
+    bool parse_timestamp(std::string_view str, local_time_us& out, size_t& length)
+    {
+        unsigned year = 0, month = 0, day = 0;
+        size_t pos = 0;
+
+        if(!parse_digits(str, 0, 4, year) || str.size() < 5 || str[4] != '-')
+        {
+            return false;
+        }
+
+        if(parse_month_name(str, 5, month))
+        {
+            pos = 8;
+        }
+        else if(parse_digits(str, 5, 2, month))
+        {
+            pos = 7;
+        }
+        else
+        {
+            return false;
+        }
+
+        if(pos >= str.size() || str[pos] != '-' || !parse_digits(str, pos + 1, 2, day) || month < 1 || month > 12 || day < 1 || day > 31)
+        {
+            return false;
+        }
+        pos += 3;
+
+        unsigned hour = 0, minute = 0, second = 0, micros = 0;
+        if(pos < str.size() && (str[pos] == ' ' || str[pos] == 'T') && parse_digits(str, pos + 1, 2, hour))
+        {
+            if(pos + 3 >= str.size() || str[pos + 3] != ':' || !parse_digits(str, pos + 4, 2, minute))
+            {
+                return false;
+            }
+            pos += 6;
+
+            if(pos < str.size() && str[pos] == ':')
+            {
+                if(!parse_digits(str, pos + 1, 2, second))
+                {
+                    return false;
+                }
+                pos += 3;
+
+                if(pos < str.size() && str[pos] == '.')
+                {
+                    pos++;
+
+                    // Only microseconds are kept, whatever the precision
+                    unsigned digits = 0;
+                    while(pos < str.size() && str[pos] >= '0' && str[pos] <= '9')
+                    {
+                        if(digits < 6)
+                        {
+                            micros = micros * 10 + static_cast<unsigned>(str[pos] - '0');
+                            digits++;
+                        }
+                        pos++;
+                    }
+
+                    for(; digits < 6; digits++)
+                    {
+                        micros *= 10;
+                    }
+                }
+            }
+        }
+
+        const int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+        out = seconds * US_PER_SECOND + micros;
+        length = pos;
+        return true;
+    }
+
+    local_time_us local_time_of(int64_t wall_ns)
+    {
+        static const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+        return (XLogClock::to_local_time(wall_ns) - EPOCH).total_microseconds();
+    }
+
+    // Accepts anything xlog-manager does, plus the names the sinks actually print
+    bool severity_from_name(std::string_view name, XLog::Severity& out)
+    {
+        std::string val(name);
+        std::transform(val.begin(), val.end(), val.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        if(val == "info")
+        {
+            out = XLog::Severity::INFO;
+        }
+        else if(val == "debug")
+        {
+            out = XLog::Severity::DEBUG;
+        }
+        else if(val == "warning" || val == "warn")
+        {
+            out = XLog::Severity::WARNING;
+        }
+        else if(val == "error" || val == "err")
+        {
+            out = XLog::Severity::ERROR;
+        }
+        else if(val == "fatal")
+        {
+            out = XLog::Severity::FATAL;
+        }
+        else if(val == "internal")
+        {
+            out = XLog::Severity::INTERNAL;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    // Durations for --last, i.e. '90s', '5m', '2h', '1d'
+    bool parse_duration(const std::string& str, int64_t& out_us)
+    {
+        size_t used = 0;
+        int64_t value = 0;
+        try
+        {
+            value = std::stoll(str, &used);
+        }
+        catch(const std::exception&)
+        {
+            return false;
+        }
+
+        const std::string unit = str.substr(used);
+        if(unit.empty() || unit == "s")
+        {
+            out_us = value * US_PER_SECOND;
+        }
+        else if(unit == "m")
+        {
+            out_us = value * 60 * US_PER_SECOND;
+        }
+        else if(unit == "h")
+        {
+            out_us = value * 3600 * US_PER_SECOND;
+        }
+        else if(unit == "d")
+        {
+            out_us = value * 86400 * US_PER_SECOND;
+        }
+        else
+        {
+            return false;
+        }
+
+        return value >= 0;
+    }
+
+    struct query
+    {
+        std::optional<local_time_us> from;
+        std::optional<local_time_us> to;
+        std::vector<std::string> channels;
+        std::vector<size_t> channel_bits;
+        std::optional<XLog::Severity> level;
+        std::string contains;
+
+        // Whether anything in a region with this summary could match
+        bool may_match(const xlog_record_summary& summary) const
+        {
+            if(summary.record_count == 0)
+            {
+                return false;
+            }
+
+            if((from && local_time_of(summary.last_ns) < *from) || (to && local_time_of(summary.first_ns) > *to))
+            {
+                return false;
+            }
+
+            if(level && (summary.severity_mask >> static_cast<uint32_t>(*level)) == 0)
+            {
+                return false;
+            }
+
+            if(!channel_bits.empty() &&
+               std::none_of(channel_bits.begin(), channel_bits.end(), [&](size_t bit) { return summary.may_have_channel(bit); }))
+            {
+                return false;
+            }
+
+            return true;
+        }
+    };
+
+    struct parsed_record
+    {
+        local_time_us time;
+        XLog::Severity severity;
+        std::string_view channel;
+    };
+
+    // Records from the same second are common, so the date & time are only parsed when the second changes
+    class record_parser
+    {
+    public:
+        bool parse(std::string_view rec, parsed_record& out)
+        {
+            std::string_view severity, timestamp;
+
+            constexpr std::string_view JSON_START = "{\"timestamp\":\"";
+            if(rec.substr(0, JSON_START.size()) == JSON_START)
+            {
+                // {"timestamp":"...","severity":"...","channel":"..."
+                rec.remove_prefix(JSON_START.size());
+                timestamp = rec.substr(0, rec.find('"'));
+                if(!take_json_field(rec, "\",\"severity\":\"", severity) || !take_json_field(rec, "\",\"channel\":\"", out.channel))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                // YYYY-Mon-DD HH:MM:SS.ffffff <SEVERITY> [channel] - ...
+                const size_t sev_start = rec.find(" <");
+                const size_t sev_end = rec.find("> [", sev_start);
+                const size_t channel_end = rec.find("] - ", sev_end);
+                if(sev_start == std::string_view::npos || sev_end == std::string_view::npos || channel_end == std::string_view::npos)
+                {
+                    return false;
+                }
+
+                timestamp = rec.substr(0, sev_start);
+                severity = rec.substr(sev_start + 2, sev_end - sev_start - 2);
+                out.channel = rec.substr(sev_end + 3, channel_end - sev_end - 3);
+            }
+
+            return parse_time(timestamp, out.time) && severity_from_name(severity, out.severity);
+        }
+
+    private:
+        static bool take_json_field(std::string_view& rec, std::string_view prefix, std::string_view& out)
+        {
+            const size_t start = rec.find(prefix);
+            if(start == std::string_view::npos)
+            {
+                return false;
+            }
+
+            rec.remove_prefix(start + prefix.size());
+
+            // Skip escaped quotes, the value is compared as it is in the file
+            size_t end = 0;
+            while(end < rec.size() && rec[end] != '"')
+            {
+                end += rec[end] == '\\' ? 2 : 1;
+            }
+
+            out = rec.substr(0, std::min(end, rec.size()));
+            return true;
+        }
+
+        bool parse_time(std::string_view timestamp, local_time_us& out)
+        {
+            // Both formats have whole seconds in the first 19 (ISO) or 20 (text) characters
+            const size_t second_length = std::min<size_t>(timestamp.find('.'), timestamp.size());
+            const std::string_view second = timestamp.substr(0, second_length);
+
+            if(second != cached_second)
+            {
+                size_t used = 0;
+                if(!parse_timestamp(second, cached_time, used) || used != second.size())
+                {
+                    cached_second.clear();
+                    return false;
+                }
+                cached_second.assign(second);
+            }
+
+            out = cached_time;
+            if(second_length < timestamp.size())
+            {
+                unsigned micros = 0;
+                const std::string_view fraction = timestamp.substr(second_length + 1, 6);
+                if(!parse_digits(fraction, 0, fraction.size(), micros))
+                {
+                    return false;
+                }
+                for(size_t i = fraction.size(); i < 6; i++)
+                {
+                    micros *= 10;
+                }
+                out += micros;
+            }
+
+            return true;
+        }
+
+        std::string cached_second;
+        local_time_us cached_time = 0;
+    };
+
+    // Whether a line starts a new record, rather than continuing a multi-line message
+    bool is_record_start(const char* begin, const char* end)
+    {
+        const size_t size = static_cast<size_t>(end - begin);
+        if(size >= 14 && std::memcmp(begin, "{\"timestamp\":\"", 14) == 0)
+        {
+            return true;
+        }
+
+        // YYYY-Mon-DD
+        return size >= 12 &&
+               std::isdigit(static_cast<unsigned char>(begin[0])) && std::isdigit(static_cast<unsigned char>(begin[3])) &&
+               begin[4] == '-' && std::isalpha(static_cast<unsigned char>(begin[5])) && begin[8] == '-' && begin[11] == ' ';
+    }
+
+    // Start of the first record at or after 'pos'
+    const char* next_record_start(const char* pos, const char* begin, const char* end)
+    {
+        // Somewhere in the middle of a line, move to the next one
+        if(pos != begin && pos[-1] != '\n')
+        {
+            pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+            if(pos == nullptr)
+            {
+                return end;
+            }
+            pos++;
+        }
+
+        while(pos < end && !is_record_start(pos, end))
+        {
+            pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+            if(pos == nullptr)
+            {
+                return end;
+            }
+            pos++;
+        }
+
+        return pos;
+    }
+
+    struct mapped_file
+    {
+        std::string path;
+        const char* data = nullptr;
+        size_t size = 0;
+
+        mapped_file() = default;
+        mapped_file(const mapped_file&) = delete;
+
+        ~mapped_file()
+        {
+            if(data != nullptr)
+            {
+                ::munmap(const_cast<char*>(data), size);
+            }
+        }
+
+        bool open(const std::string& file_path)
+        {
+            path = file_path;
+
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0)
+            {
+                return false;
+            }
+
+            struct stat info;
+            if(::fstat(fd, &info) < 0)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            size = static_cast<size_t>(info.st_size);
+            if(size != 0)
+            {
+                void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapping == MAP_FAILED)
+                {
+                    ::close(fd);
+                    return false;
+                }
+
+                data = static_cast<const char*>(mapping);
+                ::madvise(mapping, size, MADV_WILLNEED);
+            }
+
+            ::close(fd);
+            return true;
+        }
+    };
+
+    // Part of a file that gets scanned as one unit
+    struct scan_region
+    {
+        const char* data;
+        size_t size;
+        bool compressed;
+    };
+
+    constexpr size_t MIN_CHUNK_SIZE = 1024 * 1024;
+
+    // Plain text between 'begin' & 'end' (which start records), split at record starts so threads can share it
+    void add_text_regions(const char* begin, const char* end, size_t threads, std::vector<scan_region>& out)
+    {
+        const size_t size = static_cast<size_t>(end - begin);
+        const size_t chunk = std::max(MIN_CHUNK_SIZE, size / (threads * 4) + 1);
+
+        const char* start = begin;
+        while(start < end)
+        {
+            const char* split = start + std::min(chunk, static_cast<size_t>(end - start));
+            if(split < end)
+            {
+                split = next_record_start(split, start, end);
+            }
+
+            out.push_back(scan_region{start, static_cast<size_t>(split - start), false});
+            start = split;
+        }
+    }
+
+    struct file_stats
+    {
+        size_t regions = 0;
+        size_t skipped = 0;
+    };
+
+    // Splits a file into regions, leaving out the ones that can't match
+    bool plan_file(const mapped_file& file, const query& q, bool use_index, size_t threads, std::vector<scan_region>& out, file_stats& stats)
+    {
+        uint32_t magic = 0;
+        if(file.size >= sizeof(magic))
+        {
+            std::memcpy(&magic, file.data, sizeof(magic));
+        }
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+        const bool compressed = magic == XLOG_BLOCK_FRAME_MAGIC;
+#else
+        // Any zstd skippable frame, we can't read these either way
+        const bool compressed = (magic & 0xFFFFFFF0) == 0x184D2A50;
+#endif
+
+#ifndef XLOG_ENABLE_COMPRESSED_FILE_LOG
+        if(compressed)
+        {
+            std::cerr << file.path << ": compressed logs need xlog built with ENABLE_COMPRESSED_FILE_LOG" << std::endl;
+            return false;
+        }
+#endif
+
+        // Everything before 'indexed_end' is covered by the index
+        size_t indexed_end = 0;
+        std::vector<xlog_index_entry> entries;
+        if(use_index && read_index(xlog_index_path(file.path), entries))
+        {
+            // An index that points past the end of the file belongs to some other (older) version of it
+            const bool stale = std::any_of(entries.begin(), entries.end(), [&](const xlog_index_entry& entry)
+            {
+                return entry.offset + entry.length > file.size || ((entry.flags & XLOG_INDEX_COMPRESSED) != 0) != compressed;
+            });
+
+            if(stale)
+            {
+                std::cerr << file.path << ": ignoring index, it doesn't match the file" << std::endl;
+                entries.clear();
+            }
+
+            for(const auto& entry : entries)
+            {
+                stats.regions++;
+                indexed_end = std::max<size_t>(indexed_end, entry.offset + entry.length);
+
+                if(!q.may_match(entry.summary))
+                {
+                    stats.skipped++;
+                    continue;
+                }
+
+                if(compressed)
+                {
+                    out.push_back(scan_region{file.data + entry.offset, entry.length, true});
+                }
+                else
+                {
+                    add_text_regions(file.data + entry.offset, file.data + entry.offset + entry.length, threads, out);
+                }
+            }
+        }
+
+        // Whatever the index doesn't cover yet
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+        if(compressed)
+        {
+            // Block headers have the same summary an index entry would, walking them is cheap
+            size_t offset = indexed_end;
+            xlog_block_header header;
+            while(read_block_header(reinterpret_cast<const uint8_t*>(file.data) + offset, file.size - offset, header))
+            {
+                if(header.compressed_size > file.size - offset - XLOG_BLOCK_HEADER_FRAME_SIZE)
+                {
+                    // Still being written
+                    break;
+                }
+
+                const size_t length = XLOG_BLOCK_HEADER_FRAME_SIZE + header.compressed_size;
+
+                stats.regions++;
+                if(q.may_match(header.summary))
+                {
+                    out.push_back(scan_region{file.data + offset, length, true});
+                }
+                else
+                {
+                    stats.skipped++;
+                }
+
+                offset += length;
+            }
+
+            return true;
+        }
+#endif
+
+        if(indexed_end < file.size)
+        {
+            const size_t before = out.size();
+            add_text_regions(file.data + indexed_end, file.data + file.size, threads, out);
+            stats.regions += out.size() - before;
+        }
+
+        return true;
+    }
+
+    struct region_result
+    {
+        std::string output;
+        size_t matches = 0;
+        bool done = false;
+    };
+
+    class query_runner
+    {
+    public:
+        query_runner(const query& q, const std::vector<scan_region>& regions, bool count_only) :
+            q(q),
+            regions(regions),
+            results(regions.size()),
+            count_only(count_only)
+        {
+        }
+
+        // Scans on 'threads' threads while this one prints results in order, returns the number of matches
+        size_t run(size_t threads)
+        {
+            std::vector<std::thread> workers;
+            for(size_t i = 0; i < threads; i++)
+            {
+                workers.emplace_back(&query_runner::worker, this);
+            }
+
+            size_t total = 0;
+            for(size_t i = 0; i < results.size(); i++)
+            {
+                std::string output;
+                {
+                    std::unique_lock lock(mutex);
+                    done_cv.wait(lock, [&]() { return results[i].done; });
+                    output.swap(results[i].output);
+                    total += results[i].matches;
+                    printed = i + 1;
+                }
+                space_cv.notify_all();
+
+                std::cout.write(output.data(), output.size());
+            }
+
+            for(auto& thread : workers)
+            {
+                thread.join();
+            }
+
+            return total;
+        }
+
+    private:
+        void worker()
+        {
+            record_parser parser;
+            std::string decompressed;
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+            ZSTD_DCtx* context = ZSTD_createDCtx();
+#endif
+
+            while(true)
+            {
+                const size_t index = next.fetch_add(1);
+                if(index >= regions.size())
+                {
+                    break;
+                }
+
+                // Don't get too far ahead of the printing, matches are held in memory until then
+                {
+                    std::unique_lock lock(mutex);
+                    space_cv.wait(lock, [&]() { return index < printed + MAX_AHEAD; });
+                }
+
+                region_result result;
+                const scan_region& region = regions[index];
+                if(region.compressed)
+                {
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+                    xlog_block_header header;
+                    const char* error = nullptr;
+                    if(!read_block_header(reinterpret_cast<const uint8_t*>(region.data), region.size, header))
+                    {
+                        error = "no block header";
+                    }
+                    else
+                    {
+                        const uint8_t* frame = reinterpret_cast<const uint8_t*>(region.data) + XLOG_BLOCK_HEADER_FRAME_SIZE;
+                        error = check_block_sizes(header, frame, region.size - XLOG_BLOCK_HEADER_FRAME_SIZE);
+                    }
+
+                    if(error != nullptr)
+                    {
+                        std::cerr << "Skipping block -> " << error << std::endl;
+                    }
+                    else
+                    {
+                        decompressed.resize(header.uncompressed_size);
+                        const size_t size = ZSTD_decompressDCtx(context, decompressed.data(), decompressed.size(),
+                                                                region.data + XLOG_BLOCK_HEADER_FRAME_SIZE, header.compressed_size);
+                        if(ZSTD_isError(size))
+                        {
+                            std::cerr << "Failed to decompress block -> " << ZSTD_getErrorName(size) << std::endl;
+                        }
+                        else
+                        {
+                            scan(decompressed.data(), decompressed.data() + size, parser, result);
+                        }
+                    }
+#endif
+                }
+                else
+                {
+                    scan(region.data, region.data + region.size, parser, result);
+                }
+
+                {
+                    std::scoped_lock lock(mutex);
+                    result.done = true;
+                    results[index] = std::move(result);
+                }
+                done_cv.notify_all();
+            }
+
+#ifdef XLOG_ENABLE_COMPRESSED_FILE_LOG
+            ZSTD_freeDCtx(context);
+#endif
+        }
+
+        void scan(const char* begin, const char* end, record_parser& parser, region_result& result) const
+        {
+            const char* rec = next_record_start(begin, begin, end);
+            while(rec < end)
+            {
+                // A record runs until the next line that starts one
+                const char* rec_end = static_cast<const char*>(std::memchr(rec, '\n', end - rec));
+                rec_end = rec_end == nullptr ? end : rec_end + 1;
+                while(rec_end < end && !is_record_start(rec_end, end))
+                {
+                    const char* line_end = static_cast<const char*>(std::memchr(rec_end, '\n', end - rec_end));
+                    rec_end = line_end == nullptr ? end : line_end + 1;
+                }
+
+                const std::string_view text(rec, static_cast<size_t>(rec_end - rec));
+                if(matches(text, parser))
+                {
+                    result.matches++;
+                    if(!count_only)
+                    {
+                        result.output.append(text);
+                        if(text.back() != '\n')
+                        {
+                            result.output.push_back('\n');
+                        }
+                    }
+                }
+
+                rec = rec_end;
+            }
+        }
+
+        bool matches(std::string_view text, record_parser& parser) const
+        {
+            if(q.from || q.to || q.level || !q.channels.empty())
+            {
+                parsed_record parsed;
+                if(!parser.parse(text, parsed))
+                {
+                    return false;
+                }
+
+                if((q.from && parsed.time < *q.from) || (q.to && parsed.time > *q.to))
+                {
+                    return false;
+                }
+
+                if(q.level && parsed.severity < *q.level)
+                {
+                    return false;
+                }
+
+                if(!q.channels.empty() && std::find(q.channels.begin(), q.channels.end(), parsed.channel) == q.channels.end())
+                {
+                    return false;
+                }
+            }
+
+            return q.contains.empty() || text.find(q.contains) != std::string_view::npos;
+        }
+
+        static constexpr size_t MAX_AHEAD = 256;
+
+        const query& q;
+        const std::vector<scan_region>& regions;
+        std::vector<region_result> results;
+        const bool count_only;
+
+        std::atomic<size_t> next = 0;
+        size_t printed = 0;
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        std::condition_variable space_cv;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app{"xlog Log Query"};
+
+    std::vector<std::string> files;
+    std::string from_str;
+    std::string to_str;
+    std::string last_str;
+    std::string level_str;
+    query q;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    bool count_only = false;
+    bool no_index = false;
+    bool stats = false;
+
+    app.add_option("files", files, "Log files written by the file or compressed file sink")->required();
+    auto from_opt = app.add_option("--from", from_str, "Only records at or after this (local) time, i.e. '2024-01-31 13:00' or '2024-Jan-31 13:00:05'");
+    app.add_option("--to", to_str, "Only records at or before this (local) time");
+    app.add_option("--last", last_str, "Only records from the last 30s/5m/2h/1d")->excludes(from_opt);
+    app.add_option("-c, --channel", q.channels, "Only records from this channel (can be given more than once)");
+    app.add_option("-l, --level", level_str, "Only records at or above this severity");
+    app.add_option("-s, --contains", q.contains, "Only records containing this text");
+    app.add_option("-j, --threads", threads, "How many threads to scan with");
+    app.add_flag("--count", count_only, "Print how many records match rather than the records");
+    app.add_flag("--no-index", no_index, "Ignore index files, scan everything");
+    app.add_flag("--stats", stats, "Print how much of each file had to be scanned");
+
+    CLI11_PARSE(app, argc, argv);
+
+    for(const auto& [str, bound] : { std::make_pair(&from_str, &q.from), std::make_pair(&to_str, &q.to) })
+    {
+        if(!str->empty())
+        {
+            local_time_us time = 0;
+            size_t used = 0;
+            if(!parse_timestamp(*str, time, used) || used != str->size())
+            {
+                std::cerr << "Invalid time '" << *str << "'" << std::endl;
+                return 1;
+            }
+            *bound = time;
+        }
+    }
+
+    if(!last_str.empty())
+    {
+        int64_t duration = 0;
+        if(!parse_duration(last_str, duration))
+        {
+            std::cerr << "Invalid duration '" << last_str << "'" << std::endl;
+            return 1;
+        }
+        q.from = local_time_of(XLogClock::read_realtime()) - duration;
+    }
+
+    if(!level_str.empty())
+    {
+        XLog::Severity level;
+        if(!severity_from_name(level_str, level))
+        {
+            std::cerr << "Invalid severity '" << level_str << "'" << std::endl;
+            return 1;
+        }
+        q.level = level;
+    }
+
+    for(const auto& channel : q.channels)
+    {
+        q.channel_bits.push_back(xlog_channel_bit(channel));
+    }
+
+    threads = std::max<size_t>(threads, 1);
+
+    // Every file is planned up front so regions from all of them share the threads
+    std::vector<std::unique_ptr<mapped_file>> mapped;
+    std::vector<scan_region> regions;
+    bool failed = false;
+    for(const auto& path : files)
+    {
+        auto file = std::make_unique<mapped_file>();
+        if(!file->open(path))
+        {
+            std::cerr << path << ": " << std::strerror(errno) << std::endl;
+            failed = true;
+            continue;
+        }
+
+        file_stats file_stats;
+        if(!plan_file(*file, q, !no_index, threads, regions, file_stats))
+        {
+            failed = true;
+            continue;
+        }
+
+        if(stats)
+        {
+            std::cerr << path << ": " << file_stats.regions << " regions, " << file_stats.skipped << " skipped" << std::endl;
+        }
+
+        mapped.push_back(std::move(file));
+    }
+
+    query_runner runner(q, regions, count_only);
+    const size_t matches = runner.run(std::min(threads, std::max<size_t>(regions.size(), 1)));
+    if(count_only)
+    {
+        std::cout << matches << std::endl;
+    }
+
+    return failed ? 1 : 0;
+}
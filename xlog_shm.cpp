@@ -0,0 +1,391 @@
+#include "xlog_shm.noexport.h"
+
+#include <new>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/log/attributes/value_extraction.hpp>
+
+#include "xlog_clock.noexport.h"
+#include "xlog_log_internal.noexport.h"
+
+extern const char* __progname;
+
+static uint64_t round_up_power_of_two(uint64_t value)
+{
+    uint64_t rValue = 1;
+    while(rValue < value)
+    {
+        rValue <<= 1;
+    }
+
+    return rValue;
+}
+
+static constexpr uint32_t align_entry(size_t length)
+{
+    return static_cast<uint32_t>((length + 7) & ~static_cast<size_t>(7));
+}
+
+xlog_ring::xlog_ring(std::string path, void* mapping, size_t mapping_size) :
+    ring_path(std::move(path)),
+    mapping(mapping),
+    mapping_size(mapping_size),
+    head(static_cast<xlog_ring_header*>(mapping)),
+    entries(static_cast<uint8_t*>(mapping) + XLOG_RING_HEADER_SIZE)
+{
+}
+
+xlog_ring::~xlog_ring()
+{
+    ::munmap(mapping, mapping_size);
+}
+
+std::unique_ptr<xlog_ring> xlog_ring::create(const std::string& path, size_t capacity, bool allow_anyone_access)
+{
+    // Entries are addressed by masking the position, and have to fit in a uint32 length
+    capacity = round_up_power_of_two(std::clamp<size_t>(capacity, 64 * 1024, size_t(1) << 31));
+    const size_t mapping_size = XLOG_RING_HEADER_SIZE + capacity;
+
+    // Replace rather than reuse, a leftover ring with the same name belonged to a process that had our PID
+    ::unlink(path.c_str());
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(fd < 0)
+    {
+        INTERNAL_ERRNO() << "; Failed to create ring '" << path << "'";
+        return nullptr;
+    }
+
+    // The collector has to be able to write to it as well (read_position)
+    if(allow_anyone_access && ::fchmod(fd, (S_IRUSR | S_IWUSR) | (S_IRGRP | S_IWGRP) | (S_IROTH | S_IWOTH)) < 0)
+    {
+        INTERNAL_ERRNO() << "; Failed to modify permissions for ring";
+    }
+
+    if(::ftruncate(fd, static_cast<off_t>(mapping_size)) < 0)
+    {
+        INTERNAL_ERRNO() << "; Failed to resize ring";
+        ::close(fd);
+        ::unlink(path.c_str());
+        return nullptr;
+    }
+
+    void* mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        INTERNAL_ERRNO() << "; Failed to map ring";
+        ::unlink(path.c_str());
+        return nullptr;
+    }
+
+    // The file starts zeroed, which is exactly what the entries need
+    auto* head = new(mapping) xlog_ring_header{};
+    head->version = XLOG_RING_VERSION;
+    head->capacity = capacity;
+    head->pid = ::getpid();
+    std::strncpy(head->program, __progname, sizeof(head->program) - 1);
+
+    // Written last, the collector ignores the ring until the magic is there
+    std::atomic_thread_fence(std::memory_order_release);
+    head->magic = XLOG_RING_MAGIC;
+
+    return std::unique_ptr<xlog_ring>(new xlog_ring(path, mapping, mapping_size));
+}
+
+std::unique_ptr<xlog_ring> xlog_ring::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if(fd < 0)
+    {
+        INTERNAL_ERRNO() << "; Failed to open ring '" << path << "'";
+        return nullptr;
+    }
+
+    struct stat info;
+    if(::fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) <= XLOG_RING_HEADER_SIZE)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    const size_t mapping_size = static_cast<size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        INTERNAL_ERRNO() << "; Failed to map ring '" << path << "'";
+        return nullptr;
+    }
+
+    const auto* head = static_cast<const xlog_ring_header*>(mapping);
+    const bool has_magic = head->magic == XLOG_RING_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    const uint64_t capacity = head->capacity;
+    if(!has_magic ||
+       head->version != XLOG_RING_VERSION ||
+       capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+       XLOG_RING_HEADER_SIZE + capacity != mapping_size)
+    {
+        // Either not a ring, or still being set up
+        ::munmap(mapping, mapping_size);
+        return nullptr;
+    }
+
+    return std::unique_ptr<xlog_ring>(new xlog_ring(path, mapping, mapping_size));
+}
+
+bool xlog_ring::reserve(uint32_t length, reservation& out)
+{
+    const uint64_t capacity = head->capacity;
+    const uint64_t size = align_entry(sizeof(xlog_ring_entry) + length);
+
+    // Anything this big would only ever fit in an empty ring (if at all)
+    if(size > capacity / 4)
+    {
+        return false;
+    }
+
+    uint64_t position = head->write_position.load(std::memory_order_relaxed);
+    uint64_t padding = 0;
+    do
+    {
+        const uint64_t offset = position & (capacity - 1);
+        padding = (capacity - offset < size) ? capacity - offset : 0;
+
+        // Acquire so we see the collector zeroing the space we're about to take
+        if(position + padding + size - head->read_position.load(std::memory_order_acquire) > capacity)
+        {
+            return false;
+        }
+    } while(!head->write_position.compare_exchange_weak(position, position + padding + size, std::memory_order_relaxed));
+
+    if(padding != 0)
+    {
+        xlog_ring_entry* pad = entry_at(position);
+        pad->length = static_cast<uint32_t>(padding);
+        pad->state.store(XLOG_RING_PADDING, std::memory_order_release);
+    }
+
+    out.entry = entry_at(position + padding);
+    out.entry->length = static_cast<uint32_t>(size);
+    out.data = reinterpret_cast<uint8_t*>(out.entry + 1);
+    return true;
+}
+
+void xlog_ring::commit(const reservation& res)
+{
+    res.entry->state.store(XLOG_RING_RECORD, std::memory_order_release);
+}
+
+bool xlog_ring::skip_unpublished()
+{
+    const uint64_t capacity = head->capacity;
+    const uint64_t position = head->read_position.load(std::memory_order_relaxed);
+    const uint64_t write_position = head->write_position.load(std::memory_order_acquire);
+    if(is_corrupt || position == write_position)
+    {
+        return false;
+    }
+
+    xlog_ring_entry* entry = entry_at(position);
+    const uint32_t length = entry->length;
+    const uint64_t offset = position & (capacity - 1);
+    if(entry->state.load(std::memory_order_acquire) != XLOG_RING_EMPTY ||
+       length < sizeof(xlog_ring_entry) || (length % 8) != 0 || length > capacity - offset || position + length > write_position)
+    {
+        return false;
+    }
+
+    std::memset(reinterpret_cast<uint8_t*>(entry + 1), 0, length - sizeof(xlog_ring_entry));
+    entry->length = 0;
+
+    head->read_position.store(position + length, std::memory_order_release);
+    return true;
+}
+
+bool xlog_ring::empty() const
+{
+    return is_corrupt || head->read_position.load(std::memory_order_acquire) == head->write_position.load(std::memory_order_acquire);
+}
+
+static uint8_t* put_string(uint8_t* out, std::string_view str)
+{
+    std::memcpy(out, str.data(), str.size());
+    return out + str.size();
+}
+
+bool decode_ring_record(const uint8_t* data, size_t length, xlog_ring_decoded& out)
+{
+    if(length < sizeof(xlog_ring_record))
+    {
+        return false;
+    }
+
+    xlog_ring_record record;
+    std::memcpy(&record, data, sizeof(record));
+
+    const uint8_t* end = data + length;
+    const uint8_t* current = data + sizeof(record);
+
+    auto take = [&current, end](size_t size, std::string_view& str)
+    {
+        if(static_cast<size_t>(end - current) < size)
+        {
+            return false;
+        }
+
+        str = std::string_view(reinterpret_cast<const char*>(current), size);
+        current += size;
+        return true;
+    };
+
+    if(record.severity > static_cast<uint8_t>(XLog::Severity::INTERNAL) ||
+       record.context_count > XLog::ContextStack::MAX_DEPTH ||
+       !take(record.channel_length, out.channel) ||
+       !take(record.message_length, out.message) ||
+       !take(record.file_length, out.file) ||
+       !take(record.function_length, out.function))
+    {
+        return false;
+    }
+
+    out.wall_ns = record.wall_ns;
+    out.severity = static_cast<XLog::Severity>(record.severity);
+    out.line = record.line;
+    out.context_count = record.context_count;
+
+    for(size_t i = 0; i < out.context_count; i++)
+    {
+        if(end - current < 2)
+        {
+            return false;
+        }
+
+        const uint8_t key_length = current[0];
+        const uint8_t value_length = current[1];
+        current += 2;
+
+        if(!take(key_length, out.context[i][0]) || !take(value_length, out.context[i][1]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+xlog_shm_sink::xlog_shm_sink(std::unique_ptr<xlog_ring> ring) :
+    xlog_sink("shm", nullptr),
+    ring(std::move(ring))
+{
+}
+
+double xlog_shm_sink::backlog()
+{
+    const xlog_ring_header& head = ring->header();
+    const uint64_t read = head.read_position.load(std::memory_order_relaxed);
+    const uint64_t written = head.write_position.load(std::memory_order_relaxed);
+    return written <= read ? 0.0 : static_cast<double>(written - read) / head.capacity;
+}
+
+bool xlog_shm_sink::consume(const boost::log::record_view& rec, const xlog_formatted_text&)
+{
+    auto severity = boost::log::extract<XLog::Severity>("Severity", rec);
+    auto channel = boost::log::extract<std::string>("Channel", rec);
+    auto message = boost::log::extract<std::string>("Message", rec);
+
+    std::string_view channel_str = channel.empty() ? std::string_view() : std::string_view(channel.get());
+    std::string_view message_str = message.empty() ? std::string_view() : std::string_view(message.get());
+
+    xlog_source_location location;
+    get_record_source_location(rec, location);
+
+    // Anything too long for its length field is truncated, the message is limited by the ring itself
+    channel_str = channel_str.substr(0, UINT16_MAX);
+    location.file = location.file.substr(0, UINT16_MAX);
+    location.function = location.function.substr(0, UINT16_MAX);
+
+    // Instance attributes go first (the collector can't tell them apart from the context), up to MAX_DEPTH in all
+    std::string_view pairs[XLog::ContextStack::MAX_DEPTH][2];
+    size_t context_count = 0;
+
+    if(const XLog::InstanceAttributes* instance = XLog::GetRecordInstance(rec))
+    {
+        for(const auto& attribute : instance->entries())
+        {
+            if(context_count == XLog::ContextStack::MAX_DEPTH)
+            {
+                break;
+            }
+            pairs[context_count][0] = std::string_view(attribute.key).substr(0, UINT8_MAX);
+            pairs[context_count][1] = std::string_view(attribute.value).substr(0, UINT8_MAX);
+            context_count++;
+        }
+    }
+
+    if(const XLog::ContextSnapshot* context = XLog::GetRecordContext(rec))
+    {
+        for(const XLog::ContextEntry& entry : *context)
+        {
+            if(context_count == XLog::ContextStack::MAX_DEPTH)
+            {
+                break;
+            }
+            pairs[context_count][0] = entry.key();
+            pairs[context_count][1] = entry.value();
+            context_count++;
+        }
+    }
+
+    size_t length = sizeof(xlog_ring_record) + channel_str.size() + message_str.size() + location.file.size() + location.function.size();
+    for(size_t i = 0; i < context_count; i++)
+    {
+        length += 2 + pairs[i][0].size() + pairs[i][1].size();
+    }
+
+    xlog_ring::reservation res;
+    if(length > UINT32_MAX || !ring->reserve(static_cast<uint32_t>(length), res))
+    {
+        ring->header().dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const xlog_ring_record record
+    {
+        .wall_ns = XLogClock::record_wall_ns(rec),
+        .line = location.line,
+        .message_length = static_cast<uint32_t>(message_str.size()),
+        .channel_length = static_cast<uint16_t>(channel_str.size()),
+        .file_length = static_cast<uint16_t>(location.file.size()),
+        .function_length = static_cast<uint16_t>(location.function.size()),
+        .severity = static_cast<uint8_t>(severity.empty() ? XLog::Severity::INTERNAL : severity.get()),
+        .context_count = static_cast<uint8_t>(context_count)
+    };
+
+    uint8_t* out = res.data;
+    std::memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+
+    out = put_string(out, channel_str);
+    out = put_string(out, message_str);
+    out = put_string(out, location.file);
+    out = put_string(out, location.function);
+
+    for(size_t i = 0; i < context_count; i++)
+    {
+        *out++ = static_cast<uint8_t>(pairs[i][0].size());
+        *out++ = static_cast<uint8_t>(pairs[i][1].size());
+        out = put_string(out, pairs[i][0]);
+        out = put_string(out, pairs[i][1]);
+    }
+
+    ring->commit(res);
+    return true;
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "xlog_sinks.noexport.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Shared-memory transport to xlog-collector
+ *
+ * Each process maps a ring buffer at /tmp/xlog/<pid>-<progname>.ring, logging threads
+ * encode records straight into it (no formatting, no syscalls) and xlog-collector
+ * drains the rings of every process, formatting records & writing them to its own sinks.
+ * Since the ring is a file the collector can still drain it after the process has died.
+ *
+ * The ring is multi-producer/single-consumer with variable-length entries:
+ *  - Producers reserve space by advancing write_position with a CAS, then fill the entry
+ *    in and publish it by storing its state (release)
+ *  - An entry that wouldn't fit before the end of the buffer is preceded by a padding
+ *    entry so that entries are always contiguous
+ *  - The collector reads entries in order until it finds one that hasn't been published
+ *    yet, zeroes what it has read, then advances read_position (release) so producers
+ *    can reuse the space
+ *  - If there isn't enough space the record is dropped & counted, logging never blocks
+ *  - An entry's length is written straight after it's reserved, so if the process dies
+ *    before publishing it the collector can still step over it to the entries after it
+ */
+
+constexpr uint32_t XLOG_RING_MAGIC = 0x474e5258; // "XRNG"
+constexpr uint32_t XLOG_RING_VERSION = 1;
+
+// The header gets its own page, entries start straight after it
+constexpr size_t XLOG_RING_HEADER_SIZE = 4096;
+
+struct xlog_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity; // Bytes of entry space, always a power of two
+    int32_t pid;
+    char program[64];
+
+    alignas(64) std::atomic<uint64_t> write_position;
+    alignas(64) std::atomic<uint64_t> read_position;
+    alignas(64) std::atomic<uint64_t> dropped;
+};
+
+static_assert(sizeof(xlog_ring_header) <= XLOG_RING_HEADER_SIZE);
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Ring positions must be lock-free to be shared between processes");
+
+enum xlog_ring_entry_state : uint32_t
+{
+    XLOG_RING_EMPTY = 0,   // Reserved but not written yet (or never reserved)
+    XLOG_RING_RECORD = 1,  // An encoded record follows
+    XLOG_RING_PADDING = 2  // Skip to the start of the buffer
+};
+
+// Every entry starts with this & is a multiple of 8 bytes long
+struct xlog_ring_entry
+{
+    std::atomic<uint32_t> state;
+    uint32_t length; // Including this header
+};
+
+static_assert(sizeof(xlog_ring_entry) == 8);
+
+/*
+ * Encoded record, followed by the channel, message, file & function (not null terminated),
+ * then 'context_count' key/value pairs, each as a uint8 key length, uint8 value length, key, value
+ */
+struct xlog_ring_record
+{
+    int64_t wall_ns; // Nanoseconds since the epoch (UTC), so the collector doesn't need to know our clock
+    uint32_t line;
+    uint32_t message_length;
+    uint16_t channel_length;
+    uint16_t file_length;
+    uint16_t function_length;
+    uint8_t severity;
+    uint8_t context_count;
+};
+
+// A record decoded from a ring, everything points into the ring so it's only valid inside drain()
+struct xlog_ring_decoded
+{
+    int64_t wall_ns;
+    XLog::Severity severity;
+    std::string_view channel;
+    std::string_view message;
+    std::string_view file;
+    std::string_view function;
+    uint32_t line;
+
+    size_t context_count;
+    std::string_view context[XLog::ContextStack::MAX_DEPTH][2];
+};
+
+bool decode_ring_record(const uint8_t* data, size_t length, xlog_ring_decoded& out);
+
+class xlog_ring
+{
+public:
+    // Producer side, creates (or replaces) the ring file & maps it
+    static std::unique_ptr<xlog_ring> create(const std::string& path, size_t capacity, bool allow_anyone_access);
+
+    // Consumer side, maps an existing ring file (nullptr if it isn't a valid ring)
+    static std::unique_ptr<xlog_ring> open(const std::string& path);
+
+    ~xlog_ring();
+
+    xlog_ring(const xlog_ring&) = delete;
+    xlog_ring& operator=(const xlog_ring&) = delete;
+
+    const std::string& path() const { return ring_path; }
+    xlog_ring_header& header() const { return *head; }
+
+    struct reservation
+    {
+        xlog_ring_entry* entry;
+        uint8_t* data;
+    };
+
+    // Space for 'length' bytes, false if the ring is full (the record should be dropped)
+    bool reserve(uint32_t length, reservation& out);
+    void commit(const reservation& res);
+
+    // Nothing left to read (or nothing left that ever will be)
+    bool empty() const;
+
+    // Consumer side, calls func(data, length) for up to 'max_records' published records
+    // Returns how many records were read, stops early at the first unpublished entry
+    template<typename Func>
+    size_t drain(Func&& func, size_t max_records);
+
+    // Consumer side, only once the producer has exited: steps over the entry drain() stopped at, one
+    // that was reserved but never published (the process died writing it), so the records after it
+    // can still be read. False if there isn't one, or its length was never written either
+    bool skip_unpublished();
+
+    // Set by drain() if an entry was nonsense, the rest of the ring can't be trusted
+    bool corrupt() const { return is_corrupt; }
+
+private:
+    xlog_ring(std::string path, void* mapping, size_t mapping_size);
+
+    xlog_ring_entry* entry_at(uint64_t position) const
+    {
+        return reinterpret_cast<xlog_ring_entry*>(entries + (position & (head->capacity - 1)));
+    }
+
+    const std::string ring_path;
+    void* const mapping;
+    const size_t mapping_size;
+
+    xlog_ring_header* const head;
+    uint8_t* const entries;
+
+    bool is_corrupt = false;
+};
+
+template<typename Func>
+size_t xlog_ring::drain(Func&& func, size_t max_records)
+{
+    const uint64_t capacity = head->capacity;
+
+    // We're the only one that moves this, so our own view is always up-to-date
+    uint64_t position = head->read_position.load(std::memory_order_relaxed);
+    size_t count = 0;
+
+    while(count < max_records && !is_corrupt)
+    {
+        if(position == head->write_position.load(std::memory_order_acquire))
+        {
+            break;
+        }
+
+        xlog_ring_entry* entry = entry_at(position);
+        const uint32_t state = entry->state.load(std::memory_order_acquire);
+        if(state == XLOG_RING_EMPTY)
+        {
+            // Reserved, but the producer hasn't finished writing it yet
+            break;
+        }
+
+        const uint32_t length = entry->length;
+        const uint64_t offset = position & (capacity - 1);
+        if(length < sizeof(xlog_ring_entry) || (length % 8) != 0 || length > capacity - offset)
+        {
+            is_corrupt = true;
+            break;
+        }
+
+        if(state == XLOG_RING_RECORD)
+        {
+            func(reinterpret_cast<const uint8_t*>(entry + 1), length - sizeof(xlog_ring_entry));
+            count++;
+        }
+
+        // Producers expect unused space to be zeroed, so a stale entry is never mistaken for a published one
+        std::memset(reinterpret_cast<uint8_t*>(entry + 1), 0, length - sizeof(xlog_ring_entry));
+        entry->length = 0;
+        entry->state.store(XLOG_RING_EMPTY, std::memory_order_relaxed);
+
+        position += length;
+        head->read_position.store(position, std::memory_order_release);
+    }
+
+    return count;
+}
+
+// Encodes records into this process's ring, the only sink when the shared-memory transport is enabled
+class xlog_shm_sink final : public xlog_sink
+{
+public:
+    explicit xlog_shm_sink(std::unique_ptr<xlog_ring> ring);
+
+    // How much of the ring the collector hasn't drained yet
+    double backlog() override;
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
+
+    // The ring handles concurrent writers itself
+    bool concurrent() const override { return true; }
+
+private:
+    std::unique_ptr<xlog_ring> ring;
+};
@@ -0,0 +1,561 @@
+#include "xlog_sinks.noexport.h"
+#include "xlog_memory.noexport.h"
+#include "xlog_async.noexport.h"
+#include "xlog_file_writer.noexport.h"
+
+#include <chrono>
+
+#include <boost/log/detail/fake_mutex.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+
+bool get_record_source_location(const boost::log::record_view& rec, xlog_source_location& out)
+{
+    // Checked first, replayed records still pick up the collector's own (global) SourceLocation attribute
+    auto remote = boost::log::extract<xlog_remote_source_location>(REMOTE_SOURCE_LOCATION_ATTRIBUTE_NAME, rec);
+    if(!remote.empty())
+    {
+        out.file = remote.get().file;
+        out.function = remote.get().function;
+        out.line = remote.get().line;
+        return true;
+    }
+
+#ifdef XLOG_LOGGING_USE_SOURCE_LOCATION
+    auto slc = boost::log::extract<std::source_location>("SourceLocation", rec);
+    if(!slc.empty())
+    {
+        out.file = slc.get().file_name();
+        out.function = slc.get().function_name();
+        out.line = slc.get().line();
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+xlog_sink::xlog_sink(std::string name, xlog_formatter_function formatter) :
+    sink_name(std::move(name)),
+    sink_formatter(formatter)
+{
+}
+
+bool xlog_sink::accepts(XLog::Severity sev)
+{
+    if(!enabled.load(std::memory_order_relaxed))
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if(sev < level.load(std::memory_order_relaxed))
+    {
+        filtered.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+bool xlog_sink::deliver(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    bool written = false;
+    const auto start = std::chrono::steady_clock::now();
+    if(concurrent())
+    {
+        written = consume(rec, text);
+    }
+    else
+    {
+        std::scoped_lock lock(sink_mutex);
+        written = consume(rec, text);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if(!written)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    records.fetch_add(1, std::memory_order_relaxed);
+    consume_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+    if(text)
+    {
+        bytes.fetch_add(text->size(), std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+void xlog_sink::deliver_batch(const boost::log::record_view* recs, const xlog_formatted_text* texts, const std::vector<size_t>& indexes)
+{
+    uint64_t written = 0;
+    uint64_t written_bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(sink_mutex, std::defer_lock);
+        if(!concurrent())
+        {
+            lock.lock();
+        }
+
+        for(size_t i : indexes)
+        {
+            const xlog_formatted_text& text = texts != nullptr ? texts[i] : nullptr;
+            if(consume(recs[i], text))
+            {
+                written++;
+                written_bytes += text ? text->size() : 0;
+            }
+        }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    records.fetch_add(written, std::memory_order_relaxed);
+    dropped.fetch_add(indexes.size() - written, std::memory_order_relaxed);
+    bytes.fetch_add(written_bytes, std::memory_order_relaxed);
+    consume_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+}
+
+void xlog_sink::flush()
+{
+    std::scoped_lock lock(sink_mutex);
+    flush_unlocked();
+}
+
+XLog::SinkInformation xlog_sink::information() const
+{
+    return XLog::SinkInformation
+    {
+        .name = sink_name,
+        .enabled = enabled.load(std::memory_order_relaxed),
+        .level = level.load(std::memory_order_relaxed),
+        .records = records.load(std::memory_order_relaxed),
+        .bytes = bytes.load(std::memory_order_relaxed),
+        .filtered = filtered.load(std::memory_order_relaxed),
+        .dropped = dropped.load(std::memory_order_relaxed),
+        .unrouted = 0,
+        .consume_ns = consume_ns.load(std::memory_order_relaxed),
+        .trips = 0,
+        .tripped = false
+    };
+}
+
+void xlog_dispatch_backend::add_sink(std::shared_ptr<xlog_sink> sink)
+{
+    sinks.emplace_back(std::move(sink));
+}
+
+void xlog_dispatch_backend::replace_sink(std::shared_ptr<xlog_sink> sink)
+{
+    for(auto& existing : sinks)
+    {
+        if(existing->name() == sink->name())
+        {
+            existing = std::move(sink);
+            return;
+        }
+    }
+}
+
+/*
+ * One slot per distinct formatter, each with a pool of buffers kept per thread (see
+ * xlog_memory.noexport.h) so that once they've grown they're reused for later records
+ */
+struct formatted_slot
+{
+    xlog_formatter_function formatter;
+    xlog_text_pool pool;
+    xlog_formatted_text text;
+
+    // Texts of the batch being dispatched, by record
+    std::vector<xlog_formatted_text> batch;
+};
+
+static formatted_slot& thread_formatted_slot(xlog_formatter_function formatter)
+{
+    // A deque, so the slots a record or batch is using stay put when another formatter's is added
+    thread_local std::deque<formatted_slot> slots;
+
+    auto slot = std::find_if(slots.begin(), slots.end(), [formatter](const formatted_slot& s) { return s.formatter == formatter; });
+    if(slot == slots.end())
+    {
+        slots.push_back(formatted_slot{ formatter, {}, nullptr, {} });
+        slot = std::prev(slots.end());
+    }
+
+    return *slot;
+}
+
+static boost::log::formatting_ostream& thread_format_stream()
+{
+    thread_local std::string unused;
+    thread_local boost::log::formatting_ostream stream(unused);
+    return stream;
+}
+
+static XLog::Severity record_severity(const boost::log::record_view& rec)
+{
+    auto severity = boost::log::extract<XLog::Severity>("Severity", rec);
+    return severity.empty() ? XLog::Severity::INTERNAL : severity.get();
+}
+
+void xlog_dispatch_backend::consume(const boost::log::record_view& rec)
+{
+    thread_local std::vector<formatted_slot*> used;
+
+    // Let go of the last record's text, so its buffers can be reused once the sinks are done with them
+    for(formatted_slot* slot : used)
+    {
+        slot->text.reset();
+    }
+    used.clear();
+
+    const XLog::Severity sev = record_severity(rec);
+
+    // Created before we went over budget, but no need to make it worse
+    if(xlog_memory_sheds(sev))
+    {
+        return;
+    }
+
+    for(const auto& sink : sinks)
+    {
+        // Checked before formatting, so a disabled (or quiet) sink costs next to nothing
+        if(!sink->accepts(sev))
+        {
+            continue;
+        }
+
+        const xlog_formatter_function formatter = sink->formatter();
+        if(formatter == nullptr)
+        {
+            sink->deliver(rec, nullptr);
+            continue;
+        }
+
+        formatted_slot& slot = thread_formatted_slot(formatter);
+        if(!slot.text)
+        {
+            slot.text = slot.pool.format(formatter, rec, thread_format_stream());
+            used.push_back(&slot);
+        }
+
+        sink->deliver(rec, slot.text);
+    }
+}
+
+void xlog_dispatch_backend::consume_batch(const boost::log::record_view* recs, size_t count)
+{
+    std::vector<XLog::Severity> severities(count);
+    std::vector<bool> shed(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        severities[i] = record_severity(recs[i]);
+        shed[i] = xlog_memory_sheds(severities[i]);
+    }
+
+    std::vector<formatted_slot*> used;
+    std::vector<size_t> indexes;
+    for(const auto& sink : sinks)
+    {
+        indexes.clear();
+        for(size_t i = 0; i < count; i++)
+        {
+            if(!shed[i] && sink->accepts(severities[i]))
+            {
+                indexes.push_back(i);
+            }
+        }
+
+        if(indexes.empty())
+        {
+            continue;
+        }
+
+        const xlog_formatter_function formatter = sink->formatter();
+        if(formatter == nullptr)
+        {
+            sink->deliver_batch(recs, nullptr, indexes);
+            continue;
+        }
+
+        // Each record is still only formatted once per formatter, whichever sinks want it
+        formatted_slot& slot = thread_formatted_slot(formatter);
+        if(slot.batch.empty())
+        {
+            slot.batch.resize(count);
+            used.push_back(&slot);
+        }
+        for(size_t i : indexes)
+        {
+            if(!slot.batch[i])
+            {
+                slot.batch[i] = slot.pool.format(formatter, recs[i], thread_format_stream());
+            }
+        }
+
+        sink->deliver_batch(recs, slot.batch.data(), indexes);
+    }
+
+    for(formatted_slot* slot : used)
+    {
+        slot->batch.clear();
+    }
+}
+
+xlog_dispatch_frontend::xlog_dispatch_frontend(boost::shared_ptr<xlog_dispatch_backend> backend, bool cross_thread, std::shared_ptr<xlog_async_dispatcher> async) :
+    basic_sink_frontend(cross_thread || async != nullptr),
+    backend(std::move(backend)),
+    async(std::move(async))
+{
+}
+
+// Set while the thread is submitting a batch, consume() collects its records here
+static thread_local bool BATCHING = false;
+static thread_local bool BATCH_ACCEPTED = false;
+static thread_local std::vector<boost::log::record_view> BATCH_RECORDS;
+
+bool xlog_dispatch_frontend::will_consume(const boost::log::attribute_value_set& attrs)
+{
+    if(!BATCHING)
+    {
+        return basic_sink_frontend::will_consume(attrs);
+    }
+
+    if(!BATCH_ACCEPTED)
+    {
+        BATCH_ACCEPTED = basic_sink_frontend::will_consume(attrs);
+    }
+
+    return BATCH_ACCEPTED;
+}
+
+void xlog_dispatch_frontend::consume(const boost::log::record_view& rec)
+{
+    if(BATCHING)
+    {
+        BATCH_RECORDS.push_back(rec);
+        return;
+    }
+
+    if(async && async->push(rec))
+    {
+        return;
+    }
+
+    boost::log::aux::fake_mutex m;
+    feed_record(rec, m, *backend);
+}
+
+void xlog_dispatch_frontend::begin_batch()
+{
+    BATCHING = true;
+    BATCH_ACCEPTED = false;
+}
+
+bool xlog_dispatch_frontend::batch_accepted() const
+{
+    return BATCH_ACCEPTED;
+}
+
+void xlog_dispatch_frontend::end_batch()
+{
+    BATCHING = false;
+    BATCH_ACCEPTED = false;
+
+    // Cleared however we leave, the records (and their buffers) shouldn't outlive the batch
+    struct clear_batch
+    {
+        ~clear_batch()
+        {
+            BATCH_RECORDS.clear();
+        }
+    } clear;
+
+    size_t queued = 0;
+    if(async)
+    {
+        queued = async->push_batch(BATCH_RECORDS.data(), BATCH_RECORDS.size());
+    }
+
+    if(queued < BATCH_RECORDS.size())
+    {
+        backend->consume_batch(BATCH_RECORDS.data() + queued, BATCH_RECORDS.size() - queued);
+    }
+}
+
+void xlog_dispatch_frontend::flush()
+{
+    if(async)
+    {
+        async->drain();
+    }
+
+    boost::log::aux::fake_mutex m;
+    flush_backend(m, *backend);
+}
+
+std::shared_ptr<xlog_sink> xlog_dispatch_backend::find_sink(std::string_view name) const
+{
+    for(const auto& sink : sinks)
+    {
+        if(sink->name() == name)
+        {
+            return sink;
+        }
+    }
+
+    return nullptr;
+}
+
+void xlog_dispatch_backend::flush()
+{
+    for(const auto& sink : sinks)
+    {
+        sink->flush();
+    }
+}
+
+void xlog_dispatch_backend::sync()
+{
+    for(const auto& sink : sinks)
+    {
+        sink->sync();
+    }
+}
+
+xlog_stream_sink::xlog_stream_sink(std::string name, xlog_formatter_function formatter, boost::shared_ptr<std::ostream> stream) :
+    xlog_sink(std::move(name), formatter)
+{
+    backend.add_stream(stream);
+}
+
+bool xlog_stream_sink::consume(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    backend.consume(rec, *text);
+    return true;
+}
+
+void xlog_stream_sink::flush_unlocked()
+{
+    backend.flush();
+}
+
+xlog_file_sink::xlog_file_sink(std::string name, xlog_formatter_function formatter, const XLog::FileSettings& settings) :
+    xlog_sink(std::move(name), formatter),
+    writer(std::make_unique<xlog_file_writer>(settings.path, settings)),
+    auto_flush(settings.auto_flush),
+    index_interval(settings.index_interval)
+{
+    if(settings.index)
+    {
+        // Index entries need absolute offsets, and we're appending
+        pending_entry.offset = writer->appended();
+        index = std::make_unique<xlog_index_writer>(settings.path);
+    }
+}
+
+xlog_file_sink::~xlog_file_sink()
+{
+    flush_unlocked();
+}
+
+bool xlog_file_sink::is_open() const
+{
+    return writer->is_open();
+}
+
+bool xlog_file_sink::using_io_uring() const
+{
+    return writer->using_io_uring();
+}
+
+double xlog_file_sink::backlog()
+{
+    return writer->backlog();
+}
+
+void xlog_file_sink::sync()
+{
+    writer->sync();
+}
+
+bool xlog_file_sink::consume(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    const bool add_newline = text->empty() || text->back() != '\n';
+    writer->append(*text, add_newline);
+
+    if(auto_flush)
+    {
+        writer->flush();
+    }
+
+    if(index)
+    {
+        pending_entry.summary.add(rec);
+        if(writer->appended() - pending_entry.offset >= index_interval)
+        {
+            end_index_entry();
+        }
+        add_written_entries();
+    }
+
+    return true;
+}
+
+void xlog_file_sink::flush_unlocked()
+{
+    end_index_entry();
+    writer->flush();
+    add_written_entries();
+}
+
+void xlog_file_sink::end_index_entry()
+{
+    if(!index || pending_entry.summary.record_count == 0)
+    {
+        return;
+    }
+
+    pending_entry.length = writer->appended() - pending_entry.offset;
+    unwritten_entries.push_back(pending_entry);
+
+    pending_entry = xlog_index_entry{};
+    pending_entry.offset = writer->appended();
+}
+
+void xlog_file_sink::add_written_entries()
+{
+    // The index never points past what's actually in the file
+    const uint64_t written = writer->written();
+    while(!unwritten_entries.empty() && unwritten_entries.front().offset + unwritten_entries.front().length <= written)
+    {
+        index->add(unwritten_entries.front());
+        unwritten_entries.pop_front();
+    }
+}
+
+#ifdef XLOG_USE_SYSLOG_LOG
+xlog_syslog_sink::xlog_syslog_sink(std::string name, xlog_formatter_function formatter, boost::shared_ptr<boost::log::sinks::syslog_backend> backend) :
+    xlog_sink(std::move(name), formatter),
+    backend(std::move(backend))
+{
+}
+
+bool xlog_syslog_sink::consume(const boost::log::record_view& rec, const xlog_formatted_text& text)
+{
+    // The UDP implementation throws if the socket can't be written to
+    try
+    {
+        backend->consume(rec, *text);
+    }
+    catch(const std::exception&)
+    {
+        return false;
+    }
+
+    return true;
+}
+#endif // XLOG_USE_SYSLOG_LOG
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <fstream>
+
+#include "xlog_index.noexport.h"
+
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/sinks/basic_sink_frontend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
+
+/*
+ * Shared formatting stage
+ *
+ * Rather than registering every output with Boost (which runs the formatter once per sink),
+ * there's a single Boost sink (xlog_dispatch_backend) which formats each record once per
+ * distinct formatter and hands the same immutable buffer to every xlog_sink using it.
+ */
+
+typedef void (*xlog_formatter_function)(const boost::log::record_view&, boost::log::formatting_ostream&);
+
+// Formatted text of a record, shared between every sink using the same formatter
+typedef std::shared_ptr<const std::string> xlog_formatted_text;
+
+// Where a record was logged from, only valid for as long as the record is
+struct xlog_source_location
+{
+    std::string_view file;
+    std::string_view function;
+    uint32_t line = 0;
+};
+
+/*
+ * std::source_location can't be made up at runtime, so records replayed from another
+ * process (see xlog_shm.cpp) carry their source location in this attribute instead
+ */
+struct xlog_remote_source_location
+{
+    std::string file;
+    std::string function;
+    uint32_t line;
+};
+
+constexpr char REMOTE_SOURCE_LOCATION_ATTRIBUTE_NAME[] = "RemoteSourceLocation";
+
+// False if the record has no source location at all
+bool get_record_source_location(const boost::log::record_view& rec, xlog_source_location& out);
+
+class xlog_sink
+{
+public:
+    // 'formatter' may be nullptr for sinks that work directly from the record's attributes
+    xlog_sink(std::string name, xlog_formatter_function formatter);
+    virtual ~xlog_sink() = default;
+
+    const std::string& name() const { return sink_name; }
+    xlog_formatter_function formatter() const { return sink_formatter; }
+
+    // Can be changed at any time, checked before the record is formatted for this sink
+    std::atomic<bool> enabled{true};
+    std::atomic<XLog::Severity> level{XLog::Severity::INFO};
+
+    // Should this sink get the record at all? (counts the record as dropped/filtered if not)
+    bool accepts(XLog::Severity sev);
+
+    // Called by the dispatcher, serializes calls to consume(), false if the record was lost
+    bool deliver(const boost::log::record_view& rec, const xlog_formatted_text& text);
+
+    // deliver() for each of 'indexes' into 'recs' & 'texts' ('texts' is nullptr for sinks without a formatter), under one lock
+    void deliver_batch(const boost::log::record_view* recs, const xlog_formatted_text* texts, const std::vector<size_t>& indexes);
+    void flush();
+
+    virtual XLog::SinkInformation information() const;
+
+    // How full the sink's queue is (0 - 1), for sinks that hold on to records rather than writing them straight away
+    virtual double backlog() { return 0.0; }
+
+    // Makes everything the sink has flushed durable (fdatasync), for sinks that write files
+    virtual void sync() {}
+
+protected:
+    // 'text' is empty if the sink has no formatter, returns false if the record was lost (counted as dropped)
+    virtual bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) = 0;
+    virtual void flush_unlocked() {}
+
+    // For sinks that lose records after consume() took them (i.e. a block that failed to write)
+    void count_dropped(uint64_t count) { dropped.fetch_add(count, std::memory_order_relaxed); }
+
+    // Sinks that are safe to call from many threads at once can skip the sink mutex
+    virtual bool concurrent() const { return false; }
+
+private:
+    const std::string sink_name;
+    const xlog_formatter_function sink_formatter;
+
+    std::mutex sink_mutex;
+
+    // Statistics
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> filtered{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> consume_ns{0};
+};
+
+class xlog_dispatch_backend final :
+    public boost::log::sinks::basic_sink_backend<
+        boost::log::sinks::combine_requirements<
+            boost::log::sinks::concurrent_feeding,
+            boost::log::sinks::flushing
+        >::type
+    >
+{
+public:
+    // Sinks must all be added before the backend is registered with the logging core
+    void add_sink(std::shared_ptr<xlog_sink> sink);
+
+    // Swaps the sink with the same name for 'sink' (i.e. a guarded version of it), also before the backend is registered
+    void replace_sink(std::shared_ptr<xlog_sink> sink);
+
+    void consume(const boost::log::record_view& rec);
+
+    // consume() for each of 'recs', with every sink taking its lock once for all of them
+    void consume_batch(const boost::log::record_view* recs, size_t count);
+
+    void flush();
+
+    // Syncs every sink, call after flush()
+    void sync();
+
+    std::vector<std::shared_ptr<xlog_sink>> get_sinks() const { return sinks; }
+    std::shared_ptr<xlog_sink> find_sink(std::string_view name) const;
+
+private:
+    std::vector<std::shared_ptr<xlog_sink>> sinks;
+};
+
+class xlog_async_dispatcher;
+
+/*
+ * boost::log::sinks::unlocked_sink, except it can tell the core that records are handed to other
+ * threads (by guarded sinks, see xlog_guard.noexport.h, or async dispatch, see xlog_async.noexport.h),
+ * so thread-bound attribute values like the logger's Severity are detached from the logging thread first
+ */
+class xlog_dispatch_frontend final : public boost::log::sinks::basic_sink_frontend
+{
+public:
+    // Records go through 'async' (if there is one) rather than straight to the backend
+    xlog_dispatch_frontend(boost::shared_ptr<xlog_dispatch_backend> backend, bool cross_thread, std::shared_ptr<xlog_async_dispatcher> async = nullptr);
+
+    bool will_consume(const boost::log::attribute_value_set& attrs) override;
+    void consume(const boost::log::record_view& rec) override;
+    void flush() override;
+
+    /*
+     * While the calling thread is between the two (XLog::LogBatch), consume() only collects its
+     * records, and end_batch() hands them all to the async queue or the backend at once.
+     * Only the batch's first record is filtered, once it's accepted will_consume() takes the rest
+     */
+    void begin_batch();
+    void end_batch();
+
+    // Whether this thread's batch got past the filter
+    bool batch_accepted() const;
+
+private:
+    const boost::shared_ptr<xlog_dispatch_backend> backend;
+    const std::shared_ptr<xlog_async_dispatcher> async;
+};
+
+// Writes formatted text to an output stream (i.e. the console)
+class xlog_stream_sink final : public xlog_sink
+{
+public:
+    xlog_stream_sink(std::string name, xlog_formatter_function formatter, boost::shared_ptr<std::ostream> stream);
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
+    void flush_unlocked() override;
+
+private:
+    boost::log::sinks::text_ostream_backend backend;
+};
+
+class xlog_file_writer;
+
+// Appends formatted text to a file (through an xlog_file_writer, see xlog_file_writer.noexport.h)
+class xlog_file_sink final : public xlog_sink
+{
+public:
+    xlog_file_sink(std::string name, xlog_formatter_function formatter, const XLog::FileSettings& settings);
+    ~xlog_file_sink() override;
+
+    bool is_open() const;
+    bool using_io_uring() const;
+
+    double backlog() override;
+    void sync() override;
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
+    void flush_unlocked() override;
+
+private:
+    // Ends the current index entry, it's added to the index once the writer has written what it covers
+    void end_index_entry();
+    void add_written_entries();
+
+    const std::unique_ptr<xlog_file_writer> writer;
+    const bool auto_flush;
+
+    const size_t index_interval;
+    std::unique_ptr<xlog_index_writer> index;
+    xlog_index_entry pending_entry{};
+    std::deque<xlog_index_entry> unwritten_entries;
+};
+
+#ifdef XLOG_USE_SYSLOG_LOG
+
+#include <boost/log/sinks/syslog_backend.hpp>
+
+class xlog_syslog_sink final : public xlog_sink
+{
+public:
+    xlog_syslog_sink(std::string name, xlog_formatter_function formatter, boost::shared_ptr<boost::log::sinks::syslog_backend> backend);
+
+protected:
+    bool consume(const boost::log::record_view& rec, const xlog_formatted_text& text) override;
+
+private:
+    boost::shared_ptr<boost::log::sinks::syslog_backend> backend;
+};
+
+#endif // XLOG_USE_SYSLOG_LOG
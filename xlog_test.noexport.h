@@ -0,0 +1,152 @@
+#pragma once
+
+#include "xlog.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+
+#include <boost/log/attributes/clock.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+/*
+ * Unit tests (xlog-unit-tests, -DBUILD_TESTS=ON)
+ *
+ * Logging can only be initialized once per process, so rather than pulling in a test framework
+ * every test runs in a child of its own (see test_main.cpp). Tests are registered with XLOG_TEST
+ * under a group, which is what ctest runs ('xlog-unit-tests <group>'); CHECK carries on after a
+ * failure, REQUIRE gives up on the test.
+ *
+ * Tests that need whole records without initializing logging make them with make_test_record(),
+ * as a logger of the given channel would have.
+ */
+
+struct xlog_test_case
+{
+    const char* group;
+    const char* name;
+    void (*run)();
+};
+
+// Every test in the program, in registration order
+inline std::vector<xlog_test_case>& xlog_test_cases()
+{
+    static std::vector<xlog_test_case> cases;
+    return cases;
+}
+
+struct xlog_test_registrar
+{
+    xlog_test_registrar(const char* group, const char* name, void (*run)())
+    {
+        xlog_test_cases().push_back(xlog_test_case{ group, name, run });
+    }
+};
+
+// Set by any failed check, it's what the test's process exits with
+inline bool& xlog_test_failed()
+{
+    static bool failed = false;
+    return failed;
+}
+
+// Prints a failed check along with whatever is streamed into it
+class xlog_test_failure
+{
+public:
+    xlog_test_failure(const char* file, int line, const char* check)
+    {
+        xlog_test_failed() = true;
+        message << file << ":" << line << ": failed " << check;
+    }
+
+    ~xlog_test_failure()
+    {
+        std::cerr << message.str() << std::endl;
+    }
+
+    template<typename T>
+    xlog_test_failure& operator<<(const T& value)
+    {
+        message << (first ? ": " : "") << value;
+        first = false;
+        return *this;
+    }
+
+private:
+    std::ostringstream message;
+    bool first = true;
+};
+
+#define XLOG_TEST(group, name) \
+    static void xlog_test_##group##_##name(); \
+    static const xlog_test_registrar xlog_test_registrar_##group##_##name(#group, #name, &xlog_test_##group##_##name); \
+    static void xlog_test_##group##_##name()
+
+#define CHECK(cond) if(cond) {} else xlog_test_failure(__FILE__, __LINE__, #cond)
+#define REQUIRE(cond) if(cond) {} else return (void)xlog_test_failure(__FILE__, __LINE__, #cond)
+
+// A record as CUSTOM_LOG_SEV would log it, without going anywhere
+inline boost::log::record_view make_test_record(XLog::Severity sev, const std::string& channel, const std::string& message)
+{
+    boost::log::sources::severity_channel_logger<XLog::Severity, std::string> logger(boost::log::keywords::channel = channel);
+    logger.add_attribute("TimeStamp", boost::log::attributes::local_clock());
+
+    boost::log::record rec = logger.open_record(boost::log::keywords::severity = sev);
+    rec.attribute_values().insert("Message", boost::log::attributes::make_attribute_value(message));
+    return rec.lock();
+}
+
+// Somewhere under the temp directory only this process uses, removed along with everything in it by ~test_directory()
+class test_directory
+{
+public:
+    test_directory() :
+        root(std::filesystem::temp_directory_path() / ("xlog-test-" + std::to_string(::getpid())))
+    {
+        std::filesystem::create_directories(root);
+    }
+
+    ~test_directory()
+    {
+        std::error_code err;
+        std::filesystem::remove_all(root, err);
+    }
+
+    std::string path(const std::string& name) const { return (root / name).string(); }
+
+private:
+    const std::filesystem::path root;
+};
+
+inline std::string read_test_file(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// Polls 'done' until it's true or 'timeout' has passed, returns the last result
+template<typename Func>
+bool wait_for_test(Func&& done, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+{
+    const auto until = std::chrono::steady_clock::now() + timeout;
+    while(!done())
+    {
+        if(std::chrono::steady_clock::now() >= until)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
@@ -0,0 +1,397 @@
+#include "xlog_trace.noexport.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+
+#include "xlog_escape.noexport.h"
+#include "xlog_memory.noexport.h"
+#include "xlog_log_internal.noexport.h"
+
+extern const char* __progname;
+
+// Relaxed atomics, WriteTrace() can be reading an event while its thread overwrites it (the copy is thrown away then)
+struct xlog_trace_event
+{
+    std::atomic<const char*> name;
+    std::atomic<const std::string*> channel; // The logger's channel_name(), which outlives the logger
+    std::atomic<uint64_t> begin_ns;
+    std::atomic<uint64_t> end_ns;
+};
+
+static constexpr size_t EVENTS_PER_CHUNK = 4096;
+
+struct xlog_trace_chunk
+{
+    xlog_trace_event events[EVENTS_PER_CHUNK];
+};
+
+struct xlog_trace_buffer
+{
+    xlog_trace_buffer(size_t max_events) :
+        max_events(std::max<size_t>(max_events, 1)),
+        chunks((this->max_events + EVENTS_PER_CHUNK - 1) / EVENTS_PER_CHUNK)
+    {
+    }
+
+    ~xlog_trace_buffer()
+    {
+        for(auto& chunk : chunks)
+        {
+            delete chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    pid_t tid = 0;
+    std::string name;
+
+    // Set once the thread has exited, the buffer is freed after its scopes are next written out
+    std::atomic<bool> exited{false};
+
+    // A ring of the newest 'max_events' scopes, 'claimed' is raised before a slot is (over)written & 'size' after,
+    // both count every scope the thread has recorded
+    const size_t max_events;
+    std::vector<std::atomic<xlog_trace_chunk*>> chunks;
+    std::atomic<uint64_t> claimed{0};
+    std::atomic<uint64_t> size{0};
+    std::atomic<uint64_t> dropped{0};
+
+    // Scopes before this have been written out (or overwritten before they could be), only used under the registry's lock
+    uint64_t exported = 0;
+
+    // Chunks count against the memory budget, only changed by the buffer's thread
+    xlog_memory_charge charge;
+};
+
+struct xlog_trace_registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<xlog_trace_buffer>> buffers;
+    std::atomic<size_t> max_events{XLog::TraceSettings().max_events_per_thread};
+
+    // TraceSettings::path's directory, the only place traces asked for over gRPC are written (none if empty)
+    std::string directory;
+};
+
+// Never destroyed, threads can still be finishing scopes after everything else has gone
+static xlog_trace_registry& trace_registry()
+{
+    static xlog_trace_registry* registry = new xlog_trace_registry();
+    return *registry;
+}
+
+// The calling thread's buffer, which is handed back to the registry when the thread exits
+struct xlog_trace_thread
+{
+    xlog_trace_buffer* buffer = nullptr;
+
+    ~xlog_trace_thread()
+    {
+        if(buffer != nullptr)
+        {
+            buffer->exited.store(true, std::memory_order_release);
+            buffer = nullptr;
+        }
+    }
+};
+
+static thread_local xlog_trace_thread THREAD_TRACE;
+
+static xlog_trace_buffer* thread_buffer()
+{
+    if(THREAD_TRACE.buffer != nullptr)
+    {
+        return THREAD_TRACE.buffer;
+    }
+
+    auto& reg = trace_registry();
+    auto buffer = std::make_unique<xlog_trace_buffer>(reg.max_events.load(std::memory_order_relaxed));
+    buffer->tid = static_cast<pid_t>(::syscall(SYS_gettid));
+
+    char name[64] = {};
+    if(::pthread_getname_np(::pthread_self(), name, sizeof(name)) == 0)
+    {
+        buffer->name = name;
+    }
+
+    std::scoped_lock lock(reg.mutex);
+    THREAD_TRACE.buffer = buffer.get();
+    reg.buffers.push_back(std::move(buffer));
+    return THREAD_TRACE.buffer;
+}
+
+static std::string replace_pid(const std::string& path)
+{
+    std::string rValue;
+    for(size_t i = 0; i < path.size(); i++)
+    {
+        if(path[i] == '%' && i + 1 < path.size() && path[i + 1] == 'p')
+        {
+            rValue += std::to_string(::getpid());
+            i++;
+        }
+        else
+        {
+            rValue += path[i];
+        }
+    }
+
+    return rValue;
+}
+
+static void append_json_string(std::string_view value, std::string& out)
+{
+    out += '"';
+    XLogEscape::json_escape(value, out);
+    out += '"';
+}
+
+void XLog::RecordScope(const LoggerType& logger, const char* name, uint64_t begin_ns, uint64_t end_ns) noexcept
+{
+    xlog_trace_buffer* buffer = nullptr;
+    try
+    {
+        buffer = thread_buffer();
+    }
+    catch(...)
+    {
+        return;
+    }
+
+    const uint64_t index = buffer->size.load(std::memory_order_relaxed);
+    const size_t position = static_cast<size_t>(index % buffer->max_events);
+
+    auto& slot = buffer->chunks[position / EVENTS_PER_CHUNK];
+    xlog_trace_chunk* chunk = slot.load(std::memory_order_relaxed);
+    if(chunk == nullptr)
+    {
+        // Tracing is the first thing to go when over the memory budget
+        chunk = XLOG_OVER_BUDGET.load(std::memory_order_relaxed) ? nullptr : new(std::nothrow) xlog_trace_chunk;
+        if(chunk == nullptr)
+        {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        slot.store(chunk, std::memory_order_release);
+        buffer->charge.set(buffer->charge.get() + sizeof(xlog_trace_chunk));
+    }
+
+    // Claimed first, so a reader that copies this slot while it's overwritten knows to throw the copy away
+    buffer->claimed.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    xlog_trace_event& event = chunk->events[position % EVENTS_PER_CHUNK];
+    event.name.store(name, std::memory_order_relaxed);
+    event.channel.store(&logger.channel_name(), std::memory_order_relaxed);
+    event.begin_ns.store(begin_ns, std::memory_order_relaxed);
+    event.end_ns.store(end_ns, std::memory_order_relaxed);
+    buffer->size.store(index + 1, std::memory_order_release);
+}
+
+// An event as it was read out of a ring
+struct copied_event
+{
+    const char* name;
+    const std::string* channel;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+static bool write_all(int fd, std::string_view data)
+{
+    while(!data.empty())
+    {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if(written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+
+    return true;
+}
+
+// Writes every scope recorded since the last trace (that's still in its ring) to 'fd' as a Chrome trace, and closes it
+static XLog::TraceResult write_trace(int fd)
+{
+    XLog::TraceResult result{ .written = false, .events = 0, .dropped = 0 };
+    bool good = true;
+
+    const pid_t pid = ::getpid();
+    std::string out;
+
+    out += R"({"displayTimeUnit":"ns","traceEvents":[)";
+    out += fmt::format(R"({{"ph":"M","name":"process_name","pid":{0},"tid":{0},"args":{{"name":)", pid);
+    append_json_string(__progname, out);
+    out += "}}";
+
+    auto& reg = trace_registry();
+    std::scoped_lock lock(reg.mutex);
+    for(auto itr = reg.buffers.begin(); itr != reg.buffers.end();)
+    {
+        const auto& buffer = *itr;
+
+        // Checked first, so an exited thread's last scopes are all written before it goes
+        const bool exited = buffer->exited.load(std::memory_order_acquire);
+
+        if(!buffer->name.empty())
+        {
+            out += fmt::format(R"(,
+{{"ph":"M","name":"thread_name","pid":{0},"tid":{1},"args":{{"name":)", pid, buffer->tid);
+            append_json_string(buffer->name, out);
+            out += "}}";
+        }
+
+        // Copied out first, the thread keeps recording (and overwriting the oldest) while we're at it
+        const uint64_t size = buffer->size.load(std::memory_order_acquire);
+        uint64_t first = std::max(buffer->exported, size > buffer->max_events ? size - buffer->max_events : 0);
+        std::vector<copied_event> events;
+        events.reserve(static_cast<size_t>(size - first));
+        for(uint64_t i = first; i < size; i++)
+        {
+            const size_t position = static_cast<size_t>(i % buffer->max_events);
+            const xlog_trace_chunk* chunk = buffer->chunks[position / EVENTS_PER_CHUNK].load(std::memory_order_acquire);
+            const xlog_trace_event& event = chunk->events[position % EVENTS_PER_CHUNK];
+            events.push_back(copied_event{ event.name.load(std::memory_order_relaxed), event.channel.load(std::memory_order_relaxed),
+                event.begin_ns.load(std::memory_order_relaxed), event.end_ns.load(std::memory_order_relaxed) });
+        }
+
+        // Anything whose slot has been claimed again since is torn or newer, so it's gone
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t claimed = buffer->claimed.load(std::memory_order_relaxed);
+        const uint64_t overwritten = claimed > buffer->max_events ? claimed - buffer->max_events : 0;
+        const size_t skip = static_cast<size_t>(std::min<uint64_t>(overwritten > first ? overwritten - first : 0, events.size()));
+        result.dropped += (first + skip) - buffer->exported;
+        buffer->exported = size;
+
+        for(size_t i = skip; i < events.size(); i++)
+        {
+            const copied_event& event = events[i];
+
+            out += ",\n{\"ph\":\"X\",\"name\":";
+            append_json_string(event.name, out);
+            out += ",\"cat\":";
+            append_json_string(*event.channel, out);
+            out += fmt::format(R"(,"pid":{},"tid":{},"ts":{:.3f},"dur":{:.3f}}})",
+                pid, buffer->tid, event.begin_ns / 1000.0, (event.end_ns - event.begin_ns) / 1000.0);
+
+            // Written as it goes rather than building the whole trace in memory
+            if(out.size() > 64 * 1024)
+            {
+                good = good && write_all(fd, out);
+                out.clear();
+            }
+        }
+
+        result.events += events.size() - skip;
+        result.dropped += buffer->dropped.exchange(0, std::memory_order_relaxed);
+
+        // Nothing will be added to it again, and it's been written out
+        if(exited)
+        {
+            itr = reg.buffers.erase(itr);
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+
+    out += "\n]}\n";
+    good = good && write_all(fd, out);
+
+    result.written = (::close(fd) == 0) && good;
+    return result;
+}
+
+XLog::TraceResult XLog::WriteTrace(const std::string& path)
+{
+    const int fd = ::open(replace_pid(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        return TraceResult{ .written = false, .events = 0, .dropped = 0 };
+    }
+
+    return write_trace(fd);
+}
+
+XLog::TraceResult xlog_trace_write_requested(const std::string& name, std::string& path, int& error)
+{
+    const XLog::TraceResult failed{ .written = false, .events = 0, .dropped = 0 };
+
+    std::string directory;
+    {
+        auto& reg = trace_registry();
+        std::scoped_lock lock(reg.mutex);
+        directory = reg.directory;
+    }
+
+    // Only ever a file name directly inside the configured directory
+    const std::string filename = std::filesystem::path(replace_pid(name)).filename().string();
+    if(directory.empty() || filename.empty() || filename == "." || filename == "..")
+    {
+        error = directory.empty() ? EACCES : EINVAL;
+        return failed;
+    }
+
+    path = (std::filesystem::path(directory) / filename).string();
+
+    // Never follows a link or touches a file that's already there
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        error = errno;
+        return failed;
+    }
+
+    error = 0;
+    return write_trace(fd);
+}
+
+void xlog_trace_setup(const XLog::TraceSettings& settings)
+{
+    {
+        auto& reg = trace_registry();
+        std::scoped_lock lock(reg.mutex);
+        reg.directory = settings.path.empty() ? std::string() : std::filesystem::path(replace_pid(settings.path)).parent_path().string();
+        if(!settings.path.empty() && reg.directory.empty())
+        {
+            reg.directory = ".";
+        }
+    }
+
+    trace_registry().max_events.store(settings.max_events_per_thread, std::memory_order_relaxed);
+    XLog::TRACING.store(settings.enabled, std::memory_order_relaxed);
+}
+
+void xlog_trace_shutdown(const XLog::TraceSettings& settings)
+{
+    if(!XLog::TRACING.exchange(false, std::memory_order_relaxed) || settings.path.empty())
+    {
+        return;
+    }
+
+    const auto result = XLog::WriteTrace(settings.path);
+    if(!result.written)
+    {
+        INTERNAL() << "Failed to write the trace to '" << settings.path << "'";
+    }
+    else if(result.dropped != 0)
+    {
+        INTERNAL() << "Trace written to '" << settings.path << "', " << result.dropped << " older scopes were overwritten before they could be written";
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "xlog.h"
+
+/*
+ * Scope timer buffers
+ *
+ * Every thread that records a scope gets a buffer of its own the first time it does, which
+ * the registry keeps after the thread has exited until the next WriteTrace() has written it
+ * out, then frees. Events hold the channel's interned name rather than the logger, which may
+ * be long gone by then (i.e. an instance logger). A buffer is a ring of the thread's newest
+ * TraceSettings::max_events_per_thread scopes, made of fixed-size chunks allocated as they're
+ * needed, and only its thread ever writes to it. The thread claims a slot before overwriting it
+ * and publishes the count after, so WriteTrace() can copy any thread's scopes without stopping
+ * it, and throws away whatever was claimed again while it was copying. Each trace has the scopes
+ * recorded since the last one, older ones that were overwritten first are counted as dropped.
+ */
+
+// Applies LogSettings::s_trace, called by InitializeLogging
+void xlog_trace_setup(const XLog::TraceSettings& settings);
+
+// Writes the trace to the file 'name' (reduced to its file name, "%p" is replaced with the PID) in TraceSettings::path's
+// directory, for a request from outside the process: it's never written anywhere else, and never over a file or link that's
+// already there. 'path' is set to the file it's written to; 'error' to EACCES if there's no TraceSettings::path, EINVAL if
+// 'name' has no file name, otherwise errno from opening the file (0 if it was opened & then couldn't be written)
+XLog::TraceResult xlog_trace_write_requested(const std::string& name, std::string& path, int& error);
+
+// Stops recording & writes TraceSettings::path (if there is one), called by ShutownLogging
+void xlog_trace_shutdown(const XLog::TraceSettings& settings);